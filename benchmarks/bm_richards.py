@@ -12,6 +12,7 @@ import argparse
 
 import cinder
 from cinder.codegen import x64
+from cinder.policy import Policy
 import time
 
 # Task IDs
@@ -422,10 +423,14 @@ if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument('--num-iters', default=1, type=int)
     parser.add_argument('--use-jit', action='store_true')
+    parser.add_argument('--tier-up', action='store_true',
+                        help='Compile hot functions and loops automatically')
     parser.add_argument('--report', action='store_true')
     args = parser.parse_args()
     richards = Richards()
-    if args.use_jit:
+    if args.tier_up:
+        cinder.install_interpreter(Policy(modules=['__main__']))
+    elif args.use_jit:
         cinder.install_interpreter()
         TaskState.isTaskHoldingOrWaiting = x64.compile(TaskState.isTaskHoldingOrWaiting)
         TaskState.isWaitingWithPacket = x64.compile(TaskState.isWaitingWithPacket)
@@ -436,5 +441,9 @@ if __name__ == "__main__":
     elapsed = time.time() - start
     if args.report:
         print(f'Took {elapsed}s')
-    if args.use_jit:
+        if args.use_jit or args.tier_up:
+            for tier, pipeline in x64.PIPELINES.items():
+                print(f'Passes at tier {tier}:')
+                print(pipeline.report())
+    if args.use_jit or args.tier_up:
         cinder.uninstall_interpreter()
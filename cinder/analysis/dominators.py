@@ -0,0 +1,159 @@
+"""Dominator analysis.
+
+Block A dominates block B if every path from the entry to B passes through A.
+Each block other than the entry has an immediate dominator, the dominator that
+is closest to it, and these form a tree rooted at the entry. Dominance is what
+identifies loops (see cinder.analysis.loops) and decides where a value is
+available: a value is available in every block that its definition dominates.
+
+Immediate dominators are computed with the iterative algorithm of Cooper,
+Harvey and Kennedy ("A Simple, Fast Dominance Algorithm"), which converges in
+a couple of passes over the reverse postorder of the small, reducible graphs
+that Python functions produce.
+
+The analysis works on both the stack IR (cinder.ir) and SSA form (cinder.ssa).
+Blocks that are unreachable from the entry are ignored.
+"""
+from typing import (
+    Any,
+    Callable,
+    Dict,
+    Iterable,
+    List,
+    Optional,
+    Tuple,
+    Union,
+)
+
+from cinder import ir, ssa
+
+
+# A basic block of either IR
+Block = Any
+
+Graph = Union[ir.ControlFlowGraph, ssa.Function]
+
+
+def graph_edges(graph: Graph) -> Tuple[Block, Callable[[Block], Iterable[Block]]]:
+    """Returns the entry block of graph and a function that returns the
+    successors of a block
+    """
+    if isinstance(graph, ssa.Function):
+        return graph.entry, lambda block: block.successors
+    cfg = graph  # Narrowed to a ControlFlowGraph, for the closure below
+
+    def successors(block: Block) -> List[Block]:
+        # Sorted, so that the order of traversals does not depend on the order
+        # of the edge sets
+        succs = [succ for succ in cfg.get_successors(block)
+                 if isinstance(succ, ir.BasicBlock)]
+        return sorted(succs, key=lambda succ: succ.label)
+
+    entry = next(iter(cfg.get_successors(cfg.entry_node)))
+    return entry, successors
+
+
+def reverse_postorder(graph: Graph) -> List[Block]:
+    """Returns the blocks of graph that are reachable from the entry, in reverse
+    postorder. Each block precedes its successors, other than along back edges.
+    """
+    entry, successors = graph_edges(graph)
+    order = []
+    visited = {entry}
+    stack = [(entry, iter(successors(entry)))]
+    while stack:
+        block, succs = stack[-1]
+        for succ in succs:
+            if succ not in visited:
+                visited.add(succ)
+                stack.append((succ, iter(successors(succ))))
+                break
+        else:
+            stack.pop()
+            order.append(block)
+    order.reverse()
+    return order
+
+
+class DominatorTree:
+    """The result of the analysis"""
+
+    def __init__(
+        self,
+        order: List[Block],
+        predecessors: Dict[Block, List[Block]],
+        idoms: Dict[Block, Optional[Block]],
+    ) -> None:
+        # The reachable blocks in reverse postorder
+        self.order = order
+        # Maps each reachable block to its reachable predecessors
+        self.predecessors = predecessors
+        # Maps each block to its immediate dominator. The entry has none.
+        self.idoms = idoms
+        self.children: Dict[Block, List[Block]] = {block: [] for block in order}
+        for block in order[1:]:
+            self.children[idoms[block]].append(block)
+        # Number the tree in pre and postorder, so that dominance can be tested
+        # in constant time
+        self._pre: Dict[Block, int] = {}
+        self._post: Dict[Block, int] = {}
+        stack = [(order[0], iter(self.children[order[0]]))]
+        self._pre[order[0]] = 0
+        while stack:
+            block, children = stack[-1]
+            child = next(children, None)
+            if child is None:
+                stack.pop()
+                self._post[block] = len(self._post)
+            else:
+                self._pre[child] = len(self._pre)
+                stack.append((child, iter(self.children[child])))
+
+    @property
+    def entry(self) -> Block:
+        return self.order[0]
+
+    def immediate_dominator(self, block: Block) -> Optional[Block]:
+        return self.idoms[block]
+
+    def dominates(self, a: Block, b: Block) -> bool:
+        """Returns whether a dominates b. Every block dominates itself."""
+        return self._pre[a] <= self._pre[b] and self._post[b] <= self._post[a]
+
+    def is_reachable(self, block: Block) -> bool:
+        return block in self.idoms
+
+
+def analyze(graph: Graph) -> DominatorTree:
+    """Computes the dominator tree of graph"""
+    _, successors = graph_edges(graph)
+    order = reverse_postorder(graph)
+    index = {block: i for i, block in enumerate(order)}
+    predecessors: Dict[Block, List[Block]] = {block: [] for block in order}
+    for block in order:
+        for succ in successors(block):
+            predecessors[succ].append(block)
+    entry = order[0]
+    idoms: Dict[Block, Optional[Block]] = {entry: entry}
+
+    def intersect(a: Block, b: Block) -> Block:
+        while a is not b:
+            while index[a] > index[b]:
+                a = idoms[a]
+            while index[b] > index[a]:
+                b = idoms[b]
+        return a
+
+    changed = True
+    while changed:
+        changed = False
+        for block in order[1:]:
+            idom = None
+            for pred in predecessors[block]:
+                if pred in idoms:
+                    idom = pred if idom is None else intersect(pred, idom)
+            if idoms.get(block) is not idom:
+                idoms[block] = idom
+                changed = True
+    idoms[entry] = None
+    return DominatorTree(order, predecessors, idoms)
@@ -0,0 +1,124 @@
+"""Side effects of instructions in SSA form.
+
+Transformations that move or reuse loads (e.g. cinder.passes.licm) need to know
+what may change the values that they load. Almost anything can: most Python
+operations dispatch on the types of their operands, and so may run arbitrary
+Python code, which may modify any object, including the globals. This
+analysis identifies the instructions that cannot:
+
+  - Guards, which only read (and deoptimize if their checks fail), and loads
+    of globals.
+  - Attribute loads that codegen specializes into guarded reads of the
+    instance dictionary (see `instance_attribute_version`), and which
+    deoptimize rather than fall back to the generic lookup.
+  - Operators and comparisons whose operands are known to be exact builtin
+    numbers, strs or bytes (see cinder.analysis.static_types), and truth
+    tests and iteration of those and of builtin containers, whose
+    implementations never call back into Python code.
+  - Jumps and returns.
+
+Releasing the last reference to an object deallocates it (see decref in
+cinder.codegen.x64), which may run a finalizer. That is ignored here: finalizers
+are assumed not to modify the objects and globals that the function loads.
+"""
+from typing import (
+    Any,
+    FrozenSet,
+    Optional,
+    Sequence,
+    Tuple,
+)
+
+from cinder import ir, ssa, type_version_tag
+from cinder.analysis import static_types
+from cinder.profile import Profile
+
+
+def instance_attribute_version(typ: type, name: str) -> Optional[int]:
+    """Returns the version tag that guards loads of the attribute name from the
+    instance dictionary of instances of typ.
+
+    Returns None unless every load of name from an instance of typ that has a valid
+    version tag is equivalent to a lookup in the instance's dictionary.
+    """
+    if typ.__getattribute__ is not object.__getattribute__:
+        return None
+    if getattr(typ, '__dictoffset__', 0) <= 0:
+        return None
+    # Anything found on the type (e.g. descriptors and methods) takes precedence
+    # over or complements the instance dictionary
+    if any(name in klass.__dict__ for klass in typ.__mro__):
+        return None
+    return type_version_tag(typ)
+
+
+def guarded_receiver(
+    op: ir.LoadAttr,
+    profile: Profile,
+    names: Sequence[str],
+) -> Optional[Tuple[type, int]]:
+    """Returns the type that type feedback shows the receiver of op to have, and
+    the version tag that guards loads of the attribute from instances of it, if
+    codegen specializes op into a guarded read of the instance dictionary
+    """
+    receiver = profile.monomorphic_type(op)
+    if receiver is None:
+        return None
+    version = instance_attribute_version(receiver, names[op.index])
+    if version is None:
+        return None
+    return receiver, version
+
+
+# Types whose operators and comparisons are implemented in C and, given
+# operands of these types, never call back into Python code. Containers are
+# excluded, since comparing them compares their items.
+SCALAR_TYPES = static_types.BOOL_COMPARISON_TYPES
+
+# Types whose truth value is computed, and whose iterators produce their
+# items, without calling back into Python code
+CONTAINER_TYPES = SCALAR_TYPES | frozenset((dict, frozenset, list, range, set, tuple))
+
+# Iterators whose __next__ never calls back into Python code
+BUILTIN_ITERATORS = frozenset(iterator for iterator, _ in static_types.ITERATOR_TYPES.values())
+
+
+class Effects:
+    def __init__(
+        self,
+        function: ssa.Function,
+        profile: Profile,
+        types: Optional[static_types.Types] = None,
+    ) -> None:
+        self.function = function
+        self.profile = profile
+        self.types = types if types is not None else static_types.analyze(function)
+
+    def _operands_are(self, instr: ssa.Instruction, types: FrozenSet[type]) -> bool:
+        """Returns whether the operands of instr are known to be exact instances of types"""
+        return all(self.types.type_of(value, instr.block).is_subset(types)
+                   for value in instr.operands)
+
+    def may_write(self, instr: ssa.Instruction) -> bool:
+        """Returns whether instr may modify any object (including the globals),
+        directly or by running Python code
+        """
+        op: Any = instr.op
+        if op is None or isinstance(op, (ir.Branch, ir.BreakLoop, ir.ReturnValue,
+                                         ir.GuardCallee, ir.GuardGlobal, ir.GuardMethod,
+                                         ir.LoadGlobal, ir.SpeculativeLoadAttr)):
+            return False
+        elif isinstance(op, ir.LoadAttr):
+            # Inlined loads fall back to the generic lookup when their guards fail
+            return (instr.offset is None or
+                    guarded_receiver(op, self.profile, self.function.names) is None)
+        elif isinstance(op, ir.Compare) and op.predicate in (ir.ComparePredicate.IS,
+                                                            ir.ComparePredicate.IS_NOT):
+            return False
+        elif isinstance(op, (ir.Compare, ir.BinaryOperation)):
+            return not self._operands_are(instr, SCALAR_TYPES)
+        elif isinstance(op, (ir.ConditionalBranch, ir.GetIter, ir.UnaryOperation)):
+            return not self._operands_are(instr, CONTAINER_TYPES)
+        elif isinstance(op, ir.ForIter):
+            return not self._operands_are(instr, BUILTIN_ITERATORS)
+        return True
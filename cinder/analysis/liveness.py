@@ -0,0 +1,139 @@
+"""Liveness analysis for local variables in the stack IR.
+
+A local is live at a point in a function if some path from that point reads
+it before it is next assigned. The analysis is the usual backwards dataflow
+problem, solved by iterating over the blocks until the live sets stop
+changing. Loads read a local, stores and ClearLocals assign it. The results
+that codegen needs follow from liveness:
+
+  - Dead stores, which assign a value that is never read. The value can be
+    discarded instead.
+  - Last uses, loads after which the local is dead. The reference can be
+    moved out of the local rather than copied, releasing it early.
+  - The locals that are never assigned, e.g. arguments that the function
+    does not reassign. The caller keeps these alive for the whole call, so
+    the function can borrow them.
+
+Instructions may read locals implicitly. In particular, code that
+deoptimizes resumes the original bytecode in the interpreter, which reads
+whatever was live in the original code at that point, even if the compiled
+code no longer does. Callers describe these reads with `extra_uses`.
+"""
+from typing import (
+    Callable,
+    Dict,
+    FrozenSet,
+    Iterable,
+    Optional,
+    Set,
+)
+
+from cinder import ir
+from cinder.analysis import dominators
+
+
+def uses(instr: ir.Instruction) -> Iterable[int]:
+    """Returns the locals that instr reads"""
+    if isinstance(instr, ir.Load) and instr.pool == ir.VarPool.LOCALS:
+        return (instr.index,)
+    return ()
+
+
+def assigns(instr: ir.Instruction) -> Iterable[int]:
+    """Returns the locals that instr assigns"""
+    if isinstance(instr, ir.Store):
+        return (instr.index,)
+    elif isinstance(instr, ir.ClearLocals):
+        return range(instr.start, instr.start + instr.count)
+    return ()
+
+
+class Liveness:
+    """The result of the analysis"""
+
+    def __init__(self) -> None:
+        # The locals that are live on entry to, and exit from, each block
+        self.live_in: Dict[ir.BasicBlock, FrozenSet[int]] = {}
+        self.live_out: Dict[ir.BasicBlock, FrozenSet[int]] = {}
+        # Maps the offset of each instruction to the locals that are live
+        # before it
+        self.live_at_offset: Dict[int, FrozenSet[int]] = {}
+        self.dead_stores: Set[ir.Store] = set()
+        self.last_uses: Set[ir.Load] = set()
+        # The locals that are assigned anywhere in the function
+        self.assigned: Set[int] = set()
+
+    def is_dead_store(self, instr: ir.Instruction) -> bool:
+        return instr in self.dead_stores
+
+    def is_last_use(self, instr: ir.Instruction) -> bool:
+        return instr in self.last_uses
+
+    def live_at(self, offset: int) -> FrozenSet[int]:
+        """Returns the locals that are live before the instruction at offset"""
+        return self.live_at_offset.get(offset, frozenset())
+
+
+def analyze(
+    cfg: ir.ControlFlowGraph,
+    extra_uses: Optional[Callable[[ir.Instruction], Iterable[int]]] = None,
+) -> Liveness:
+    """Computes the liveness of the locals of cfg.
+
+    Args:
+        extra_uses - Returns the locals that an instruction reads implicitly,
+            in addition to those that it loads
+    """
+    def all_uses(instr: ir.Instruction) -> Iterable[int]:
+        if extra_uses is None:
+            return uses(instr)
+        return list(uses(instr)) + list(extra_uses(instr))
+
+    order = dominators.reverse_postorder(cfg)
+    successors = {
+        block: [succ for succ in cfg.get_successors(block) if isinstance(succ, ir.BasicBlock)]
+        for block in order
+    }
+    # The locals each block reads before assigning them, and those it assigns
+    gen: Dict[ir.BasicBlock, Set[int]] = {}
+    kill: Dict[ir.BasicBlock, Set[int]] = {}
+    for block in order:
+        live: Set[int] = set()
+        killed: Set[int] = set()
+        for instr in reversed(block.instructions):
+            assigned = set(assigns(instr))
+            live -= assigned
+            killed |= assigned
+            live.update(all_uses(instr))
+        gen[block] = live
+        kill[block] = killed
+    result = Liveness()
+    live_in = {block: frozenset() for block in order}
+    changed = True
+    while changed:
+        changed = False
+        # Successors tend to come before their predecessors in postorder
+        for block in reversed(order):
+            live_out = frozenset().union(*(live_in[succ] for succ in successors[block]))
+            new_in = frozenset(gen[block] | (live_out - kill[block]))
+            result.live_out[block] = live_out
+            if new_in != live_in[block]:
+                live_in[block] = new_in
+                changed = True
+    result.live_in = live_in
+    for block in order:
+        live = set(result.live_out[block])
+        for instr in reversed(block.instructions):
+            assigned = list(assigns(instr))
+            if isinstance(instr, ir.Store) and instr.index not in live:
+                result.dead_stores.add(instr)
+            result.assigned.update(assigned)
+            live.difference_update(assigned)
+            instr_uses = all_uses(instr)
+            if isinstance(instr, ir.Load) and instr.pool == ir.VarPool.LOCALS:
+                if instr.index not in live:
+                    result.last_uses.add(instr)
+            live.update(instr_uses)
+            if instr.offset is not None:
+                result.live_at_offset[instr.offset] = frozenset(live)
+    return result
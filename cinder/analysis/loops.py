@@ -0,0 +1,136 @@
+"""Natural loop analysis.
+
+The bytecode marks loops with SETUP_LOOP and POP_BLOCK, which disassembly
+records as flags on the blocks that they delimit. Those describe the loops of
+the source rather than of the control flow graph: they are missing for loops
+that the compiler builds out of jumps, they do not survive transformations of
+the graph, and newer versions of CPython do not emit them at all. This analysis
+finds loops from the control flow itself.
+
+An edge from block B to block H is a back edge if H dominates B. Every loop has
+a single header, H, which is the only way into it, and its body is H together
+with every block that can reach one of the back edges into H without passing
+through H. Loops that share a header are treated as one. Python functions are
+always reducible, so every cycle in the graph contains a back edge.
+
+Loops either nest or are disjoint. Each loop's parent is the smallest loop that
+contains it, and the depth of a block is the number of loops that contain it
+(0 outside of any loop).
+"""
+from typing import (
+    Dict,
+    List,
+    Optional,
+    Set,
+    Tuple,
+)
+
+from cinder.analysis import dominators as dominators_analysis
+from cinder.analysis.dominators import Block, DominatorTree, Graph
+
+
+class Loop:
+    def __init__(self, header: Block) -> None:
+        self.header = header
+        # The blocks in the loop, including the header
+        self.blocks: Set[Block] = {header}
+        # The sources of the back edges into the header
+        self.latches: List[Block] = []
+        self.parent: Optional['Loop'] = None
+        self.children: List['Loop'] = []
+
+    @property
+    def depth(self) -> int:
+        """The number of loops that contain this one, including itself"""
+        depth = 1
+        loop = self.parent
+        while loop is not None:
+            depth += 1
+            loop = loop.parent
+        return depth
+
+    def __contains__(self, block: Block) -> bool:
+        return block in self.blocks
+
+
+class LoopForest:
+    """The result of the analysis"""
+
+    def __init__(self, dominators: DominatorTree) -> None:
+        self.dominators = dominators
+        # Outer loops come before the loops nested inside of them
+        self.loops: List[Loop] = []
+        self.back_edges: List[Tuple[Block, Block]] = []
+        # Maps each block in a loop to the innermost loop that contains it
+        self.innermost: Dict[Block, Loop] = {}
+
+    @property
+    def roots(self) -> List[Loop]:
+        """The loops that are not nested in other loops"""
+        return [loop for loop in self.loops if loop.parent is None]
+
+    @property
+    def headers(self) -> Set[Block]:
+        return {loop.header for loop in self.loops}
+
+    def loop_of(self, block: Block) -> Optional[Loop]:
+        """Returns the innermost loop that contains block, if any"""
+        return self.innermost.get(block, None)
+
+    def loop_with_header(self, block: Block) -> Optional[Loop]:
+        loop = self.loop_of(block)
+        if loop is not None and loop.header is block:
+            return loop
+        return None
+
+    def depth(self, block: Block) -> int:
+        """Returns the number of loops that contain block"""
+        loop = self.loop_of(block)
+        return 0 if loop is None else loop.depth
+
+
+def analyze(graph: Graph, dominators: Optional[DominatorTree] = None) -> LoopForest:
+    """Finds the natural loops of graph.
+
+    Args:
+        dominators - The dominator tree of graph, which is computed if it is
+            not given
+    """
+    if dominators is None:
+        dominators = dominators_analysis.analyze(graph)
+    _, successors = dominators_analysis.graph_edges(graph)
+    forest = LoopForest(dominators)
+    by_header: Dict[Block, Loop] = {}
+    for block in dominators.order:
+        for succ in successors(block):
+            if dominators.dominates(succ, block):
+                forest.back_edges.append((block, succ))
+                if succ not in by_header:
+                    by_header[succ] = Loop(succ)
+                by_header[succ].latches.append(block)
+    # Headers of outer loops dominate, and so precede, those of inner loops
+    for header in dominators.order:
+        loop = by_header.get(header, None)
+        if loop is None:
+            continue
+        worklist = [latch for latch in loop.latches if latch is not header]
+        while worklist:
+            block = worklist.pop()
+            if block in loop.blocks:
+                continue
+            loop.blocks.add(block)
+            worklist.extend(dominators.predecessors[block])
+        forest.loops.append(loop)
+    for loop in forest.loops:
+        # The innermost enclosing loop is the smallest one that contains the header
+        enclosing = [other for other in forest.loops
+                     if other is not loop and loop.header in other.blocks]
+        if enclosing:
+            loop.parent = min(enclosing, key=lambda other: len(other.blocks))
+            loop.parent.children.append(loop)
+    for loop in forest.loops:
+        for block in loop.blocks:
+            current = forest.innermost.get(block, None)
+            if current is None or len(loop.blocks) < len(current.blocks):
+                forest.innermost[block] = loop
+    return forest
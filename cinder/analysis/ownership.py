@@ -0,0 +1,140 @@
+"""Reference ownership analysis for the stack IR.
+
+Every value on the operand stack is conceptually an owned reference: the
+instruction that pushes it increments its reference count and the instruction
+that pops it decrements the reference count once it is done with it. When a
+value is only borrowed for the duration of the consuming operation and its
+referent is guaranteed to outlive that operation, the pair is redundant and
+codegen may omit both halves.
+
+A value may be borrowed if its producer and consumer are in the same basic
+block and:
+
+  - The producer loads a constant. Constants are owned by the code object.
+  - The producer loads a local that is not stored to, cleared or moved from
+    before the value is consumed. The local variable slot (or, for arguments,
+    the caller) keeps the referent alive. Codegen may move the reference out
+    of a local at its last use (see cinder.analysis.liveness), which then no
+    longer keeps the referent alive.
+  - The producer only ever pushes True or False (e.g. `is` and `in`
+    comparisons and `not`). These are kept alive by the runtime.
+
+and the consumer does not take ownership of the operand (e.g. `is`
+comparisons, attribute loads, and conditional branches that pop their
+operand). Values that flow across block boundaries are always owned.
+"""
+from typing import (
+    AbstractSet,
+    Dict,
+    List,
+    Optional,
+    Set,
+)
+
+from cinder import ir
+
+
+class Ownership:
+    """The result of the analysis"""
+
+    def __init__(self) -> None:
+        # Instructions whose result may be pushed without a new reference
+        self.borrowed_results: Set[ir.Instruction] = set()
+        # Maps instructions to the positions of the operands that they must
+        # not release. Position 0 is the top of the stack.
+        self.borrowed_operands: Dict[ir.Instruction, Set[int]] = {}
+
+    def is_borrowed(self, instr: ir.Instruction) -> bool:
+        """Returns whether or not instr's result is a borrowed reference."""
+        return instr in self.borrowed_results
+
+    def operands_borrowed(self, instr: ir.Instruction) -> Set[int]:
+        """Returns the positions of instr's operands that are borrowed."""
+        return self.borrowed_operands.get(instr, set())
+
+
+def _produces_borrowable(instr: ir.Instruction) -> bool:
+    if isinstance(instr, ir.Load):
+        return instr.pool in (ir.VarPool.CONSTANTS, ir.VarPool.LOCALS)
+    elif isinstance(instr, ir.Compare):
+        return instr.predicate in (
+            ir.ComparePredicate.IS,
+            ir.ComparePredicate.IS_NOT,
+            ir.ComparePredicate.IN,
+            ir.ComparePredicate.NOT_IN,
+        )
+    elif isinstance(instr, ir.UnaryOperation):
+        return instr.kind == ir.UnaryOperationKind.NOT
+    return False
+
+
+def _borrowing_operands(instr: ir.Instruction) -> Set[int]:
+    """Returns the positions of the operands that instr only reads."""
+    if isinstance(instr, (ir.PopTop, ir.LoadAttr, ir.UnaryOperation, ir.GetIter)):
+        return {0}
+    elif isinstance(instr, ir.ConditionalBranch) and instr.pop_before_eval:
+        return {0}
+    elif isinstance(instr, (ir.StoreAttr, ir.Compare, ir.BinaryOperation)):
+        # PyObject_SetAttr acquires its own reference to the value
+        return {0, 1}
+    return set()
+
+
+class _StackEntry:
+    def __init__(self, producer: ir.Instruction) -> None:
+        self.producer = producer
+        # Cleared if the referent may die before the value is consumed
+        self.borrowable = _produces_borrowable(producer)
+
+
+def _release(stack: List[Optional[_StackEntry]], indices) -> None:
+    """Mark the pending loads of the locals at indices as not borrowable"""
+    for pending in stack:
+        if (pending is not None and
+                isinstance(pending.producer, ir.Load) and
+                pending.producer.pool == ir.VarPool.LOCALS and
+                pending.producer.index in indices):
+            pending.borrowable = False
+
+
+def _analyze_block(
+    block: ir.BasicBlock,
+    result: Ownership,
+    last_uses: AbstractSet[ir.Instruction],
+) -> None:
+    # Values pushed by predecessors are represented by None
+    stack: List[Optional[_StackEntry]] = []
+    for instr in block.instructions:
+        borrowing = _borrowing_operands(instr)
+        for pos in range(instr.pops):
+            entry = stack.pop() if stack else None
+            if entry is None or not entry.borrowable or pos not in borrowing:
+                continue
+            result.borrowed_results.add(entry.producer)
+            result.borrowed_operands.setdefault(instr, set()).add(pos)
+        if isinstance(instr, ir.Store):
+            # The store releases the local's previous value
+            _release(stack, (instr.index,))
+        elif isinstance(instr, ir.ClearLocals):
+            _release(stack, range(instr.start, instr.start + instr.count))
+        elif instr in last_uses:
+            # The load may move the value out of the local
+            _release(stack, (instr.index,))
+        for _ in range(instr.pushes):
+            stack.append(_StackEntry(instr))
+
+
+def analyze(
+    cfg: ir.ControlFlowGraph,
+    last_uses: AbstractSet[ir.Instruction] = frozenset(),
+) -> Ownership:
+    """Computes which references need not be owned in cfg.
+
+    Args:
+        last_uses - The loads of locals that may move the reference out of the
+            local
+    """
+    result = Ownership()
+    for block in cfg:
+        _analyze_block(block, result, last_uses)
+    return result
@@ -0,0 +1,109 @@
+"""Static operand stack depth analysis for the stack IR.
+
+CPython tracks the extent of each loop at runtime using the block stack:
+SETUP_LOOP records the depth of the operand stack on entry to the loop and
+POP_BLOCK and BREAK_LOOP unwind the operand stack back to it. Since the depth
+of the operand stack at any point in a function is fixed by the bytecode
+compiler, all of this can be computed ahead of time. This lets codegen resolve
+loop exits into a statically known number of pops followed by a direct jump.
+"""
+from typing import (
+    Dict,
+    List,
+    Tuple,
+)
+
+from cinder import ir
+
+
+class StackDepths:
+    """The result of the analysis"""
+
+    def __init__(self) -> None:
+        # Maps the label of each reachable block to the depth of the operand
+        # stack on entry to the block
+        self.entry_depths: Dict[ir.Label, int] = {}
+
+    def at_entry(self, block: ir.BasicBlock) -> int:
+        """Returns the depth of the operand stack on entry to block."""
+        return self.entry_depths[block.label]
+
+    def at_exit(self, block: ir.BasicBlock) -> int:
+        """Returns the depth of the operand stack before block's terminator
+        executes.
+        """
+        depth = self.at_entry(block)
+        for instr in block.instructions[:-1]:
+            depth += instr.pushes - instr.pops
+        return depth
+
+    def to_unwind(self, instr: ir.BreakLoop, block: ir.BasicBlock) -> int:
+        """Returns the number of values that instr discards when exiting its
+        loop from block.
+        """
+        return self.at_exit(block) - self.entry_depths[instr.loop_header]
+
+
+def _successor_depths(
+    block: ir.BasicBlock,
+    depth: int,
+    depths: StackDepths,
+) -> List[Tuple[ir.Label, int]]:
+    """Returns the depth on entry to each of block's explicit successors, given
+    that the stack depth is depth before block's terminator executes.
+    """
+    terminator = block.terminator
+    if isinstance(terminator, ir.ConditionalBranch):
+        if terminator.jump_when_true:
+            taken, not_taken = terminator.true_branch, terminator.false_branch
+        else:
+            taken, not_taken = terminator.false_branch, terminator.true_branch
+        if terminator.pop_before_eval:
+            return [(taken, depth - 1), (not_taken, depth - 1)]
+        # The non-popping variants only pop when they fall through
+        return [(taken, depth), (not_taken, depth - 1)]
+    elif isinstance(terminator, ir.ForIter):
+        # The iterator is popped once it is exhausted
+        return [(terminator.body, depth + 1), (terminator.exit, depth - 1)]
+    elif isinstance(terminator, ir.BreakLoop):
+        # The loop header dominates the break, so its depth is already known
+        return [(terminator.target, depths.entry_depths[terminator.loop_header])]
+    elif isinstance(terminator, ir.Branch):
+        return [(terminator.target, depth)]
+    return []
+
+
+def analyze(cfg: ir.ControlFlowGraph, entry_depth: int = 0) -> StackDepths:
+    """Computes the depth of the operand stack on entry to each block in cfg.
+
+    Args:
+        entry_depth - The depth of the stack on entry to cfg. This is only
+            non-zero for OSR entries, which start with the interpreter's stack.
+
+    Raises:
+        ValueError: If control flow merges with inconsistent stack depths.
+    """
+    depths = StackDepths()
+    for block in cfg:
+        if not depths.entry_depths:
+            depths.entry_depths[block.label] = entry_depth
+        elif block.label not in depths.entry_depths:
+            raise ValueError(f'Stack depth at entry to {block.label} is unknown')
+        depth = depths.at_exit(block)
+        succs = _successor_depths(block, depth, depths)
+        terminator = block.terminator
+        if not isinstance(terminator, (ir.ConditionalBranch, ir.Branch, ir.BreakLoop,
+                                       ir.ForIter, ir.ReturnValue)):
+            # Fall through to the next block
+            depth += terminator.pushes - terminator.pops
+            succs = [
+                (succ.label, depth) for succ in cfg.get_successors(block)
+                if isinstance(succ, ir.BasicBlock)
+            ]
+        for label, succ_depth in succs:
+            known = depths.entry_depths.setdefault(label, succ_depth)
+            if known != succ_depth:
+                raise ValueError(
+                    f'Inconsistent stack depth at entry to {label}: '
+                    f'{known} != {succ_depth}')
+    return depths
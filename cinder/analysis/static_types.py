@@ -0,0 +1,385 @@
+"""Static type inference over SSA form.
+
+Type feedback (see cinder.profile) records the types that an instruction has
+seen so far, which codegen has to guard on. Much of it is evident from the
+code itself: literals have exact types, `not` and `is` produce bools, the sum
+of two ints is an int, and `len` returns one. This analysis computes, for each
+value in a function, the set of exact types that it may have:
+
+  - Constants have the type of their value.
+  - Comparisons, `not`, and the operators on builtin numbers and sequences
+    have the types that their implementations return, when the types of their
+    operands are known.
+  - Calls to known builtin functions and types (e.g. `len`, `isinstance` and
+    `range`), once constant folding has replaced the global load of the
+    callee by its value, have the type that the builtin returns.
+  - Iterating over a range produces ints, and over a str produces strs.
+  - Block parameters have the union of the types of their arguments.
+
+The analysis is flow sensitive at conditional branches: in the blocks that
+are only reachable when `x is None` is true, x is known to be None, and
+where it is false (or where x itself tested true), x is known not to be None.
+This also holds for the arguments that those branches pass to their
+successors, so that `if x is None: x = 0` leaves x an int (if it was an int
+or None before).
+
+The results are keyed by the stack IR instructions of the function, like type
+feedback, so that codegen can consult them after lowering.
+"""
+import enum
+
+from typing import (
+    Callable,
+    Dict,
+    FrozenSet,
+    Iterable,
+    List,
+    Optional,
+    Tuple,
+)
+
+from cinder import ir, ssa
+from cinder.analysis import dominators
+
+
+# Values that may have more types than this are considered to have any type
+MAX_TYPES = 4
+
+NoneType = type(None)
+
+# Types whose rich comparisons always return a bool (or raise)
+BOOL_COMPARISON_TYPES = frozenset((NoneType, bool, int, float, str, bytes))
+
+# Builtins that always return an instance of exactly the given type
+BUILTIN_RESULTS = {
+    bool: bool,
+    callable: bool,
+    chr: str,
+    dict: dict,
+    hasattr: bool,
+    id: int,
+    isinstance: bool,
+    issubclass: bool,
+    len: int,
+    list: list,
+    ord: int,
+    range: range,
+    set: set,
+    tuple: tuple,
+}
+
+# Maps iterable types to the types of their iterators and the types of the
+# items those produce, if known
+ITERATOR_TYPES = {
+    range: (type(iter(range(0))), int),
+    str: (type(iter('')), str),
+    list: (type(iter([])), None),
+    tuple: (type(iter(())), None),
+}
+
+ITEM_TYPES = {iterator: item for iterator, item in ITERATOR_TYPES.values()}
+
+INT_TYPES = (bool, int)
+
+NUMERIC_TYPES = (bool, int, float)
+
+# Operators whose result is a float if either operand is
+FLOAT_OPERATORS = frozenset((
+    ir.BinaryOperator.ADD,
+    ir.BinaryOperator.SUBTRACT,
+    ir.BinaryOperator.MULTIPLY,
+    ir.BinaryOperator.TRUE_DIVIDE,
+    ir.BinaryOperator.FLOOR_DIVIDE,
+    ir.BinaryOperator.MODULO,
+))
+
+# Operators whose result is an int if both operands are ints
+INT_OPERATORS = frozenset((
+    ir.BinaryOperator.ADD,
+    ir.BinaryOperator.SUBTRACT,
+    ir.BinaryOperator.MULTIPLY,
+    ir.BinaryOperator.FLOOR_DIVIDE,
+    ir.BinaryOperator.MODULO,
+    ir.BinaryOperator.LSHIFT,
+    ir.BinaryOperator.RSHIFT,
+))
+
+BITWISE_OPERATORS = frozenset((
+    ir.BinaryOperator.AND,
+    ir.BinaryOperator.OR,
+    ir.BinaryOperator.XOR,
+))
+
+
+class Type:
+    """The exact types that a value may have.
+
+    types is None if the value may have any type, in which case it may still
+    be known not to be None.
+    """
+
+    def __init__(self, types: Optional[FrozenSet[type]], not_none: bool = False) -> None:
+        if types is not None and len(types) > MAX_TYPES:
+            not_none = NoneType not in types
+            types = None
+        self.types = types
+        self.not_none = not_none if types is None else NoneType not in types
+
+    @classmethod
+    def of(cls, *types: type) -> 'Type':
+        return cls(frozenset(types))
+
+    def may_be(self, typ: type) -> bool:
+        if self.types is None:
+            return typ is not NoneType or not self.not_none
+        return typ in self.types
+
+    def is_subset(self, types: Iterable[type]) -> bool:
+        """Returns whether the value is always an instance of exactly one of types"""
+        return self.types is not None and self.types <= frozenset(types)
+
+    def join(self, other: 'Type') -> 'Type':
+        if self.types is None or other.types is None:
+            return Type(None, self.not_none and other.not_none)
+        return Type(self.types | other.types)
+
+    def __eq__(self, other: object) -> bool:
+        return (isinstance(other, Type) and self.types == other.types and
+                self.not_none == other.not_none)
+
+    def __hash__(self) -> int:
+        return hash((self.types, self.not_none))
+
+    def __repr__(self) -> str:
+        if self.types is None:
+            return 'Type(any, not None)' if self.not_none else 'Type(any)'
+        return f'Type({", ".join(sorted(typ.__name__ for typ in self.types))})'
+
+
+# No value (e.g. an undefined local, or code that has not been reached)
+NOTHING = Type(frozenset())
+
+ANY = Type(None)
+
+BOOL = Type.of(bool)
+
+
+class Narrowing(enum.Enum):
+    """What a conditional branch establishes about a value along an edge"""
+    NONE = 'none'
+    NOT_NONE = 'not none'
+
+    def apply(self, typ: Type) -> Type:
+        if self == Narrowing.NONE:
+            return Type.of(NoneType) if typ.may_be(NoneType) else NOTHING
+        if typ.types is None:
+            return Type(None, True)
+        return Type(typ.types - {NoneType})
+
+
+def _binary_result(operator: ir.BinaryOperator, left: type, right: type) -> Optional[type]:
+    """Returns the type of the result of operator on exact instances of left and
+    right, if it is known
+    """
+    if left in INT_TYPES and right in INT_TYPES:
+        if operator in BITWISE_OPERATORS:
+            return bool if left is bool and right is bool else int
+        elif operator in INT_OPERATORS:
+            return int
+        elif operator == ir.BinaryOperator.TRUE_DIVIDE:
+            return float
+        return None
+    if left in NUMERIC_TYPES and right in NUMERIC_TYPES:
+        return float if operator in FLOAT_OPERATORS else None
+    if operator == ir.BinaryOperator.ADD and left is right and left in (str, bytes, list, tuple):
+        return left
+    if operator == ir.BinaryOperator.MULTIPLY:
+        for seq, count in ((left, right), (right, left)):
+            if seq in (str, bytes, list, tuple) and count in INT_TYPES:
+                return seq
+    if operator == ir.BinaryOperator.MODULO and left in (str, bytes):
+        # The right operand is an exact builtin, so its __rmod__ does not take
+        # precedence
+        return left
+    return None
+
+
+class Types:
+    """The result of the analysis"""
+
+    def __init__(self, function: ssa.Function, tree: dominators.DominatorTree) -> None:
+        self.function = function
+        self.tree = tree
+        self.values: Dict[ssa.Value, Type] = {}
+        # Maps blocks that are only reachable along one edge to what the branch
+        # that the edge leaves establishes about values
+        self.narrowings: Dict[ssa.Block, Dict[ssa.Value, Narrowing]] = {}
+        # Maps stack IR instructions to the types of their operands
+        self.operands: Dict[ir.Instruction, List[Type]] = {}
+
+    def type_of(self, value: ssa.Value, block: Optional[ssa.Block] = None) -> Type:
+        """Returns the type of value in block, or anywhere if block is None"""
+        if isinstance(value, ssa.Constant):
+            return Type.of(type(self.function.value_of(value)))
+        elif isinstance(value, ssa.Undefined):
+            return NOTHING
+        typ = self.values.get(value, NOTHING)
+        narrowings = []
+        while block is not None:
+            narrowing = self.narrowings.get(block, {}).get(value, None)
+            if narrowing is not None:
+                narrowings.append(narrowing)
+            block = self.tree.immediate_dominator(block) if self.tree.is_reachable(block) else None
+        # Narrowings closer to the definition apply first
+        for narrowing in reversed(narrowings):
+            typ = narrowing.apply(typ)
+        return typ
+
+    def type_along(self, edge: ssa.Edge, value: ssa.Value) -> Type:
+        """Returns the type of value when control leaves the source of edge along it"""
+        typ = self.type_of(value, edge.source)
+        narrowing = edge_narrowings(self.function, edge).get(value, None)
+        return typ if narrowing is None else narrowing.apply(typ)
+
+    def operand_type(self, instr: ir.Instruction, operand: int = 0) -> Type:
+        """Returns the type of an operand of a stack IR instruction.
+
+        Operands are numbered from the bottom of the stack, so 0 is the left hand
+        side of a binary operation.
+        """
+        types = self.operands.get(instr, None)
+        if types is None or operand >= len(types):
+            return ANY
+        return types[operand]
+
+    def may_be(self, instr: ir.Instruction, operand: int, typ: type) -> bool:
+        """Returns whether an operand of instr may be an exact instance of typ"""
+        return self.operand_type(instr, operand).may_be(typ)
+
+
+def edge_narrowings(function: ssa.Function, edge: ssa.Edge) -> Dict[ssa.Value, Narrowing]:
+    """Returns what the branch that edge leaves establishes about values along it"""
+    terminator = edge.source.terminator
+    if not isinstance(terminator.op, ir.ConditionalBranch):
+        return {}
+    taken = terminator.edges.index(edge) == 0
+    tested = terminator.operands[0]
+    narrowings = {}
+    if taken:
+        # Truthy values are not None
+        narrowings[tested] = Narrowing.NOT_NONE
+    if isinstance(tested, ssa.Instruction) and isinstance(tested.op, ir.Compare):
+        predicate = tested.op.predicate
+        if predicate in (ir.ComparePredicate.IS, ir.ComparePredicate.IS_NOT):
+            left, right = tested.operands
+            for value, other in ((left, right), (right, left)):
+                if (isinstance(other, ssa.Constant) and function.value_of(other) is None and
+                        not isinstance(value, ssa.Constant)):
+                    is_none = taken == (predicate == ir.ComparePredicate.IS)
+                    narrowings[value] = Narrowing.NONE if is_none else Narrowing.NOT_NONE
+    return narrowings
+
+
+def _map_types(
+    operands: Iterable[Type],
+    result: Callable[..., Optional[type]],
+) -> Type:
+    """Returns the type of an instruction whose result, for each combination of
+    the exact types of its operands, is an instance of result(*types), or of
+    any type if that is None
+    """
+    combinations: List[Tuple[type, ...]] = [()]
+    for typ in operands:
+        if typ.types is None:
+            return ANY
+        combinations = [types + (t,) for types in combinations for t in typ.types]
+    results = set()
+    for types in combinations:
+        typ = result(*types)
+        if typ is None:
+            return ANY
+        results.add(typ)
+    return Type(frozenset(results))
+
+
+class _Inference:
+    def __init__(self, function: ssa.Function) -> None:
+        self.function = function
+        self.result = Types(function, dominators.analyze(function))
+
+    def run(self) -> Types:
+        result = self.result
+        order = result.tree.order
+        for block in order:
+            reachable = [edge for edge in block.predecessors
+                         if result.tree.is_reachable(edge.source)]
+            if len(reachable) == 1 and reachable[0].source is not block:
+                narrowings = edge_narrowings(self.function, reachable[0])
+                if narrowings:
+                    result.narrowings[block] = narrowings
+        changed = True
+        while changed:
+            changed = False
+            for block in order:
+                for index, param in enumerate(block.params):
+                    changed |= self.update(param, self.param_type(block, index))
+                for instr in block.instructions + [block.terminator]:
+                    if instr.op is not None and instr.op.pushes:
+                        changed |= self.update(instr, self.infer(instr))
+        for block in order:
+            for instr in block.instructions + [block.terminator]:
+                if instr.op is not None:
+                    result.operands[instr.op] = [result.type_of(value, block)
+                                                 for value in instr.operands]
+        return result
+
+    def update(self, value: ssa.Value, typ: Type) -> bool:
+        if self.result.values.get(value, NOTHING) == typ:
+            return False
+        self.result.values[value] = typ
+        return True
+
+    def param_type(self, block: ssa.Block, index: int) -> Type:
+        result = self.result
+        if block is self.function.entry:
+            # The arguments, or the values of an OSR entry
+            return ANY
+        typ = NOTHING
+        for edge in block.predecessors:
+            if result.tree.is_reachable(edge.source):
+                typ = typ.join(result.type_along(edge, edge.operands[index]))
+        return typ
+
+    def infer(self, instr: ssa.Instruction) -> Type:
+        op = instr.op
+        operands = [self.result.type_of(value, instr.block) for value in instr.operands]
+        if isinstance(op, ir.Compare):
+            if op.predicate in (ir.ComparePredicate.IS, ir.ComparePredicate.IS_NOT,
+                                ir.ComparePredicate.IN, ir.ComparePredicate.NOT_IN):
+                return BOOL
+            if all(typ.is_subset(BOOL_COMPARISON_TYPES) for typ in operands):
+                return BOOL
+        elif isinstance(op, ir.UnaryOperation) and op.kind == ir.UnaryOperationKind.NOT:
+            return BOOL
+        elif isinstance(op, ir.BinaryOperation):
+            return _map_types(operands, lambda left, right: _binary_result(op.operator, left, right))
+        elif isinstance(op, ir.Call):
+            callee = instr.operands[0]
+            if isinstance(callee, ssa.Constant):
+                try:
+                    typ = BUILTIN_RESULTS.get(self.function.value_of(callee), None)
+                except TypeError:
+                    # Unhashable
+                    typ = None
+                if typ is not None:
+                    return Type.of(typ)
+        elif isinstance(op, ir.GetIter):
+            return _map_types(operands, lambda typ: ITERATOR_TYPES.get(typ, (None,))[0])
+        elif isinstance(op, ir.ForIter):
+            return _map_types(operands, lambda typ: ITEM_TYPES.get(typ, None))
+        return ANY
+
+
+def analyze(function: ssa.Function) -> Types:
+    """Infers the types of the values in function"""
+    return _Inference(function).run()
@@ -138,6 +138,7 @@ class Opcode(enum.IntEnum):
 
 # TODO(mpage): Flesh this out
 DIRECT_BRANCH_OPCODES = {
+    Opcode.BREAK_LOOP,
     Opcode.JUMP_ABSOLUTE,
     Opcode.JUMP_FORWARD,
     Opcode.RETURN_VALUE,
@@ -218,12 +219,29 @@ class BytecodeIterator:
         return offset, instr
 
 
+def loop_exit(code: bytes, setup_offset: int, argument: int) -> int:
+    """Returns the offset that a break from the loop set up at setup_offset
+    resumes execution at.
+
+    This is the instruction following the loop's POP_BLOCK if the loop does
+    not have an else clause, which is equivalent to resuming at the POP_BLOCK
+    itself once the stack has been unwound to the loop's level. We use the
+    POP_BLOCK in that case so that it remains at the start of its block.
+    """
+    target = setup_offset + INSTRUCTION_SIZE_B + argument
+    if code[target - INSTRUCTION_SIZE_B] == Opcode.POP_BLOCK:
+        return target - INSTRUCTION_SIZE_B
+    return target
+
+
 def compute_block_boundaries(code: bytes) -> List[Tuple[int, int]]:
     """Compute the offsets of basic blocks.
 
     An offset starts a new basic block if:
       - It is the target of a branch
       - It follows a conditional branch
+      - It follows the setup of a loop
+      - It is where a break from a loop resumes
 
     Returns:
         A list of half open intervals, where each interval contains a
@@ -242,6 +260,9 @@ def compute_block_boundaries(code: bytes) -> List[Tuple[int, int]]:
             block_starts.add(next_instr_offset + instr.argument)
         elif opcode in ABSOLUTE_BRANCH_OPCODES:
             block_starts.add(instr.argument)
+        elif opcode == Opcode.SETUP_LOOP:
+            block_starts.add(next_instr_offset)
+            block_starts.add(loop_exit(code, offset, instr.argument))
     sorted_block_starts = sorted(block_starts)
     sorted_block_starts.append(len(code))
     boundaries: List[Tuple[int, int]] = []
@@ -250,25 +271,79 @@ def compute_block_boundaries(code: bytes) -> List[Tuple[int, int]]:
     return boundaries
 
 
+def find_enclosing_loops(code: bytes) -> Dict[Offset, Tuple[Offset, Offset]]:
+    """Find the innermost loop that encloses each BREAK_LOOP.
+
+    Returns:
+        A map from the offset of each BREAK_LOOP to the offsets of the loop's
+        header (the instruction following its SETUP_LOOP) and the offset where
+        the break resumes.
+    """
+    # Loops are lexically nested. Each entry is (header, exit, end).
+    loops: List[Tuple[Offset, Offset, Offset]] = []
+    enclosing = {}
+    for offset, instr in BytecodeIterator(code):
+        while loops and loops[-1][2] <= offset:
+            loops.pop()
+        if instr.opcode == Opcode.SETUP_LOOP:
+            header = offset + INSTRUCTION_SIZE_B
+            end = header + instr.argument
+            loops.append((header, loop_exit(code, offset, instr.argument), end))
+        elif instr.opcode == Opcode.BREAK_LOOP:
+            if not loops:
+                raise ValueError(f'BREAK_LOOP at {offset} is outside of a loop')
+            header, exit, _ = loops[-1]
+            enclosing[offset] = (header, exit)
+    return enclosing
+
+
+def enclosing_loops(code: bytes, offset: Offset) -> List[Tuple[Offset, Offset]]:
+    """Find the loops that enclose the instruction at offset.
+
+    Returns:
+        The offsets of the header and end (the target of the SETUP_LOOP) of
+        each loop, from the outermost in.
+    """
+    loops: List[Tuple[Offset, Offset]] = []
+    for instr_offset, instr in BytecodeIterator(code):
+        while loops and loops[-1][1] <= instr_offset:
+            loops.pop()
+        if instr_offset == offset:
+            break
+        if instr.opcode == Opcode.SETUP_LOOP:
+            header = instr_offset + INSTRUCTION_SIZE_B
+            loops.append((header, header + instr.argument))
+    return loops
+
+
 _UNIMPLEMENTED = 'UNIMPLEMENTED'
 
 
 class InstructionDecoder:
     """Lifts bytecode instructions into ir instructions"""
 
-    def __init__(self, labels: Dict[int, ir.Label]) -> None:
+    def __init__(
+        self,
+        labels: Dict[int, ir.Label],
+        loops: Optional[Dict[Offset, Tuple[Offset, Offset]]] = None,
+    ) -> None:
         """
         Args:
             labels - Maps bytecode offsets to symbol names. This is used to name
                 the jump targets for instructions that branch.
+            loops - Maps the offset of each BREAK_LOOP to the offsets of the
+                header and exit of the loop that it breaks out of.
         """
         self.labels = labels
+        self.loops = loops or {}
 
     def decode(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         decoder = self.decoders.get(instr.opcode, None)
         if decoder is None:
             raise ValueError(f'Cannot decode opcode {dis.opname[instr.opcode]}')
-        return decoder(self, offset, instr)
+        ir_instr = decoder(self, offset, instr)
+        ir_instr.offset = offset
+        return ir_instr
 
     def decode_return(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         return ir.ReturnValue()
@@ -311,6 +386,17 @@ class InstructionDecoder:
     def decode_pop_top(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         return ir.PopTop()
 
+    def decode_get_iter(self, offset: Offset, instr: Instruction) -> ir.Instruction:
+        return ir.GetIter()
+
+    def decode_for_iter(self, offset: Offset, instr: Instruction) -> ir.Instruction:
+        body = offset + INSTRUCTION_SIZE_B
+        return ir.ForIter(self.labels[body], self.labels[body + instr.argument])
+
+    def decode_break_loop(self, offset: Offset, instr: Instruction) -> ir.Instruction:
+        header, exit = self.loops[offset]
+        return ir.BreakLoop(self.labels[exit], self.labels[header])
+
     def decode_store_attr(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         return ir.StoreAttr(instr.argument)
 
@@ -320,10 +406,7 @@ class InstructionDecoder:
     def decode_call(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         return ir.Call(instr.argument)
 
-    COMPARE_PREDICATES = {p.value: p for p in (
-        ir.ComparePredicate.IS,
-        ir.ComparePredicate.IS_NOT,)
-    }
+    COMPARE_PREDICATES = {p.value: p for p in ir.ComparePredicate}
 
     def decode_compare(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         predicate = self.COMPARE_PREDICATES.get(instr.argument, None)
@@ -332,19 +415,47 @@ class InstructionDecoder:
             raise ValueError(f"Cannot decode compare predicate {name}")
         return ir.Compare(predicate)
 
+    # Maps opcodes to (operator, inplace)
     BINARY_OPERATORS = {
-        Opcode.BINARY_AND: ir.BinaryOperator.AND,
+        Opcode.BINARY_POWER: (ir.BinaryOperator.POWER, False),
+        Opcode.BINARY_MULTIPLY: (ir.BinaryOperator.MULTIPLY, False),
+        Opcode.BINARY_MATRIX_MULTIPLY: (ir.BinaryOperator.MATRIX_MULTIPLY, False),
+        Opcode.BINARY_FLOOR_DIVIDE: (ir.BinaryOperator.FLOOR_DIVIDE, False),
+        Opcode.BINARY_TRUE_DIVIDE: (ir.BinaryOperator.TRUE_DIVIDE, False),
+        Opcode.BINARY_MODULO: (ir.BinaryOperator.MODULO, False),
+        Opcode.BINARY_ADD: (ir.BinaryOperator.ADD, False),
+        Opcode.BINARY_SUBTRACT: (ir.BinaryOperator.SUBTRACT, False),
+        Opcode.BINARY_LSHIFT: (ir.BinaryOperator.LSHIFT, False),
+        Opcode.BINARY_RSHIFT: (ir.BinaryOperator.RSHIFT, False),
+        Opcode.BINARY_AND: (ir.BinaryOperator.AND, False),
+        Opcode.BINARY_XOR: (ir.BinaryOperator.XOR, False),
+        Opcode.BINARY_OR: (ir.BinaryOperator.OR, False),
+        Opcode.INPLACE_POWER: (ir.BinaryOperator.POWER, True),
+        Opcode.INPLACE_MULTIPLY: (ir.BinaryOperator.MULTIPLY, True),
+        Opcode.INPLACE_MATRIX_MULTIPLY: (ir.BinaryOperator.MATRIX_MULTIPLY, True),
+        Opcode.INPLACE_FLOOR_DIVIDE: (ir.BinaryOperator.FLOOR_DIVIDE, True),
+        Opcode.INPLACE_TRUE_DIVIDE: (ir.BinaryOperator.TRUE_DIVIDE, True),
+        Opcode.INPLACE_MODULO: (ir.BinaryOperator.MODULO, True),
+        Opcode.INPLACE_ADD: (ir.BinaryOperator.ADD, True),
+        Opcode.INPLACE_SUBTRACT: (ir.BinaryOperator.SUBTRACT, True),
+        Opcode.INPLACE_LSHIFT: (ir.BinaryOperator.LSHIFT, True),
+        Opcode.INPLACE_RSHIFT: (ir.BinaryOperator.RSHIFT, True),
+        Opcode.INPLACE_AND: (ir.BinaryOperator.AND, True),
+        Opcode.INPLACE_XOR: (ir.BinaryOperator.XOR, True),
+        Opcode.INPLACE_OR: (ir.BinaryOperator.OR, True),
     }
 
     def decode_binary_op(self, offset: Offset, instr: Instruction) -> ir.Instruction:
         operator = self.BINARY_OPERATORS.get(instr.opcode, None)
         if operator is None:
             raise ValueError(f'Cannot decode {dis.opname[instr.opcode]}')
-        return ir.BinaryOperation(operator)
+        return ir.BinaryOperation(*operator)
 
     decoders = {
+        Opcode.BREAK_LOOP: decode_break_loop,
         Opcode.CALL_FUNCTION: decode_call,
-        Opcode.BINARY_AND: decode_binary_op,
+        Opcode.FOR_ITER: decode_for_iter,
+        Opcode.GET_ITER: decode_get_iter,
         Opcode.COMPARE_OP: decode_compare,
         Opcode.JUMP_ABSOLUTE: decode_branch,
         Opcode.JUMP_FORWARD: decode_jump_forward,
@@ -361,6 +472,7 @@ class InstructionDecoder:
         Opcode.STORE_FAST: decode_store,
         Opcode.UNARY_NOT: decode_unary_operation,
     }
+    decoders.update(dict.fromkeys(BINARY_OPERATORS, decode_binary_op))
 
 
 def is_block_setup(code: bytes, start: int, end: int) -> bool:
@@ -382,7 +494,7 @@ def disassemble(code: bytes) -> ir.ControlFlowGraph:
         labels[interval[0]] = f'bb{i}'
     # Construct blocks
     blocks = []
-    decoder = InstructionDecoder(labels)
+    decoder = InstructionDecoder(labels, find_enclosing_loops(code))
     for start, end in block_boundaries:
         if is_block_setup(code, start, end):
             # Skip basic blocks that only set up the block stack
@@ -0,0 +1,219 @@
+"""A persistent, on-disk cache of compiled code.
+
+Compiling a program's hot functions again in every process is wasted work when
+the processes run the same code. A CodeCache stores the machine code generated
+for a code object in a directory, so that later processes can load it instead.
+
+Generated code embeds the addresses of runtime functions and objects, which
+differ between processes. Each embedded address is recorded in the cache as a
+symbolic reference (e.g. `('const', 2)` or `('runtime', 'PyObject_GetAttr')`),
+and resolved against the loading process when the code is relinked. Code that
+refers to anything that cannot be named this way, such as types and functions
+observed by type feedback, is never stored.
+
+Entries are keyed on everything that the generated code depends on: the parts
+of the code object that the compiler reads, the entry point (the function
+itself or an OSR entry), the tier it was compiled at, the offsets whose guards
+had failed when it was compiled, and a hash of the compiler and the Python
+runtime. Changing any of them starts a fresh set of entries.
+
+Loading an entry maps its contents into the process as executable code, so
+anyone who can write to the cache directory can run arbitrary code in every
+process that uses it. The cache therefore only trusts a directory that the
+current user owns and that no one else can write to: it is created with mode
+0o700, and an existing directory that is owned by another user or is writable
+by its group or by others is refused. Entries themselves are not checked any
+further, so the directory must not be shared between users.
+"""
+import hashlib
+import marshal
+import os
+import stat
+import struct
+import sys
+import tempfile
+
+from types import CodeType
+from typing import (
+    Any,
+    Dict,
+    Iterable,
+    Optional,
+    Tuple,
+)
+
+import _cinder
+
+from cinder import MachineCode
+
+
+# A symbolic reference to an address, which is resolved when code is loaded
+Symbol = Tuple[Any, ...]
+
+# Code is padded so that its entry point keeps the same alignment, modulo this,
+# when it is loaded
+CODE_ALIGNMENT = 16
+
+INT3 = b'\xcc'
+
+
+def _compiler_version() -> str:
+    """Returns a hash of the compiler, the extension module, and the Python runtime"""
+    digest = hashlib.sha256(sys.version.encode())
+    package = os.path.dirname(os.path.abspath(__file__))
+    paths = [_cinder.__file__]
+    for root, dirs, files in os.walk(package):
+        dirs.sort()
+        paths.extend(os.path.join(root, name) for name in sorted(files) if name.endswith('.py'))
+    for path in paths:
+        with open(path, 'rb') as f:
+            digest.update(f.read())
+    return digest.hexdigest()
+
+
+def code_key(code: CodeType) -> bytes:
+    """Returns the parts of code that determine the code generated for it"""
+    return marshal.dumps((
+        code.co_code,
+        code.co_consts,
+        code.co_names,
+        code.co_varnames,
+        code.co_freevars,
+        code.co_cellvars,
+        code.co_argcount,
+        code.co_kwonlyargcount,
+        code.co_nlocals,
+        code.co_flags,
+    ))
+
+
+def check_private(directory: str) -> None:
+    """Raises PermissionError unless directory is owned by the current user and
+    cannot be written to by anyone else
+    """
+    st = os.stat(directory)
+    if not stat.S_ISDIR(st.st_mode):
+        raise NotADirectoryError(f'{directory} is not a directory')
+    if st.st_uid != os.geteuid():
+        raise PermissionError(f'{directory} is owned by another user')
+    if st.st_mode & (stat.S_IWGRP | stat.S_IWOTH):
+        raise PermissionError(f'{directory} is writable by other users')
+
+
+class CodeCache:
+    """Stores machine code for code objects in a directory"""
+
+    def __init__(self, directory: str) -> None:
+        """
+        Args:
+            directory - Where the cached code is stored. It is created if it does
+                not exist. Processes run by the user who owns it may share it.
+
+        Raises:
+            OSError if the directory cannot be created, or cannot be trusted (see
+            `check_private`)
+        """
+        self.directory = directory
+        os.makedirs(directory, mode=0o700, exist_ok=True)
+        check_private(directory)
+        self.version = _compiler_version()
+        self.hits = 0
+        self.misses = 0
+        self.stores = 0
+
+    def path(
+        self,
+        code: CodeType,
+        osr_offset: Optional[int],
+        tier: str,
+        unstable_offsets: Iterable[int] = (),
+    ) -> str:
+        digest = hashlib.sha256(self.version.encode())
+        digest.update(code_key(code))
+        digest.update(repr((osr_offset, tier, tuple(sorted(set(unstable_offsets))))).encode())
+        return os.path.join(self.directory, digest.hexdigest())
+
+    def load(
+        self,
+        code: CodeType,
+        osr_offset: Optional[int],
+        tier: str,
+        unstable_offsets: Iterable[int],
+        symbols: Dict[Symbol, int],
+    ) -> Optional[MachineCode]:
+        """Load the machine code that was stored for code.
+
+        Args:
+            osr_offset - The offset of the loop header that the code is entered
+                at, for OSR entries
+            tier - The tier that the code is compiled at
+            unstable_offsets - The offsets of the instructions whose guards had
+                failed when the code was compiled
+            symbols - The addresses that the references in the code resolve to
+
+        Returns:
+            None if nothing was stored for code or the stored code refers to
+            something that is missing from symbols.
+        """
+        try:
+            with open(self.path(code, osr_offset, tier, unstable_offsets), 'rb') as f:
+                padding, machine_code, relocations = marshal.load(f)
+            machine_code = bytearray(INT3 * padding + machine_code)
+            for offset, symbol in relocations:
+                if offset < 0:
+                    raise ValueError(f'Invalid relocation offset {offset}')
+                struct.pack_into('<Q', machine_code, padding + offset, symbols[symbol])
+        except (OSError, EOFError, ValueError, TypeError, KeyError, struct.error):
+            # Missing or unusable entries are recompiled
+            self.misses += 1
+            return None
+        self.hits += 1
+        return MachineCode(bytes(machine_code), padding)
+
+    def store(
+        self,
+        code: CodeType,
+        osr_offset: Optional[int],
+        tier: str,
+        unstable_offsets: Iterable[int],
+        machine_code: MachineCode,
+        symbols: Dict[Symbol, int],
+    ) -> bool:
+        """Store the machine code generated for code.
+
+        Args:
+            osr_offset - The offset of the loop header that the code is entered
+                at, for OSR entries
+            tier - The tier that the code was compiled at
+            unstable_offsets - The offsets of the instructions whose guards had
+                failed when the code was compiled
+            symbols - Names for the addresses that may appear in the code
+
+        Returns:
+            Whether the code was stored. It is not unless every address that it
+            embeds is named by symbols.
+        """
+        names = {}
+        for symbol, address in symbols.items():
+            names.setdefault(address, symbol)
+        data = machine_code.code
+        relocations = []
+        for offset in machine_code.relocations:
+            address, = struct.unpack_from('<Q', data, offset)
+            if address not in names:
+                return False
+            relocations.append((offset, names[address]))
+        padding = machine_code.address % CODE_ALIGNMENT
+        # Entries are written to a temporary file and renamed, so that readers
+        # never see a partially written entry
+        fd, temp_path = tempfile.mkstemp(dir=self.directory)
+        try:
+            with os.fdopen(fd, 'wb') as f:
+                marshal.dump((padding, data, tuple(relocations)), f)
+            os.replace(temp_path, self.path(code, osr_offset, tier, unstable_offsets))
+        except OSError:
+            if os.path.exists(temp_path):
+                os.unlink(temp_path)
+            return False
+        self.stores += 1
+        return True
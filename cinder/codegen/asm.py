@@ -0,0 +1,224 @@
+"""A thin wrapper around the assembler in _cinder (see src/asm.h).
+
+Instructions are emitted into the function that is currently being assembled,
+using a syntax similar to PeachPy's:
+
+    with Function('add_one') as func:
+        LEA(rax, [rdi + 1])
+        RETURN(rax)
+    code = func.finalize()
+
+Registers and memory operands are tuples in the form that the assembler
+expects, so they are passed straight through to C. Memory operands are written
+as `[base + index * scale + displacement]`, optionally sized with `qword[...]`
+or `dword[...]` when the other operand does not determine the size.
+
+Absolute addresses of objects and runtime functions are wrapped in Address, so
+that the finalized code records where they are embedded (see
+MachineCode.relocations).
+"""
+from typing import (
+    Any,
+    Callable,
+)
+
+from cinder import (
+    ASM_ADDRESS,
+    ASM_LABEL,
+    ASM_MEMORY,
+    ASM_OPS,
+    ASM_REGISTER,
+    Assembler,
+    MachineCode,
+)
+
+
+class Address(tuple):
+    """An absolute address, which may only be moved into a 64 bit register"""
+
+    def __new__(cls, value: int) -> 'Address':
+        return tuple.__new__(cls, (ASM_ADDRESS, value))
+
+    @property
+    def value(self) -> int:
+        return self[1]
+
+
+class Memory(tuple):
+    """A memory operand"""
+
+    def __new__(cls, base: int, index: int = -1, scale: int = 1, displacement: int = 0,
+                size: int = 0) -> 'Memory':
+        return tuple.__new__(cls, (ASM_MEMORY, base, index, scale, displacement, size))
+
+    # Displaces the operand rather than concatenating, unlike tuple.__add__
+    def __add__(self, displacement: int) -> 'Memory':  # type: ignore
+        _, base, index, scale, disp, size = self
+        return Memory(base, index, scale, disp + displacement, size)
+
+    def __sub__(self, displacement: int) -> 'Memory':
+        return self + -displacement
+
+
+class _ScaledIndex(tuple):
+    """The index of a memory operand, e.g. the rcx * 8 in [rdx + rcx * 8]"""
+
+
+class Register(tuple):
+    def __new__(cls, number: int, size: int) -> 'Register':
+        return tuple.__new__(cls, (ASM_REGISTER, number, size))
+
+    def __add__(self, other: object) -> 'Memory':
+        if isinstance(other, int):
+            return Memory(self[1], displacement=other)
+        elif isinstance(other, _ScaledIndex):
+            return Memory(self[1], other[0], other[1])
+        elif isinstance(other, Register):
+            return Memory(self[1], other[1])
+        return NotImplemented
+
+    def __radd__(self, other: object) -> 'Memory':
+        if isinstance(other, int):
+            return self + other
+        return NotImplemented
+
+    def __sub__(self, displacement: object) -> 'Memory':
+        if isinstance(displacement, int):
+            return Memory(self[1], displacement=-displacement)
+        return NotImplemented
+
+    def __mul__(self, scale: object) -> '_ScaledIndex':
+        if isinstance(scale, int):
+            return _ScaledIndex((self[1], scale))
+        return NotImplemented
+
+
+class _Size:
+    """Specifies the size of a memory operand, as in qword[rax + 8]"""
+
+    def __init__(self, size: int) -> None:
+        self.size = size
+
+    def __getitem__(self, operand) -> Memory:
+        if isinstance(operand, Register):
+            operand = operand + 0
+        _, base, index, scale, disp, _ = operand
+        return Memory(base, index, scale, disp, self.size)
+
+
+qword = _Size(8)
+dword = _Size(4)
+
+rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 = (
+    Register(number, 8) for number in range(16)
+)
+eax, ecx, edx, ebx, esp, ebp, esi, edi, r8d, r9d, r10d, r11d, r12d, r13d, r14d, r15d = (
+    Register(number, 4) for number in range(16)
+)
+
+# The assembler that instructions are emitted into
+_current = None
+
+
+class Function:
+    """Assembles a function. The function is current while the context is
+    active.
+    """
+
+    def __init__(self, name: str) -> None:
+        self.name = name
+        self.assembler = Assembler()
+
+    def __enter__(self) -> 'Function':
+        global _current
+        self.outer = _current
+        _current = self.assembler
+        return self
+
+    def __exit__(self, *exc_info) -> None:
+        global _current
+        _current = self.outer
+
+    def finalize(self) -> MachineCode:
+        """Resolve jumps and load the function into executable memory"""
+        return self.assembler.finalize()
+
+
+class Label(tuple):
+    """A position in the current function, which is set by LABEL"""
+
+    def __new__(cls) -> 'Label':
+        return tuple.__new__(cls, (ASM_LABEL, _current.new_label()))
+
+
+def _instruction(name: str) -> Callable[..., None]:
+    op = ASM_OPS[name]
+
+    def emit(dst: Any = None, src: Any = None) -> None:
+        _current.emit(op, dst, src)
+
+    emit.__name__ = emit.__qualname__ = name
+    return emit
+
+
+MOV = _instruction('MOV')
+MOVSXD = _instruction('MOVSXD')
+LEA = _instruction('LEA')
+ADD = _instruction('ADD')
+OR = _instruction('OR')
+AND = _instruction('AND')
+SUB = _instruction('SUB')
+XOR = _instruction('XOR')
+CMP = _instruction('CMP')
+TEST = _instruction('TEST')
+IMUL = _instruction('IMUL')
+INC = _instruction('INC')
+DEC = _instruction('DEC')
+PUSH = _instruction('PUSH')
+POP = _instruction('POP')
+CALL = _instruction('CALL')
+JMP = _instruction('JMP')
+JO = _instruction('JO')
+JNO = _instruction('JNO')
+JB = _instruction('JB')
+JAE = _instruction('JAE')
+JE = _instruction('JE')
+JZ = _instruction('JZ')
+JNE = _instruction('JNE')
+JNZ = _instruction('JNZ')
+JBE = _instruction('JBE')
+JA = _instruction('JA')
+JS = _instruction('JS')
+JNS = _instruction('JNS')
+JL = _instruction('JL')
+JGE = _instruction('JGE')
+JLE = _instruction('JLE')
+JG = _instruction('JG')
+
+
+def LABEL(label: Label) -> None:
+    _current.bind(label[1])
+
+
+def ALIGN(alignment: int) -> None:
+    _current.align(alignment)
+
+
+def RETURN(value: Register = None) -> None:
+    """Restore the callee saved registers and return value, if given"""
+    if value is not None and value != rax:
+        MOV(rax, value)
+    _current.ret()
+
+
+__all__ = [
+    'Address', 'Function', 'Label', 'MachineCode', 'Memory', 'Register', 'qword', 'dword',
+    'rax', 'rcx', 'rdx', 'rbx', 'rsp', 'rbp', 'rsi', 'rdi',
+    'r8', 'r9', 'r10', 'r11', 'r12', 'r13', 'r14', 'r15',
+    'eax', 'ecx', 'edx', 'ebx', 'esp', 'ebp', 'esi', 'edi',
+    'r8d', 'r9d', 'r10d', 'r11d', 'r12d', 'r13d', 'r14d', 'r15d',
+    'MOV', 'MOVSXD', 'LEA', 'ADD', 'OR', 'AND', 'SUB', 'XOR', 'CMP', 'TEST',
+    'IMUL', 'INC', 'DEC', 'PUSH', 'POP', 'CALL', 'JMP', 'JO', 'JNO', 'JB',
+    'JAE', 'JE', 'JZ', 'JNE', 'JNZ', 'JBE', 'JA', 'JS', 'JNS', 'JL', 'JGE',
+    'JLE', 'JG', 'LABEL', 'ALIGN', 'RETURN',
+]
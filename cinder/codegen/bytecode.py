@@ -1,10 +1,11 @@
-from cinder import ir
+from cinder import ir, ssa
 from cinder.bytecode import (
     INSTRUCTION_SIZE_B,
     Instruction,
+    InstructionDecoder,
     Opcode
 )
-from typing import Dict
+from typing import Dict, List, Union
 
 
 class InstructionEncoder:
@@ -39,6 +40,13 @@ class InstructionEncoder:
             return Instruction(Opcode.JUMP_ABSOLUTE, self.offsets[instr.target])
         elif isinstance(instr, ir.PopTop):
             return Instruction(Opcode.POP_TOP, 0)
+        elif isinstance(instr, ir.BreakLoop):
+            return Instruction(Opcode.BREAK_LOOP, 0)
+        elif isinstance(instr, ir.GetIter):
+            return Instruction(Opcode.GET_ITER, 0)
+        elif isinstance(instr, ir.ForIter):
+            delta = self.offsets[instr.exit] - (offset + INSTRUCTION_SIZE_B)
+            return Instruction(Opcode.FOR_ITER, delta)
         elif isinstance(instr, ir.StoreAttr):
             return Instruction(Opcode.STORE_ATTR, instr.index)
         elif isinstance(instr, ir.LoadGlobal):
@@ -81,23 +89,50 @@ class InstructionEncoder:
         return Instruction(opcode, offset)
 
     BINARY_OPERATOR_OPCODES = {
-        ir.BinaryOperator.AND: Opcode.BINARY_AND
+        operator: opcode
+        for opcode, operator in InstructionDecoder.BINARY_OPERATORS.items()
     }
 
     def encode_binary_operation(self, instr: ir.BinaryOperation) -> Instruction:
-        opcode = self.BINARY_OPERATOR_OPCODES.get(instr.operator, None)
+        opcode = self.BINARY_OPERATOR_OPCODES.get((instr.operator, instr.inplace), None)
         if opcode is None:
             raise ValueError(f'Cannot encode ir instruction {instr}')
         return Instruction(opcode, 0)
 
 
-def assemble(cfg: ir.ControlFlowGraph) -> bytes:
-    """Converts a CFG into the corresponding Python bytecode"""
-    # Arrange basic blocks in order they should appear in the bytecode
+def find_loop_footer(blocks: List[ir.BasicBlock], header: int) -> ir.Label:
+    """Find the footer of the loop whose header is blocks[header].
+
+    Loops are lexically nested, so this is the first footer that follows the
+    header and does not belong to a loop nested inside of it.
+    """
+    depth = 0
+    for block in blocks[header:]:
+        if block.is_loop_header:
+            depth += 1
+        if block.is_loop_footer:
+            depth -= 1
+            if depth == 0:
+                return block.label
+    raise ValueError(f'Loop header {blocks[header].label} has no footer')
+
+
+def assemble(cfg: Union[ir.ControlFlowGraph, ssa.Function]) -> bytes:
+    """Converts a CFG into the corresponding Python bytecode.
+
+    Functions in SSA form are lowered first. Any temporaries that they need are
+    stored in locals following the function's own (see ssa.lower).
+    """
+    if isinstance(cfg, ssa.Function):
+        cfg = ssa.lower(cfg).cfg
+    # Arrange basic blocks in order they should appear in the bytecode. Blocks
+    # that fall through rely on keeping their original order.
+    reachable = set(cfg)
+    blocks = [block for block in cfg.blocks.values() if block in reachable]
     # Compute block offsets
     offsets: Dict[ir.Label, int] = {}
     offset = 0
-    for block in cfg:
+    for block in blocks:
         offsets[block.label] = offset
         num_instrs = len(block.instructions)
         if block.is_loop_header or block.is_loop_footer:
@@ -106,23 +141,16 @@ def assemble(cfg: ir.ControlFlowGraph) -> bytes:
             num_instrs += 1
         offset += num_instrs * INSTRUCTION_SIZE_B
     # Adjust block offsets so that loop headers don't include SETUP_LOOP
-    for block in cfg:
+    for block in blocks:
         if block.is_loop_header:
             offsets[block.label] += INSTRUCTION_SIZE_B
     # Relocate jumps and generate code
     code = bytearray(offset)
     offset = 0
     encoder = InstructionEncoder(offsets)
-    for block in cfg:
+    for i, block in enumerate(blocks):
         if block.is_loop_header:
-            footer = None
-            for succ in cfg.get_successors(block):
-                if not isinstance(succ, ir.BasicBlock):
-                    continue
-                if succ.is_loop_footer:
-                    footer = succ.label
-                    break
-            assert footer is not None
+            footer = find_loop_footer(blocks, i)
             code[offset] = Opcode.SETUP_LOOP
             code[offset + 1] = offsets[footer] - offset
             offset += 2
@@ -1,21 +1,35 @@
+import builtins as builtins_module
 import ctypes
+import os
+import threading
 import types as pytypes
+import weakref
 
 from cinder import (
     bytecode,
+    get_compiled,
     ir,
     JitFunction,
+    ssa,
+    struct_offsets,
+    UNICODE_READY_MASK,
+    VALID_VERSION_TAG,
 )
+from cinder.analysis import liveness, loops, ownership, stack, static_types
+from cinder.analysis.effects import instance_attribute_version
+from cinder.code_cache import CodeCache
+from cinder.codegen.asm import *
+from cinder.passes import cleanup, constants, escape, inline, licm, loads
+from cinder.passes.manager import Context, Pass, PassManager
+from cinder.profile import Profile
 from ctypes import pythonapi
 from ctypes.util import find_library
-from peachpy import *
-from peachpy.x86_64 import *
-from peachpy.x86_64.registers import rsp
-from typing import Tuple
+from typing import Dict, Optional, Tuple
 
 _cinder_name = find_library('_cinder')
 _cinder = ctypes.CDLL(_cinder_name)
 _cinder.get_call_function_address.restype = ctypes.c_void_p
+_cinder.get_deopt_address.restype = ctypes.c_void_p
 
 
 dllib = ctypes.CDLL(None)
@@ -30,46 +44,97 @@ def pysym(name):
 class Runtime:
     PY_SYMBOLS = (
         '_PyDict_LoadGlobal',
+        'PyDict_GetItem',
+        'PyErr_Clear',
+        'PyErr_ExceptionMatches',
+        'PyErr_Occurred',
+        # This is the address of the PyObject* for the exception type
+        'PyExc_StopIteration',
+        'PyLong_FromLong',
+        'PyNumber_Add',
+        'PyNumber_And',
+        'PyNumber_FloorDivide',
+        'PyNumber_InPlaceAdd',
+        'PyNumber_InPlaceAnd',
+        'PyNumber_InPlaceFloorDivide',
+        'PyNumber_InPlaceLshift',
+        'PyNumber_InPlaceMatrixMultiply',
+        'PyNumber_InPlaceMultiply',
+        'PyNumber_InPlaceOr',
+        'PyNumber_InPlacePower',
+        'PyNumber_InPlaceRemainder',
+        'PyNumber_InPlaceRshift',
+        'PyNumber_InPlaceSubtract',
+        'PyNumber_InPlaceTrueDivide',
+        'PyNumber_InPlaceXor',
+        'PyNumber_Lshift',
+        'PyNumber_MatrixMultiply',
+        'PyNumber_Multiply',
+        'PyNumber_Or',
+        'PyNumber_Power',
+        'PyNumber_Remainder',
+        'PyNumber_Rshift',
+        'PyNumber_Subtract',
+        'PyNumber_TrueDivide',
+        'PyNumber_Xor',
         'PyObject_GetAttr',
+        'PyObject_GetIter',
         'PyObject_IsTrue',
+        'PyObject_RichCompare',
         'PyObject_SetAttr',
+        'PySequence_Contains',
     )
 
 # Initialize pointers from libpython
 for name in Runtime.PY_SYMBOLS:
     symbol = pysym(name.encode())
-    setattr(Runtime, name, symbol)
+    setattr(Runtime, name, Address(symbol))
 
 # Initialize pointers from cinder
-Runtime.call_function = _cinder.get_call_function_address()
+Runtime.call_function = Address(_cinder.get_call_function_address())
+Runtime.deopt = Address(_cinder.get_deopt_address())
 
 # Calling convention and stack-frame layout for jit-compiled functions
 #
-# Jit functions take a single argument, a PyObject**, that points to the beginning of
-# the argument list. This matches CPython's fast calling convention.
+# Functions that take at most MAX_REGISTER_ARGS arguments receive them in the SysV
+# argument registers. Other jit functions take a single argument, a PyObject**, that
+# points to the beginning of the argument list. This matches CPython's fast calling
+# convention. Either way the prologue copies the arguments into the frame, where they
+# are accessed like any other local variable. Register entry points are wrapped in an
+# adapter that takes the argument array, which is used when calling from C.
 #
-# The following registers are initialized in the function prologue and must remain fixed
+# The following register is initialized in the function prologue and must remain fixed
 # for the lifetime of the function:
 #
-#   r12 - Holds a pointer to the function's arguments
-#   r13 - Holds a pointer to the top of the block stack
 #   rbp - Holds a pointer to the beginning of the local variable storage
 #
+# Leaf functions never call out, so they use the caller saved r11 in place of rbp and
+# need not save any registers.
+#
+# There is no block stack. The depth of the value stack is known statically at every
+# point in the function, so loop exits are compiled into a fixed number of pops
+# followed by a direct jump (see cinder.analysis.stack).
+#
+# Code that is specialized using type feedback is guarded. When a guard fails the
+# function deoptimizes: the locals and the value stack are handed to a new
+# interpreter frame that resumes at the guarded instruction (see src/deopt.h). To
+# make this possible, locals that have not been assigned yet are always NULL.
+#
+# Loops that run for a long time in the interpreter are continued in machine code
+# through an OSR entry (see src/osr.h). It copies the interpreter's locals and value
+# stack into a fresh frame and jumps to the loop header.
+#
 # Immediately after the function prologue completes, the stack looks like
 #
 # +------------------------------------+ Frame (fixed size)
-# | Saved r12                          |
-# | Saved r13                          |
 # | Saved rbp                          |
 # |+----------------+ Local variables  | <--- rbp
-# ||Local 0         |                  |
+# ||Argument 0      |                  |
 # ||...             |                  |
-# ||Local N         |                  |
-# |+----------------+                  |
-# |+----------------+                  | <--- r13 (moves)
-# ||Block stack     |                  |
-# ||     | Growth   |                  |
-# ||     v          |                  |
+# ||Argument N      |                  |
+# ||Local N + 1     |                  |
+# ||...             |                  |
+# ||Local M         |                  |
 # |+----------------+                  |
 # +------------------------------------+
 # .                                    .
@@ -81,45 +146,153 @@ Runtime.call_function = _cinder.get_call_function_address()
 # Caller saved registers: r10, r11, parameter passing regs (rdi, rsi, rdx, rcx, r8, r9)
 # Callee saved registers: rbx, rbp, rsp (implicitly), r12 - r15,
 
-# TODO(mpage): Calculate this by scanning the bytecode for instructions that push onto the blockstack
-BLOCKSTACK_SIZE = 20
+# Offsets of fields in CPython objects
+OB_TYPE = struct_offsets['PyObject.ob_type']
+OB_SIZE = struct_offsets['PyVarObject.ob_size']
+OB_DIGIT = struct_offsets['PyLongObject.ob_digit']
+MA_USED = struct_offsets['PyDictObject.ma_used']
+MA_VERSION_TAG = struct_offsets['PyDictObject.ma_version_tag']
+OB_ITEM = struct_offsets['PyListObject.ob_item']
+STR_LENGTH = struct_offsets['PyASCIIObject.length']
+STR_STATE = struct_offsets['PyASCIIObject.state']
+TP_DEALLOC = struct_offsets['PyTypeObject.tp_dealloc']
+TP_AS_NUMBER = struct_offsets['PyTypeObject.tp_as_number']
+TP_AS_SEQUENCE = struct_offsets['PyTypeObject.tp_as_sequence']
+TP_AS_MAPPING = struct_offsets['PyTypeObject.tp_as_mapping']
+TP_ITERNEXT = struct_offsets['PyTypeObject.tp_iternext']
+TP_FLAGS = struct_offsets['PyTypeObject.tp_flags']
+TP_VERSION_TAG = struct_offsets['PyTypeObject.tp_version_tag']
+NB_BOOL = struct_offsets['PyNumberMethods.nb_bool']
+SQ_LENGTH = struct_offsets['PySequenceMethods.sq_length']
+MP_LENGTH = struct_offsets['PyMappingMethods.mp_length']
+JF_REGISTER_ENTRY = struct_offsets['JitFunction.register_entry']
+JF_NUM_ARGS = struct_offsets['JitFunction.num_args']
+FUNC_CODE = struct_offsets['PyFunctionObject.func_code']
+RANGEITER_INDEX = struct_offsets['rangeiterobject.index']
+RANGEITER_START = struct_offsets['rangeiterobject.start']
+RANGEITER_STEP = struct_offsets['rangeiterobject.step']
+RANGEITER_LEN = struct_offsets['rangeiterobject.len']
+LISTITER_INDEX = struct_offsets['listiterobject.it_index']
+LISTITER_SEQ = struct_offsets['listiterobject.it_seq']
+
+# The iterator types that FOR_ITER handles inline. Ranges whose bounds do not
+# fit in a C long produce a different iterator type and take the generic path.
+RANGE_ITERATOR_TYPE = type(iter(range(0)))
+LIST_ITERATOR_TYPE = type(iter([]))
+
+
+ARGUMENT_REGISTERS = (rdi, rsi, rdx, rcx, r8, r9)
+MAX_REGISTER_ARGS = len(ARGUMENT_REGISTERS)
+
+# The registers that deallocating an object may clobber (see decref)
+CALLER_SAVED_REGISTERS = (rax, rcx, rdx, rsi, rdi, r8, r9, r10, r11)
+
+
+def prologue(num_args, num_locals, frame=rbp, owned_args=()):
+    """Set up the frame and copy the arguments into it.
+
+    The arguments are passed in ARGUMENT_REGISTERS, or as a pointer to the argument
+    array in rdi if there are more than MAX_REGISTER_ARGS.
 
+    Args:
+        num_args: The number of arguments that the function takes
+        num_locals: The number of local variables, including arguments
+        frame: The register that holds the base of the frame
+        owned_args: The indices of the arguments that the function reassigns. It
+            acquires references to these, and borrows the rest from the caller.
+    """
+    MOV(frame, rsp)
+    if num_locals:
+        SUB(rsp, num_locals * 8)
+    for index in range(num_args, num_locals):
+        MOV(qword[frame - (index + 1) * 8], 0)
+    if num_args <= MAX_REGISTER_ARGS:
+        for index, arg in enumerate(ARGUMENT_REGISTERS[:num_args]):
+            MOV([frame - (index + 1) * 8], arg)
+            if index in owned_args:
+                incref(arg, rax)
+    else:
+        for index in range(num_args):
+            MOV(rcx, [rdi + index * 8])
+            MOV([frame - (index + 1) * 8], rcx)
+            if index in owned_args:
+                incref(rcx, rax)
 
-def prologue(args, num_locals):
-    LOAD.ARGUMENT(r12, args)
-    LEA(r13, [rsp - num_locals * 8])
-    MOV(rbp, rsp)
-    frame_size = (num_locals + BLOCKSTACK_SIZE) * 8
-    SUB(rsp, frame_size)
 
+def osr_prologue(num_locals, stack_depth, frame=rbp, num_inlined_locals=0,
+                 owned_locals=()):
+    """Set up the frame for an OSR entry, which continues a function that was
+    running in the interpreter.
 
-def epilogue():
-    # TODO(mpage): Decref any remaining items on the stack
-    MOV(rsp, rbp)
+    The entry is passed the interpreter's locals in rdi and the bottom of its value
+    stack in rsi.
 
+    Args:
+        num_locals: The number of local variables, including arguments
+        stack_depth: The number of values on the interpreter's value stack
+        frame: The register that holds the base of the frame
+        num_inlined_locals: The number of additional slots used by the locals of
+            inlined functions, which start out NULL
+        owned_locals: The indices of the locals that the function reassigns. It
+            acquires references to these, and borrows the rest from the
+            interpreter's frame.
+    """
+    MOV(frame, rsp)
+    if num_locals + num_inlined_locals:
+        SUB(rsp, (num_locals + num_inlined_locals) * 8)
+    for index in range(num_locals, num_locals + num_inlined_locals):
+        MOV(qword[frame - (index + 1) * 8], 0)
+    for index in range(num_locals):
+        MOV(rcx, [rdi + index * 8])
+        MOV([frame - (index + 1) * 8], rcx)
+        if index in owned_locals:
+            xincref(rcx, rax)
+    for index in range(stack_depth):
+        PUSH(qword[rsi + index * 8])
 
-def push_blockstack_entry():
-    SUB(r13, 8)
-    MOV([r13], rsp)
 
+def epilogue(frame=rbp):
+    MOV(rsp, frame)
 
-def pop_blockstack_entry(reg):
-    """Pop an entry from the blockstack and store it in the register reg"""
-    MOV(reg, [r13])
-    ADD(r13, 8)
 
+def deoptimize(metadata, frame=rbp):
+    """Resume the function in the interpreter and return its result.
 
-def pop_stack_until(target):
-    """Pop and decref entries from the stack until the stack pointer reaches the target"""
-    done = Label()
-    loop = Label()
-    LABEL(loop)
-    CMP(rsp, target)
-    JE(done)
-    POP(rdi)
-    decref(rdi, rsi)
-    JMP(loop)
-    LABEL(done)
+    Args:
+        metadata: Describes the state of the function (see src/deopt.h). The caller
+            must keep it alive.
+        frame: The register that holds the base of the frame
+    """
+    MOV(rdi, Address(id(metadata)))
+    MOV(rsi, frame)
+    MOV(rdx, rsp)
+    AND(rsp, -16)
+    MOV(rax, Runtime.deopt)
+    CALL(rax)
+    # TODO(mpage): Error handling
+    epilogue(frame)
+    RETURN(rax)
+
+
+def call_runtime(target):
+    """Call the function at the address in target.
+
+    The value stack lives on the machine stack, so rsp is not necessarily 16-byte
+    aligned as the SysV ABI requires. Functions that may run arbitrary code need it
+    to be, so it is realigned around the call. The original rsp is kept in r12,
+    which is callee saved.
+    """
+    MOV(r12, rsp)
+    AND(rsp, -16)
+    CALL(target)
+    MOV(rsp, r12)
+
+
+def discard(num_items):
+    """Pop and decref the top num_items entries of the stack"""
+    for _ in range(num_items):
+        POP(rdi)
+        decref(rdi, rsi)
 
 
 def incref(pyobj, temp, amount=1):
@@ -136,16 +309,55 @@ def incref(pyobj, temp, amount=1):
 
 
 def decref(pyobj, temp, amount=1):
-    """Decrement the reference count of a PyObject.
+    """Decrement the reference count of a PyObject, deallocating it if the count
+    reaches zero.
+
+    The object is deallocated in the cold section of the current function (see
+    ColdSection), which preserves every register other than temp, so callers do
+    not need to know whether it happened.
 
     Args:
         pyobj: A register storing a pointer to the PyObject whose refcount is being deceremented.
         temp: A temporary register
         amount: How much to decrement the reference count by
     """
+    done = Label()
+
+    def dealloc():
+        for reg in CALLER_SAVED_REGISTERS:
+            PUSH(reg)
+        # Equivalent to _Py_Dealloc, which is a macro in release builds
+        MOV(rdi, pyobj)
+        MOV(rax, [rdi + OB_TYPE])
+        MOV(rax, [rax + TP_DEALLOC])
+        call_runtime(rax)
+        for reg in reversed(CALLER_SAVED_REGISTERS):
+            POP(reg)
+        JMP(done)
+
     MOV(temp, [pyobj])
-    LEA(temp, [temp - amount])
+    SUB(temp, amount)
     MOV([pyobj], temp)
+    JZ(_cold.add(dealloc))
+    LABEL(done)
+
+
+def xincref(pyobj, temp):
+    """Increment the reference count of a PyObject, unless pyobj is NULL"""
+    null = Label()
+    TEST(pyobj, pyobj)
+    JZ(null)
+    incref(pyobj, temp)
+    LABEL(null)
+
+
+def xdecref(pyobj, temp):
+    """Decrement the reference count of a PyObject, unless pyobj is NULL"""
+    null = Label()
+    TEST(pyobj, pyobj)
+    JZ(null)
+    decref(pyobj, temp)
+    LABEL(null)
 
 
 def duplicate_and_reverse(num_items):
@@ -164,8 +376,144 @@ def duplicate_and_reverse(num_items):
     LABEL(reverse_done)
 
 
-def call_function(num_args):
-    """Perform the equivalent of CALL_FUNCTION"""
+def register_entry(callee, num_args):
+    """Returns the address of the register entry point of callee if it is a jit
+    function that takes num_args arguments, or a function that takes exactly num_args
+    positional arguments and that the interpreter has compiled (see cinder.policy).
+    """
+    if callee.__class__ is pytypes.FunctionType:
+        if callee.__code__.co_argcount != num_args:
+            return None
+        callee = get_compiled(callee.__code__)
+    if callee.__class__ is not JitFunction or num_args > MAX_REGISTER_ARGS:
+        return None
+    if ctypes.c_ssize_t.from_address(id(callee) + JF_NUM_ARGS).value != num_args:
+        return None
+    return ctypes.c_void_p.from_address(id(callee) + JF_REGISTER_ENTRY).value
+
+
+def guard_callee(num_args, callee, deopt, code=None):
+    """Jump to deopt unless the function below the top num_args values on the
+    stack is callee.
+
+    Leaves callee in rax.
+
+    Args:
+        code: The code that callee must have, if it is a Python function. Code that
+            was compiled from the function's code is invalid once it is replaced.
+            Defaults to the current code.
+    """
+    MOV(rax, Address(id(callee)))
+    CMP([rsp + num_args * 8], rax)
+    JNE(deopt)
+    if callee.__class__ is pytypes.FunctionType:
+        MOV(rcx, Address(id(code or callee.__code__)))
+        CMP([rax + FUNC_CODE], rcx)
+        JNE(deopt)
+
+
+def guard_method(name, method, code, receivers, deopt):
+    """Jump to deopt unless loading name from the object at the top of the stack
+    would produce method bound to the object.
+
+    Args:
+        code: The code that method must have
+        receivers: The possible types of the object, and their version tags. Each
+            must resolve name to method and have the same __dictoffset__ (see
+            cinder.passes.inline).
+    """
+    matched = Label()
+    MOV(rdi, [rsp])
+    MOV(rax, [rdi + OB_TYPE])
+    for i, (typ, version) in enumerate(receivers):
+        last = i == len(receivers) - 1
+        mismatch = deopt if last else Label()
+        MOV(rcx, Address(id(typ)))
+        CMP(rax, rcx)
+        JNE(mismatch)
+        CMP(dword[rax + TP_VERSION_TAG], version)
+        JNE(deopt)
+        if not last:
+            JMP(matched)
+            LABEL(mismatch)
+    LABEL(matched)
+    TEST(qword[rax + TP_FLAGS], VALID_VERSION_TAG)
+    JZ(deopt)
+    MOV(rax, Address(id(method)))
+    MOV(rcx, Address(id(code)))
+    CMP([rax + FUNC_CODE], rcx)
+    JNE(deopt)
+    dict_offset = receivers[0][0].__dictoffset__
+    if dict_offset:
+        # The instance dictionary takes precedence over methods
+        no_dict = Label()
+        MOV(rdi, [rdi + dict_offset])
+        TEST(rdi, rdi)
+        JZ(no_dict)
+        MOV(rsi, Address(id(name)))
+        MOV(rax, Runtime.PyDict_GetItem)
+        call_runtime(rax)
+        TEST(rax, rax)
+        JNZ(deopt)
+        LABEL(no_dict)
+
+
+def clear_locals(start, count, frame=rbp):
+    """Release the locals in [start, start + count) and set them to NULL"""
+    for index in range(start, start + count):
+        MOV(rdi, [frame - (index + 1) * 8])
+        xdecref(rdi, rsi)
+        MOV(qword[frame - (index + 1) * 8], 0)
+
+
+def release_locals(indices, frame=rbp):
+    """Release the locals at indices, any of which may be NULL"""
+    for index in indices:
+        MOV(rdi, [frame - (index + 1) * 8])
+        xdecref(rdi, rsi)
+
+
+def call_function(num_args, callee=None, deopt=None, known=False):
+    """Perform the equivalent of CALL_FUNCTION.
+
+    Calls to jit functions that take exactly num_args arguments in registers go
+    directly to their register entry point.
+
+    Args:
+        callee: The only callee that type feedback has observed, if any. If it has a
+            register entry point (see register_entry) the call is guarded on its
+            identity and made to a fixed address. The caller must keep callee alive.
+        deopt: Where to go if the guard on callee fails
+        known: The call is known to invoke callee, so it is not guarded
+    """
+    generic = Label()
+    done = Label()
+    entry = None if callee is None else register_entry(callee, num_args)
+    if entry is not None and not known:
+        guard_callee(num_args, callee, deopt)
+    elif num_args <= MAX_REGISTER_ARGS:
+        MOV(rax, [rsp + num_args * 8])
+        MOV(rcx, Address(id(JitFunction)))
+        CMP([rax + OB_TYPE], rcx)
+        JNE(generic)
+        CMP(qword[rax + JF_NUM_ARGS], num_args)
+        JNE(generic)
+    if entry is not None or num_args <= MAX_REGISTER_ARGS:
+        # Arguments were pushed in order, so the last one is at the top of the stack
+        for index, reg in enumerate(ARGUMENT_REGISTERS[:num_args]):
+            MOV(reg, [rsp + (num_args - index - 1) * 8])
+        if entry is not None:
+            MOV(rax, Address(entry))
+            CALL(rax)
+        else:
+            CALL([rax + JF_REGISTER_ENTRY])
+        # TODO(mpage): Error handling
+        discard(num_args + 1)
+        PUSH(rax)
+        if entry is not None:
+            return
+        JMP(done)
+    LABEL(generic)
     # This is heinous. CPython's stack grows in the opposite direction of the
     # machine's stack so we are forced to reverse the order of the arguments
     # and function on the stack before calling into the runtime. Obviously we
@@ -180,7 +528,7 @@ def call_function(num_args):
     MOV(rsi, num_args)
     MOV(rdx, 0)
     MOV(rcx, Runtime.call_function)
-    CALL(rcx)
+    call_runtime(rcx)
     # call_function takes care of decrementing refcounts on the arguments and
     # function.
     #
@@ -189,54 +537,68 @@ def call_function(num_args):
     num_items = 1 + num_items * 2
     LEA(rsp, [rsp + num_items * 8])
     PUSH(rax)
+    LABEL(done)
 
 
-def load_const(code, index):
+def load_const(consts, index, borrowed=False):
     """Load a reference to const onto the stack.
 
     NB: This embeds a pointer to the constant into the jitted code. This is potentially invalid
     if the code object for the function is re-assigned.
 
     Args:
-        code: The code object
-        index: An index into the constants tuple of the code object
+        consts: The constants of the function being compiled, followed by those of the
+            functions inlined into it
+        index: An index into consts
+        borrowed: Push the constant without acquiring a new reference
     """
-    MOV(rdi, id(code.co_consts[index]))
-    incref(rdi, rsi)
-    PUSH(rdi)
-
-
-def load_arg(index):
-    # TODO(mpage): Error handling
-    MOV(rdi, [r12 + index * 8])
-    incref(rdi, rsi)
+    MOV(rdi, Address(id(consts[index])))
+    if not borrowed:
+        incref(rdi, rsi)
     PUSH(rdi)
 
 
-def store_arg(index):
-    POP(rdi)
-    MOV([r12 + index * 8], rdi)
-
+def load_local(index, borrowed=False, frame=rbp, move=False):
+    """Push the value of a local.
 
-def load_local(index):
+    Args:
+        borrowed: Push the value without acquiring a new reference
+        move: Move the local's reference onto the stack, leaving the local NULL.
+            The local must be owned and not read again.
+    """
     # TODO(mpage): Error handling
-    MOV(rdi, [rbp - (index + 1) * 8])
-    incref(rdi, rsi)
+    MOV(rdi, [frame - (index + 1) * 8])
+    if move:
+        MOV(qword[frame - (index + 1) * 8], 0)
+    elif not borrowed:
+        incref(rdi, rsi)
     PUSH(rdi)
 
 
-def store_local(index):
+def store_local(index, frame=rbp, dead=False):
+    """Pop the top of the stack into a local, releasing the local's previous value.
+
+    Args:
+        dead: The local is not read again before it is reassigned, so the value is
+            discarded instead
+    """
     POP(rdi)
-    MOV([rbp - (index + 1) * 8], rdi)
+    if dead:
+        decref(rdi, rsi)
+        return
+    MOV(rsi, [frame - (index + 1) * 8])
+    MOV([frame - (index + 1) * 8], rdi)
+    xdecref(rsi, rdx)
 
 
-def pop_top():
+def pop_top(borrowed=False):
     """Discard the top-most element on the stack"""
     POP(rdi)
-    decref(rdi, rsi)
+    if not borrowed:
+        decref(rdi, rsi)
 
 
-def load_attr(name):
+def load_attr(name, borrowed_owner=False):
     """Call PyObject_GetAttr(<tos>, name) and push the result.
 
     NB: This embeds a pointer to the constant into the jitted code. This is potentially invalid
@@ -245,19 +607,54 @@ def load_attr(name):
     Args:
         name: The name being looked up. This should be a PyObject* retrieved from the
             co_names tuple of the code object that is being jit compiled.
+        borrowed_owner: The owner on the stack is a borrowed reference
     """
     POP(rdi)
-    MOV(rsi, id(name))
+    MOV(rsi, Address(id(name)))
     MOV(rdx, Runtime.PyObject_GetAttr)
     PUSH(rdi)
-    CALL(rdx)
+    call_runtime(rdx)
     # TODO(mpage): Error handling
     POP(rdi)
-    decref(rdi, rsi)
+    if not borrowed_owner:
+        decref(rdi, rsi)
     PUSH(rax)
 
 
-def store_attr(name):
+def load_instance_attr(name, typ, version, deopt, borrowed_owner=False):
+    """Load an attribute from the instance dictionary of an object of type typ.
+
+    The load is guarded on the exact type of the owner and its version tag, which
+    changes whenever the type or any of its bases are modified, and on the attribute
+    being present. If any of these fail the function deoptimizes and the interpreter
+    performs the load.
+    """
+    MOV(rdi, [rsp])
+    MOV(rax, [rdi + OB_TYPE])
+    MOV(rcx, Address(id(typ)))
+    CMP(rax, rcx)
+    JNE(deopt)
+    TEST(qword[rax + TP_FLAGS], VALID_VERSION_TAG)
+    JZ(deopt)
+    CMP(dword[rax + TP_VERSION_TAG], version)
+    JNE(deopt)
+    MOV(rdi, [rdi + typ.__dictoffset__])
+    TEST(rdi, rdi)
+    JZ(deopt)
+    MOV(rsi, Address(id(name)))
+    MOV(rax, Runtime.PyDict_GetItem)
+    call_runtime(rax)
+    # Missing attributes may still be provided by __getattr__
+    TEST(rax, rax)
+    JZ(deopt)
+    incref(rax, rcx)
+    POP(rdi)
+    if not borrowed_owner:
+        decref(rdi, rsi)
+    PUSH(rax)
+
+
+def store_attr(name, borrowed_owner=False, borrowed_value=False):
     """Call PyObject_SetAttr(<tos>, <name>, <tos + 1>)
 
     NB: This embeds a pointer to the constant into the jitted code. This is potentially invalid
@@ -266,18 +663,48 @@ def store_attr(name):
     Args:
         name: The name of the attribute being set. This should be a PyObject* retrieved from
             the co_names tuple of the code object being compiled.
+        borrowed_owner: The owner on the stack is a borrowed reference
+        borrowed_value: The value on the stack is a borrowed reference
     """
     MOV(rdi, [rsp])
     MOV(rdx, [rsp + 8])
-    MOV(rsi, id(name))
+    MOV(rsi, Address(id(name)))
     MOV(rcx, Runtime.PyObject_SetAttr)
-    CALL(rcx)
+    call_runtime(rcx)
     # TODO(mpage): Error handling
     # Dispose of owner and value
     POP(rdi)
-    decref(rdi, rsi)
+    if not borrowed_owner:
+        decref(rdi, rsi)
     POP(rdi)
-    decref(rdi, rsi)
+    if not borrowed_value:
+        decref(rdi, rsi)
+
+
+def guard_global(versions, deopt):
+    """Jump to deopt if any of the dictionaries in versions no longer has the
+    version that it is paired with.
+    """
+    for d, version in versions:
+        MOV(rax, Address(id(d)))
+        MOV(rcx, version)
+        CMP([rax + MA_VERSION_TAG], rcx)
+        JNE(deopt)
+
+
+def globals_and_builtins(func):
+    """Returns the dictionaries that func looks globals up in. The builtins are
+    None unless they are a module or dictionary.
+    """
+    globals = getattr(func, '__globals__', None)
+    if globals.__class__ is not dict:
+        raise ValueError('Cannot compile functions whose globals are not a dictionary')
+    builtins = globals.get('__builtins__', None)
+    if isinstance(builtins, pytypes.ModuleType):
+        builtins = builtins.__dict__
+    elif not isinstance(builtins, dict):
+        builtins = None
+    return globals, builtins
 
 
 def load_global(globals, builtins, name):
@@ -291,129 +718,235 @@ def load_global(globals, builtins, name):
         globals: The globals dictionary
         builtins: The builtins dictionary
     """
-    MOV(rdi, id(globals))
-    MOV(rsi, id(builtins))
-    MOV(rdx, id(name))
+    MOV(rdi, Address(id(globals)))
+    MOV(rsi, Address(id(builtins)))
+    MOV(rdx, Address(id(name)))
     MOV(rcx, Runtime._PyDict_LoadGlobal)
-    CALL(rcx)
+    call_runtime(rcx)
     # TODO(mpage): Error handling
     incref(rax, rdi)
     PUSH(rax)
 
 
-def unary_not():
-    false_label = Label()
-    done_label = Label()
-    POP(r13)
-    MOV(rdi, r13)
-    MOV(rdx, Runtime.PyObject_IsTrue)
-    CALL(rdx)
-    # TODO(mpage): Error handling around call to PyObject_IsTrue
-    decref(r13, r14)
-    CMP(rax, 0)
-    JNZ(false_label)
-    MOV(r13, id(True))
-    incref(r13, r14)
-    PUSH(r13)
-    JMP(done_label)
-    LABEL(false_label)
-    MOV(r13, id(False))
-    incref(r13, r14)
-    PUSH(r13)
-    LABEL(done_label)
-
-
-def conditional_branch(instr, labels):
+# The cold section of the function being generated
+_cold = None
+
+
+class ColdSection:
+    """Code that is unlikely to execute (e.g. generic slow paths).
+
+    Cold code is emitted after the body of the function so that the hot paths
+    are laid out contiguously and fall through to each other. Within a with
+    block, the section is also the one that decref adds to.
+    """
+
+    def __init__(self):
+        self.stubs = []
+
+    def __enter__(self):
+        global _cold
+        self.outer = _cold
+        _cold = self
+        return self
+
+    def __exit__(self, *exc_info):
+        global _cold
+        _cold = self.outer
+
+    def add(self, emit):
+        """Defer emit() until the end of the function.
+
+        Returns:
+            The label that marks the beginning of the cold code.
+        """
+        label = Label()
+        self.stubs.append((label, emit))
+        return label
+
+    def emit(self):
+        for label, emit in self.stubs:
+            LABEL(label)
+            emit()
+
+
+def jump_unless_next(target, next_label):
+    """Jump to target unless it immediately follows the current code"""
+    if target is not next_label:
+        JMP(target)
+
+
+# Builtin types whose instances are falsey iff the word at the given offset is
+# zero. For ints this is the number of digits.
+SIZED_TYPES = (
+    (int, OB_SIZE),
+    (list, OB_SIZE),
+    (tuple, OB_SIZE),
+    (dict, MA_USED),
+)
+
+# The types that truth_test handles without consulting the type's slots
+TRUTH_TEST_TYPES = (bool, type(None), str) + tuple(typ for typ, _ in SIZED_TYPES)
+
+
+def truth_test(pyobj, if_true, if_false, cold, typ=static_types.ANY):
+    """Jump to if_true or if_false depending on the truthiness of pyobj.
+
+    This never falls through. The following are handled inline:
+
+      - True, False, and None.
+      - Exact ints, lists, tuples, dicts, and (ready) strs, which are falsey iff
+        they are empty (or zero).
+      - Instances of types that define neither __bool__ nor __len__, which are
+        always truthy. The slots that PyObject_IsTrue consults are checked
+        directly, so this stays correct if the type is modified later.
+
+    Everything else is handled by PyObject_IsTrue in the cold section. Checks
+    for types that pyobj is statically known not to have are omitted.
+
+    Args:
+        pyobj: A callee saved register holding the PyObject being tested
+        if_true: The label to jump to if pyobj is truthy
+        if_false: The label to jump to if pyobj is falsey
+        cold: The cold section of the function
+        typ: The static_types.Type of pyobj
+    """
+    def is_true_slow_path():
+        MOV(rdi, pyobj)
+        MOV(rax, Runtime.PyObject_IsTrue)
+        call_runtime(rax)
+        # TODO(mpage): Error handling around call to PyObject_IsTrue
+        CMP(eax, 0)
+        JG(if_true)
+        JMP(if_false)
+
+    if typ.is_subset((bool, type(None))):
+        # Only True is truthy
+        MOV(rax, Address(id(True)))
+        CMP(pyobj, rax)
+        JE(if_true)
+        JMP(if_false)
+        return
+    slow = cold.add(is_true_slow_path)
+    if typ.may_be(bool):
+        MOV(rax, Address(id(True)))
+        CMP(pyobj, rax)
+        JE(if_true)
+        MOV(rax, Address(id(False)))
+        CMP(pyobj, rax)
+        JE(if_false)
+    if typ.may_be(type(None)):
+        MOV(rax, Address(id(None)))
+        CMP(pyobj, rax)
+        JE(if_false)
+    # Dispatch on the exact type
+    MOV(rax, [pyobj + OB_TYPE])
+    for sized_type, size_offset in SIZED_TYPES:
+        if not typ.may_be(sized_type):
+            continue
+        not_typ = Label()
+        MOV(rcx, Address(id(sized_type)))
+        CMP(rax, rcx)
+        JNE(not_typ)
+        CMP(qword[pyobj + size_offset], 0)
+        JE(if_false)
+        JMP(if_true)
+        LABEL(not_typ)
+    if typ.may_be(str):
+        not_str = Label()
+        MOV(rcx, Address(id(str)))
+        CMP(rax, rcx)
+        JNE(not_str)
+        TEST(dword[pyobj + STR_STATE], UNICODE_READY_MASK)
+        JZ(slow)
+        CMP(qword[pyobj + STR_LENGTH], 0)
+        JE(if_false)
+        JMP(if_true)
+        LABEL(not_str)
+    if typ.is_subset(TRUTH_TEST_TYPES):
+        # Unreachable, since every type that pyobj may have was handled above
+        JMP(slow)
+        return
+    # Objects are truthy unless their type defines nb_bool, mp_length, or
+    # sq_length
+    for methods_offset, slot_offset in ((TP_AS_NUMBER, NB_BOOL),
+                                        (TP_AS_MAPPING, MP_LENGTH),
+                                        (TP_AS_SEQUENCE, SQ_LENGTH)):
+        no_slot = Label()
+        MOV(rcx, [rax + methods_offset])
+        TEST(rcx, rcx)
+        JZ(no_slot)
+        CMP(qword[rcx + slot_offset], 0)
+        JNE(slow)
+        LABEL(no_slot)
+    JMP(if_true)
+
+
+def unary_not(cold, borrowed_operand=False, borrowed_result=False, typ=static_types.ANY):
+    is_true = Label()
+    is_false = Label()
+    done = Label()
+    POP(r14)
+    truth_test(r14, is_true, is_false, cold, typ)
+    LABEL(is_true)
+    MOV(rax, Address(id(False)))
+    JMP(done)
+    LABEL(is_false)
+    MOV(rax, Address(id(True)))
+    LABEL(done)
+    if not borrowed_operand:
+        decref(r14, rdi)
+    if not borrowed_result:
+        incref(rax, rdi)
+    PUSH(rax)
+
+
+def conditional_branch(instr, labels, cold, next_label=None, borrowed=False,
+                       typ=static_types.ANY):
+    """Perform the equivalent of POP_JUMP_IF_* and JUMP_IF_*_OR_POP.
+
+    Args:
+        instr: The ir.ConditionalBranch
+        labels: Maps block labels to machine code labels
+        cold: The cold section of the function
+        next_label: The label of the block that immediately follows this one
+        borrowed: The value being tested is a borrowed reference
+        typ: The static_types.Type of the value being tested
+    """
     # TODO(mpage): Error handling
-    MOV(rdi, id(True))
-    MOV(rsi, id(False))
-    true, false = rdi, rsi
-    fall_through = Label()
-    do_branch = Label()
     if instr.pop_before_eval:
         POP(r14)
-        if instr.jump_when_true:
-            # TOS == Py_False?
-            CMP(r14, false)
-            JE(fall_through)
-            # TOS == Py_True?
-            CMP(r14, true)
-            JE(do_branch)
-            # Call PyObject_IsTrue(TOS)
-            MOV(rdi, r14)
-            MOV(rsi, Runtime.PyObject_IsTrue)
-            CALL(rsi)
-            CMP(rax, 0)
-            JE(fall_through)
-            # TOS is truthy, do the branch
-            LABEL(do_branch)
-            decref(r14, rdi)
-            JMP(labels[instr.true_branch])
-            # TOS is falsey, fall through
-            LABEL(fall_through)
-            decref(r14, rdi)
-        else:
-            # TOS == Py_True?
-            CMP(r14, true)
-            JE(fall_through)
-            # TOS == Py_False?
-            CMP(r14, false)
-            JE(do_branch)
-            # Call PyObject_IsTrue(TOS)
-            MOV(rdi, r14)
-            MOV(rsi, Runtime.PyObject_IsTrue)
-            CALL(rsi)
-            CMP(rax, 0)
-            JG(fall_through)
-            # TOS is truthy, do the branch
-            LABEL(do_branch)
-            decref(r14, rdi)
-            JMP(labels[instr.false_branch])
-            # TOS is falsey, fall through
-            LABEL(fall_through)
-            decref(r14, rdi)
     else:
         MOV(r14, [rsp])
-        if instr.jump_when_true:
-            # TOS == Py_False?
-            CMP(r14, false)
-            JE(fall_through)
-            CMP(r14, true)
-            JE(labels[instr.true_branch])
-            # Call PyObject_IsTrue(TOS)
-            MOV(rdi, r14)
-            MOV(rsi, Runtime.PyObject_IsTrue)
-            CALL(rsi)
-            # TOS is truthy, jump
-            CMP(rax, 0)
-            JG(labels[instr.true_branch])
-            # TOS is falsey, pop and fall through
-            LABEL(fall_through)
-            decref(r14, rdi)
-            ADD(rsp, 8)
+    # Each arm either transfers control directly to its target or must first
+    # release the value being tested.
+    arms = []
+    for target, is_jump_arm in ((instr.true_branch, instr.jump_when_true),
+                                (instr.false_branch, not instr.jump_when_true)):
+        if instr.pop_before_eval:
+            cleanup = not borrowed
         else:
-            # TOS == Py_True?
-            CMP(r14, true)
-            JE(fall_through)
-            CMP(r14, false)
-            # TOS is false, jump
-            JE(labels[instr.false_branch])
-            # Call PyObject_IsTrue(TOS)
-            MOV(rdi, r14)
-            MOV(rsi, Runtime.PyObject_IsTrue)
-            CALL(rsi)
-            # TOS is falsey, jump
-            CMP(rax, 0)
-            JE(labels[instr.false_branch])
-            # TOS is truthy, pop and fall through
-            LABEL(fall_through)
-            decref(r14, rdi)
+            # The non-popping variants only pop when they fall through
+            cleanup = not is_jump_arm
+        entry = Label() if cleanup else labels[target]
+        arms.append((entry, labels[target], cleanup))
+    (true_entry, _, _), (false_entry, _, _) = arms
+    truth_test(r14, true_entry, false_entry, cold, typ)
+    # Lay out the arm that continues to the next block last so that it falls
+    # through.
+    arms.sort(key=lambda arm: arm[1] is next_label)
+    for entry, target, cleanup in arms:
+        if not cleanup:
+            continue
+        LABEL(entry)
+        decref(r14, rdi)
+        if not instr.pop_before_eval:
             ADD(rsp, 8)
+        jump_unless_next(target, next_label)
 
 
-def compare_is():
-    true = id(True)
-    false = id(False)
+def compare_is(borrowed_operands=(), borrowed_result=False):
+    true = Address(id(True))
+    false = Address(id(False))
     is_true = Label()
     done = Label()
     POP(rdi)
@@ -425,15 +958,18 @@ def compare_is():
     LABEL(is_true)
     MOV(rdx, true)
     LABEL(done)
-    incref(rdx, rcx)
+    if not borrowed_result:
+        incref(rdx, rcx)
     PUSH(rdx)
-    decref(rdi, rcx)
-    decref(rsi, rcx)
+    if 0 not in borrowed_operands:
+        decref(rdi, rcx)
+    if 1 not in borrowed_operands:
+        decref(rsi, rcx)
 
 
-def compare_is_not():
-    true = id(True)
-    false = id(False)
+def compare_is_not(borrowed_operands=(), borrowed_result=False):
+    true = Address(id(True))
+    false = Address(id(False))
     is_true = Label()
     done = Label()
     POP(rdi)
@@ -445,30 +981,474 @@ def compare_is_not():
     LABEL(is_true)
     MOV(rdx, true)
     LABEL(done)
-    incref(rdx, rcx)
+    if not borrowed_result:
+        incref(rdx, rcx)
     PUSH(rdx)
-    decref(rdi, rcx)
-    decref(rsi, rcx)
+    if 0 not in borrowed_operands:
+        decref(rdi, rcx)
+    if 1 not in borrowed_operands:
+        decref(rsi, rcx)
+
+
+def unbox_small_int(pyobj, dst, dst32, temp, long_type, slow):
+    """Load the value of an exact int that fits in a single digit.
+
+    Jumps to slow if pyobj is not an exact int or if its magnitude requires more
+    than one digit.
+
+    Args:
+        pyobj: A register storing a pointer to the PyObject being unboxed
+        dst: The register that will hold the value
+        dst32: The 32 bit view of dst
+        temp: A temporary register
+        long_type: A register holding a pointer to PyLong_Type, or None if pyobj is
+            statically known to be an exact int
+        slow: The label to jump to if the fast path does not apply
+    """
+    if long_type is not None:
+        CMP([pyobj + OB_TYPE], long_type)
+        JNE(slow)
+    # Single digit ints have a size of -1, 0, or 1
+    done = Label()
+    MOV(temp, [pyobj + OB_SIZE])
+    LEA(dst, [temp + 1])
+    CMP(dst, 2)
+    JA(slow)
+    # Zero has no digits, so reading one would run past the end of the object
+    XOR(dst32, dst32)
+    TEST(temp, temp)
+    JZ(done)
+    MOV(dst32, [pyobj + OB_DIGIT])
+    IMUL(dst, temp)
+    LABEL(done)
+
+
+def unbox_small_int_operands(slow, known_ints=(False, False)):
+    """Unbox the two operands at the top of the stack into rcx (left) and rdx (right).
+
+    Args:
+        known_ints: Whether each operand, from the left, is statically known to be
+            an exact int
+    """
+    MOV(rdi, [rsp + 8])
+    MOV(rsi, [rsp])
+    long_type = None
+    if not all(known_ints):
+        long_type = r8
+        MOV(r8, Address(id(int)))
+    left, right = (None if known else long_type for known in known_ints)
+    unbox_small_int(rdi, rcx, ecx, rax, left, slow)
+    unbox_small_int(rsi, rdx, edx, rax, right, slow)
+
+
+def pop_operands(borrowed_operands):
+    """Pop the two operands at the top of the stack, releasing those that are owned"""
+    POP(rdi)
+    if 0 not in borrowed_operands:
+        decref(rdi, rcx)
+    POP(rdi)
+    if 1 not in borrowed_operands:
+        decref(rdi, rcx)
+
+
+BINARY_OPERATOR_FUNCTIONS = {
+    ir.BinaryOperator.POWER: ('PyNumber_Power', 'PyNumber_InPlacePower'),
+    ir.BinaryOperator.MULTIPLY: ('PyNumber_Multiply', 'PyNumber_InPlaceMultiply'),
+    ir.BinaryOperator.MATRIX_MULTIPLY: ('PyNumber_MatrixMultiply', 'PyNumber_InPlaceMatrixMultiply'),
+    ir.BinaryOperator.FLOOR_DIVIDE: ('PyNumber_FloorDivide', 'PyNumber_InPlaceFloorDivide'),
+    ir.BinaryOperator.TRUE_DIVIDE: ('PyNumber_TrueDivide', 'PyNumber_InPlaceTrueDivide'),
+    ir.BinaryOperator.MODULO: ('PyNumber_Remainder', 'PyNumber_InPlaceRemainder'),
+    ir.BinaryOperator.ADD: ('PyNumber_Add', 'PyNumber_InPlaceAdd'),
+    ir.BinaryOperator.SUBTRACT: ('PyNumber_Subtract', 'PyNumber_InPlaceSubtract'),
+    ir.BinaryOperator.LSHIFT: ('PyNumber_Lshift', 'PyNumber_InPlaceLshift'),
+    ir.BinaryOperator.RSHIFT: ('PyNumber_Rshift', 'PyNumber_InPlaceRshift'),
+    ir.BinaryOperator.AND: ('PyNumber_And', 'PyNumber_InPlaceAnd'),
+    ir.BinaryOperator.XOR: ('PyNumber_Xor', 'PyNumber_InPlaceXor'),
+    ir.BinaryOperator.OR: ('PyNumber_Or', 'PyNumber_InPlaceOr'),
+}
+
+
+# Operators that have a fast path for small ints. Maps the operator to the
+# instruction that implements it and whether or not it can overflow.
+SMALL_INT_OPERATORS = {
+    ir.BinaryOperator.ADD: (ADD, True),
+    ir.BinaryOperator.SUBTRACT: (SUB, True),
+    ir.BinaryOperator.MULTIPLY: (IMUL, True),
+    ir.BinaryOperator.AND: (AND, False),
+    ir.BinaryOperator.OR: (OR, False),
+    ir.BinaryOperator.XOR: (XOR, False),
+}
 
 
-def pop_block():
-    """Equivalent to CPython's POP_BLOCK"""
-    pop_blockstack_entry(rcx)
-    pop_stack_until(rcx)
+def binary_operation(operator, inplace, cold, borrowed_operands=(), small_ints=True,
+                     known_ints=(False, False)):
+    """Perform the equivalent of BINARY_<operator> or INPLACE_<operator>.
 
+    Operations on small, exact ints are performed inline. Everything else,
+    including results that overflow 32 bits, is handled by the corresponding
+    PyNumber_* function in the cold section.
 
-def return_value():
+    Args:
+        small_ints: Whether to emit the inline path for small ints. Type feedback
+            may show that the operands are never ints.
+        known_ints: Whether each operand is statically known to be an exact int
+    """
+    done = Label()
+
+    def generic():
+        MOV(rdi, [rsp + 8])
+        MOV(rsi, [rsp])
+        if operator == ir.BinaryOperator.POWER:
+            MOV(rdx, Address(id(None)))
+        function = BINARY_OPERATOR_FUNCTIONS[operator][1 if inplace else 0]
+        MOV(rax, getattr(Runtime, function))
+        call_runtime(rax)
+        # TODO(mpage): Error handling
+
+    if small_ints and operator in SMALL_INT_OPERATORS:
+        def slow_path():
+            generic()
+            JMP(done)
+
+        slow = cold.add(slow_path)
+        instr, can_overflow = SMALL_INT_OPERATORS[operator]
+        unbox_small_int_operands(slow, known_ints)
+        instr(ecx, edx)
+        if can_overflow:
+            JO(slow)
+        MOVSXD(rdi, ecx)
+        MOV(rax, Runtime.PyLong_FromLong)
+        call_runtime(rax)
+    else:
+        generic()
+    LABEL(done)
+    pop_operands(borrowed_operands)
+    PUSH(rax)
+
+
+SMALL_INT_COMPARISONS = {
+    ir.ComparePredicate.LT: JL,
+    ir.ComparePredicate.LE: JLE,
+    ir.ComparePredicate.EQ: JE,
+    ir.ComparePredicate.NE: JNE,
+    ir.ComparePredicate.GT: JG,
+    ir.ComparePredicate.GE: JGE,
+}
+
+
+def rich_compare(predicate, cold, borrowed_operands=(), small_ints=True,
+                 known_ints=(False, False)):
+    """Perform the equivalent of COMPARE_OP for <, <=, ==, !=, >, and >=.
+
+    Comparisons between small, exact ints are performed inline. Everything else
+    is handled by PyObject_RichCompare in the cold section.
+
+    Args:
+        small_ints: Whether to emit the inline path for small ints. Type feedback
+            may show that the operands are never ints.
+        known_ints: Whether each operand is statically known to be an exact int
+    """
+    is_true = Label()
+    box = Label()
+    done = Label()
+
+    def generic():
+        MOV(rdi, [rsp + 8])
+        MOV(rsi, [rsp])
+        MOV(rdx, predicate.value)
+        MOV(rax, Runtime.PyObject_RichCompare)
+        call_runtime(rax)
+        # TODO(mpage): Error handling
+
+    def slow_path():
+        generic()
+        JMP(done)
+
+    if not small_ints:
+        generic()
+        pop_operands(borrowed_operands)
+        PUSH(rax)
+        return
+    unbox_small_int_operands(cold.add(slow_path), known_ints)
+    CMP(rcx, rdx)
+    SMALL_INT_COMPARISONS[predicate](is_true)
+    MOV(rax, Address(id(False)))
+    JMP(box)
+    LABEL(is_true)
+    MOV(rax, Address(id(True)))
+    LABEL(box)
+    incref(rax, rcx)
+    LABEL(done)
+    pop_operands(borrowed_operands)
+    PUSH(rax)
+
+
+def compare_contains(predicate, borrowed_operands=(), borrowed_result=False):
+    """Perform the equivalent of COMPARE_OP for `in` and `not in`."""
+    is_true = Label()
+    done = Label()
+    # PySequence_Contains(container, item)
+    MOV(rdi, [rsp])
+    MOV(rsi, [rsp + 8])
+    MOV(rax, Runtime.PySequence_Contains)
+    call_runtime(rax)
+    # TODO(mpage): Error handling
+    CMP(eax, 0)
+    if predicate == ir.ComparePredicate.IN:
+        JNE(is_true)
+    else:
+        JE(is_true)
+    MOV(rax, Address(id(False)))
+    JMP(done)
+    LABEL(is_true)
+    MOV(rax, Address(id(True)))
+    LABEL(done)
+    if not borrowed_result:
+        incref(rax, rcx)
+    pop_operands(borrowed_operands)
+    PUSH(rax)
+
+
+def get_iter(borrowed_operand=False):
+    """Call PyObject_GetIter(<tos>) and replace the top of the stack with the result"""
+    POP(rdi)
+    PUSH(rdi)
+    MOV(rax, Runtime.PyObject_GetIter)
+    call_runtime(rax)
+    # TODO(mpage): Error handling
+    POP(rdi)
+    if not borrowed_operand:
+        decref(rdi, rsi)
+    PUSH(rax)
+
+
+def for_iter(body, exit, cold, next_label=None):
+    """Equivalent to CPython's FOR_ITER.
+
+    Exact range and list iterators are advanced inline by updating their index
+    directly. Everything else is advanced by calling tp_iternext in the cold
+    section.
+
+    Args:
+        body: The label of the loop body, entered with the next value pushed
+        exit: The label to jump to once the iterator has been popped
+        cold: The cold section
+        next_label: The label of the code that follows the loop
+    """
+    have_value = Label()
+
+    def exhausted():
+        POP(rdi)
+        decref(rdi, rsi)
+        JMP(exit)
+
+    def release_list():
+        # Drop the reference to the list, as listiter_next does
+        MOV(qword[rdi + LISTITER_SEQ], 0)
+        decref(rsi, rdx)
+        JMP(stop)
+
+    def stop_iteration():
+        MOV(rax, Runtime.PyErr_Occurred)
+        call_runtime(rax)
+        TEST(rax, rax)
+        JZ(stop)
+        MOV(rdi, Runtime.PyExc_StopIteration)
+        MOV(rdi, [rdi])
+        MOV(rax, Runtime.PyErr_ExceptionMatches)
+        call_runtime(rax)
+        # TODO(mpage): Error handling
+        TEST(eax, eax)
+        JZ(stop)
+        MOV(rax, Runtime.PyErr_Clear)
+        call_runtime(rax)
+        JMP(stop)
+
+    def generic():
+        MOV(rax, [rdi + OB_TYPE])
+        MOV(rax, [rax + TP_ITERNEXT])
+        call_runtime(rax)
+        TEST(rax, rax)
+        JZ(iternext_failed)
+        JMP(have_value)
+
+    stop = cold.add(exhausted)
+    list_done = cold.add(release_list)
+    iternext_failed = cold.add(stop_iteration)
+    slow = cold.add(generic)
+    not_range = Label()
+    MOV(rdi, [rsp])
+    MOV(rax, [rdi + OB_TYPE])
+    MOV(rcx, Address(id(RANGE_ITERATOR_TYPE)))
+    CMP(rax, rcx)
+    JNE(not_range)
+    # value = start + index * step
+    MOV(rcx, [rdi + RANGEITER_INDEX])
+    CMP(rcx, [rdi + RANGEITER_LEN])
+    JGE(stop)
+    MOV(rax, rcx)
+    IMUL(rax, [rdi + RANGEITER_STEP])
+    ADD(rax, [rdi + RANGEITER_START])
+    INC(rcx)
+    MOV([rdi + RANGEITER_INDEX], rcx)
+    MOV(rdi, rax)
+    MOV(rax, Runtime.PyLong_FromLong)
+    call_runtime(rax)
+    JMP(have_value)
+    LABEL(not_range)
+    MOV(rcx, Address(id(LIST_ITERATOR_TYPE)))
+    CMP(rax, rcx)
+    JNE(slow)
+    MOV(rsi, [rdi + LISTITER_SEQ])
+    TEST(rsi, rsi)
+    JZ(stop)
+    MOV(rcx, [rdi + LISTITER_INDEX])
+    CMP(rcx, [rsi + OB_SIZE])
+    JGE(list_done)
+    MOV(rdx, [rsi + OB_ITEM])
+    MOV(rax, [rdx + rcx * 8])
+    INC(rcx)
+    MOV([rdi + LISTITER_INDEX], rcx)
+    incref(rax, rdx)
+    LABEL(have_value)
+    PUSH(rax)
+    jump_unless_next(body, next_label)
+
+
+def break_loop(num_items, target, next_label):
+    """Equivalent to CPython's BREAK_LOOP, given the number of values that the loop
+    left on the stack.
+    """
+    discard(num_items)
+    jump_unless_next(target, next_label)
+
+
+def return_value(stack_depth, frame=rbp, owned_locals=()):
+    """Equivalent to CPython's RETURN_VALUE.
+
+    Args:
+        stack_depth: The depth of the value stack, including the return value
+        frame: The register that holds the base of the frame
+        owned_locals: The indices of the locals that the function owns, which
+            are released
+    """
     # Top of stack contains PyObject*
     POP(rax)
-    epilogue()
+    # Release anything left behind by enclosing loops (e.g. iterators)
+    discard(stack_depth - 1)
+    release_locals(owned_locals, frame)
+    epilogue(frame)
     RETURN(rax)
 
 
+def fall_through_successor(cfg, block, profile=None):
+    """Returns the block that should immediately follow block, if any.
+
+    This is the successor that is reached without branching for blocks that
+    end in a conditional branch, unless type feedback shows that the branch is
+    usually taken, the branch target for blocks that end in an unconditional
+    branch, and the next block for blocks that fall through.
+    """
+    terminator = block.terminator
+    if isinstance(terminator, ir.ReturnValue):
+        return None
+    elif isinstance(terminator, (ir.Branch, ir.BreakLoop)):
+        return cfg.blocks[terminator.target]
+    elif isinstance(terminator, ir.ForIter):
+        return cfg.blocks[terminator.body]
+    elif isinstance(terminator, ir.ConditionalBranch):
+        counts = None if profile is None else profile.branch_counts(terminator)
+        if counts is not None:
+            num_true, num_false = counts
+            if num_true != num_false:
+                likely = terminator.true_branch if num_true > num_false else terminator.false_branch
+                return cfg.blocks[likely]
+        if terminator.jump_when_true:
+            return cfg.blocks[terminator.false_branch]
+        return cfg.blocks[terminator.true_branch]
+    for succ in cfg.get_successors(block):
+        return succ
+    return None
+
+
+def layout_blocks(cfg, profile=None):
+    """Order the blocks in cfg for emission.
+
+    Blocks are greedily chained onto their fall through successor, so that the
+    common path through each conditional branch and every unconditional branch
+    to a block that has not been placed yet becomes a fall through.
+    """
+    order = []
+    placed = set()
+    for block in cfg:
+        while isinstance(block, ir.BasicBlock) and block not in placed:
+            order.append(block)
+            placed.add(block)
+            block = fall_through_successor(cfg, block, profile)
+    return order
+
+
+# Loop headers are aligned so that the loop body packs into as few cache lines
+# (and decoded instruction windows) as possible.
+LOOP_HEADER_ALIGNMENT = 16
+
+
+def may_be_small_ints(profile, instr, types=None):
+    """Returns whether both operands of instr may be ints according to profile and
+    the static_types.Types of the function, if given
+    """
+    return all(profile.may_be(instr, operand, int) and
+               (types is None or types.may_be(instr, operand, int))
+               for operand in (0, 1))
+
+
+def known_ints(types, instr):
+    """Returns whether each operand of instr is statically known to be an exact int"""
+    return tuple(types.operand_type(instr, operand).is_subset((int,)) for operand in (0, 1))
+
+
+def is_leaf(cfg):
+    """Returns whether the code generated for cfg never calls out of the function,
+    other than to deallocate objects (which preserves every register, see decref)
+    """
+    for block in cfg:
+        for instr in block.instructions:
+            if isinstance(instr, (ir.Store, ir.PopTop, ir.Branch, ir.BreakLoop, ir.ReturnValue)):
+                continue
+            elif isinstance(instr, ir.Load) and instr.pool in (ir.VarPool.LOCALS, ir.VarPool.CONSTANTS):
+                continue
+            elif isinstance(instr, ir.Compare) and instr.predicate in (ir.ComparePredicate.IS,
+                                                                       ir.ComparePredicate.IS_NOT):
+                continue
+            return False
+    return True
+
+
+def array_adapter(name, num_args, register_entry):
+    """Generate an entry point that takes an argument array and forwards to register_entry"""
+    with Function(f'{name}_array_entry') as adapter:
+        MOV(r10, rdi)
+        for index, reg in enumerate(ARGUMENT_REGISTERS[:num_args]):
+            MOV(reg, [r10 + index * 8])
+        MOV(rax, register_entry)
+        CALL(rax)
+        RETURN(rax)
+    return adapter.finalize()
+
+
 _SUPPORTED_INSTRUCTIONS = {
+    ir.BinaryOperation,
     ir.Branch,
+    ir.BreakLoop,
     ir.Call,
+    ir.ClearLocals,
     ir.Compare,
     ir.ConditionalBranch,
+    ir.ForIter,
+    ir.GetIter,
+    ir.GuardCallee,
+    ir.GuardGlobal,
+    ir.GuardMethod,
     ir.LoadAttr,
     ir.LoadGlobal,
     ir.Load,
@@ -480,79 +1460,474 @@ _SUPPORTED_INSTRUCTIONS = {
 }
 
 
-def compile(func):
+# The number of times that a guard may fail before the function is recompiled
+# without the corresponding specialization
+DEOPT_RECOMPILE_THRESHOLD = 100
+
+
+def fold_constants(function, context):
+    constants.fold_constants(function, context.globals, context.builtins,
+                             context.unstable_offsets)
+
+
+def sink_allocations(function, context):
+    escape.sink_allocations(function, context.profile)
+
+
+def clean_up(function, context):
+    cleanup.clean_up(function)
+
+
+def forward_loads(function, context):
+    loads.forward_loads(function, context.profile)
+
+
+def hoist_invariants(function, context):
+    licm.hoist_invariants(function, context.profile, context.unstable_offsets)
+
+
+# The passes that are run over the SSA form of functions compiled at each tier.
+# The baseline tier skips everything that specializes the code, which keeps
+# compilation cheap.
+PIPELINES = {
+    'baseline': PassManager([
+        Pass('cleanup', clean_up),
+    ]),
+    'optimized': PassManager([
+        Pass('constants', fold_constants),
+        Pass('escape', sink_allocations),
+        Pass('cleanup', clean_up),
+        Pass('loads', forward_loads),
+        Pass('licm', hoist_invariants),
+    ]),
+}
+
+DEFAULT_TIER = 'optimized'
+
+
+class DeoptState:
+    """Tracks guard failures in a jit function.
+
+    Once a guard has failed DEOPT_RECOMPILE_THRESHOLD times, its type feedback is
+    discarded and the function is recompiled. The new code replaces the old in the
+    existing JitFunction, so callers pick it up without being recompiled.
+    """
+
+    def __init__(self, func, profile, osr_offset=None, tier=DEFAULT_TIER):
+        self.func = func
+        self.profile = profile
+        # The offset of the loop header that the code is entered at, for OSR entries
+        self.osr_offset = osr_offset
+        # The key of the pipeline in PIPELINES that the code is compiled with
+        self.tier = tier
+        # Maps the offsets of guarded instructions to the number of times their
+        # guards have failed
+        self.failures = {}
+        self.jit_function = None
+
+    def __call__(self, offset):
+        count = self.failures.get(offset, 0) + 1
+        self.failures[offset] = count
+        jit_function = self.jit_function and self.jit_function()
+        if count != DEOPT_RECOMPILE_THRESHOLD or jit_function is None:
+            return
+        self.profile = self.profile.without([offset])
+        jit_function.replace(_compile(self.func, self.profile, self))
+
+
+def deopt_metadata(func, depths, stack_shape, instr, loop_headers, on_deopt,
+                   borrowed_locals):
+    """Describe the state of func before instr executes for cinder_deopt.
+
+    Args:
+        depths: The stack depths of the function
+        stack_shape: Whether each value on the stack is borrowed, from the bottom up
+        loop_headers: Maps the offsets of loop headers to their blocks
+        on_deopt: Called with the offset of instr when the guard fails
+        borrowed_locals: Whether each local is borrowed, including the slots that
+            follow those of func (e.g. for inlined functions). The interpreter
+            takes over the locals of func, and the rest are released.
+    """
+    code = func.__code__
+    blocks = tuple(
+        (end, depths.at_entry(loop_headers[header]))
+        for header, end in bytecode.enclosing_loops(code.co_code, instr.offset)
+    )
+    return (code, func.__globals__, instr.offset, tuple(borrowed_locals), tuple(stack_shape),
+            blocks, on_deopt)
+
+
+def may_deoptimize(instr):
+    """Returns whether the code generated for instr may deoptimize"""
+    return instr.offset is not None and isinstance(
+        instr, (ir.Call, ir.GuardCallee, ir.GuardGlobal, ir.GuardMethod, ir.LoadAttr))
+
+
+def compile(func, profile=None, tier=DEFAULT_TIER):
+    """Compile func into machine code.
+
+    Args:
+        func: The function to compile
+        profile: Type feedback used to specialize the generated code. Defaults to
+            whatever the interpreter has recorded for func.
+        tier: The key of the pipeline in PIPELINES to optimize func with
+    """
+    if profile is None:
+        profile = Profile.from_code(func.__code__)
+    state = DeoptState(func, profile, tier=tier)
+    jit_function = _compile(func, profile, state)
+    state.jit_function = weakref.ref(jit_function)
+    return jit_function
+
+
+def compile_osr(func, offset, profile=None, tier=DEFAULT_TIER):
+    """Compile an entry point that continues func at the loop header at offset.
+
+    The entry is called by the interpreter to replace a running frame (see
+    src/osr.h). It cannot be called from Python.
+    """
+    if profile is None:
+        profile = Profile.from_code(func.__code__)
+    state = DeoptState(func, profile, offset, tier)
+    jit_function = _compile(func, profile, state)
+    state.jit_function = weakref.ref(jit_function)
+    return jit_function
+
+
+def osr_handler(code, globals, offset, tier=DEFAULT_TIER):
+    """Compile OSR entries on behalf of the interpreter.
+
+    Install with cinder.set_osr_handler(). Returns None for code that cannot be
+    compiled.
+    """
+    # Closures cannot be rebuilt from their code and globals alone
+    if code.co_freevars:
+        return None
+    try:
+        return compile_osr(pytypes.FunctionType(code, globals), offset, tier=tier)
+    except ValueError:
+        return None
+
+
+# The assembler keeps the function that is being generated in global state, so code
+# generation must not be interleaved between threads
+_codegen_lock = threading.RLock()
+
+
+# Where compiled code is stored for other processes to reuse, if anywhere
+_code_cache: Optional[CodeCache] = None
+
+
+def set_code_cache(cache: Optional[CodeCache]) -> None:
+    """Load compiled code from and store it in cache, or stop caching if cache is None.
+
+    The cache is also enabled by setting the CINDER_CODE_CACHE environment variable to
+    a directory.
+    """
+    global _code_cache
+    _code_cache = cache
+
+
+def get_code_cache() -> Optional[CodeCache]:
+    return _code_cache
+
+
+# Objects that code may refer to in any process
+WELL_KNOWN_OBJECTS = {
+    name: obj for name, obj in vars(builtins_module).items() if isinstance(obj, type)
+}
+WELL_KNOWN_OBJECTS.update({
+    'None': None,
+    'True': True,
+    'False': False,
+    'JitFunction': JitFunction,
+    'range_iterator': RANGE_ITERATOR_TYPE,
+    'list_iterator': LIST_ITERATOR_TYPE,
+})
+
+
+def symbols(func) -> Dict[Tuple, int]:
+    """Returns names for the addresses that code compiled for func may embed without
+    depending on type feedback (see cinder.code_cache).
+    """
     code = func.__code__
+    result = {('runtime', name): getattr(Runtime, name).value
+              for name in Runtime.PY_SYMBOLS + ('call_function', 'deopt')}
+    result.update((('object', name), id(obj)) for name, obj in WELL_KNOWN_OBJECTS.items())
+    result.update((('const', i), id(const)) for i, const in enumerate(code.co_consts))
+    result.update((('name', i), id(name)) for i, name in enumerate(code.co_names))
+    globals = func.__globals__
+    result[('globals',)] = id(globals)
+    builtins = globals.get('__builtins__', None)
+    if isinstance(builtins, pytypes.ModuleType):
+        builtins = builtins.__dict__
+    result[('builtins',)] = id(builtins)
+    return result
+
+
+def _compile(func, profile, deopt_state):
+    with _codegen_lock:
+        cache = _code_cache
+        osr_offset = deopt_state.osr_offset
+        tier = deopt_state.tier
+        unstable_offsets = frozenset(deopt_state.failures)
+        # Code is recompiled after its guards fail because the code that was
+        # compiled before (which may be what is cached) did not work out
+        if unstable_offsets:
+            cache = None
+        if cache is not None:
+            loaded = cache.load(func.__code__, osr_offset, tier, unstable_offsets,
+                                symbols(func))
+            if loaded is not None:
+                return _link(func, loaded, (), osr_offset)
+        loaded, dependencies = _generate(func, profile, deopt_state)
+        # Dependencies are objects that type feedback led the code to refer to,
+        # which only exist in this process
+        if cache is not None and not dependencies:
+            cache.store(func.__code__, osr_offset, tier, unstable_offsets, loaded,
+                        symbols(func))
+        return _link(func, loaded, dependencies, osr_offset)
+
+
+def _link(func, loaded, dependencies, osr_offset):
+    """Wrap loaded, the machine code for func, in a JitFunction"""
+    num_args = func.__code__.co_argcount
+    if osr_offset is not None:
+        # OSR entries are never called through the JitFunction
+        return JitFunction((loaded, dependencies), loaded.address, 0, -1)
+    if num_args > MAX_REGISTER_ARGS:
+        return JitFunction((loaded, dependencies), loaded.address, 0, num_args)
+    entry = loaded.address
+    adapter = array_adapter(func.__name__, num_args, entry)
+    return JitFunction((loaded, adapter, dependencies), adapter.address, entry, num_args)
+
+
+def _generate(func, profile, deopt_state):
+    """Returns the machine code for func and the objects that it depends on"""
+    code = func.__code__
+    # Objects that the generated code depends on, which must outlive it
+    dependencies = []
     cfg = bytecode.disassemble(code.co_code)
     blocks = list(cfg)
     for block in blocks:
         for instr in block.instructions:
             if instr.__class__ not in _SUPPORTED_INSTRUCTIONS:
                 raise ValueError(f'Cannot compile {instr}')
-    args = Argument(ptr())
-    with Function(func.__name__, (args,), uint64_t) as ppfunc:
-        num_locals = code.co_nlocals - code.co_argcount
-        prologue(args, num_locals)
+    inlined = inline.inline_calls(func, cfg, profile)
+    profile = inlined.profile
+    consts, names = inlined.consts, inlined.names
+    # Deoptimization reconstructs the loops of the original function, so it uses
+    # their stack depths before any transformations
+    loop_depths = stack.analyze(inlined.cfg)
+    blocks_by_offset = {
+        block.instructions[0].offset: block for block in inlined.cfg.blocks.values()
+        if block.instructions[0].offset is not None
+    }
+    # Deoptimization resumes the original code, which may read locals that the
+    # compiled code no longer does
+    original_liveness = liveness.analyze(cfg)
+    num_args = code.co_argcount
+    osr_offset = deopt_state.osr_offset
+    entry = None
+    entry_depth = 0
+    if osr_offset is not None:
+        # The locals are borrowed from the interpreter's frame
+        num_borrowed_locals = code.co_nlocals
+        header = blocks_by_offset.get(osr_offset)
+        if header is None or header not in loops.analyze(inlined.cfg).headers:
+            raise ValueError(f'No loop starts at offset {osr_offset}')
+        entry = header.label
+        entry_depth = loop_depths.at_entry(header)
+    else:
+        num_borrowed_locals = num_args
+    globals, builtins = globals_and_builtins(func)
+    ssa_function = ssa.build(inlined.cfg, inlined.num_locals, entry, consts, names)
+    # The values of globals are specific to this process, so they are not folded
+    # into code that may be cached
+    context = Context(func, None if _code_cache else globals, builtins, profile,
+                      frozenset(deopt_state.failures))
+    PIPELINES[deopt_state.tier].run(ssa_function, context)
+    types = static_types.analyze(ssa_function)
+    lowered = ssa.lower(ssa_function)
+    cfg, num_locals, consts = lowered.cfg, lowered.num_locals, lowered.consts
+    if len(consts) > len(inlined.consts):
+        dependencies.append(consts[len(inlined.consts):])
+
+    def deopt_uses(instr):
+        return original_liveness.live_at(instr.offset) if may_deoptimize(instr) else ()
+
+    live = liveness.analyze(cfg, deopt_uses)
+    # Locals that are never assigned are borrowed for the whole call. The function
+    # owns everything else, acquiring references to the borrowed locals that it
+    # reassigns on entry.
+    borrowed_locals = [index < num_borrowed_locals and index not in live.assigned
+                       for index in range(num_locals)]
+    owned_locals = sorted(live.assigned)
+    owned = ownership.analyze(cfg, live.last_uses)
+    depths = stack.analyze(cfg, entry_depth)
+    frame = r11 if is_leaf(cfg) else rbp
+    blocks = layout_blocks(cfg, profile)
+    loop_headers = loops.analyze(cfg).headers
+    with Function(func.__name__) as function, ColdSection() as cold:
         labels = {block.label: Label() for block in blocks}
-        for block in blocks:
+        reassigned = [index for index in owned_locals if index < num_borrowed_locals]
+        if osr_offset is None:
+            prologue(num_args, num_locals, frame, reassigned)
+        else:
+            # The entry block comes first
+            osr_prologue(code.co_nlocals, entry_depth, frame, num_locals - code.co_nlocals,
+                         reassigned)
+        for i, block in enumerate(blocks):
+            next_label = None
+            if i + 1 < len(blocks):
+                next_label = labels[blocks[i + 1].label]
+            if block in loop_headers:
+                ALIGN(LOOP_HEADER_ALIGNMENT)
             LABEL(labels[block.label])
-            if block.is_loop_header:
-                push_blockstack_entry()
-            if block.is_loop_footer:
-                pop_block()
+            # Whether each value on the stack is borrowed. Values that flow across
+            # blocks are always owned.
+            stack_shape = [False] * depths.at_entry(block)
             for instr in block.instructions:
+                borrowed_result = owned.is_borrowed(instr)
+                borrowed_operands = owned.operands_borrowed(instr)
+
+                def deopt_exit(discard=0):
+                    """Returns the label of code that deoptimizes before instr, after
+                    discarding the top discard values on the stack
+                    """
+                    depth = len(stack_shape) - discard
+                    metadata = deopt_metadata(func, loop_depths, stack_shape[:depth], instr,
+                                              blocks_by_offset, deopt_state,
+                                              borrowed_locals)
+                    dependencies.append(metadata)
+                    discarded = stack_shape[depth:]
+
+                    def emit():
+                        for borrowed in reversed(discarded):
+                            pop_top(borrowed)
+                        deoptimize(metadata, frame)
+
+                    return cold.add(emit)
+
                 if isinstance(instr, ir.Load):
                     if instr.pool == ir.VarPool.LOCALS:
-                        index = instr.index
-                        if index < code.co_argcount:
-                            load_arg(index)
-                        else:
-                            load_local(index - code.co_argcount)
+                        move = (live.is_last_use(instr) and not borrowed_result and
+                                not borrowed_locals[instr.index])
+                        load_local(instr.index, borrowed_result, frame, move)
                     elif instr.pool == ir.VarPool.CONSTANTS:
-                        load_const(code, instr.index)
+                        load_const(consts, instr.index, borrowed_result)
                     else:
                         raise ValueError('Can only load arguments or constants')
                 elif isinstance(instr, ir.Branch):
-                    JMP(labels[instr.target])
+                    jump_unless_next(labels[instr.target], next_label)
                 elif isinstance(instr, ir.Store):
-                    if instr.index < code.co_argcount:
-                        store_arg(instr.index)
-                    else:
-                        store_local(instr.index - code.co_argcount)
+                    store_local(instr.index, frame, live.is_dead_store(instr))
+                elif isinstance(instr, ir.SpeculativeLoadAttr):
+                    # The receiver is not an operand of the instruction that the
+                    # interpreter resumes at
+                    dependencies.append(instr.receiver)
+                    load_instance_attr(names[instr.index], instr.receiver, instr.version,
+                                       deopt_exit(1), 0 in borrowed_operands)
                 elif isinstance(instr, ir.LoadAttr):
-                    load_attr(code.co_names[instr.index])
+                    name = names[instr.index]
+                    receiver = profile.monomorphic_type(instr)
+                    version = None
+                    if receiver is not None:
+                        version = instance_attribute_version(receiver, name)
+                    if version is None:
+                        load_attr(name, 0 in borrowed_operands)
+                    elif instr.offset is None:
+                        # Inlined code cannot deoptimize, so it falls back to the
+                        # generic load when the guards fail
+                        dependencies.append(receiver)
+                        done = Label()
+
+                        def generic_load_attr(name=name, borrowed=0 in borrowed_operands,
+                                              done=done):
+                            load_attr(name, borrowed)
+                            JMP(done)
+
+                        load_instance_attr(name, receiver, version, cold.add(generic_load_attr),
+                                           0 in borrowed_operands)
+                        LABEL(done)
+                    else:
+                        dependencies.append(receiver)
+                        load_instance_attr(name, receiver, version, deopt_exit(),
+                                           0 in borrowed_operands)
                 elif isinstance(instr, ir.ReturnValue):
-                    return_value()
+                    return_value(depths.at_exit(block), frame, owned_locals)
+                elif isinstance(instr, ir.GetIter):
+                    get_iter(0 in borrowed_operands)
+                elif isinstance(instr, ir.ForIter):
+                    for_iter(labels[instr.body], labels[instr.exit], cold, next_label)
+                elif isinstance(instr, ir.BreakLoop):
+                    break_loop(depths.to_unwind(instr, block), labels[instr.target], next_label)
                 elif isinstance(instr, ir.UnaryOperation):
                     if instr.kind != ir.UnaryOperationKind.NOT:
                         raise ValueError('Can only encode unary not')
-                    unary_not()
+                    unary_not(cold, 0 in borrowed_operands, borrowed_result,
+                              types.operand_type(instr))
                 elif isinstance(instr, ir.ConditionalBranch):
-                    conditional_branch(instr, labels)
+                    conditional_branch(instr, labels, cold, next_label, 0 in borrowed_operands,
+                                       types.operand_type(instr))
                 elif isinstance(instr, ir.StoreAttr):
-                    store_attr(code.co_names[instr.index])
+                    store_attr(names[instr.index], 0 in borrowed_operands,
+                               1 in borrowed_operands)
                 elif isinstance(instr, ir.LoadGlobal):
-                    globals = getattr(func, '__globals__', None)
-                    if globals.__class__ is not dict:
-                        raise ValueError('Cannot compile functions whose globals are not a dictionary')
-                    builtins = globals.get('__builtins__', None)
-                    if isinstance(builtins, dict):
-                        pass
-                    elif isinstance(builtins, pytypes.ModuleType):
-                        builtins = builtins.__dict__
-                    else:
+                    if builtins is None:
                         raise ValueError(f'Cannot compile functions whose builtins are not a module or dictionary')
-                    load_global(globals, builtins, code.co_names[instr.index])
+                    load_global(globals, builtins, names[instr.index])
+                elif isinstance(instr, ir.Call) and instr.callee is not None:
+                    dependencies.append(instr.callee)
+                    call_function(instr.num_args, instr.callee, known=True)
                 elif isinstance(instr, ir.Call):
-                    call_function(instr.num_args)
+                    callee = profile.callee(instr)
+                    deopt = None
+                    if register_entry(callee, instr.num_args) is None:
+                        callee = None
+                    else:
+                        dependencies.append(callee)
+                        deopt = deopt_exit()
+                    call_function(instr.num_args, callee, deopt)
+                elif isinstance(instr, ir.GuardCallee):
+                    dependencies.extend((instr.callee, instr.code))
+                    guard_callee(instr.num_args, instr.callee, deopt_exit(), instr.code)
+                elif isinstance(instr, ir.GuardGlobal):
+                    guard_global(instr.versions, deopt_exit())
+                elif isinstance(instr, ir.GuardMethod):
+                    dependencies.extend((instr.method, instr.code, instr.receivers))
+                    guard_method(instr.name, instr.method, instr.code, instr.receivers,
+                                 deopt_exit())
+                elif isinstance(instr, ir.ClearLocals):
+                    clear_locals(instr.start, instr.count, frame)
                 elif isinstance(instr, ir.PopTop):
-                    pop_top()
+                    pop_top(0 in borrowed_operands)
                 elif isinstance(instr, ir.Compare):
                     if instr.predicate == ir.ComparePredicate.IS:
-                        compare_is()
+                        compare_is(borrowed_operands, borrowed_result)
                     elif instr.predicate == ir.ComparePredicate.IS_NOT:
-                        compare_is_not()
+                        compare_is_not(borrowed_operands, borrowed_result)
+                    elif instr.predicate in SMALL_INT_COMPARISONS:
+                        rich_compare(instr.predicate, cold, borrowed_operands,
+                                     may_be_small_ints(profile, instr, types),
+                                     known_ints(types, instr))
+                    elif instr.predicate in (ir.ComparePredicate.IN, ir.ComparePredicate.NOT_IN):
+                        compare_contains(instr.predicate, borrowed_operands, borrowed_result)
                     else:
                         raise ValueError(f'Cannot compile functions with {instr.predicate.name} comparisons')
-    encoded = ppfunc.finalize(abi.detect()).encode()
-    loaded = encoded.load()
-    return JitFunction(loaded, loaded.loader.code_address)
+                elif isinstance(instr, ir.BinaryOperation):
+                    binary_operation(instr.operator, instr.inplace, cold, borrowed_operands,
+                                     may_be_small_ints(profile, instr, types),
+                                     known_ints(types, instr))
+                del stack_shape[len(stack_shape) - instr.pops:]
+                stack_shape.extend([borrowed_result] * instr.pushes)
+            terminator = block.terminator
+            if not isinstance(terminator, (ir.Branch, ir.BreakLoop, ir.ConditionalBranch,
+                                           ir.ForIter, ir.ReturnValue)):
+                jump_unless_next(labels[fall_through_successor(cfg, block).label], next_label)
+        cold.emit()
+    return function.finalize(), dependencies
+
+
+if os.environ.get('CINDER_CODE_CACHE'):
+    set_code_cache(CodeCache(os.environ['CINDER_CODE_CACHE']))
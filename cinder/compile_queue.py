@@ -0,0 +1,112 @@
+"""Compiling code on a background thread.
+
+Compiling a function takes milliseconds, which is too long to stall whichever
+thread happened to make it hot. A CompileQueue hands the work to a dedicated
+worker thread instead. The interpreter keeps running the code until the worker
+publishes the result (see src/tierup.h).
+
+Most of the compiler is written in Python, so the worker holds the GIL while
+it analyzes and optimizes code and emits instructions. The assembler releases
+it while it encodes the instructions, resolves jumps and loads the code (see
+src/asm.h). For the rest, the interpreter yields the GIL at safepoints while
+compilations are pending, so the worker and the threads running Python code
+take turns rather than the latter stalling for the whole of a compilation.
+"""
+import threading
+import time
+import traceback
+
+from queue import Queue
+from types import CodeType
+from typing import (
+    Any,
+    Callable,
+    Optional,
+    Tuple,
+)
+
+import cinder
+
+from cinder import JitFunction
+
+
+Compiler = Callable[[], Optional[JitFunction]]
+
+
+class CompileQueue:
+    """Compilations served, in order, by a single worker thread"""
+
+    def __init__(
+        self,
+        budget: Optional[float] = None,
+        clock: Callable[[], float] = time.monotonic,
+        sleep: Callable[[float], Any] = time.sleep,
+    ) -> None:
+        """
+        Args:
+            budget - The maximum number of seconds that the worker may spend
+                compiling in each second, or None for no limit.
+            clock - Returns the current time in seconds.
+            sleep - Blocks the calling thread for the given number of
+                seconds.
+        """
+        self.budget = budget
+        self._clock = clock
+        self._sleep = sleep
+        self._requests: 'Queue[Tuple[Compiler, CodeType, Optional[int]]]' = Queue()
+        self._worker: Optional[threading.Thread] = None
+        self._lock = threading.Lock()
+        # The start of the current one second window and the time spent
+        # compiling during it
+        self._window_start: Optional[float] = None
+        self._spent = 0.0
+
+    def submit(self, compile: Compiler, code: CodeType, offset: Optional[int] = None) -> Any:
+        """Queue compile(), whose result is published for code, or for the loop
+        header at offset in code.
+
+        Returns:
+            cinder.PENDING, which should be returned to the interpreter.
+        """
+        with self._lock:
+            if self._worker is None:
+                self._worker = threading.Thread(
+                    target=self._run, name='cinder-compiler', daemon=True)
+                self._worker.start()
+        self._requests.put((compile, code, offset))
+        return cinder.PENDING
+
+    def join(self) -> None:
+        """Wait until every queued compilation has been published."""
+        self._requests.join()
+
+    def _run(self) -> None:
+        # Nothing run by the worker is counted or compiled by the interpreter
+        cinder.enter_compiler()
+        while True:
+            compile, code, offset = self._requests.get()
+            try:
+                self.wait_for_budget()
+                start = self._clock()
+                result = None
+                try:
+                    result = compile()
+                except Exception:
+                    traceback.print_exc()
+                self._spent += self._clock() - start
+                cinder.publish(code, result, offset)
+            finally:
+                self._requests.task_done()
+
+    def wait_for_budget(self) -> None:
+        """Block until the budget allows more time to be spent compiling."""
+        if self.budget is None:
+            return
+        now = self._clock()
+        if self._window_start is not None and now - self._window_start < 1.0:
+            if self._spent < self.budget:
+                return
+            self._sleep(self._window_start + 1.0 - now)
+            now = self._clock()
+        self._window_start = now
+        self._spent = 0.0
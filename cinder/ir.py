@@ -13,6 +13,7 @@ from typing import (
     NamedTuple,
     Optional,
     Set,
+    Tuple,
 )
 
 
@@ -20,10 +21,19 @@ Label = str
 
 
 class Instruction:
-    pass
+    # The number of values that the instruction pops off of and pushes onto the
+    # operand stack.
+    pops = 0
+    pushes = 0
+    # The offset of the bytecode instruction that this was decoded from, if any.
+    # Runtime information about the instruction (e.g. type feedback) is keyed by
+    # this.
+    offset: Optional[int] = None
 
 
 class ReturnValue(Instruction):
+    pops = 1
+
     def __str__(self) -> str:
         return 'RETURN_VALUE'
 
@@ -36,6 +46,8 @@ class VarPool(enum.Enum):
 
 
 class Load(Instruction):
+    pushes = 1
+
     def __init__(self, index: int, pool: VarPool) -> None:
         self.index = index
         self.pool = pool
@@ -47,6 +59,8 @@ class Load(Instruction):
 class Store(Instruction):
     """Only stores into locals"""
 
+    pops = 1
+
     def __init__(self, index: int) -> None:
         self.index = index
 
@@ -66,20 +80,47 @@ class ConditionalBranch(Instruction):
         self.false_branch = false_branch
         self.pop_before_eval = pop_before_eval
         self.jump_when_true = jump_when_true
+        # The non-popping variants leave the value on the stack when they
+        # branch and pop it when they fall through.
+        self.pops = 1 if pop_before_eval else 0
 
     def __str__(self) -> str:
         return f'COND_BRANCH true={self.true_branch} false={self.false_branch}'
 
 
 class BinaryOperator(enum.Enum):
-    AND    = '&'
+    POWER           = '**'
+    MULTIPLY        = '*'
+    MATRIX_MULTIPLY = '@'
+    FLOOR_DIVIDE    = '//'
+    TRUE_DIVIDE     = '/'
+    MODULO          = '%'
+    ADD             = '+'
+    SUBTRACT        = '-'
+    LSHIFT          = '<<'
+    RSHIFT          = '>>'
+    AND             = '&'
+    XOR             = '^'
+    OR              = '|'
 
 
 class BinaryOperation(Instruction):
-    def __init__(self, operator: BinaryOperator) -> None:
+    pops = 2
+    pushes = 1
+
+    def __init__(self, operator: BinaryOperator, inplace: bool = False) -> None:
+        """
+        Args:
+            operator - The operator being applied
+            inplace - Whether or not the left operand may be updated in place
+                (e.g. `x += y`)
+        """
         self.operator = operator
+        self.inplace = inplace
 
     def __str__(self) -> str:
+        if self.inplace:
+            return f"INPLACE_OP {self.operator.name}"
         return f"BIN_OP {self.operator.name}"
 
 
@@ -91,7 +132,57 @@ class Branch(Instruction):
         return f'BRANCH {self.target}'
 
 
+class BreakLoop(Instruction):
+    """Exits the innermost loop.
+
+    Anything that the loop left on the stack (e.g. the iterator of a for loop)
+    is discarded before branching to target.
+    """
+
+    def __init__(self, target: Label, loop_header: Label) -> None:
+        """
+        Args:
+            target - Where execution resumes after the loop
+            loop_header - The first block of the loop. The stack depth on entry
+                to it is the depth that the break unwinds to.
+        """
+        self.target = target
+        self.loop_header = loop_header
+
+    def __str__(self) -> str:
+        return f'BREAK_LOOP {self.target}'
+
+
+class GetIter(Instruction):
+    pops = 1
+    pushes = 1
+
+    def __str__(self) -> str:
+        return 'GET_ITER'
+
+
+class ForIter(Instruction):
+    """Advances the iterator at the top of the stack.
+
+    Pushes the next value and continues to body, or pops the iterator and
+    branches to exit once it is exhausted.
+    """
+
+    # The iterator stays on the stack for the duration of the loop
+    pushes = 1
+
+    def __init__(self, body: Label, exit: Label) -> None:
+        self.body = body
+        self.exit = exit
+
+    def __str__(self) -> str:
+        return f'FOR_ITER body={self.body} exit={self.exit}'
+
+
 class LoadAttr(Instruction):
+    pops = 1
+    pushes = 1
+
     def __init__(self, index: int) -> None:
         self.index = index
 
@@ -99,7 +190,29 @@ class LoadAttr(Instruction):
         return f'LOAD_ATTR {self.index}'
 
 
+class SpeculativeLoadAttr(LoadAttr):
+    """Loads the attribute from the instance dictionary of the object at the top
+    of the stack, ahead of the LoadAttrs that it replaces (see
+    cinder.passes.licm).
+
+    The object must be an exact instance of receiver, whose version tag must
+    still be version, and its instance dictionary must contain the attribute.
+    Otherwise the object is discarded and the function deoptimizes with the rest
+    of the stack.
+    """
+
+    def __init__(self, index: int, receiver: type, version: int) -> None:
+        super().__init__(index)
+        self.receiver = receiver
+        self.version = version
+
+    def __str__(self) -> str:
+        return f'SPECULATIVE_LOAD_ATTR {self.index} {self.receiver.__qualname__}'
+
+
 class LoadGlobal(Instruction):
+    pushes = 1
+
     def __init__(self, index: int) -> None:
         self.index = index
 
@@ -108,6 +221,8 @@ class LoadGlobal(Instruction):
 
 
 class StoreAttr(Instruction):
+    pops = 2
+
     def __init__(self, index: int) -> None:
         self.index = index
 
@@ -120,6 +235,9 @@ class UnaryOperationKind(enum.Enum):
 
 
 class UnaryOperation(Instruction):
+    pops = 1
+    pushes = 1
+
     def __init__(self, kind: UnaryOperationKind) -> None:
         self.kind = kind
 
@@ -128,23 +246,125 @@ class UnaryOperation(Instruction):
 
 
 class PopTop(Instruction):
-    pass
+    pops = 1
 
 
 class Call(Instruction):
-    def __init__(self, num_args: int) -> None:
+    pushes = 1
+
+    def __init__(self, num_args: int, callee: Any = None) -> None:
+        """
+        Args:
+            callee - The function that the call is known to invoke, if any (see
+                cinder.passes.escape). The call does not need to guard on it.
+        """
         self.num_args = num_args
+        self.pops = num_args + 1
+        self.callee = callee
 
     def __str__(self) -> str:
+        if self.callee is not None:
+            return f'CALL {self.num_args} {self.callee.__qualname__}'
         return f'CALL {self.num_args}'
 
 
+class GuardCallee(Instruction):
+    """Deoptimizes unless the function below the top num_args values on the
+    stack is callee and its code is still code. Leaves the stack unchanged.
+
+    This protects the body of callee when it is inlined at a call.
+    """
+
+    def __init__(self, num_args: int, callee: Any, code: CodeType) -> None:
+        self.num_args = num_args
+        self.callee = callee
+        self.code = code
+
+    def __str__(self) -> str:
+        return f'GUARD_CALLEE {self.num_args} {self.callee.__qualname__}'
+
+
+class GuardMethod(Instruction):
+    """Deoptimizes unless loading the attribute name from the object at the top
+    of the stack would produce method bound to the object. Leaves the stack
+    unchanged.
+
+    The object must be an instance of one of receivers, which pair the types
+    observed by type feedback with the version tags they had when method was
+    looked up on them, and its instance dictionary must not contain name. The
+    code of method must still be code. This protects the body of method when it
+    is inlined in place of the LoadAttr and Call that would create and call the
+    bound method.
+    """
+
+    def __init__(
+        self,
+        name: str,
+        method: Any,
+        code: CodeType,
+        receivers: Iterable[Tuple[type, int]],
+    ) -> None:
+        self.name = name
+        self.method = method
+        self.code = code
+        self.receivers = tuple(receivers)
+
+    def __str__(self) -> str:
+        return f'GUARD_METHOD {self.name} {self.method.__qualname__}'
+
+
+class GuardGlobal(Instruction):
+    """Deoptimizes if any of the dictionaries that the global name is looked up
+    in has been modified. Leaves the stack unchanged.
+
+    versions pairs the dictionaries (the globals, followed by the builtins if
+    name was found there) with the versions (see PEP 509) that they had when
+    name was looked up. This protects code that was specialized for the value
+    of the global.
+    """
+
+    def __init__(self, name: str, versions: Iterable[Tuple[dict, int]]) -> None:
+        self.name = name
+        self.versions = tuple(versions)
+
+    def __str__(self) -> str:
+        return f'GUARD_GLOBAL {self.name}'
+
+
+class ClearLocals(Instruction):
+    """Releases the locals in [start, start + count) and sets them to NULL.
+
+    Inlined functions store their locals in slots following those of the
+    function they are inlined into. These are cleared when the inlined function
+    returns, as they would be when its frame is destroyed.
+    """
+
+    def __init__(self, start: int, count: int) -> None:
+        self.start = start
+        self.count = count
+
+    def __str__(self) -> str:
+        return f'CLEAR_LOCALS {self.start} {self.count}'
+
+
 class ComparePredicate(enum.Enum):
+    # Values match the indices of dis.cmp_op
+    LT     = 0
+    LE     = 1
+    EQ     = 2
+    NE     = 3
+    GT     = 4
+    GE     = 5
+    IN     = 6
+    NOT_IN = 7
     IS     = 8
     IS_NOT = 9
 
 
 class Compare(Instruction):
+    pops = 2
+    pushes = 1
+
     def __init__(self, predicate: ComparePredicate) -> None:
         self.predicate = predicate
 
@@ -220,6 +440,8 @@ class CFGIterator:
                     succs = false_block, true_block
                     if terminator.jump_when_true:
                         succs = true_block, false_block
+                elif isinstance(terminator, ForIter):
+                    succs = self.cfg.blocks[terminator.exit], self.cfg.blocks[terminator.body]
                 self.queue.extendleft(succs)
             else:
                 self.queue.extendleft(succs)
@@ -276,7 +498,8 @@ def build_initial_cfg(blocks: List[BasicBlock]) -> ControlFlowGraph:
         cfg.add_block(block)
         # Outgoing edges are as follows if the terminator is a:
         #   - Direct branch      => block of branch target
-        #   - Conditional branch => block of branch target and next block
+        #   - Conditional branch => blocks of both branch targets
+        #   - Loop iteration     => loop body and exit blocks
         #   - Return             => exit node
         #   - Otherwise          => next block
         terminator = block.terminator
@@ -285,6 +508,11 @@ def build_initial_cfg(blocks: List[BasicBlock]) -> ControlFlowGraph:
         elif isinstance(terminator, ConditionalBranch):
             cfg.add_edge(block, block_index[terminator.true_branch])
             cfg.add_edge(block, block_index[terminator.false_branch])
+        elif isinstance(terminator, ForIter):
+            cfg.add_edge(block, block_index[terminator.body])
+            cfg.add_edge(block, block_index[terminator.exit])
+        elif isinstance(terminator, (Branch, BreakLoop)):
+            cfg.add_edge(block, block_index[terminator.target])
         else:
             cfg.add_edge(block, blocks[i + 1])
     return cfg
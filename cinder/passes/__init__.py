@@ -0,0 +1 @@
+# cinder.passes
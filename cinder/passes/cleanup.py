@@ -0,0 +1,135 @@
+"""Control flow cleanup.
+
+Bytecode has a basic block for every jump target, and SSA form keeps each of
+them, including blocks that do nothing but jump elsewhere. Constant folding
+(see cinder.passes.constants) leaves more of these behind when it replaces
+conditional branches with jumps. Every block boundary costs something: codegen
+emits a JMP whenever a block cannot be laid out immediately after its
+predecessor, and analyses and transformations work a block at a time. This
+pass repeats the following until nothing changes:
+
+  - Blocks that are unreachable from the entry are removed.
+  - Jumps through blocks that contain nothing but a jump are threaded: the
+    predecessors of such a block jump directly to its successor instead.
+  - A block that jumps to a block with no other predecessors is merged with
+    it.
+  - Instructions that have no side effects and whose results are unused are
+    removed. Loads of locals and constants, and the pops that discard them,
+    do not survive the conversion into SSA form, so this is what remains of
+    dead stack manipulation (e.g. `x is None` as a statement).
+
+Blocks that are marked as loop headers or footers must remain where they are,
+since the bytecode assembler emits SETUP_LOOP and POP_BLOCK for them. They
+may absorb their successors but are never merged into, or threaded through.
+Loop headers are entered by falling into their SETUP_LOOP, so jumps are not
+threaded into them either.
+"""
+from typing import Set
+
+from cinder import ir, ssa
+
+
+def is_jump(terminator: ssa.Terminator) -> bool:
+    """Returns whether terminator transfers control to its only edge without
+    doing anything else
+    """
+    return terminator.op is None or isinstance(terminator.op, ir.Branch)
+
+
+def is_pure(instr: ssa.Instruction) -> bool:
+    """Returns whether instr may be removed if its result is unused"""
+    op = instr.op
+    return isinstance(op, ir.Compare) and op.predicate in (
+        ir.ComparePredicate.IS, ir.ComparePredicate.IS_NOT)
+
+
+def _is_movable(block: ssa.Block) -> bool:
+    return not (block.is_loop_header or block.is_loop_footer)
+
+
+def _is_local(block: ssa.Block) -> bool:
+    """Returns whether the parameters of block are only used by block"""
+    terminator = block.terminator
+    users: Set[ssa.User] = {block.entry, terminator, terminator.state}
+    users.update(terminator.edges)
+    return all(user in users for param in block.params for user in param.users)
+
+
+def thread_jumps(function: ssa.Function) -> bool:
+    """Redirect the predecessors of blocks that only jump to their successors.
+    Returns whether any were redirected.
+    """
+    changed = False
+    for block in function.blocks[1:]:
+        terminator = block.terminator
+        if block.instructions or not is_jump(terminator) or not _is_movable(block):
+            continue
+        out, = terminator.edges
+        if out.target is block or out.target.is_loop_header or not _is_local(block):
+            continue
+        for edge in list(block.predecessors):
+            args = dict(zip(block.params, edge.operands))
+            threaded = ssa.Edge(out.target, [args.get(value, value) for value in out.operands])
+            source = edge.source
+            threaded.source = source
+            edges = source.terminator.edges
+            edges[edges.index(edge)] = threaded
+            edge.remove()
+            changed = True
+    return changed
+
+
+def merge_blocks(function: ssa.Function) -> bool:
+    """Merge blocks into their only predecessors, when those jump to them.
+    Returns whether any were merged.
+    """
+    changed = False
+    for block in list(function.blocks):
+        if block not in function.blocks:
+            # Already merged into its predecessor
+            continue
+        while is_jump(block.terminator):
+            edge, = block.terminator.edges
+            succ = edge.target
+            if (succ is block or succ is function.entry or len(succ.predecessors) != 1 or
+                    not _is_movable(succ)):
+                break
+            for param, arg in zip(succ.params, edge.operands):
+                param.replace_all_uses_with(arg)
+            succ.params = []
+            succ.entry.drop_operands()
+            for instr in succ.instructions:
+                block.append(instr)
+            block.set_terminator(succ.terminator)
+            function.blocks.remove(succ)
+            changed = True
+    return changed
+
+
+def remove_dead_instructions(function: ssa.Function) -> bool:
+    """Remove the pure instructions whose results are unused. Returns whether
+    any were removed.
+    """
+    changed = False
+    worklist = [instr for block in function.blocks for instr in block.instructions]
+    while worklist:
+        instr = worklist.pop()
+        if instr.block is None or instr.users or not is_pure(instr):
+            continue
+        operands = instr.operands
+        instr.remove()
+        worklist.extend(value for value in operands if isinstance(value, ssa.Instruction))
+        changed = True
+    return changed
+
+
+def clean_up(function: ssa.Function) -> None:
+    """Simplify the control flow of function and remove dead code"""
+    changed = True
+    while changed:
+        changed = False
+        changed |= ssa.remove_unreachable_blocks(function)
+        changed |= thread_jumps(function)
+        changed |= merge_blocks(function)
+        changed |= remove_dead_instructions(function)
+        changed |= ssa.remove_trivial_params(function)
@@ -0,0 +1,258 @@
+"""Constant folding and propagation.
+
+SSA form propagates constants on its own: a constant that is stored into a
+local, or passed along an edge, is the same Constant value wherever it is
+used. This pass makes more values constant, until nothing changes:
+
+  - Globals that exist when the function is compiled are replaced by their
+    values. A GuardGlobal takes the place of each load, and deoptimizes if the
+    globals (or, for names that were found in the builtins, either dictionary)
+    have been modified since, which PEP 509 version tags make cheap to check.
+    Loads in inlined code, which cannot deoptimize, are left alone, as are all
+    of the loads in functions whose global guards have failed before: code
+    that modifies the globals of its module would otherwise never stop
+    deoptimizing.
+  - Operators, comparisons and `not` are evaluated when their operands are
+    constants of immutable builtin types, unless they raise or produce large
+    values (e.g. `'x' * 10**9`). `is` and `is not` are evaluated between any
+    constants.
+  - Conditional branches on constants become jumps, and blocks that are no
+    longer reachable are removed. Parameters that then receive the same value
+    along every edge are replaced by it, which may make more values constant.
+
+Together these remove code such as `if tracing: trace(...)` entirely, leaving
+only the guard on the globals.
+"""
+import operator
+import types as pytypes
+
+from typing import (
+    Any,
+    Callable,
+    Dict,
+    Iterable,
+    Optional,
+)
+
+from cinder import dict_version, ir, ssa
+
+
+# Types whose values are immutable and whose operators have no side effects
+FOLDABLE_TYPES = (type(None), bool, int, float, complex, str, bytes)
+
+# Types whose values are always true
+TRUE_TYPES = (type, pytypes.FunctionType, pytypes.BuiltinFunctionType)
+
+# Folded values that are larger than these are left to be computed at runtime
+MAX_INT_BITS = 128
+MAX_SEQUENCE_LENGTH = 4096
+
+BINARY_OPERATORS: Dict[ir.BinaryOperator, Callable[[Any, Any], Any]] = {
+    ir.BinaryOperator.POWER: operator.pow,
+    ir.BinaryOperator.MULTIPLY: operator.mul,
+    ir.BinaryOperator.FLOOR_DIVIDE: operator.floordiv,
+    ir.BinaryOperator.TRUE_DIVIDE: operator.truediv,
+    ir.BinaryOperator.MODULO: operator.mod,
+    ir.BinaryOperator.ADD: operator.add,
+    ir.BinaryOperator.SUBTRACT: operator.sub,
+    ir.BinaryOperator.LSHIFT: operator.lshift,
+    ir.BinaryOperator.RSHIFT: operator.rshift,
+    ir.BinaryOperator.AND: operator.and_,
+    ir.BinaryOperator.XOR: operator.xor,
+    ir.BinaryOperator.OR: operator.or_,
+}
+
+COMPARISONS: Dict[ir.ComparePredicate, Callable[[Any, Any], Any]] = {
+    ir.ComparePredicate.LT: operator.lt,
+    ir.ComparePredicate.LE: operator.le,
+    ir.ComparePredicate.EQ: operator.eq,
+    ir.ComparePredicate.NE: operator.ne,
+    ir.ComparePredicate.GT: operator.gt,
+    ir.ComparePredicate.GE: operator.ge,
+    ir.ComparePredicate.IN: lambda a, b: a in b,
+    ir.ComparePredicate.NOT_IN: lambda a, b: a not in b,
+}
+
+
+def is_foldable(value: Any) -> bool:
+    if value.__class__ is tuple:
+        return all(is_foldable(item) for item in value)
+    return value.__class__ in FOLDABLE_TYPES
+
+
+def is_small(value: Any) -> bool:
+    if value.__class__ is int:
+        return value.bit_length() <= MAX_INT_BITS
+    elif value.__class__ in (str, bytes, tuple):
+        return len(value) <= MAX_SEQUENCE_LENGTH
+    return True
+
+
+def _may_be_expensive(op: ir.BinaryOperator, left: Any, right: Any) -> bool:
+    """Returns whether evaluating op could take a long time because it produces
+    a large value, which would then not be folded anyway
+    """
+    if left.__class__ not in (int, bool) or right.__class__ not in (int, bool):
+        if op == ir.BinaryOperator.MULTIPLY:
+            # Repetition of a sequence
+            for seq, count in ((left, right), (right, left)):
+                if seq.__class__ in (str, bytes, tuple) and count.__class__ in (int, bool):
+                    return len(seq) * count > MAX_SEQUENCE_LENGTH
+        return False
+    if op == ir.BinaryOperator.POWER:
+        return right > 0 and left.bit_length() * right > MAX_INT_BITS
+    elif op == ir.BinaryOperator.LSHIFT:
+        return right > MAX_INT_BITS
+    return False
+
+
+def truth_value(value: Any) -> Optional[bool]:
+    """Returns the truth value of the constant value, if testing it has no side
+    effects
+    """
+    if value.__class__ in TRUE_TYPES:
+        return True
+    if is_foldable(value):
+        return bool(value)
+    return None
+
+
+class _Folder:
+    def __init__(
+        self,
+        function: ssa.Function,
+        globals: Optional[Dict[str, Any]],
+        builtins: Optional[Dict[str, Any]],
+    ) -> None:
+        self.function = function
+        self.globals = globals
+        self.builtins = builtins
+
+    def run(self) -> None:
+        function = self.function
+        changed = True
+        while changed:
+            changed = False
+            for block in function.blocks:
+                for instr in list(block.instructions):
+                    changed |= self.fold(instr)
+                changed |= self.fold_branch(block)
+            if ssa.remove_unreachable_blocks(function):
+                changed = True
+            if ssa.remove_trivial_params(function):
+                changed = True
+
+    def constant_operands(self, instr: ssa.Instruction) -> Optional[list]:
+        """Returns the values of the operands of instr if they are all constants"""
+        if not all(isinstance(value, ssa.Constant) for value in instr.operands):
+            return None
+        return [self.function.value_of(value) for value in instr.operands]
+
+    def replace(self, instr: ssa.Instruction, value: Any) -> bool:
+        instr.replace_all_uses_with(self.function.add_constant(value))
+        instr.remove()
+        return True
+
+    def fold(self, instr: ssa.Instruction) -> bool:
+        op = instr.op
+        if isinstance(op, ir.LoadGlobal) and self.globals is not None:
+            return self.fold_global(instr)
+        values = self.constant_operands(instr)
+        if values is None:
+            return False
+        if isinstance(op, ir.Compare):
+            left, right = values
+            if op.predicate == ir.ComparePredicate.IS:
+                return self.replace(instr, left is right)
+            elif op.predicate == ir.ComparePredicate.IS_NOT:
+                return self.replace(instr, left is not right)
+            elif is_foldable(left) and is_foldable(right):
+                return self.evaluate(instr, COMPARISONS[op.predicate], left, right)
+        elif isinstance(op, ir.BinaryOperation):
+            left, right = values
+            evaluate = BINARY_OPERATORS.get(op.operator, None)
+            if (evaluate is not None and is_foldable(left) and is_foldable(right) and
+                    not _may_be_expensive(op.operator, left, right)):
+                return self.evaluate(instr, evaluate, left, right)
+        elif isinstance(op, ir.UnaryOperation) and op.kind == ir.UnaryOperationKind.NOT:
+            truth = truth_value(values[0])
+            if truth is not None:
+                return self.replace(instr, not truth)
+        return False
+
+    def evaluate(
+        self,
+        instr: ssa.Instruction,
+        evaluate: Callable[[Any, Any], Any],
+        left: Any,
+        right: Any,
+    ) -> bool:
+        try:
+            value = evaluate(left, right)
+        except Exception:
+            # Left to raise at runtime
+            return False
+        if not is_foldable(value) or not is_small(value):
+            return False
+        return self.replace(instr, value)
+
+    def fold_global(self, load: ssa.Instruction) -> bool:
+        if load.offset is None:
+            return False
+        name = self.function.names[load.op.index]
+        if name in self.globals:
+            value = self.globals[name]
+            dicts = [self.globals]
+        elif self.builtins is not None and name in self.builtins:
+            value = self.builtins[name]
+            dicts = [self.globals, self.builtins]
+        else:
+            return False
+        guard_op = ir.GuardGlobal(name, [(d, dict_version(d)) for d in dicts])
+        guard_op.offset = load.offset
+        state = load.state
+        guard = ssa.Instruction(guard_op, [], ssa.FrameState(state.locals, state.stack))
+        load.block.insert_before(load, guard)
+        return self.replace(load, value)
+
+    def fold_branch(self, block: ssa.Block) -> bool:
+        terminator = block.terminator
+        if not isinstance(terminator.op, ir.ConditionalBranch):
+            return False
+        value = terminator.operands[0]
+        if not isinstance(value, ssa.Constant):
+            return False
+        truth = truth_value(self.function.value_of(value))
+        if truth is None:
+            return False
+        taken = terminator.edges[0 if truth else 1]
+        state = terminator.state
+        stack = state.stack[:-terminator.op.pops or None]
+        jump = ssa.Terminator(None, [], ssa.FrameState(state.locals, stack),
+                              [ssa.Edge(taken.target, taken.operands)])
+        block.set_terminator(jump)
+        return True
+
+
+def fold_constants(
+    function: ssa.Function,
+    globals: Optional[Dict[str, Any]] = None,
+    builtins: Optional[Dict[str, Any]] = None,
+    unstable_offsets: Iterable[int] = (),
+) -> None:
+    """Fold and propagate the constants in function.
+
+    function must have been built with its constant and name pools.
+
+    Args:
+        globals - The globals of the function, or None to leave global loads
+            alone
+        builtins - The builtins of the function
+        unstable_offsets - The offsets of instructions whose guards have failed
+    """
+    unstable = set(unstable_offsets)
+    if globals is not None and any(
+            isinstance(instr.op, ir.LoadGlobal) and instr.offset in unstable
+            for instr in function.instructions()):
+        globals = None
+    _Folder(function, globals, builtins).run()
@@ -0,0 +1,80 @@
+"""Allocation sinking for bound methods.
+
+`obj.method(args)` compiles to a LoadAttr, which allocates a bound method,
+and a Call of it, which unpacks the bound method again and frees it. The bound
+method never escapes: nothing but the call uses it. Inlining (see
+cinder.passes.inline) removes both for small methods. This pass handles the
+rest: when type feedback shows that the receiver's type resolves the attribute
+to a plain function (using the same conditions as inlining), the pair is
+replaced by
+
+  - a GuardMethod in place of the LoadAttr, which deoptimizes (and so
+    materializes the bound method in the interpreter) unless the attribute
+    still resolves to the function, and
+  - a Call of the function with the receiver as its first argument, which
+    needs no guard of its own.
+
+A value escapes if anything other than the instruction that consumes it uses
+it. Frame states count: if the bound method is on the stack when another
+instruction may deoptimize, the interpreter needs it. Since SSA form makes
+every use explicit, this only has to check that the call and its frame state
+are the only users of the LoadAttr. This also guarantees that nothing runs
+between the guard and the call, so the guard still holds when the call is
+made.
+
+Loads in inlined code are left alone, since they cannot deoptimize.
+"""
+from cinder import ir, ssa
+from cinder.passes import inline
+from cinder.profile import Profile
+
+
+def is_only_used_by(value: ssa.Value, instr: ssa.Instruction) -> bool:
+    """Returns whether instr (including its frame state) is the only user of value"""
+    return all(user is instr or user is instr.state for user in value.users)
+
+
+def sink_bound_method(function: ssa.Function, profile: Profile, call: ssa.Instruction) -> bool:
+    """Call the function that call's bound method wraps instead of creating it,
+    if possible. Returns whether call was replaced.
+    """
+    load = call.operands[0]
+    if not isinstance(load, ssa.Instruction) or not isinstance(load.op, ir.LoadAttr):
+        return False
+    if load.offset is None or call.operands.count(load) != 1 or not is_only_used_by(load, call):
+        return False
+    receivers = profile.operand_types(load.op)
+    if not receivers:
+        return False
+    name = function.names[load.op.index]
+    resolved = inline.resolve_method(receivers, name)
+    if resolved is None:
+        return False
+    method, versions = resolved
+    guard_op = ir.GuardMethod(name, method, method.__code__, versions)
+    guard_op.offset = load.offset
+    state = load.state
+    load.block.insert_before(load, ssa.Instruction(
+        guard_op, [], ssa.FrameState(state.locals, state.stack)))
+    call_op = ir.Call(call.op.num_args + 1, method)
+    call_op.offset = call.offset
+    operands = [function.add_constant(method), load.operands[0]] + call.operands[1:]
+    state = call.state
+    stack = state.stack[:len(state.stack) - len(call.operands)] + operands
+    direct = ssa.Instruction(call_op, operands, ssa.FrameState(state.locals, stack))
+    call.block.insert_before(call, direct)
+    call.replace_all_uses_with(direct)
+    call.remove()
+    load.remove()
+    return True
+
+
+def sink_allocations(function: ssa.Function, profile: Profile) -> None:
+    """Remove the allocations in function that do not escape.
+
+    function must have been built with its constant and name pools.
+    """
+    for block in function.blocks:
+        for instr in list(block.instructions):
+            if isinstance(instr.op, ir.Call) and instr.op.callee is None:
+                sink_bound_method(function, profile, instr)
@@ -0,0 +1,315 @@
+"""Guarded inlining of small functions into their callers.
+
+The cost of calling a small function (e.g. an accessor such as
+`def is_done(self): return self.done`) dwarfs the cost of its body. When type
+feedback identifies the function that a call invokes, its body is copied into
+the caller in place of the call:
+
+  - Calls that always invoke the same function object (e.g. a global function,
+    or a function accessed through a class as in `Task.run(task)`) are guarded
+    on the identity of the function.
+  - Method calls of the form `obj.method(args)`, where the receiver is one of a
+    handful of types that all resolve method to the same function, are guarded
+    on the type of the receiver. The bound method is never created.
+
+Both guards also check that the code of the function has not been replaced. If
+a guard fails the caller deoptimizes and the interpreter performs the call.
+Nothing inside an inlined body may deoptimize, since there is no interpreter
+frame for the callee to resume in, so codegen falls back to the generic path
+when a specialization in an inlined body does not apply.
+
+Inlined functions store their locals in slots that follow the caller's. The
+arguments are stored into them before the body runs and all of them are
+released once it returns. Constants and names that inlined instructions refer
+to are appended to those of the caller.
+"""
+import inspect
+import types as pytypes
+
+from types import CodeType
+from typing import (
+    Any,
+    Dict,
+    List,
+    Optional,
+    Tuple,
+)
+
+from cinder import bytecode, ir, type_version_tag
+from cinder.profile import Profile
+
+
+# Functions whose bytecode is longer than this many instructions are not inlined
+MAX_INLINE_SIZE = 20
+
+# Code flags of functions whose frames cannot be elided
+UNINLINABLE_FLAGS = (
+    inspect.CO_VARARGS |
+    inspect.CO_VARKEYWORDS |
+    inspect.CO_GENERATOR |
+    inspect.CO_COROUTINE |
+    inspect.CO_ITERABLE_COROUTINE |
+    inspect.CO_ASYNC_GENERATOR
+)
+
+# Instructions that may appear in the body of an inlined function. Calls are
+# excluded, which keeps inlining from recursing and ensures that inlined code
+# never needs to deoptimize on account of its callees.
+INLINABLE_INSTRUCTIONS = {
+    ir.BinaryOperation,
+    ir.Branch,
+    ir.Compare,
+    ir.ConditionalBranch,
+    ir.Load,
+    ir.LoadAttr,
+    ir.LoadGlobal,
+    ir.PopTop,
+    ir.ReturnValue,
+    ir.Store,
+    ir.StoreAttr,
+    ir.UnaryOperation,
+}
+
+
+class InlinedFunction:
+    """A function with calls replaced by the bodies of their callees"""
+
+    def __init__(
+        self,
+        cfg: ir.ControlFlowGraph,
+        num_locals: int,
+        consts: Tuple[Any, ...],
+        names: Tuple[str, ...],
+        profile: Profile,
+    ) -> None:
+        """
+        Args:
+            cfg - The body of the function
+            num_locals - The number of local variable slots used by the
+                function and its inlined callees
+            consts - The constants referenced by Load instructions
+            names - The names referenced by attribute and global instructions
+            profile - The type feedback for the function and its inlined
+                callees
+        """
+        self.cfg = cfg
+        self.num_locals = num_locals
+        self.consts = consts
+        self.names = names
+        self.profile = profile
+
+
+def inlinable_body(
+    func: Any,
+    globals: Dict[str, Any],
+) -> Optional[Tuple[CodeType, ir.ControlFlowGraph]]:
+    """Returns the code of func and its body if it may be inlined into a
+    function whose globals are globals.
+    """
+    if func.__class__ is not pytypes.FunctionType:
+        return None
+    code = func.__code__
+    if (code.co_flags & UNINLINABLE_FLAGS or code.co_kwonlyargcount or
+            code.co_cellvars or code.co_freevars):
+        return None
+    if len(code.co_code) // bytecode.INSTRUCTION_SIZE_B > MAX_INLINE_SIZE:
+        return None
+    try:
+        cfg = bytecode.disassemble(code.co_code)
+    except ValueError:
+        return None
+    for block in cfg.blocks.values():
+        for instr in block.instructions:
+            if instr.__class__ not in INLINABLE_INSTRUCTIONS:
+                return None
+            # Inlined global loads are performed against the caller's globals
+            if isinstance(instr, ir.LoadGlobal) and func.__globals__ is not globals:
+                return None
+    return code, cfg
+
+
+def resolve_method(receivers: Tuple[type, ...], name: str) -> Optional[Tuple[Any, List[Tuple[type, int]]]]:
+    """Returns the function that name resolves to on instances of all of
+    receivers, and the version tag of each receiver.
+
+    Returns None unless the function would be found on the type by every load
+    of name from an instance of a receiver whose instance dictionary does not
+    contain name, and the receivers store their instance dictionaries at the
+    same offset.
+    """
+    method = None
+    versions = []
+    for typ in receivers:
+        if typ.__getattribute__ is not object.__getattribute__:
+            return None
+        if typ.__dictoffset__ < 0 or typ.__dictoffset__ != receivers[0].__dictoffset__:
+            return None
+        # The tag is read before the lookup so that changes to the type that race
+        # with the lookup invalidate it
+        version = type_version_tag(typ)
+        if version is None:
+            return None
+        found = next((klass.__dict__[name] for klass in typ.__mro__ if name in klass.__dict__), None)
+        if found.__class__ is not pytypes.FunctionType or method not in (None, found):
+            return None
+        method = found
+        versions.append((typ, version))
+    if method is None:
+        return None
+    return method, versions
+
+
+class _Inliner:
+    def __init__(self, func: Any, cfg: ir.ControlFlowGraph, profile: Profile) -> None:
+        self.func = func
+        self.cfg = cfg
+        self.profile = profile
+        code = func.__code__
+        self.consts = list(code.co_consts)
+        self.names = list(code.co_names)
+        self.num_locals = code.co_nlocals
+        # Feedback for the inlined instructions
+        self.inlined_sites: Dict[ir.Instruction, Any] = {}
+        self.num_sites = 0
+
+    def find_callee(
+        self,
+        instrs: List[ir.Instruction],
+        index: int,
+    ) -> Optional[Tuple[int, Any, ir.ControlFlowGraph]]:
+        """Determine whether the call at instrs[index] can be inlined.
+
+        Returns:
+            The index of the first instruction that must be replaced, the guard
+            that protects the inlined body, and the body.
+        """
+        call = instrs[index]
+        globals = self.func.__globals__
+        callee = self.profile.callee(call)
+        inlinable = inlinable_body(callee, globals)
+        if inlinable is not None and inlinable[0].co_argcount == call.num_args:
+            code, body = inlinable
+            return index, ir.GuardCallee(call.num_args, callee, code), body
+        # Method calls load the method and then push the arguments. Arguments are
+        # restricted to simple loads, since the stack holds the receiver rather
+        # than the bound method in between.
+        start = index - call.num_args - 1
+        if start < 0 or not isinstance(instrs[start], ir.LoadAttr):
+            return None
+        if not all(isinstance(instr, ir.Load) for instr in instrs[start + 1:index]):
+            return None
+        load = instrs[start]
+        receivers = self.profile.operand_types(load)
+        if not receivers:
+            return None
+        name = self.names[load.index]
+        resolved = resolve_method(receivers, name)
+        if resolved is None:
+            return None
+        method, versions = resolved
+        inlinable = inlinable_body(method, globals)
+        if inlinable is None or inlinable[0].co_argcount != call.num_args + 1:
+            return None
+        code, body = inlinable
+        return start, ir.GuardMethod(name, method, code, versions), body
+
+    def inline(self, code: CodeType, body: ir.ControlFlowGraph, cont: ir.Label) -> List[ir.BasicBlock]:
+        """Copy body, which was disassembled from code, into the caller.
+
+        Returns:
+            The blocks of the body, which branch to cont when the function
+            returns.
+        """
+        self.num_sites += 1
+        callee_profile = Profile.from_code(code)
+        base_local = self.func.__code__.co_nlocals
+        self.num_locals = max(self.num_locals, base_local + code.co_nlocals)
+        base_const = len(self.consts)
+        self.consts.extend(code.co_consts)
+        base_name = len(self.names)
+        self.names.extend(code.co_names)
+
+        def label(name: ir.Label) -> ir.Label:
+            return f'{name}.inline{self.num_sites}'
+
+        blocks = []
+        for block in body.blocks.values():
+            instrs = []
+            for instr in block.instructions:
+                site = callee_profile.sites.get(instr.offset, None)
+                if isinstance(instr, ir.ReturnValue):
+                    # The return value is left on the stack
+                    instr = ir.Branch(cont)
+                elif isinstance(instr, ir.Branch):
+                    instr.target = label(instr.target)
+                elif isinstance(instr, ir.ConditionalBranch):
+                    instr.true_branch = label(instr.true_branch)
+                    instr.false_branch = label(instr.false_branch)
+                elif isinstance(instr, ir.Load) and instr.pool == ir.VarPool.LOCALS:
+                    instr.index += base_local
+                elif isinstance(instr, ir.Load):
+                    instr.index += base_const
+                elif isinstance(instr, ir.Store):
+                    instr.index += base_local
+                elif isinstance(instr, (ir.LoadAttr, ir.StoreAttr, ir.LoadGlobal)):
+                    instr.index += base_name
+                # The offset refers to the callee's code
+                instr.offset = None
+                if site is not None:
+                    self.inlined_sites[instr] = site
+                instrs.append(instr)
+            blocks.append(ir.BasicBlock(label(block.label), instrs))
+        return blocks
+
+    def run(self) -> InlinedFunction:
+        blocks = []
+        for block in self.cfg.blocks.values():
+            label = block.label
+            instrs = list(block.instructions)
+            is_loop_header = block.is_loop_header
+            index = 0
+            while index < len(instrs):
+                found = None
+                if isinstance(instrs[index], ir.Call):
+                    found = self.find_callee(instrs, index)
+                if found is None:
+                    index += 1
+                    continue
+                start, guard, body = found
+                guard.offset = instrs[start].offset
+                num_args = guard.code.co_argcount
+                base = self.func.__code__.co_nlocals
+                if isinstance(guard, ir.GuardCallee):
+                    # Store the arguments, which were pushed in order, and discard the function
+                    call_site = [guard]
+                    call_site.extend(ir.Store(base + i) for i in reversed(range(num_args)))
+                    call_site.append(ir.PopTop())
+                else:
+                    # The receiver is the first argument
+                    call_site = [guard]
+                    call_site.extend(instrs[start + 1:index])
+                    call_site.extend(ir.Store(base + i) for i in reversed(range(num_args)))
+                cont = f'{block.label}.cont{self.num_sites + 1}'
+                inlined = self.inline(guard.code, body, cont)
+                call_site.append(ir.Branch(inlined[0].label))
+                blocks.append(ir.BasicBlock(label, instrs[:start] + call_site, is_loop_header))
+                blocks.extend(inlined)
+                label = cont
+                instrs = [ir.ClearLocals(base, guard.code.co_nlocals)] + instrs[index + 1:]
+                is_loop_header = False
+                index = 1
+            blocks.append(ir.BasicBlock(label, instrs, is_loop_header, block.is_loop_footer))
+        return InlinedFunction(
+            ir.build_initial_cfg(blocks),
+            self.num_locals,
+            tuple(self.consts),
+            tuple(self.names),
+            self.profile.with_inlined(self.inlined_sites),
+        )
+
+
+def inline_calls(func: Any, cfg: ir.ControlFlowGraph, profile: Profile) -> InlinedFunction:
+    """Inline the callees of the calls in cfg, the body of func, that type
+    feedback in profile identifies.
+    """
+    return _Inliner(func, cfg, profile).run()
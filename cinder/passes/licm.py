@@ -0,0 +1,176 @@
+"""Loop-invariant code motion for guards and attribute loads.
+
+Specialized code is full of checks that cannot change from one iteration of a
+loop to the next: the GuardGlobals that protect folded globals (e.g. the
+`tracing` flag in `while ...: if tracing: ...`), and the type and version
+checks of attribute loads from the instance dictionary of an object that the
+loop never replaces. This pass moves them into the loop's preheader, so that
+they run once per entry to the loop rather than once per iteration.
+
+Both are only invariant if nothing in the loop may modify the globals, a type,
+or an instance dictionary. Calls, stores and most operators may run arbitrary
+Python code, so loops that contain any instruction that cinder.analysis.effects
+cannot rule out are left alone. Within a loop that qualifies, this pass hoists
+
+  - every GuardGlobal, and
+  - every LoadAttr that codegen specializes into a guarded read of the
+    instance dictionary, whose receiver is defined outside of the loop. Loads
+    of the same attribute from the same receiver share one hoisted load.
+
+Only the instructions that run on every iteration, i.e. those in blocks that
+dominate every back edge, are hoisted, so that a check on a path that is rarely
+taken does not deoptimize the whole loop.
+
+A hoisted instruction deoptimizes at the start of the loop header, with the
+frame state that the preheader passes to it, which is always a state that the
+interpreter can resume in. Loads become SpeculativeLoadAttrs, which discard
+their receiver before deoptimizing. If this happens often enough for the
+function to be recompiled, the header's offset is unstable and its loop is
+left alone from then on.
+
+The preheader is the only block outside of the loop that jumps to the header.
+Loops without one (e.g. those entered from several places) and loops in
+inlined code, where the interpreter cannot resume, are left alone.
+"""
+from typing import (
+    Dict,
+    Iterable,
+    Optional,
+    Set,
+    Tuple,
+)
+
+from cinder import ir, ssa
+from cinder.analysis import loops
+from cinder.analysis.effects import Effects, guarded_receiver
+from cinder.analysis.loops import Loop, LoopForest
+from cinder.profile import Profile
+
+
+def preheader_edge(loop: Loop) -> Optional[ssa.Edge]:
+    """Returns the edge into the header of loop from its preheader, if it has one"""
+    header = loop.header
+    if header.offset is None:
+        return None
+    entries = [edge for edge in header.predecessors if edge.source not in loop]
+    if len(entries) != 1:
+        return None
+    edge, = entries
+    terminator = edge.source.terminator
+    if len(terminator.edges) != 1 or not (terminator.op is None or
+                                          isinstance(terminator.op, ir.Branch)):
+        return None
+    return edge
+
+
+def is_invariant(value: ssa.Value, loop: Loop) -> bool:
+    """Returns whether value is defined outside of loop"""
+    if isinstance(value, ssa.Constant):
+        return True
+    elif isinstance(value, (ssa.Instruction, ssa.Parameter)):
+        return value.block is not None and value.block not in loop
+    return False
+
+
+def speculation(
+    instr: ssa.Instruction,
+    profile: Profile,
+    names: Iterable[str],
+) -> Optional[Tuple[type, int]]:
+    """Returns the receiver type and version tag that the load instr is
+    specialized for, if codegen reads the attribute from the instance dictionary
+    and deoptimizes when its guards fail
+    """
+    op = instr.op
+    if isinstance(op, ir.SpeculativeLoadAttr):
+        return op.receiver, op.version
+    elif isinstance(op, ir.LoadAttr) and instr.offset is not None:
+        return guarded_receiver(op, profile, tuple(names))
+    return None
+
+
+def hoist_loop(
+    function: ssa.Function,
+    profile: Profile,
+    forest: LoopForest,
+    loop: Loop,
+    effects: Effects,
+) -> bool:
+    """Hoist the invariant guards and loads of loop into its preheader. Returns
+    whether anything was hoisted.
+    """
+    edge = preheader_edge(loop)
+    if edge is None:
+        return False
+    blocks = [block for block in function.blocks if block in loop]
+    for block in blocks:
+        if any(effects.may_write(instr) for instr in block.instructions + [block.terminator]):
+            return False
+    dominators = forest.dominators
+    preheader = edge.source
+    offset = loop.header.offset
+    locals, stack = edge.state()
+    guards: Set[str] = set()
+    loads: Dict[Tuple[ssa.Value, int], ssa.Instruction] = {}
+    hoisted = False
+    for block in blocks:
+        if not all(dominators.dominates(block, latch) for latch in loop.latches):
+            continue
+        for instr in list(block.instructions):
+            op = instr.op
+            if isinstance(op, ir.GuardGlobal):
+                if op.name not in guards:
+                    guard_op = ir.GuardGlobal(op.name, op.versions)
+                    guard_op.offset = offset
+                    preheader.append(ssa.Instruction(guard_op, [], ssa.FrameState(locals, stack)))
+                    guards.add(op.name)
+                instr.remove()
+                hoisted = True
+                continue
+            if not isinstance(op, ir.LoadAttr) or not is_invariant(instr.operands[0], loop):
+                continue
+            speculated = speculation(instr, profile, function.names)
+            if speculated is None:
+                continue
+            receiver = instr.operands[0]
+            key = (receiver, op.index)
+            load = loads.get(key, None)
+            if load is None:
+                load_op = ir.SpeculativeLoadAttr(op.index, *speculated)
+                load_op.offset = offset
+                load = ssa.Instruction(load_op, [receiver],
+                                       ssa.FrameState(locals, stack + [receiver]))
+                preheader.append(load)
+                loads[key] = load
+            instr.replace_all_uses_with(load)
+            instr.remove()
+            hoisted = True
+    return hoisted
+
+
+def hoist_invariants(
+    function: ssa.Function,
+    profile: Profile,
+    unstable_offsets: Iterable[int] = (),
+) -> None:
+    """Hoist the loop-invariant guards and attribute loads in function.
+
+    function must have been built with its constant and name pools.
+
+    Args:
+        unstable_offsets - The offsets of instructions whose guards have failed.
+            Loops whose headers are among them are left alone.
+    """
+    unstable = set(unstable_offsets)
+    forest = loops.analyze(function)
+    effects: Optional[Effects] = None
+    # Inner loops come first, so that what they hoist may be hoisted again out of
+    # the loops that contain them
+    for loop in reversed(forest.loops):
+        if loop.header.offset in unstable or preheader_edge(loop) is None:
+            continue
+        if effects is None:
+            effects = Effects(function, profile)
+        if hoist_loop(function, profile, forest, loop, effects):
+            # The hoisted loads have no types yet
+            effects = None
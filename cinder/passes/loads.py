@@ -0,0 +1,93 @@
+"""Redundant attribute load elimination.
+
+Methods tend to read the same attributes of `self` over and over, e.g.
+`self.x * self.x + self.y * self.y`. When type feedback shows a single receiver
+type, each of those loads is a guard on the receiver's type and version tag
+followed by a lookup in its instance dictionary. This pass reuses the result of
+the first load for the ones that follow it.
+
+A load is redundant if an earlier load of the same attribute from the same
+receiver is available. Receivers are compared as SSA values, so loads through
+different locals that hold the same object match. The earlier load is
+available if
+
+  - it is a guarded read of the instance dictionary (see
+    cinder.analysis.effects). Generic loads may go through descriptors, such as
+    properties, that produce a new value each time, and
+  - nothing between the two loads may modify any object. Stores, calls, and
+    anything else that cinder.analysis.effects cannot rule out make every
+    earlier load unavailable.
+
+If the guards of the earlier load failed, the function deoptimized before it
+reached the later one, so the later load needs no guards of its own: it is
+removed, and its uses refer to the earlier load instead.
+
+Loads remain available to the end of their extended basic block: the blocks
+that are only reachable through the one they are in, along a chain of blocks
+that each have a single predecessor. Blocks where control flow merges start
+with nothing available.
+"""
+from typing import (
+    Dict,
+    Tuple,
+)
+
+from cinder import ir, ssa
+from cinder.analysis import dominators
+from cinder.analysis.effects import Effects
+from cinder.profile import Profile
+
+
+# Maps the receiver and name index of each available load to the load
+Available = Dict[Tuple[ssa.Value, int], ssa.Instruction]
+
+
+def forward_block(block: ssa.Block, available: Available, effects: Effects) -> int:
+    """Replace the loads in block that are available, updating available with
+    what is available at the end of block. Returns the number of loads removed.
+    """
+    removed = 0
+    for instr in list(block.instructions):
+        op = instr.op
+        if isinstance(op, ir.LoadAttr) and not isinstance(op, ir.SpeculativeLoadAttr):
+            key = (instr.operands[0], op.index)
+            earlier = available.get(key, None)
+            if earlier is not None:
+                instr.replace_all_uses_with(earlier)
+                instr.remove()
+                removed += 1
+                continue
+        if effects.may_write(instr):
+            available.clear()
+        elif isinstance(op, ir.LoadAttr):
+            available[(instr.operands[0], op.index)] = instr
+    if effects.may_write(block.terminator):
+        available.clear()
+    return removed
+
+
+def forward_loads(function: ssa.Function, profile: Profile) -> int:
+    """Remove the attribute loads in function whose results are available from
+    earlier loads. Returns the number of loads removed.
+
+    function must have been built with its constant and name pools.
+    """
+    keys = [(instr.operands[0], instr.op.index) for instr in function.instructions()
+            if isinstance(instr.op, ir.LoadAttr)]
+    if len(set(keys)) == len(keys):
+        # Nothing is loaded twice
+        return 0
+    effects = Effects(function, profile)
+    tree = dominators.analyze(function)
+    at_exit: Dict[ssa.Block, Available] = {}
+    removed = 0
+    # Predecessors come before their successors, apart from back edges, which
+    # only enter blocks where control flow merges
+    for block in tree.order:
+        available: Available = {}
+        if len(block.predecessors) == 1:
+            source = block.predecessors[0].source
+            available = dict(at_exit.get(source, {}))
+        removed += forward_block(block, available, effects)
+        at_exit[block] = available
+    return removed
@@ -0,0 +1,150 @@
+"""Pipelines of transformations over SSA form.
+
+A PassManager runs a fixed sequence of passes over each function that it is
+given, and keeps statistics across the functions that it has run on: how often
+each pass ran, the time spent in it, and the number of instructions before and
+after it. These are what to look at when compile times grow or an optimization
+stops paying off.
+
+Passes are functions of the SSA form and a Context, which carries what passes
+may need to know about the function beyond its code (its globals, type
+feedback, and so on). A pass ignores whatever it does not need.
+
+The function can be printed after any pass, by passing the names of the
+passes to dump to the PassManager, or for every PassManager at once with the
+CINDER_DUMP_IR environment variable (see `set_dump_ir`), e.g.
+
+    CINDER_DUMP_IR=constants,cleanup python bm_richards.py --use-jit
+
+`all` dumps after every pass, and `input` dumps the function before the first
+pass. Dumps go to stderr.
+"""
+import os
+import sys
+import time
+
+from typing import (
+    Any,
+    Callable,
+    Dict,
+    FrozenSet,
+    Iterable,
+    List,
+    NamedTuple,
+    Optional,
+    TextIO,
+)
+
+from cinder import ssa
+from cinder.profile import Profile
+
+
+class Context(NamedTuple):
+    """What passes may know about the function being compiled"""
+    # The function object whose code is being compiled
+    func: Any
+    # The globals and builtins that the function's code refers to. Passes that
+    # specialize on their contents (see cinder.passes.constants) do nothing if
+    # globals is None.
+    globals: Optional[Dict[str, Any]]
+    builtins: Optional[Dict[str, Any]]
+    profile: Profile
+    # The offsets of the instructions whose guards have failed before
+    unstable_offsets: FrozenSet[int] = frozenset()
+
+
+class Pass(NamedTuple):
+    name: str
+    run: Callable[[ssa.Function, Context], Any]
+
+
+class PassStatistics:
+    """Totals for a pass over every function that it has run on"""
+
+    def __init__(self, name: str) -> None:
+        self.name = name
+        self.runs = 0
+        self.seconds = 0.0
+        self.instructions_before = 0
+        self.instructions_after = 0
+
+    def __str__(self) -> str:
+        return (f'{self.name:<16} {self.runs:>6} {self.seconds * 1000:>10.2f} '
+                f'{self.instructions_before:>10} {self.instructions_after:>10}')
+
+
+def count_instructions(function: ssa.Function) -> int:
+    """Returns the number of instructions in function, including terminators"""
+    return sum(len(block.instructions) + 1 for block in function.blocks)
+
+
+def parse_dump_names(spec: str) -> FrozenSet[str]:
+    """Returns the pass names in spec, a comma separated list"""
+    return frozenset(name.strip() for name in spec.split(',') if name.strip())
+
+
+# The passes that every PassManager dumps after
+_dump_ir = parse_dump_names(os.environ.get('CINDER_DUMP_IR', ''))
+
+
+def set_dump_ir(names: Iterable[str]) -> None:
+    """Dump the function after the passes in names in every PassManager. This
+    overrides the CINDER_DUMP_IR environment variable.
+    """
+    global _dump_ir
+    _dump_ir = frozenset(names)
+
+
+class PassManager:
+    def __init__(
+        self,
+        passes: Iterable[Pass],
+        dump: Iterable[str] = (),
+        out: Optional[TextIO] = None,
+    ) -> None:
+        """
+        Args:
+            dump - The names of the passes after which to print the function, in
+                addition to those given by CINDER_DUMP_IR
+            out - Where to print dumps. Defaults to stderr.
+        """
+        self.passes: List[Pass] = list(passes)
+        self.dump = frozenset(dump)
+        self.out = out
+        self.statistics: Dict[str, PassStatistics] = {
+            p.name: PassStatistics(p.name) for p in self.passes
+        }
+
+    def should_dump(self, name: str) -> bool:
+        names = self.dump | _dump_ir
+        return name in names or 'all' in names
+
+    def dump_function(self, function: ssa.Function, context: Context, name: str) -> None:
+        out = self.out or sys.stderr
+        qualname = getattr(context.func, '__qualname__', '<unknown>')
+        print(f'-- {qualname} after {name} --', file=out)
+        print(function, file=out)
+
+    def run(self, function: ssa.Function, context: Context) -> None:
+        """Run each pass over function, in order"""
+        if self.should_dump('input'):
+            self.dump_function(function, context, 'input')
+        for p in self.passes:
+            stats = self.statistics[p.name]
+            stats.runs += 1
+            stats.instructions_before += count_instructions(function)
+            start = time.perf_counter()
+            p.run(function, context)
+            stats.seconds += time.perf_counter() - start
+            stats.instructions_after += count_instructions(function)
+            if self.should_dump(p.name):
+                self.dump_function(function, context, p.name)
+
+    def reset_statistics(self) -> None:
+        self.statistics = {p.name: PassStatistics(p.name) for p in self.passes}
+
+    def report(self) -> str:
+        """Returns a table of the statistics for each pass"""
+        lines = [f'{"pass":<16} {"runs":>6} {"ms":>10} {"before":>10} {"after":>10}']
+        lines.extend(str(stats) for stats in self.statistics.values())
+        return '\n'.join(lines)
@@ -0,0 +1,116 @@
+"""Policies that decide when the cinder interpreter compiles code.
+
+A policy is passed to `cinder.install_interpreter`. While it is installed, the
+interpreter records type feedback, counts the calls to each function and the
+back edges taken to each loop header, and asks the policy to compile code once
+it crosses the policy's thresholds. Compiled functions are stored against their
+code objects, so later calls go straight to machine code without the caller
+having to replace anything. Code that fails to compile is never retried.
+
+Only code that may still be compiled is profiled: code that the policy does not
+allow, and code that has been compiled or has failed to, runs without recording
+type feedback, as does any code once it has been profiled for a bounded number
+of calls (see src/profile.h).
+
+Compilation may be moved off the threads that run Python code by using a
+background policy, which queues it on a cinder.compile_queue.CompileQueue.
+"""
+from types import (
+    CodeType,
+    FunctionType,
+)
+from typing import (
+    Any,
+    Dict,
+    Iterable,
+    Optional,
+)
+
+from cinder import JitFunction
+from cinder.codegen import x64
+from cinder.compile_queue import CompileQueue
+
+
+class Policy:
+    """Compile hot functions and loops using cinder.codegen.x64"""
+
+    def __init__(
+        self,
+        call_threshold: Optional[int] = 1000,
+        loop_threshold: Optional[int] = 1000,
+        modules: Optional[Iterable[str]] = None,
+        background: bool = False,
+        compile_budget: Optional[float] = None,
+        tier: str = x64.DEFAULT_TIER,
+    ) -> None:
+        """
+        Args:
+            call_threshold - The number of calls after which a function is
+                compiled, or None to never compile functions when they are
+                called.
+            loop_threshold - The number of back edges to a loop header after
+                which a running loop is continued in compiled code, or None to
+                leave running loops in the interpreter.
+            modules - The names of the modules whose code may be compiled, or
+                None to compile code from any module.
+            background - Compile on a worker thread instead of the thread
+                that made the code hot.
+            compile_budget - The maximum number of seconds per second that
+                the worker may spend compiling. Only used in the background.
+            tier - The pipeline (see cinder.codegen.x64.PIPELINES) that code
+                is optimized with.
+        """
+        self.call_threshold = call_threshold
+        self.loop_threshold = loop_threshold
+        self.modules = None if modules is None else frozenset(modules)
+        self.tier = tier
+        self.queue: Optional[CompileQueue] = None
+        if background:
+            self.queue = CompileQueue(compile_budget)
+
+    def allows(self, globals: Dict[str, Any]) -> bool:
+        """Returns whether code running against globals may be compiled.
+
+        Called by the interpreter the first time that it runs each code object.
+        """
+        return self.modules is None or globals.get('__name__') in self.modules
+
+    def compile(self, code: CodeType, globals: Dict[str, Any]) -> Any:
+        """Called by the interpreter once code is hot.
+
+        Returns None if code cannot be compiled, or cinder.PENDING if it has
+        been queued.
+        """
+        if not self.allows(globals):
+            return None
+        if self.queue is not None:
+            return self.queue.submit(lambda: self.compile_function(code, globals), code)
+        return self.compile_function(code, globals)
+
+    def compile_function(self, code: CodeType, globals: Dict[str, Any]) -> Optional[JitFunction]:
+        # Closures cannot be rebuilt from their code and globals alone
+        if code.co_freevars:
+            return None
+        try:
+            return x64.compile(FunctionType(code, globals), tier=self.tier)
+        except ValueError:
+            return None
+
+    def compile_osr(
+        self,
+        code: CodeType,
+        globals: Dict[str, Any],
+        offset: int,
+    ) -> Any:
+        """Called by the interpreter once the loop whose header is at offset is
+        hot.
+
+        Returns None if the loop cannot be compiled, or cinder.PENDING if it has
+        been queued.
+        """
+        if not self.allows(globals):
+            return None
+        if self.queue is not None:
+            return self.queue.submit(
+                lambda: x64.osr_handler(code, globals, offset, self.tier), code, offset)
+        return x64.osr_handler(code, globals, offset, self.tier)
@@ -0,0 +1,119 @@
+"""Type feedback recorded by the cinder interpreter loop.
+
+When profiling is enabled (see `cinder.enable_profiling`), the interpreter
+records the following for each code object that it executes:
+
+  - The types of the receiver of LOAD_ATTR and STORE_ATTR.
+  - The types of both operands of binary operations and comparisons.
+  - The callees of CALL_FUNCTION.
+  - How often each conditional branch is taken.
+
+Only a handful of distinct types (or callees) are recorded per operand. Once
+more are seen the operand is considered megamorphic and nothing more is
+recorded for it.
+"""
+from types import CodeType
+from typing import (
+    Any,
+    Dict,
+    Iterable,
+    Optional,
+    Tuple,
+)
+
+import cinder
+
+from cinder import ir
+
+
+# Recorded values for a single operand, or None if it is megamorphic
+OperandValues = Optional[Tuple[Any, ...]]
+
+
+class Profile:
+    """The feedback recorded for a code object, keyed by IR instruction"""
+
+    def __init__(
+        self,
+        sites: Optional[Dict[int, Any]] = None,
+        inlined: Optional[Dict[ir.Instruction, Any]] = None,
+    ) -> None:
+        """
+        Args:
+            sites - Maps bytecode offsets to the values recorded for the
+                instruction at that offset, as returned by cinder.get_profile
+            inlined - Maps instructions that were inlined from other functions
+                to the values recorded for them. Their offsets refer to the
+                code of the inlined function, so they are keyed by identity.
+        """
+        self.sites = sites or {}
+        self.inlined = inlined or {}
+
+    @classmethod
+    def from_code(cls, code: CodeType) -> 'Profile':
+        return cls(cinder.get_profile(code))
+
+    def _site(self, instr: ir.Instruction) -> Any:
+        if instr.offset is None:
+            return self.inlined.get(instr, None)
+        return self.sites.get(instr.offset, None)
+
+    def operand_types(self, instr: ir.Instruction, operand: int = 0) -> OperandValues:
+        """Returns the types observed for an operand of instr.
+
+        Operands are numbered from the bottom of the stack, so 0 is the left
+        hand side of a binary operation. Returns None if instr has not executed
+        or the operand is megamorphic.
+        """
+        site = self._site(instr)
+        if site is None or operand >= len(site):
+            return None
+        return site[operand]
+
+    def monomorphic_type(self, instr: ir.Instruction, operand: int = 0) -> Optional[type]:
+        """Returns the only type observed for an operand of instr, if any"""
+        types = self.operand_types(instr, operand)
+        if types is None or len(types) != 1:
+            return None
+        return types[0]
+
+    def may_be(self, instr: ir.Instruction, operand: int, typ: type) -> bool:
+        """Returns whether an operand of instr may be an instance of typ.
+
+        This is conservative: operands without feedback may be anything.
+        """
+        types = self.operand_types(instr, operand)
+        return types is None or typ in types
+
+    def callee(self, instr: ir.Call) -> Any:
+        """Returns the only callee observed for instr, if any"""
+        callees = self._site(instr)
+        if callees is None or len(callees) != 1:
+            return None
+        return callees[0]
+
+    def without(self, offsets: Iterable[int]) -> 'Profile':
+        """Returns a copy of the profile that has no feedback for the
+        instructions at offsets.
+        """
+        excluded = set(offsets)
+        return Profile({
+            offset: site for offset, site in self.sites.items()
+            if offset not in excluded
+        }, self.inlined)
+
+    def with_inlined(self, sites: Dict[ir.Instruction, Any]) -> 'Profile':
+        """Returns a copy of the profile that includes the feedback for
+        instructions inlined from other functions.
+        """
+        return Profile(self.sites, {**self.inlined, **sites})
+
+    def branch_counts(self, instr: ir.ConditionalBranch) -> Optional[Tuple[int, int]]:
+        """Returns how often instr branched to its true and false successors"""
+        counts = self._site(instr)
+        if counts is None:
+            return None
+        taken, not_taken = counts
+        if instr.jump_when_true:
+            return taken, not_taken
+        return not_taken, taken
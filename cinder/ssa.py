@@ -0,0 +1,866 @@
+"""Static single assignment (SSA) form.
+
+Instructions in the stack IR (cinder.ir) communicate through an implicit
+operand stack and the local variable slots, just as bytecode does. Anything
+that transforms it has to reason about stack positions: finding the operands of
+an instruction means replaying the stack effects of everything before it,
+possibly across blocks, and replacing an instruction means keeping the stack
+balanced around it.
+
+In SSA form every value is defined exactly once, and instructions name the
+values that they operate on:
+
+  - Loads of locals and constants, stores into locals, and the pops that
+    discard values disappear. A load is replaced by the value that the local or
+    constant holds, and a store changes which value the local refers to from
+    then on.
+  - Where control flow merges with different values in a local or a stack
+    slot, the block that it merges into takes a parameter, and each predecessor
+    passes the value that it has as an argument (this is equivalent to a phi).
+  - Each value keeps a list of its users, so that every use of a value can be
+    found, and replaced, without a search.
+
+When code deoptimizes, the interpreter still needs to know what is in each
+local and on the stack. Each instruction records this in its frame state: the
+values that are in the locals and on the operand stack immediately before it
+executes. Frame states are users of the values that they contain, so replacing
+a value updates them too.
+
+Frame states also allow SSA form to be converted back into the stack IR (see
+`lower`), which is how the backends consume it. Before each instruction, values
+are loaded, stored and popped until the locals and the stack match its frame
+state. Lowering a function that has not been transformed reproduces the stack
+IR that it was built from. A value that is no longer in a local or on the stack
+when it is needed is kept in a temporary: an extra local slot following those
+of the function.
+"""
+import collections
+
+from typing import (
+    Any,
+    Deque,
+    Dict,
+    Iterable,
+    Iterator,
+    List,
+    NamedTuple,
+    Optional,
+    Set,
+    Tuple,
+)
+
+from cinder import ir
+from cinder.analysis import stack as stack_analysis
+
+
+class Value:
+    """Anything that may be the operand of an instruction"""
+
+    def __init__(self) -> None:
+        # The users of the value, once for each time that they use it
+        self.users: List['User'] = []
+
+    def replace_all_uses_with(self, value: 'Value') -> None:
+        for user in list(self.users):
+            user.replace_operand(self, value)
+
+
+class Constant(Value):
+    """An entry in the constant pool of the function"""
+
+    def __init__(self, index: int) -> None:
+        super().__init__()
+        self.index = index
+
+    def __str__(self) -> str:
+        return f'const{self.index}'
+
+
+class Undefined(Value):
+    """The contents of a local that has been cleared (NULL)"""
+
+    def __str__(self) -> str:
+        return 'undefined'
+
+
+class Parameter(Value):
+    """A value that is passed to a block by each of its predecessors"""
+
+    def __init__(self, block: 'Block') -> None:
+        super().__init__()
+        self.block = block
+
+
+class User:
+    """Anything that refers to values"""
+
+    def __init__(self, operands: Iterable[Value]) -> None:
+        self.operands: List[Value] = []
+        for value in operands:
+            self.add_operand(value)
+
+    def add_operand(self, value: Value) -> None:
+        self.operands.append(value)
+        value.users.append(self)
+
+    def set_operand(self, index: int, value: Value) -> None:
+        self.operands[index].users.remove(self)
+        self.operands[index] = value
+        value.users.append(self)
+
+    def remove_operand(self, index: int) -> None:
+        self.operands.pop(index).users.remove(self)
+
+    def replace_operand(self, old: Value, new: Value) -> None:
+        """Replace every use of old by this with new"""
+        for index, value in enumerate(self.operands):
+            if value is old:
+                self.set_operand(index, new)
+
+    def drop_operands(self) -> None:
+        for value in self.operands:
+            value.users.remove(self)
+        self.operands = []
+
+
+class FrameState(User):
+    """The values in the locals and on the operand stack (from the bottom up) at
+    some point in the function
+    """
+
+    def __init__(self, locals: Iterable[Value], stack: Iterable[Value]) -> None:
+        locals = list(locals)
+        super().__init__(locals + list(stack))
+        self.num_locals = len(locals)
+
+    @property
+    def locals(self) -> List[Value]:
+        return self.operands[:self.num_locals]
+
+    @property
+    def stack(self) -> List[Value]:
+        return self.operands[self.num_locals:]
+
+
+class Instruction(Value, User):
+    """An instruction of the stack IR, with explicit operands.
+
+    The operands are the values that op pops, from the bottom of the stack up.
+    Instructions whose op pushes a value are that value.
+    """
+
+    def __init__(
+        self,
+        op: Optional[ir.Instruction],
+        operands: Iterable[Value],
+        state: FrameState,
+    ) -> None:
+        """
+        Args:
+            op - The stack IR instruction, which carries the offset and any
+                immediates (e.g. the operator of a BinaryOperation)
+            state - The frame state before the instruction executes, including
+                the operands
+        """
+        Value.__init__(self)
+        User.__init__(self, operands)
+        self.op = op
+        self.state = state
+        self.block: Optional[Block] = None
+
+    @property
+    def offset(self) -> Optional[int]:
+        return None if self.op is None else self.op.offset
+
+    def remove(self) -> None:
+        """Remove the instruction, which must be unused, from its block"""
+        self.block.instructions.remove(self)
+        self.drop_operands()
+        self.state.drop_operands()
+        self.block = None
+
+
+class Edge(User):
+    """Control flow from the terminator of source to target. The operands are the
+    arguments for the parameters of target.
+    """
+
+    def __init__(self, target: 'Block', args: Iterable[Value]) -> None:
+        super().__init__(args)
+        self.source: Optional[Block] = None
+        self.target = target
+        target.predecessors.append(self)
+
+    def state(self) -> Tuple[List[Value], List[Value]]:
+        """Returns the values in the locals and on the stack on entry to target
+        along the edge
+        """
+        args = dict(zip(self.target.params, self.operands))
+        entry = self.target.entry
+        return ([args.get(value, value) for value in entry.locals],
+                [args.get(value, value) for value in entry.stack])
+
+    def remove(self) -> None:
+        self.drop_operands()
+        self.target.predecessors.remove(self)
+
+
+class Terminator(Instruction):
+    """The last instruction of a block, which transfers control to its edges.
+
+    op is one of ReturnValue, Branch, BreakLoop, ConditionalBranch (whose edges
+    are the true and false branches) or ForIter (whose edges are the body and
+    the exit, and which is the next value along the body edge). Blocks that fall
+    through into their only successor have no op. Branch targets in op are
+    updated from the edges when the function is lowered.
+    """
+
+    def __init__(
+        self,
+        op: Optional[ir.Instruction],
+        operands: Iterable[Value],
+        state: FrameState,
+        edges: Iterable[Edge] = (),
+    ) -> None:
+        super().__init__(op, operands, state)
+        self.edges: List[Edge] = list(edges)
+
+
+class Block:
+    def __init__(
+        self,
+        label: ir.Label,
+        is_loop_header: bool = False,
+        is_loop_footer: bool = False,
+    ) -> None:
+        self.label = label
+        self.params: List[Parameter] = []
+        # The values in the locals and on the stack on entry to the block
+        self.entry: Optional[FrameState] = None
+        self.instructions: List[Instruction] = []
+        self.terminator: Optional[Terminator] = None
+        # The edges that enter the block
+        self.predecessors: List[Edge] = []
+        self.is_loop_header = is_loop_header
+        self.is_loop_footer = is_loop_footer
+        # The offset of the first instruction of the block in the original code,
+        # where the interpreter can resume with the entry state of the block, or
+        # None if the block has no counterpart there (e.g. in inlined code)
+        self.offset: Optional[int] = None
+
+    @property
+    def successors(self) -> List['Block']:
+        return [edge.target for edge in self.terminator.edges]
+
+    def add_param(self) -> Parameter:
+        param = Parameter(self)
+        self.params.append(param)
+        return param
+
+    def remove_param(self, param: Parameter) -> None:
+        """Remove param, which must be unused, and its arguments"""
+        index = self.params.index(param)
+        for edge in self.predecessors:
+            edge.remove_operand(index)
+        del self.params[index]
+
+    def append(self, instr: Instruction) -> None:
+        instr.block = self
+        self.instructions.append(instr)
+
+    def insert_before(self, instr: Instruction, new: Instruction) -> None:
+        new.block = self
+        self.instructions.insert(self.instructions.index(instr), new)
+
+    def set_terminator(self, terminator: Terminator) -> None:
+        """Replace the terminator of the block, removing the edges of the old one"""
+        if self.terminator is not None:
+            for edge in self.terminator.edges:
+                edge.remove()
+            self.terminator.drop_operands()
+            self.terminator.state.drop_operands()
+        terminator.block = self
+        for edge in terminator.edges:
+            edge.source = self
+        self.terminator = terminator
+
+
+class Function:
+    def __init__(
+        self,
+        num_locals: int,
+        consts: Iterable[Any] = (),
+        names: Iterable[str] = (),
+    ) -> None:
+        self.num_locals = num_locals
+        # The first block is the entry. Blocks are kept in the order that the
+        # stack IR had them in, which lowering preserves.
+        self.blocks: List[Block] = []
+        self.undefined = Undefined()
+        self.constants: Dict[int, Constant] = {}
+        # The constant and name pools that instructions index into. Passes may
+        # add constants.
+        self.consts: List[Any] = list(consts)
+        self.names: Tuple[str, ...] = tuple(names)
+
+    @property
+    def entry(self) -> Block:
+        return self.blocks[0]
+
+    def constant(self, index: int) -> Constant:
+        if index not in self.constants:
+            self.constants[index] = Constant(index)
+        return self.constants[index]
+
+    def add_constant(self, value: Any) -> Constant:
+        """Returns the constant for value, adding it to the pool if it is not
+        already there
+        """
+        for index, const in enumerate(self.consts):
+            if const is value:
+                return self.constant(index)
+        self.consts.append(value)
+        return self.constant(len(self.consts) - 1)
+
+    def value_of(self, const: Constant) -> Any:
+        return self.consts[const.index]
+
+    def instructions(self) -> Iterator[Instruction]:
+        """Iterates over every instruction, including terminators"""
+        for block in self.blocks:
+            yield from block.instructions
+            yield block.terminator
+
+    def __str__(self) -> str:
+        names: Dict[Value, str] = {}
+
+        def name(value: Value) -> str:
+            if isinstance(value, (Constant, Undefined)):
+                return str(value)
+            return names.setdefault(value, f'%{len(names)}')
+
+        def values(values: Iterable[Value]) -> str:
+            return ', '.join(name(value) for value in values)
+
+        lines = []
+        for block in self.blocks:
+            lines.append(f'{block.label}({values(block.params)}):')
+            for instr in block.instructions:
+                text = str(instr.op)
+                if instr.op.pushes:
+                    text = f'{name(instr)} = {text}'
+                lines.append(f'  {text} {values(instr.operands)}'.rstrip())
+            terminator = block.terminator
+            text = _TERMINATOR_NAMES[terminator.op.__class__]
+            if isinstance(terminator.op, ir.ForIter):
+                text = f'{name(terminator)} = {text}'
+            edges = ' '.join(f'{edge.target.label}({values(edge.operands)})'
+                             for edge in terminator.edges)
+            lines.append(f'  {text} {values(terminator.operands)} {edges}'.rstrip())
+        return '\n'.join(lines)
+
+
+_TERMINATOR_NAMES = {
+    ir.ReturnValue: 'RETURN_VALUE',
+    ir.Branch: 'BRANCH',
+    ir.BreakLoop: 'BREAK_LOOP',
+    ir.ConditionalBranch: 'COND_BRANCH',
+    ir.ForIter: 'FOR_ITER',
+    type(None): 'JUMP',
+}
+
+# Label of the block that OSR entries start in
+OSR_ENTRY = 'osr_entry'
+
+
+class _Builder:
+    def __init__(self, cfg: ir.ControlFlowGraph, function: Function) -> None:
+        self.cfg = cfg
+        self.depths = stack_analysis.analyze(cfg)
+        self.function = function
+        self.blocks: Dict[ir.Label, Block] = {}
+        # Blocks whose entry states are known but that have not been translated
+        self.ready: Deque[ir.BasicBlock] = collections.deque()
+
+    def run(self, entry: Optional[ir.Label]) -> Function:
+        function = self.function
+        first = next(iter(self.cfg.get_successors(self.cfg.entry_node)))
+        start = first if entry is None else self.cfg.blocks[entry]
+        # Blocks with a single predecessor inherit its values. Everything else,
+        # including the entry block, takes a parameter for each local and
+        # stack slot.
+        num_preds = {start: 1}
+        worklist = [start]
+        while worklist:
+            block = worklist.pop()
+            for succ in self._successors(block):
+                if succ not in num_preds:
+                    worklist.append(succ)
+                num_preds[succ] = num_preds.get(succ, 0) + 1
+        if entry is not None:
+            osr_entry = Block(OSR_ENTRY)
+            function.blocks.append(osr_entry)
+            self._add_params(osr_entry, self.depths.at_entry(start))
+        for label, block in self.cfg.blocks.items():
+            if block not in num_preds:
+                continue
+            ssa_block = Block(label, block.is_loop_header, block.is_loop_footer)
+            ssa_block.offset = block.instructions[0].offset
+            self.blocks[label] = ssa_block
+            function.blocks.append(ssa_block)
+            if num_preds[block] != 1 or (block is start and entry is None):
+                self._add_params(ssa_block, self.depths.at_entry(block))
+                self.ready.append(block)
+        if entry is not None:
+            osr_entry = function.blocks[0]
+            state = osr_entry.entry
+            terminator = Terminator(None, [], FrameState(state.locals, state.stack),
+                                    [self._edge(start, state.locals, state.stack)])
+            osr_entry.set_terminator(terminator)
+        while self.ready:
+            self._translate(self.ready.popleft())
+        remove_trivial_params(function)
+        return function
+
+    def _successors(self, block: ir.BasicBlock) -> List[ir.BasicBlock]:
+        """Returns the successors of block, once for each edge to them"""
+        terminator = block.terminator
+        blocks = self.cfg.blocks
+        if isinstance(terminator, ir.ConditionalBranch):
+            return [blocks[terminator.true_branch], blocks[terminator.false_branch]]
+        elif isinstance(terminator, ir.ForIter):
+            return [blocks[terminator.body], blocks[terminator.exit]]
+        elif isinstance(terminator, (ir.Branch, ir.BreakLoop)):
+            return [blocks[terminator.target]]
+        return [succ for succ in self.cfg.get_successors(block)
+                if isinstance(succ, ir.BasicBlock)]
+
+    def _add_params(self, block: Block, depth: int) -> None:
+        params = [block.add_param() for _ in range(self.function.num_locals + depth)]
+        block.entry = FrameState(params[:self.function.num_locals],
+                                 params[self.function.num_locals:])
+
+    def _edge(self, target: ir.BasicBlock, locals: List[Value], stack: List[Value]) -> Edge:
+        block = self.blocks[target.label]
+        if block.params:
+            return Edge(block, locals + stack)
+        block.entry = FrameState(locals, stack)
+        self.ready.append(target)
+        return Edge(block, [])
+
+    def _translate(self, ir_block: ir.BasicBlock) -> None:
+        function = self.function
+        block = self.blocks[ir_block.label]
+        locals = block.entry.locals
+        stack = block.entry.stack
+        terminator = ir_block.terminator
+        body = ir_block.instructions
+        if isinstance(terminator, _BRANCHES):
+            body = body[:-1]
+        for instr in body:
+            if isinstance(instr, ir.Load) and instr.pool == ir.VarPool.LOCALS:
+                stack.append(locals[instr.index])
+            elif isinstance(instr, ir.Load) and instr.pool == ir.VarPool.CONSTANTS:
+                stack.append(function.constant(instr.index))
+            elif isinstance(instr, ir.Store):
+                locals[instr.index] = stack.pop()
+            elif isinstance(instr, ir.PopTop):
+                stack.pop()
+            elif isinstance(instr, ir.ClearLocals):
+                for index in range(instr.start, instr.start + instr.count):
+                    locals[index] = function.undefined
+            else:
+                depth = len(stack) - instr.pops
+                value = Instruction(instr, stack[depth:], FrameState(locals, stack))
+                block.append(value)
+                del stack[depth:]
+                if instr.pushes:
+                    stack.append(value)
+        state = FrameState(locals, stack)
+        blocks = self.cfg.blocks
+        if isinstance(terminator, ir.ReturnValue):
+            block.set_terminator(Terminator(terminator, stack[-1:], state))
+        elif isinstance(terminator, ir.Branch):
+            edge = self._edge(blocks[terminator.target], locals, stack)
+            block.set_terminator(Terminator(terminator, [], state, [edge]))
+        elif isinstance(terminator, ir.BreakLoop):
+            depth = self.depths.entry_depths[terminator.loop_header]
+            edge = self._edge(blocks[terminator.target], locals, stack[:depth])
+            block.set_terminator(Terminator(terminator, [], state, [edge]))
+        elif isinstance(terminator, ir.ConditionalBranch):
+            true_stack = false_stack = stack[:-1]
+            if not terminator.pop_before_eval:
+                # The non-popping variants leave the value on the stack when they
+                # branch
+                if terminator.jump_when_true:
+                    true_stack = stack
+                else:
+                    false_stack = stack
+            edges = [self._edge(blocks[terminator.true_branch], locals, true_stack),
+                     self._edge(blocks[terminator.false_branch], locals, false_stack)]
+            block.set_terminator(Terminator(terminator, stack[-1:], state, edges))
+        elif isinstance(terminator, ir.ForIter):
+            value = Terminator(terminator, stack[-1:], state)
+            value.edges = [self._edge(blocks[terminator.body], locals, stack + [value]),
+                           self._edge(blocks[terminator.exit], locals, stack[:-1])]
+            block.set_terminator(value)
+        else:
+            succ = next(iter(self.cfg.get_successors(ir_block)))
+            block.set_terminator(Terminator(None, [], state, [self._edge(succ, locals, stack)]))
+
+
+_BRANCHES = (ir.ReturnValue, ir.Branch, ir.BreakLoop, ir.ConditionalBranch, ir.ForIter)
+
+
+def remove_trivial_params(function: Function) -> bool:
+    """Replace the parameters that receive the same value along every edge (other
+    than from themselves) with that value. Returns whether any were replaced.
+    """
+    removed = False
+    changed = True
+    while changed:
+        changed = False
+        for block in function.blocks[1:]:
+            for index in reversed(range(len(block.params))):
+                param = block.params[index]
+                args = {edge.operands[index] for edge in block.predecessors}
+                args.discard(param)
+                if len(args) == 1:
+                    param.replace_all_uses_with(args.pop())
+                    block.remove_param(param)
+                    changed = removed = True
+    return removed
+
+
+def remove_unreachable_blocks(function: Function) -> bool:
+    """Remove the blocks that cannot be reached from the entry, and their edges.
+    Returns whether any were removed.
+    """
+    reachable = {function.entry}
+    worklist = [function.entry]
+    while worklist:
+        for succ in worklist.pop().successors:
+            if succ not in reachable:
+                reachable.add(succ)
+                worklist.append(succ)
+    unreachable = [block for block in function.blocks if block not in reachable]
+    # Unreachable blocks may only be used by each other, so every use is dropped
+    # before anything is removed
+    for block in unreachable:
+        for edge in block.terminator.edges:
+            edge.remove()
+        block.entry.drop_operands()
+        for instr in block.instructions + [block.terminator]:
+            instr.drop_operands()
+            instr.state.drop_operands()
+    function.blocks = [block for block in function.blocks if block in reachable]
+    return bool(unreachable)
+
+
+def build(
+    cfg: ir.ControlFlowGraph,
+    num_locals: int,
+    entry: Optional[ir.Label] = None,
+    consts: Iterable[Any] = (),
+    names: Iterable[str] = (),
+) -> Function:
+    """Convert cfg into SSA form. The instructions of cfg become part of the
+    function and must not be used elsewhere.
+
+    Args:
+        num_locals - The number of local variable slots that cfg uses
+        entry - The label of the loop header that the function is entered at,
+            for OSR entries. The function then starts with a block named
+            OSR_ENTRY that takes the locals and the stack as parameters, and
+            code that is only reachable before the loop is omitted.
+        consts, names - The pools that the instructions of cfg index into. Only
+            passes that inspect the values of constants or names need them.
+
+    Raises:
+        ValueError: If control flow merges with inconsistent stack depths.
+    """
+    return _Builder(cfg, Function(num_locals, consts, names)).run(entry)
+
+
+class LoweredFunction(NamedTuple):
+    cfg: ir.ControlFlowGraph
+    # The number of local variable slots that cfg uses, including temporaries
+    num_locals: int
+    # The constant pool that cfg indexes into, including any constants that
+    # passes added
+    consts: Tuple[Any, ...]
+
+
+class _Unavailable(Exception):
+    """Raised when a value is needed after every copy of it has been discarded"""
+
+    def __init__(self, value: Value) -> None:
+        super().__init__()
+        self.value = value
+
+
+class _Emitter:
+    """Emits stack IR for part of a block, tracking which values are in the
+    locals and on the stack
+    """
+
+    def __init__(self, lowering: '_Lowering', locals: List[Value], stack: List[Value]) -> None:
+        self.lowering = lowering
+        self.locals = list(locals)
+        self.stack = list(stack)
+        self.instructions: List[ir.Instruction] = []
+
+    def emit(self, instr: ir.Instruction) -> None:
+        self.instructions.append(instr)
+
+    def is_available(self, value: Value) -> bool:
+        """Returns whether value can be loaded"""
+        return (value in self.locals or isinstance(value, Constant) or
+                value in self.lowering.temps)
+
+    def push(self, value: Value) -> None:
+        for index, held in enumerate(self.locals):
+            if held is value:
+                self.emit(ir.Load(index, ir.VarPool.LOCALS))
+                break
+        else:
+            if isinstance(value, Constant):
+                self.emit(ir.Load(value.index, ir.VarPool.CONSTANTS))
+            elif value in self.lowering.temps:
+                self.emit(ir.Load(self.lowering.temps[value], ir.VarPool.LOCALS))
+            else:
+                raise _Unavailable(value)
+        self.stack.append(value)
+
+    def store(self, index: int) -> None:
+        self.emit(ir.Store(index))
+        self.locals[index] = self.stack.pop()
+
+    def pop(self) -> None:
+        self.emit(ir.PopTop())
+        self.stack.pop()
+
+    def define(self, value: Value) -> None:
+        """Copy value into its temporary, if it needs one. This must happen where
+        value is defined.
+        """
+        lowering = self.lowering
+        if value not in lowering.needs_temp or value in lowering.temps:
+            return
+        if value in self.locals:
+            self.push(value)
+            self.emit(ir.Store(lowering.temp(value)))
+            self.stack.pop()
+            return
+        # Spill everything above it, and then restore the stack
+        depth = max(i for i, held in enumerate(self.stack) if held is value)
+        spilled = self.stack[depth:]
+        for held in reversed(spilled):
+            if held in lowering.temps:
+                self.pop()
+            else:
+                self.emit(ir.Store(lowering.temp(held)))
+                self.stack.pop()
+        for held in spilled:
+            self.push(held)
+
+    def reconcile(self, locals: List[Value], stack: List[Value]) -> None:
+        """Emit loads, stores and pops until the locals hold locals and the stack
+        holds stack
+        """
+        current = self.stack
+        prefix = 0
+        while (prefix < min(len(current), len(stack)) and
+               current[prefix] is stack[prefix]):
+            prefix += 1
+        pending = [i for i, value in enumerate(locals) if self.locals[i] is not value]
+        wanted = {locals[i] for i in pending}
+        # Values that locals need must be popped into them, unless they can be
+        # loaded from somewhere else
+        for depth in range(prefix):
+            if current[depth] in wanted and not self.is_available(current[depth]):
+                prefix = depth
+                break
+        while len(current) > prefix:
+            index = next((i for i in pending if locals[i] is current[-1]), None)
+            if index is None:
+                self.pop()
+            else:
+                self.store(index)
+                pending.remove(index)
+        cleared = [i for i in pending if locals[i] is self.lowering.function.undefined]
+        for start, count in _runs(cleared):
+            self.emit(ir.ClearLocals(start, count))
+            for index in range(start, start + count):
+                self.locals[index] = locals[index]
+        for index in pending:
+            if index not in cleared:
+                self.push(locals[index])
+                self.store(index)
+        for value in stack[prefix:]:
+            self.push(value)
+
+
+def _runs(indices: List[int]) -> Iterator[Tuple[int, int]]:
+    """Yields the (start, count) of each run of consecutive indices"""
+    start = count = 0
+    for index in indices:
+        if count and index == start + count:
+            count += 1
+            continue
+        if count:
+            yield start, count
+        start, count = index, 1
+    if count:
+        yield start, count
+
+
+class _Lowering:
+    def __init__(self, function: Function, needs_temp: Set[Value]) -> None:
+        self.function = function
+        # Values that are kept in temporaries, and the temporaries that have been
+        # assigned to them
+        self.needs_temp = needs_temp
+        self.temps: Dict[Value, int] = {}
+        self.blocks: List[ir.BasicBlock] = []
+        # Edge blocks that are not fallen into, which are placed at the end
+        self.deferred: List[ir.BasicBlock] = []
+        self.num_edges = 0
+
+    def temp(self, value: Value) -> int:
+        if value not in self.temps:
+            self.temps[value] = self.function.num_locals + len(self.temps)
+        return self.temps[value]
+
+    def run(self) -> LoweredFunction:
+        blocks = self.function.blocks
+        for index, block in enumerate(blocks):
+            next_block = blocks[index + 1] if index + 1 < len(blocks) else None
+            self.lower_block(block, next_block)
+        return LoweredFunction(ir.build_initial_cfg(self.blocks + self.deferred),
+                               self.function.num_locals + len(self.temps),
+                               tuple(self.function.consts))
+
+    def lower_block(self, block: Block, next_block: Optional[Block]) -> None:
+        entry = block.entry
+        emitter = _Emitter(self, entry.locals, entry.stack)
+        for value in entry.operands:
+            if isinstance(value, Parameter) and value.block is block:
+                emitter.define(value)
+        for instr in block.instructions:
+            self.reconcile(emitter, instr)
+            emitter.emit(instr.op)
+            del emitter.stack[len(emitter.stack) - instr.op.pops:]
+            if instr.op.pushes:
+                emitter.stack.append(instr)
+                emitter.define(instr)
+        terminator = block.terminator
+        op = terminator.op
+        # Edge blocks that control falls into from this one
+        following: List[ir.BasicBlock] = []
+        if isinstance(op, ir.ReturnValue):
+            self.reconcile(emitter, terminator)
+            emitter.emit(op)
+        elif isinstance(op, ir.ConditionalBranch):
+            self.reconcile(emitter, terminator)
+            emitter.emit(op)
+            taken = 0 if op.jump_when_true else 1
+            labels = []
+            for index, edge in enumerate(terminator.edges):
+                stack = emitter.stack[:-1]
+                if index == taken and not op.pop_before_eval:
+                    stack = emitter.stack
+                labels.append(self.edge_label(emitter, stack, edge, index != taken,
+                                              next_block, following))
+            op.true_branch, op.false_branch = labels
+        elif isinstance(op, ir.ForIter):
+            self.reconcile(emitter, terminator)
+            emitter.emit(op)
+            body, exit = terminator.edges
+            op.body = self.edge_label(emitter, emitter.stack + [terminator], body, True,
+                                      next_block, following, terminator)
+            op.exit = self.edge_label(emitter, emitter.stack[:-1], exit, False,
+                                      next_block, following)
+        else:
+            edge, = terminator.edges
+            locals, stack = edge.state()
+            if isinstance(op, ir.BreakLoop):
+                # Whatever is above the stack of the target is discarded
+                if emitter.stack[:len(stack)] == stack:
+                    stack = stack + emitter.stack[len(stack):]
+                op.target = edge.target.label
+            emitter.reconcile(locals, stack)
+            if isinstance(op, ir.Branch):
+                op.target = edge.target.label
+            elif op is None and (edge.target is not next_block or not emitter.instructions):
+                op = ir.Branch(edge.target.label)
+            if op is not None:
+                emitter.emit(op)
+        self.blocks.append(ir.BasicBlock(block.label, emitter.instructions,
+                                         block.is_loop_header, block.is_loop_footer))
+        self.blocks.extend(following)
+
+    def reconcile(self, emitter: _Emitter, instr: Instruction) -> None:
+        """Arrange for the locals and the stack to match the frame state of instr,
+        with its operands on top of the stack
+        """
+        state = instr.state
+        stack = state.stack
+        stack = stack[:len(stack) - len(instr.operands)] + instr.operands
+        emitter.reconcile(state.locals, stack)
+
+    def edge_label(
+        self,
+        emitter: _Emitter,
+        stack: List[Value],
+        edge: Edge,
+        falls_through: bool,
+        next_block: Optional[Block],
+        following: List[ir.BasicBlock],
+        defined: Optional[Value] = None,
+    ) -> ir.Label:
+        """Returns the label that a branch along edge should target.
+
+        This is the target of the edge unless the locals or stack (the stack after
+        the branch) need to be adjusted first, or the edge must fall through but
+        the target does not follow. In that case a block that makes the
+        adjustments and branches to the target is emitted.
+
+        Args:
+            falls_through - Whether the branch reaches the target without jumping
+            defined - A value that the branch defines along edge
+        """
+        locals, target_stack = edge.state()
+        if (emitter.locals == locals and stack == target_stack and
+                (not falls_through or edge.target is next_block) and
+                defined not in self.needs_temp):
+            return edge.target.label
+        edge_emitter = _Emitter(self, emitter.locals, stack)
+        if defined is not None:
+            edge_emitter.define(defined)
+        edge_emitter.reconcile(locals, target_stack)
+        edge_emitter.emit(ir.Branch(edge.target.label))
+        self.num_edges += 1
+        label = f'{edge.source.label}.edge{self.num_edges}'
+        block = ir.BasicBlock(label, edge_emitter.instructions)
+        if falls_through:
+            following.append(block)
+        else:
+            self.deferred.append(block)
+        return label
+
+
+def lower(function: Function) -> LoweredFunction:
+    """Convert function back into the stack IR.
+
+    The branch targets of the stack IR instructions in function are updated in
+    place.
+    """
+    needs_temp: Set[Value] = set()
+    while True:
+        try:
+            return _Lowering(function, needs_temp).run()
+        except _Unavailable as e:
+            if e.value in needs_temp or isinstance(e.value, Undefined):
+                raise ValueError(f'Cannot lower a use of {e.value}')
+            needs_temp.add(e.value)
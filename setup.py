@@ -8,7 +8,8 @@ _cinder = Extension(
     define_macros=[('MAJOR_VERSION', '0'),
                    ('MINOR_VERSION', '1')],
     include_dirs=['src'],
-    sources=['src/cinder.c', 'src/ceval.c'])
+    sources=['src/asm.c', 'src/cinder.c', 'src/ceval.c', 'src/deopt.c',
+             'src/osr.c', 'src/profile.c', 'src/tierup.c'])
 
 
 setup(name='cinder',
@@ -0,0 +1,1282 @@
+#include <Python.h>
+#include <structmember.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "asm.h"
+
+#define RSP 4
+#define RBP 5
+
+// The callee saved registers, in the order that they are pushed
+static const int callee_saved[] = {3, 5, 12, 13, 14, 15};
+#define NUM_CALLEE_SAVED (sizeof(callee_saved) / sizeof(callee_saved[0]))
+
+// Enough room to push every callee saved register. Pushing r8 - r15 takes two
+// bytes.
+#define MAX_PROLOGUE_SIZE 10
+// Enough room to pop every callee saved register and return
+#define MAX_EPILOGUE_SIZE (MAX_PROLOGUE_SIZE + 1)
+
+// The longest x86-64 instruction is 15 bytes
+#define MAX_INSTRUCTION_SIZE 16
+
+#define INT3 0xCC
+
+static const char* op_names[ASM_NUM_OPS] = {
+  [ASM_MOV] = "MOV",
+  [ASM_MOVSXD] = "MOVSXD",
+  [ASM_LEA] = "LEA",
+  [ASM_ADD] = "ADD",
+  [ASM_OR] = "OR",
+  [ASM_AND] = "AND",
+  [ASM_SUB] = "SUB",
+  [ASM_XOR] = "XOR",
+  [ASM_CMP] = "CMP",
+  [ASM_TEST] = "TEST",
+  [ASM_IMUL] = "IMUL",
+  [ASM_INC] = "INC",
+  [ASM_DEC] = "DEC",
+  [ASM_PUSH] = "PUSH",
+  [ASM_POP] = "POP",
+  [ASM_CALL] = "CALL",
+  [ASM_JMP] = "JMP",
+  [ASM_JO] = "JO",
+  [ASM_JNO] = "JNO",
+  [ASM_JB] = "JB",
+  [ASM_JAE] = "JAE",
+  [ASM_JE] = "JE",
+  [ASM_JNE] = "JNE",
+  [ASM_JBE] = "JBE",
+  [ASM_JA] = "JA",
+  [ASM_JS] = "JS",
+  [ASM_JNS] = "JNS",
+  [ASM_JL] = "JL",
+  [ASM_JGE] = "JGE",
+  [ASM_JLE] = "JLE",
+  [ASM_JG] = "JG",
+};
+
+// The condition codes of the conditional jumps, which are added to the opcode
+static int
+condition_code(AsmOp op) {
+  switch (op) {
+    case ASM_JO: return 0x0;
+    case ASM_JNO: return 0x1;
+    case ASM_JB: return 0x2;
+    case ASM_JAE: return 0x3;
+    case ASM_JE: return 0x4;
+    case ASM_JNE: return 0x5;
+    case ASM_JBE: return 0x6;
+    case ASM_JA: return 0x7;
+    case ASM_JS: return 0x8;
+    case ASM_JNS: return 0x9;
+    case ASM_JL: return 0xC;
+    case ASM_JGE: return 0xD;
+    case ASM_JLE: return 0xE;
+    case ASM_JG: return 0xF;
+    default: return -1;
+  }
+}
+
+// Aliases for conditional jumps, which share their encodings
+static const struct {
+  const char* name;
+  AsmOp op;
+} op_aliases[] = {
+  {"JZ", ASM_JE},
+  {"JNZ", ASM_JNE},
+  {"JC", ASM_JB},
+  {"JNC", ASM_JAE},
+  {"JNAE", ASM_JB},
+  {"JNB", ASM_JAE},
+  {"JNA", ASM_JBE},
+  {"JNBE", ASM_JA},
+  {"JNGE", ASM_JL},
+  {"JNL", ASM_JGE},
+  {"JNG", ASM_JLE},
+  {"JNLE", ASM_JG},
+};
+
+// The opcode extensions (the reg field of ModRM) of the arithmetic
+// instructions that share the 0x01/0x03/0x81/0x83 encodings
+static int
+alu_extension(AsmOp op) {
+  switch (op) {
+    case ASM_ADD: return 0;
+    case ASM_OR: return 1;
+    case ASM_AND: return 4;
+    case ASM_SUB: return 5;
+    case ASM_XOR: return 6;
+    case ASM_CMP: return 7;
+    default: return -1;
+  }
+}
+
+typedef enum {
+  OPERAND_NONE,
+  OPERAND_REGISTER,
+  OPERAND_MEMORY,
+  OPERAND_IMMEDIATE,
+  OPERAND_LABEL,
+  OPERAND_ADDRESS,
+} OperandKind;
+
+typedef struct {
+  OperandKind kind;
+  // The size in bytes, or 0 if it is implied by the other operand
+  int size;
+  // The register, or the base register of a memory operand (-1 if none)
+  int reg;
+  // The index register of a memory operand (-1 if none)
+  int index;
+  int scale;
+  // The displacement of a memory operand, the value of an immediate or
+  // address, or the id of a label
+  int64_t value;
+} Operand;
+
+typedef struct {
+  // Where the 32 bit displacement to the label is stored
+  Py_ssize_t offset;
+  Py_ssize_t label;
+} Relocation;
+
+typedef enum {
+  ITEM_INSTRUCTION,
+  ITEM_BIND,
+  ITEM_ALIGN,
+  ITEM_RETURN,
+} ItemKind;
+
+// An instruction, or a label, alignment or return. Items are encoded by
+// finalize(), which releases the GIL while it does so.
+typedef struct {
+  ItemKind kind;
+  AsmOp op;
+  // The operands of an instruction. The label of a bind and the alignment of
+  // an align are stored in dst.value.
+  Operand dst;
+  Operand src;
+} Item;
+
+typedef struct {
+  PyObject_HEAD
+  Item* items;
+  Py_ssize_t num_items;
+  Py_ssize_t items_capacity;
+  // The encoded function, which is only written by finalize()
+  uint8_t* code;
+  Py_ssize_t size;
+  Py_ssize_t capacity;
+  // The index of the item that binds each label, or -1
+  Py_ssize_t* labels;
+  Py_ssize_t num_labels;
+  Py_ssize_t labels_capacity;
+  // The offset at which each label is bound, or -1 until encoding reaches it
+  Py_ssize_t* offsets;
+  Py_ssize_t offsets_capacity;
+  Relocation* relocations;
+  Py_ssize_t num_relocations;
+  Py_ssize_t relocations_capacity;
+  // The offsets of the space reserved for epilogues
+  Py_ssize_t* epilogues;
+  Py_ssize_t num_epilogues;
+  Py_ssize_t epilogues_capacity;
+  // The offsets of the absolute addresses embedded in the code
+  Py_ssize_t* addresses;
+  Py_ssize_t num_addresses;
+  Py_ssize_t addresses_capacity;
+  // Bit i is set if register i is used
+  unsigned int used_registers;
+  int finalized;
+  // Why encoding failed. Encoding runs without the GIL, so the error is
+  // raised once finalize() has taken it back.
+  char error[128];
+} Assembler;
+
+typedef struct {
+  PyObject_HEAD
+  uint8_t* memory;
+  size_t mapped_size;
+  // The offset of the entry point and the end of the code within memory
+  Py_ssize_t entry;
+  Py_ssize_t end;
+  // A tuple of the offsets, from the entry point, of the absolute addresses
+  // embedded in the code
+  PyObject* relocations;
+} MachineCode;
+
+// Ensures that items, an array of capacity elements of item_size bytes, can
+// hold needed elements
+static int
+reserve(void** items, Py_ssize_t* capacity, Py_ssize_t needed, size_t item_size) {
+  if (needed <= *capacity) {
+    return 0;
+  }
+  Py_ssize_t new_capacity = *capacity ? *capacity : 64;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
+  }
+  void* new_items = PyMem_Realloc(*items, new_capacity * item_size);
+  if (new_items == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  *items = new_items;
+  *capacity = new_capacity;
+  return 0;
+}
+
+static int
+reserve_code(Assembler* a, Py_ssize_t size) {
+  return reserve((void**) &a->code, &a->capacity, a->size + size, 1);
+}
+
+static inline void
+emit_byte(Assembler* a, uint8_t byte) {
+  a->code[a->size++] = byte;
+}
+
+static inline void
+emit_int32(Assembler* a, int32_t value) {
+  memcpy(a->code + a->size, &value, sizeof(value));
+  a->size += sizeof(value);
+}
+
+static inline void
+emit_int64(Assembler* a, int64_t value) {
+  memcpy(a->code + a->size, &value, sizeof(value));
+  a->size += sizeof(value);
+}
+
+// Records an encoding error, to be raised as a ValueError. Returns -1.
+static int
+encode_error(Assembler* a, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(a->error, sizeof(a->error), format, args);
+  va_end(args);
+  return -1;
+}
+
+static inline int
+fits_int8(int64_t value) {
+  return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static inline int
+fits_int32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static int
+parse_register(Assembler* a, PyObject* number, int* reg) {
+  long value = PyLong_AsLong(number);
+  if (value == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  if (value < -1 || value > 15) {
+    PyErr_Format(PyExc_ValueError, "invalid register %ld", value);
+    return -1;
+  }
+  if (value >= 0) {
+    a->used_registers |= 1u << value;
+  }
+  *reg = (int) value;
+  return 0;
+}
+
+static int
+parse_operand(Assembler* a, PyObject* obj, Operand* op) {
+  memset(op, 0, sizeof(*op));
+  op->reg = -1;
+  op->index = -1;
+  op->scale = 1;
+  if (obj == NULL || obj == Py_None) {
+    op->kind = OPERAND_NONE;
+    return 0;
+  }
+  if (PyLong_Check(obj)) {
+    int overflow;
+    op->kind = OPERAND_IMMEDIATE;
+    op->value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+    if (overflow > 0) {
+      // Addresses and masks may not fit in a signed 64 bit integer
+      op->value = (int64_t) PyLong_AsUnsignedLongLong(obj);
+    } else if (overflow < 0) {
+      PyErr_SetString(PyExc_ValueError, "immediate does not fit in 64 bits");
+      return -1;
+    }
+    return op->value == -1 && PyErr_Occurred() ? -1 : 0;
+  }
+  if (PyList_Check(obj) && PyList_GET_SIZE(obj) == 1) {
+    if (parse_operand(a, PyList_GET_ITEM(obj, 0), op) < 0) {
+      return -1;
+    }
+    if (op->kind == OPERAND_REGISTER) {
+      op->kind = OPERAND_MEMORY;
+      op->size = 0;
+      return 0;
+    } else if (op->kind == OPERAND_MEMORY) {
+      return 0;
+    }
+    PyErr_SetString(PyExc_TypeError, "expected a register or memory operand in []");
+    return -1;
+  }
+  if (!PyTuple_Check(obj) || PyTuple_GET_SIZE(obj) < 2) {
+    PyErr_Format(PyExc_TypeError, "invalid operand %R", obj);
+    return -1;
+  }
+  long kind = PyLong_AsLong(PyTuple_GET_ITEM(obj, 0));
+  if (kind == ASM_REGISTER && PyTuple_GET_SIZE(obj) == 3) {
+    op->kind = OPERAND_REGISTER;
+    if (parse_register(a, PyTuple_GET_ITEM(obj, 1), &op->reg) < 0) {
+      return -1;
+    }
+    op->size = (int) PyLong_AsLong(PyTuple_GET_ITEM(obj, 2));
+    return 0;
+  } else if (kind == ASM_MEMORY && PyTuple_GET_SIZE(obj) == 6) {
+    op->kind = OPERAND_MEMORY;
+    if (parse_register(a, PyTuple_GET_ITEM(obj, 1), &op->reg) < 0 ||
+        parse_register(a, PyTuple_GET_ITEM(obj, 2), &op->index) < 0) {
+      return -1;
+    }
+    op->scale = (int) PyLong_AsLong(PyTuple_GET_ITEM(obj, 3));
+    op->value = PyLong_AsLongLong(PyTuple_GET_ITEM(obj, 4));
+    op->size = (int) PyLong_AsLong(PyTuple_GET_ITEM(obj, 5));
+    if (PyErr_Occurred()) {
+      return -1;
+    }
+    if (op->index == RSP) {
+      PyErr_SetString(PyExc_ValueError, "rsp cannot be used as an index");
+      return -1;
+    }
+    if (op->scale != 1 && op->scale != 2 && op->scale != 4 && op->scale != 8) {
+      PyErr_Format(PyExc_ValueError, "invalid scale %d", op->scale);
+      return -1;
+    }
+    if (!fits_int32(op->value)) {
+      PyErr_SetString(PyExc_ValueError, "displacement does not fit in 32 bits");
+      return -1;
+    }
+    return 0;
+  } else if (kind == ASM_LABEL && PyTuple_GET_SIZE(obj) == 2) {
+    op->kind = OPERAND_LABEL;
+    op->value = PyLong_AsSsize_t(PyTuple_GET_ITEM(obj, 1));
+    if (op->value < 0 || op->value >= a->num_labels) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError, "label belongs to a different assembler");
+      }
+      return -1;
+    }
+    return 0;
+  } else if (kind == ASM_ADDRESS && PyTuple_GET_SIZE(obj) == 2) {
+    op->kind = OPERAND_ADDRESS;
+    op->value = (int64_t) PyLong_AsUnsignedLongLong(PyTuple_GET_ITEM(obj, 1));
+    return PyErr_Occurred() ? -1 : 0;
+  }
+  if (!PyErr_Occurred()) {
+    PyErr_Format(PyExc_TypeError, "invalid operand %R", obj);
+  }
+  return -1;
+}
+
+// Returns the REX.W bit for an operation on size bytes, or -1 if the size is
+// not supported
+static int
+rex_w(Assembler* a, int size) {
+  switch (size) {
+    case 8:
+      return 1;
+    case 4:
+      return 0;
+    default:
+      return encode_error(a, "unsupported operand size %d", size);
+  }
+}
+
+static void
+emit_rex(Assembler* a, int w, int reg, int index, int base) {
+  uint8_t rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) |
+                (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+  if (rex != 0x40) {
+    emit_byte(a, rex);
+  }
+}
+
+static uint8_t
+scale_bits(int scale) {
+  switch (scale) {
+    case 2: return 1;
+    case 4: return 2;
+    case 8: return 3;
+    default: return 0;
+  }
+}
+
+// Emits an instruction with a ModRM byte: any REX prefix, the opcode, and the
+// encoding of rm, which is a register or memory operand, with reg (a register
+// or an opcode extension) in the reg field
+static void
+emit_modrm(Assembler* a, int w, const uint8_t* opcode, int opcode_len, int reg, const Operand* rm) {
+  if (rm->kind == OPERAND_REGISTER) {
+    emit_rex(a, w, reg, 0, rm->reg);
+    for (int i = 0; i < opcode_len; i++) {
+      emit_byte(a, opcode[i]);
+    }
+    emit_byte(a, 0xC0 | ((reg & 7) << 3) | (rm->reg & 7));
+    return;
+  }
+  int base = rm->reg;
+  int index = rm->index;
+  emit_rex(a, w, reg, index < 0 ? 0 : index, base < 0 ? 0 : base);
+  for (int i = 0; i < opcode_len; i++) {
+    emit_byte(a, opcode[i]);
+  }
+  uint8_t sib_index = index < 0 ? 4 : (index & 7);
+  if (base < 0) {
+    // [index * scale + disp32], or an absolute address if there is no index
+    emit_byte(a, ((reg & 7) << 3) | 4);
+    emit_byte(a, (scale_bits(rm->scale) << 6) | (sib_index << 3) | 5);
+    emit_int32(a, (int32_t) rm->value);
+    return;
+  }
+  int mod;
+  if (rm->value == 0 && (base & 7) != RBP) {
+    mod = 0;
+  } else if (fits_int8(rm->value)) {
+    mod = 1;
+  } else {
+    mod = 2;
+  }
+  if (index >= 0 || (base & 7) == RSP) {
+    emit_byte(a, (mod << 6) | ((reg & 7) << 3) | 4);
+    emit_byte(a, (scale_bits(rm->scale) << 6) | (sib_index << 3) | (base & 7));
+  } else {
+    emit_byte(a, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+  }
+  if (mod == 1) {
+    emit_byte(a, (uint8_t) (int8_t) rm->value);
+  } else if (mod == 2) {
+    emit_int32(a, (int32_t) rm->value);
+  }
+}
+
+static int
+is_rm(const Operand* op) {
+  return op->kind == OPERAND_REGISTER || op->kind == OPERAND_MEMORY;
+}
+
+// Returns the size of an instruction's operands, which must agree
+static int
+operand_size(Assembler* a, const Operand* dst, const Operand* src) {
+  int size = dst->size;
+  if (src != NULL && src->kind == OPERAND_REGISTER) {
+    if (size && size != src->size) {
+      return encode_error(a, "operand size mismatch (%d and %d)", size, src->size);
+    }
+    size = src->size;
+  }
+  if (size == 0) {
+    return encode_error(a, "ambiguous operand size");
+  }
+  return size;
+}
+
+static int
+invalid_operands(Assembler* a, AsmOp op) {
+  return encode_error(a, "invalid operands for %s", op_names[op]);
+}
+
+static void
+add_relocation(Assembler* a, Py_ssize_t label) {
+  Relocation* reloc = &a->relocations[a->num_relocations++];
+  reloc->offset = a->size;
+  reloc->label = label;
+  emit_int32(a, 0);
+}
+
+// Emits a jump to a label. Backward jumps that fit use the short form.
+static int
+emit_jump(Assembler* a, AsmOp op, const Operand* target) {
+  Py_ssize_t bound = a->offsets[target->value];
+  int is_jmp = op == ASM_JMP;
+  int cc = is_jmp ? 0 : condition_code(op);
+  if (bound >= 0 && fits_int8(bound - (a->size + 2))) {
+    emit_byte(a, is_jmp ? 0xEB : 0x70 + cc);
+    emit_byte(a, (uint8_t) (int8_t) (bound - (a->size + 1)));
+    return 0;
+  }
+  if (is_jmp) {
+    emit_byte(a, 0xE9);
+  } else {
+    emit_byte(a, 0x0F);
+    emit_byte(a, 0x80 + cc);
+  }
+  add_relocation(a, target->value);
+  return 0;
+}
+
+static int
+emit_mov(Assembler* a, const Operand* dst, const Operand* src) {
+  static const uint8_t store[] = {0x89};
+  static const uint8_t load[] = {0x8B};
+  static const uint8_t store_imm[] = {0xC7};
+  int size, w;
+  if (is_rm(dst) && src->kind == OPERAND_REGISTER) {
+    if ((size = operand_size(a, dst, src)) < 0 || (w = rex_w(a, size)) < 0) {
+      return -1;
+    }
+    emit_modrm(a, w, store, 1, src->reg, dst);
+  } else if (dst->kind == OPERAND_REGISTER && src->kind == OPERAND_MEMORY) {
+    if ((w = rex_w(a, dst->size)) < 0) {
+      return -1;
+    }
+    emit_modrm(a, w, load, 1, dst->reg, src);
+  } else if (dst->kind == OPERAND_REGISTER && src->kind == OPERAND_IMMEDIATE) {
+    if ((w = rex_w(a, dst->size)) < 0) {
+      return -1;
+    }
+    if (src->value >= 0 && src->value <= UINT32_MAX) {
+      // Writing the 32 bit register zero extends into the 64 bit register
+      emit_rex(a, 0, 0, 0, dst->reg);
+      emit_byte(a, 0xB8 + (dst->reg & 7));
+      emit_int32(a, (int32_t) (uint32_t) src->value);
+    } else if (!w) {
+      if (!fits_int32(src->value)) {
+        return encode_error(a, "immediate does not fit in 32 bits");
+      }
+      emit_rex(a, 0, 0, 0, dst->reg);
+      emit_byte(a, 0xB8 + (dst->reg & 7));
+      emit_int32(a, (int32_t) src->value);
+    } else if (fits_int32(src->value)) {
+      emit_modrm(a, 1, store_imm, 1, 0, dst);
+      emit_int32(a, (int32_t) src->value);
+    } else {
+      emit_rex(a, 1, 0, 0, dst->reg);
+      emit_byte(a, 0xB8 + (dst->reg & 7));
+      emit_int64(a, src->value);
+    }
+  } else if (dst->kind == OPERAND_REGISTER && dst->size == 8 &&
+             src->kind == OPERAND_ADDRESS) {
+    // Addresses always take the full 8 bytes so that they can be relocated
+    emit_rex(a, 1, 0, 0, dst->reg);
+    emit_byte(a, 0xB8 + (dst->reg & 7));
+    a->addresses[a->num_addresses++] = a->size;
+    emit_int64(a, src->value);
+  } else if (dst->kind == OPERAND_MEMORY && src->kind == OPERAND_IMMEDIATE) {
+    if ((size = operand_size(a, dst, NULL)) < 0 || (w = rex_w(a, size)) < 0) {
+      return -1;
+    }
+    if (!fits_int32(src->value)) {
+      return encode_error(a, "immediate does not fit in 32 bits");
+    }
+    emit_modrm(a, w, store_imm, 1, 0, dst);
+    emit_int32(a, (int32_t) src->value);
+  } else {
+    return invalid_operands(a, ASM_MOV);
+  }
+  return 0;
+}
+
+// ADD, OR, AND, SUB, XOR, CMP, and TEST
+static int
+emit_arithmetic(Assembler* a, AsmOp op, const Operand* dst, const Operand* src) {
+  int ext = alu_extension(op);
+  int size, w;
+  if (is_rm(dst) && src->kind == OPERAND_REGISTER) {
+    uint8_t opcode = op == ASM_TEST ? 0x85 : (uint8_t) ((ext << 3) | 0x01);
+    if ((size = operand_size(a, dst, src)) < 0 || (w = rex_w(a, size)) < 0) {
+      return -1;
+    }
+    emit_modrm(a, w, &opcode, 1, src->reg, dst);
+  } else if (dst->kind == OPERAND_REGISTER && src->kind == OPERAND_MEMORY &&
+             op != ASM_TEST) {
+    uint8_t opcode = (uint8_t) ((ext << 3) | 0x03);
+    if ((w = rex_w(a, dst->size)) < 0) {
+      return -1;
+    }
+    emit_modrm(a, w, &opcode, 1, dst->reg, src);
+  } else if (is_rm(dst) && src->kind == OPERAND_IMMEDIATE) {
+    if ((size = operand_size(a, dst, NULL)) < 0 || (w = rex_w(a, size)) < 0) {
+      return -1;
+    }
+    if (size == 4 && src->value >= 0 && src->value <= UINT32_MAX) {
+      // Masks with the top bit set are written as unsigned
+      ;
+    } else if (!fits_int32(src->value)) {
+      return encode_error(a, "immediate does not fit in 32 bits");
+    }
+    if (op == ASM_TEST) {
+      static const uint8_t opcode[] = {0xF7};
+      emit_modrm(a, w, opcode, 1, 0, dst);
+      emit_int32(a, (int32_t) src->value);
+    } else if (fits_int8(src->value)) {
+      static const uint8_t opcode[] = {0x83};
+      emit_modrm(a, w, opcode, 1, ext, dst);
+      emit_byte(a, (uint8_t) (int8_t) src->value);
+    } else {
+      static const uint8_t opcode[] = {0x81};
+      emit_modrm(a, w, opcode, 1, ext, dst);
+      emit_int32(a, (int32_t) src->value);
+    }
+  } else {
+    return invalid_operands(a, op);
+  }
+  return 0;
+}
+
+static int
+emit_instruction(Assembler* a, AsmOp op, const Operand* dst, const Operand* src) {
+  int w;
+  switch (op) {
+    case ASM_MOV:
+      return emit_mov(a, dst, src);
+    case ASM_MOVSXD: {
+      static const uint8_t opcode[] = {0x63};
+      if (dst->kind != OPERAND_REGISTER || dst->size != 8 || !is_rm(src) ||
+          (src->kind == OPERAND_REGISTER && src->size != 4)) {
+        return invalid_operands(a, op);
+      }
+      emit_modrm(a, 1, opcode, 1, dst->reg, src);
+      return 0;
+    }
+    case ASM_LEA: {
+      static const uint8_t opcode[] = {0x8D};
+      if (dst->kind != OPERAND_REGISTER || src->kind != OPERAND_MEMORY) {
+        return invalid_operands(a, op);
+      }
+      if ((w = rex_w(a, dst->size)) < 0) {
+        return -1;
+      }
+      emit_modrm(a, w, opcode, 1, dst->reg, src);
+      return 0;
+    }
+    case ASM_ADD:
+    case ASM_OR:
+    case ASM_AND:
+    case ASM_SUB:
+    case ASM_XOR:
+    case ASM_CMP:
+    case ASM_TEST:
+      return emit_arithmetic(a, op, dst, src);
+    case ASM_IMUL: {
+      static const uint8_t opcode[] = {0x0F, 0xAF};
+      if (dst->kind != OPERAND_REGISTER || !is_rm(src)) {
+        return invalid_operands(a, op);
+      }
+      int size = operand_size(a, dst, src);
+      if (size < 0 || (w = rex_w(a, size)) < 0) {
+        return -1;
+      }
+      emit_modrm(a, w, opcode, 2, dst->reg, src);
+      return 0;
+    }
+    case ASM_INC:
+    case ASM_DEC: {
+      static const uint8_t opcode[] = {0xFF};
+      if (!is_rm(dst) || src->kind != OPERAND_NONE) {
+        return invalid_operands(a, op);
+      }
+      int size = operand_size(a, dst, NULL);
+      if (size < 0 || (w = rex_w(a, size)) < 0) {
+        return -1;
+      }
+      emit_modrm(a, w, opcode, 1, op == ASM_INC ? 0 : 1, dst);
+      return 0;
+    }
+    case ASM_PUSH:
+    case ASM_POP:
+      if (src->kind != OPERAND_NONE) {
+        return invalid_operands(a, op);
+      }
+      if (dst->kind == OPERAND_REGISTER && dst->size == 8) {
+        emit_rex(a, 0, 0, 0, dst->reg);
+        emit_byte(a, (op == ASM_PUSH ? 0x50 : 0x58) + (dst->reg & 7));
+      } else if (dst->kind == OPERAND_MEMORY && (dst->size == 0 || dst->size == 8)) {
+        static const uint8_t push[] = {0xFF};
+        static const uint8_t pop[] = {0x8F};
+        emit_modrm(a, 0, op == ASM_PUSH ? push : pop, 1, op == ASM_PUSH ? 6 : 0, dst);
+      } else if (op == ASM_PUSH && dst->kind == OPERAND_IMMEDIATE && fits_int32(dst->value)) {
+        emit_byte(a, 0x68);
+        emit_int32(a, (int32_t) dst->value);
+      } else {
+        return invalid_operands(a, op);
+      }
+      return 0;
+    case ASM_CALL:
+    case ASM_JMP:
+      if (src->kind != OPERAND_NONE) {
+        return invalid_operands(a, op);
+      }
+      if (dst->kind == OPERAND_LABEL) {
+        if (op == ASM_JMP) {
+          return emit_jump(a, op, dst);
+        }
+        emit_byte(a, 0xE8);
+        add_relocation(a, dst->value);
+      } else if (is_rm(dst) && (dst->kind == OPERAND_MEMORY || dst->size == 8)) {
+        static const uint8_t opcode[] = {0xFF};
+        emit_modrm(a, 0, opcode, 1, op == ASM_CALL ? 2 : 4, dst);
+      } else {
+        return invalid_operands(a, op);
+      }
+      return 0;
+    default:
+      if (op >= ASM_JO && op <= ASM_JG) {
+        if (dst->kind != OPERAND_LABEL || src->kind != OPERAND_NONE) {
+          return invalid_operands(a, op);
+        }
+        return emit_jump(a, op, dst);
+      }
+      return encode_error(a, "unknown operation %d", op);
+  }
+}
+
+static int
+check_not_finalized(Assembler* a) {
+  if (a->finalized) {
+    PyErr_SetString(PyExc_ValueError, "the assembler has already been finalized");
+    return -1;
+  }
+  return 0;
+}
+
+// Appends an item, which is encoded when the function is finalized. Returns
+// NULL on error.
+static Item*
+add_item(Assembler* a, ItemKind kind) {
+  if (check_not_finalized(a) < 0 ||
+      reserve((void**) &a->items, &a->items_capacity, a->num_items + 1,
+              sizeof(Item)) < 0) {
+    return NULL;
+  }
+  Item* item = &a->items[a->num_items++];
+  memset(item, 0, sizeof(*item));
+  item->kind = kind;
+  return item;
+}
+
+static PyObject*
+Assembler_emit(Assembler* self, PyObject* args) {
+  int op;
+  PyObject* dst_obj = NULL;
+  PyObject* src_obj = NULL;
+  if (!PyArg_ParseTuple(args, "i|OO:emit", &op, &dst_obj, &src_obj)) {
+    return NULL;
+  }
+  if (op < 0 || op >= ASM_NUM_OPS) {
+    PyErr_Format(PyExc_ValueError, "unknown operation %d", op);
+    return NULL;
+  }
+  Operand dst, src;
+  if (check_not_finalized(self) < 0 ||
+      parse_operand(self, dst_obj, &dst) < 0 ||
+      parse_operand(self, src_obj, &src) < 0) {
+    return NULL;
+  }
+  Item* item = add_item(self, ITEM_INSTRUCTION);
+  if (item == NULL) {
+    return NULL;
+  }
+  item->op = (AsmOp) op;
+  item->dst = dst;
+  item->src = src;
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+Assembler_new_label(Assembler* self, PyObject* unused) {
+  if (check_not_finalized(self) < 0 ||
+      reserve((void**) &self->labels, &self->labels_capacity, self->num_labels + 1,
+              sizeof(Py_ssize_t)) < 0) {
+    return NULL;
+  }
+  self->labels[self->num_labels] = -1;
+  return PyLong_FromSsize_t(self->num_labels++);
+}
+
+static PyObject*
+Assembler_bind(Assembler* self, PyObject* label) {
+  Py_ssize_t id = PyLong_AsSsize_t(label);
+  if (id == -1 && PyErr_Occurred()) {
+    return NULL;
+  }
+  if (check_not_finalized(self) < 0) {
+    return NULL;
+  }
+  if (id < 0 || id >= self->num_labels) {
+    PyErr_SetString(PyExc_ValueError, "unknown label");
+    return NULL;
+  }
+  if (self->labels[id] >= 0) {
+    PyErr_SetString(PyExc_ValueError, "label is already bound");
+    return NULL;
+  }
+  Item* item = add_item(self, ITEM_BIND);
+  if (item == NULL) {
+    return NULL;
+  }
+  item->dst.value = id;
+  self->labels[id] = self->num_items - 1;
+  Py_RETURN_NONE;
+}
+
+// Recommended multi-byte NOPs, indexed by length
+static const uint8_t nops[][9] = {
+  {0},
+  {0x90},
+  {0x66, 0x90},
+  {0x0F, 0x1F, 0x00},
+  {0x0F, 0x1F, 0x40, 0x00},
+  {0x0F, 0x1F, 0x44, 0x00, 0x00},
+  {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+  {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+  {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+  {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+#define MAX_NOP_SIZE 9
+
+static PyObject*
+Assembler_align(Assembler* self, PyObject* alignment_obj) {
+  Py_ssize_t alignment = PyLong_AsSsize_t(alignment_obj);
+  if (alignment == -1 && PyErr_Occurred()) {
+    return NULL;
+  }
+  if (alignment <= 0 || (alignment & (alignment - 1)) || alignment > 4096) {
+    PyErr_SetString(PyExc_ValueError, "alignment must be a power of two no larger than a page");
+    return NULL;
+  }
+  Item* item = add_item(self, ITEM_ALIGN);
+  if (item == NULL) {
+    return NULL;
+  }
+  item->dst.value = alignment;
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+Assembler_ret(Assembler* self, PyObject* unused) {
+  if (add_item(self, ITEM_RETURN) == NULL) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static void
+emit_padding(Assembler* a, Py_ssize_t alignment) {
+  Py_ssize_t padding = (alignment - a->size % alignment) % alignment;
+  // The padding is executed when control falls through into the aligned code
+  while (padding > 0) {
+    Py_ssize_t n = padding > MAX_NOP_SIZE ? MAX_NOP_SIZE : padding;
+    memcpy(a->code + a->size, nops[n], n);
+    a->size += n;
+    padding -= n;
+  }
+}
+
+// Reserves room for the largest encoding of every item, so that encode() does
+// not need to allocate
+static int
+reserve_for_items(Assembler* a) {
+  Py_ssize_t max_size = MAX_PROLOGUE_SIZE;
+  Py_ssize_t max_relocations = 0;
+  Py_ssize_t max_epilogues = 0;
+  Py_ssize_t max_addresses = 0;
+  for (Py_ssize_t i = 0; i < a->num_items; i++) {
+    Item* item = &a->items[i];
+    switch (item->kind) {
+      case ITEM_INSTRUCTION:
+        max_size += MAX_INSTRUCTION_SIZE;
+        max_relocations += item->dst.kind == OPERAND_LABEL;
+        max_addresses += item->src.kind == OPERAND_ADDRESS;
+        break;
+      case ITEM_BIND:
+        break;
+      case ITEM_ALIGN:
+        max_size += item->dst.value - 1;
+        break;
+      case ITEM_RETURN:
+        max_size += MAX_EPILOGUE_SIZE;
+        max_epilogues++;
+        break;
+    }
+  }
+  a->size = 0;
+  return reserve_code(a, max_size) < 0 ||
+         reserve((void**) &a->relocations, &a->relocations_capacity,
+                 max_relocations, sizeof(Relocation)) < 0 ||
+         reserve((void**) &a->epilogues, &a->epilogues_capacity,
+                 max_epilogues, sizeof(Py_ssize_t)) < 0 ||
+         reserve((void**) &a->addresses, &a->addresses_capacity,
+                 max_addresses, sizeof(Py_ssize_t)) < 0 ||
+         reserve((void**) &a->offsets, &a->offsets_capacity,
+                 a->num_labels, sizeof(Py_ssize_t)) < 0 ? -1 : 0;
+}
+
+// Encodes the items, resolves jumps, and fills in the prologue and epilogues.
+// Returns the offset of the entry point, or -1 with the reason in a->error.
+// Runs without the GIL.
+static Py_ssize_t
+encode(Assembler* a) {
+  a->size = MAX_PROLOGUE_SIZE;
+  a->num_relocations = 0;
+  a->num_epilogues = 0;
+  a->num_addresses = 0;
+  for (Py_ssize_t i = 0; i < a->num_labels; i++) {
+    a->offsets[i] = -1;
+  }
+  for (Py_ssize_t i = 0; i < a->num_items; i++) {
+    Item* item = &a->items[i];
+    switch (item->kind) {
+      case ITEM_INSTRUCTION:
+        if (emit_instruction(a, item->op, &item->dst, &item->src) < 0) {
+          return -1;
+        }
+        break;
+      case ITEM_BIND:
+        a->offsets[item->dst.value] = a->size;
+        break;
+      case ITEM_ALIGN:
+        emit_padding(a, item->dst.value);
+        break;
+      case ITEM_RETURN:
+        a->epilogues[a->num_epilogues++] = a->size;
+        a->size += MAX_EPILOGUE_SIZE;
+        break;
+    }
+  }
+
+  for (Py_ssize_t i = 0; i < a->num_relocations; i++) {
+    Relocation* reloc = &a->relocations[i];
+    Py_ssize_t target = a->offsets[reloc->label];
+    if (target < 0) {
+      return encode_error(a, "jump to a label that was never bound");
+    }
+    int32_t displacement = (int32_t) (target - (reloc->offset + 4));
+    memcpy(a->code + reloc->offset, &displacement, sizeof(displacement));
+  }
+
+  // Push the callee saved registers so that they end where the body begins
+  uint8_t prologue[MAX_PROLOGUE_SIZE];
+  uint8_t epilogue[MAX_EPILOGUE_SIZE];
+  int prologue_size = 0;
+  int epilogue_size = 0;
+  for (size_t i = 0; i < NUM_CALLEE_SAVED; i++) {
+    int reg = callee_saved[i];
+    if (a->used_registers & (1u << reg)) {
+      if (reg >= 8) {
+        prologue[prologue_size++] = 0x41;
+      }
+      prologue[prologue_size++] = 0x50 + (reg & 7);
+    }
+  }
+  for (int i = NUM_CALLEE_SAVED - 1; i >= 0; i--) {
+    int reg = callee_saved[i];
+    if (a->used_registers & (1u << reg)) {
+      if (reg >= 8) {
+        epilogue[epilogue_size++] = 0x41;
+      }
+      epilogue[epilogue_size++] = 0x58 + (reg & 7);
+    }
+  }
+  epilogue[epilogue_size++] = 0xC3;
+  Py_ssize_t entry = MAX_PROLOGUE_SIZE - prologue_size;
+  memset(a->code, INT3, entry);
+  memcpy(a->code + entry, prologue, prologue_size);
+  for (Py_ssize_t i = 0; i < a->num_epilogues; i++) {
+    memset(a->code + a->epilogues[i], INT3, MAX_EPILOGUE_SIZE);
+    memcpy(a->code + a->epilogues[i], epilogue, epilogue_size);
+  }
+  return entry;
+}
+
+// Copies size bytes of code into executable memory, whose size is stored in
+// mapped_size. Returns NULL with errno set on failure. Does not need the GIL.
+static uint8_t*
+map_code(const uint8_t* code, Py_ssize_t size, size_t* mapped_size) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  *mapped_size = (size + page_size - 1) / page_size * page_size;
+  if (*mapped_size == 0) {
+    *mapped_size = page_size;
+  }
+  void* memory = mmap(NULL, *mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return NULL;
+  }
+  memcpy(memory, code, size);
+  if (mprotect(memory, *mapped_size, PROT_READ | PROT_EXEC) < 0) {
+    int saved_errno = errno;
+    munmap(memory, *mapped_size);
+    errno = saved_errno;
+    return NULL;
+  }
+  return (uint8_t*) memory;
+}
+
+// Wraps memory returned by map_code. Steals a reference to relocations, and
+// unmaps memory on failure.
+static MachineCode*
+new_machine_code(uint8_t* memory, size_t mapped_size, Py_ssize_t entry,
+                 Py_ssize_t end, PyObject* relocations) {
+  MachineCode* result = PyObject_New(MachineCode, &MachineCodeType);
+  if (result == NULL) {
+    munmap(memory, mapped_size);
+    Py_DECREF(relocations);
+    return NULL;
+  }
+  result->memory = memory;
+  result->mapped_size = mapped_size;
+  result->entry = entry;
+  result->end = end;
+  result->relocations = relocations;
+  return result;
+}
+
+// Copies size bytes of code into executable memory. Steals a reference to
+// relocations.
+static MachineCode*
+load_code(const uint8_t* code, Py_ssize_t size, Py_ssize_t entry, PyObject* relocations) {
+  size_t mapped_size;
+  uint8_t* memory = map_code(code, size, &mapped_size);
+  if (memory == NULL) {
+    Py_DECREF(relocations);
+    PyErr_SetFromErrno(PyExc_OSError);
+    return NULL;
+  }
+  return new_machine_code(memory, mapped_size, entry, size, relocations);
+}
+
+static PyObject*
+Assembler_finalize(Assembler* self, PyObject* unused) {
+  if (check_not_finalized(self) < 0 || reserve_for_items(self) < 0) {
+    return NULL;
+  }
+  // Nothing may be emitted while the GIL is released
+  self->finalized = 1;
+  Py_ssize_t entry;
+  uint8_t* memory = NULL;
+  size_t mapped_size = 0;
+  int map_errno = 0;
+  Py_BEGIN_ALLOW_THREADS
+  entry = encode(self);
+  if (entry >= 0) {
+    memory = map_code(self->code, self->size, &mapped_size);
+    map_errno = errno;
+  }
+  Py_END_ALLOW_THREADS
+  if (entry < 0 || memory == NULL) {
+    self->finalized = 0;
+    if (entry < 0) {
+      PyErr_SetString(PyExc_ValueError, self->error);
+    } else {
+      errno = map_errno;
+      PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return NULL;
+  }
+
+  PyObject* relocations = PyTuple_New(self->num_addresses);
+  if (relocations == NULL) {
+    munmap(memory, mapped_size);
+    self->finalized = 0;
+    return NULL;
+  }
+  for (Py_ssize_t i = 0; i < self->num_addresses; i++) {
+    PyObject* offset = PyLong_FromSsize_t(self->addresses[i] - entry);
+    if (offset == NULL) {
+      munmap(memory, mapped_size);
+      Py_DECREF(relocations);
+      self->finalized = 0;
+      return NULL;
+    }
+    PyTuple_SET_ITEM(relocations, i, offset);
+  }
+  MachineCode* result = new_machine_code(memory, mapped_size, entry, self->size,
+                                         relocations);
+  if (result == NULL) {
+    self->finalized = 0;
+  }
+  return (PyObject*) result;
+}
+
+static PyMethodDef Assembler_methods[] = {
+  {"emit", (PyCFunction) Assembler_emit, METH_VARARGS,
+   "emit(op, dst=None, src=None)\n\nAssemble an instruction."},
+  {"new_label", (PyCFunction) Assembler_new_label, METH_NOARGS,
+   "Return the id of a new, unbound label."},
+  {"bind", (PyCFunction) Assembler_bind, METH_O,
+   "Bind a label to the current position."},
+  {"align", (PyCFunction) Assembler_align, METH_O,
+   "Pad the code with nops to a multiple of the given alignment."},
+  {"ret", (PyCFunction) Assembler_ret, METH_NOARGS,
+   "Restore the callee saved registers and return."},
+  {"finalize", (PyCFunction) Assembler_finalize, METH_NOARGS,
+   "Resolve jumps and copy the code into executable memory. Returns a "
+   "MachineCode."},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyObject*
+Assembler_get_size(Assembler* self, void* closure) {
+  return PyLong_FromSsize_t(self->finalized ? self->size : 0);
+}
+
+static PyGetSetDef Assembler_getset[] = {
+  {"size", (getter) Assembler_get_size, NULL,
+   "The number of bytes assembled, including the space reserved for the "
+   "prologue. Instructions are only encoded by finalize(), so this is 0 until "
+   "then.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyObject*
+Assembler_new(PyTypeObject* type, PyObject* args, PyObject* kwargs) {
+  if (!_PyArg_NoKeywords("Assembler", kwargs) ||
+      !PyArg_ParseTuple(args, ":Assembler")) {
+    return NULL;
+  }
+  return type->tp_alloc(type, 0);
+}
+
+static void
+Assembler_dealloc(Assembler* self) {
+  PyMem_Free(self->items);
+  PyMem_Free(self->code);
+  PyMem_Free(self->labels);
+  PyMem_Free(self->offsets);
+  PyMem_Free(self->relocations);
+  PyMem_Free(self->epilogues);
+  PyMem_Free(self->addresses);
+  Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+PyTypeObject AssemblerType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "_cinder.Assembler",
+  .tp_doc = "Assembles a single function (see src/asm.h).",
+  .tp_basicsize = sizeof(Assembler),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_new = Assembler_new,
+  .tp_dealloc = (destructor) Assembler_dealloc,
+  .tp_methods = Assembler_methods,
+  .tp_getset = Assembler_getset,
+};
+
+static PyObject*
+MachineCode_get_address(MachineCode* self, void* closure) {
+  return PyLong_FromVoidPtr(self->memory + self->entry);
+}
+
+static PyObject*
+MachineCode_get_code(MachineCode* self, void* closure) {
+  return PyBytes_FromStringAndSize((const char*) self->memory + self->entry,
+                                   self->end - self->entry);
+}
+
+static PyGetSetDef MachineCode_getset[] = {
+  {"address", (getter) MachineCode_get_address, NULL,
+   "The address of the entry point.", NULL},
+  {"code", (getter) MachineCode_get_code, NULL,
+   "The bytes of the function, starting at the entry point.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyMemberDef MachineCode_members[] = {
+  {"relocations", T_OBJECT, offsetof(MachineCode, relocations), READONLY,
+   "The offsets in code of the absolute addresses that it embeds."},
+  {NULL, 0, 0, 0, NULL}
+};
+
+static PyObject*
+MachineCode_new(PyTypeObject* type, PyObject* args, PyObject* kwargs) {
+  Py_buffer code;
+  Py_ssize_t entry = 0;
+  if (!_PyArg_NoKeywords("MachineCode", kwargs) ||
+      !PyArg_ParseTuple(args, "y*|n:MachineCode", &code, &entry)) {
+    return NULL;
+  }
+  if (entry < 0 || entry > code.len) {
+    PyBuffer_Release(&code);
+    PyErr_SetString(PyExc_ValueError, "entry point is out of range");
+    return NULL;
+  }
+  PyObject* relocations = PyTuple_New(0);
+  MachineCode* result = NULL;
+  if (relocations != NULL) {
+    result = load_code(code.buf, code.len, entry, relocations);
+  }
+  PyBuffer_Release(&code);
+  return (PyObject*) result;
+}
+
+static void
+MachineCode_dealloc(MachineCode* self) {
+  munmap(self->memory, self->mapped_size);
+  Py_XDECREF(self->relocations);
+  PyObject_Del(self);
+}
+
+PyTypeObject MachineCodeType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "_cinder.MachineCode",
+  .tp_doc = "MachineCode(code, entry=0)\n\nExecutable code produced by an "
+            "Assembler, or a copy of code, which must not need relocating, "
+            "that is entered at offset entry. The code is released when this "
+            "is destroyed.",
+  .tp_basicsize = sizeof(MachineCode),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_new = MachineCode_new,
+  .tp_dealloc = (destructor) MachineCode_dealloc,
+  .tp_members = MachineCode_members,
+  .tp_getset = MachineCode_getset,
+};
+
+int
+cinder_asm_init(PyObject* module) {
+  if (PyType_Ready(&AssemblerType) < 0 || PyType_Ready(&MachineCodeType) < 0) {
+    return -1;
+  }
+  PyObject* ops = PyDict_New();
+  if (ops == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < ASM_NUM_OPS; i++) {
+    PyObject* value = PyLong_FromLong(i);
+    int err = value == NULL ? -1 : PyDict_SetItemString(ops, op_names[i], value);
+    Py_XDECREF(value);
+    if (err < 0) {
+      Py_DECREF(ops);
+      return -1;
+    }
+  }
+  for (size_t i = 0; i < sizeof(op_aliases) / sizeof(op_aliases[0]); i++) {
+    PyObject* value = PyLong_FromLong(op_aliases[i].op);
+    int err = value == NULL ? -1 : PyDict_SetItemString(ops, op_aliases[i].name, value);
+    Py_XDECREF(value);
+    if (err < 0) {
+      Py_DECREF(ops);
+      return -1;
+    }
+  }
+  Py_INCREF(&AssemblerType);
+  Py_INCREF(&MachineCodeType);
+  if (PyModule_AddObject(module, "Assembler", (PyObject*) &AssemblerType) < 0 ||
+      PyModule_AddObject(module, "MachineCode", (PyObject*) &MachineCodeType) < 0 ||
+      PyModule_AddObject(module, "ASM_OPS", ops) < 0 ||
+      PyModule_AddIntConstant(module, "ASM_REGISTER", ASM_REGISTER) < 0 ||
+      PyModule_AddIntConstant(module, "ASM_MEMORY", ASM_MEMORY) < 0 ||
+      PyModule_AddIntConstant(module, "ASM_LABEL", ASM_LABEL) < 0 ||
+      PyModule_AddIntConstant(module, "ASM_ADDRESS", ASM_ADDRESS) < 0) {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Python.h>
+
+// A small x86-64 assembler for the code generator.
+//
+// Only the instructions and operand forms that cinder.codegen.x64 emits are
+// supported. Instructions are checked and recorded as they are emitted, which
+// needs the GIL to read their operands. Encoding them, resolving the jumps to
+// labels, and copying the code into executable memory is left to finalize(),
+// which releases the GIL while it does so, so that threads running Python code
+// are not stalled by a compilation on another thread. Invalid operand
+// combinations are therefore reported by finalize().
+//
+// Operands are passed from Python in a compact form (see cinder.codegen.asm):
+//
+//   - Integers are immediates.
+//   - (ASM_REGISTER, number, size) is a register.
+//   - (ASM_MEMORY, base, index, scale, displacement, size) is a memory
+//     operand. base and index are register numbers, or -1 if absent. A size of
+//     0 means that the size is implied by the other operand.
+//   - (ASM_LABEL, id) is a label returned by Assembler.new_label().
+//   - (ASM_ADDRESS, value) is an absolute address that must be relocated if
+//     the code is loaded into another process (see cinder.code_cache). It may
+//     only be moved into a 64 bit register.
+//   - A single element list [x] is the memory operand addressed by x, which is
+//     either a register or a memory operand.
+//
+// Registers are numbered as in their encoding (rax = 0, ..., r15 = 15) and
+// sizes are in bytes.
+//
+// Assembler.ret() emits the function epilogue. The callee saved registers that
+// a function uses are pushed on entry and popped before each return. Since
+// the set is only known once the whole function has been assembled, space is
+// reserved for the prologue and each epilogue and filled in by finalize().
+
+#define ASM_REGISTER 1
+#define ASM_MEMORY 2
+#define ASM_LABEL 3
+#define ASM_ADDRESS 4
+
+typedef enum {
+  ASM_MOV,
+  ASM_MOVSXD,
+  ASM_LEA,
+  ASM_ADD,
+  ASM_OR,
+  ASM_AND,
+  ASM_SUB,
+  ASM_XOR,
+  ASM_CMP,
+  ASM_TEST,
+  ASM_IMUL,
+  ASM_INC,
+  ASM_DEC,
+  ASM_PUSH,
+  ASM_POP,
+  ASM_CALL,
+  ASM_JMP,
+  ASM_JO,
+  ASM_JNO,
+  ASM_JB,
+  ASM_JAE,
+  ASM_JE,
+  ASM_JNE,
+  ASM_JBE,
+  ASM_JA,
+  ASM_JS,
+  ASM_JNS,
+  ASM_JL,
+  ASM_JGE,
+  ASM_JLE,
+  ASM_JG,
+  ASM_NUM_OPS,
+} AsmOp;
+
+extern PyTypeObject AssemblerType;
+extern PyTypeObject MachineCodeType;
+
+// Readies the types and adds them, along with the names of the operations, to
+// module. Returns -1 on error.
+int cinder_asm_init(PyObject* module);
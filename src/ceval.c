@@ -14,6 +14,9 @@
 #include <ctype.h>
 
 #include "cinder.h"
+#include "osr.h"
+#include "profile.h"
+#include "tierup.h"
 
 
 typedef PyObject *(*callproc)(PyObject *, PyObject *, PyObject *);
@@ -142,8 +145,24 @@ static void restore_and_clear_exc_state(PyThreadState *, PyFrameObject *);
 static int do_raise(PyObject *, PyObject *);
 static int unpack_iterable(PyObject *, int, int, PyObject **);
 
+static PyObject *eval_frame(PyFrameObject *, int, int);
+
 PyObject *
 cinder_eval_frame(PyFrameObject *f, int throwflag)
+{
+    return eval_frame(f, throwflag, 0);
+}
+
+/* Frames that resume compiled code after a guard failure must not enter the
+   same code again, even if they resume at the first instruction */
+PyObject *
+cinder_eval_resumed_frame(PyFrameObject *f)
+{
+    return eval_frame(f, 0, 1);
+}
+
+static PyObject *
+eval_frame(PyFrameObject *f, int throwflag, int resumed)
 {
     PyObject **stack_pointer;  /* Next free slot in value stack */
     const _Py_CODEUNIT *next_instr;
@@ -158,6 +177,8 @@ cinder_eval_frame(PyFrameObject *f, int throwflag)
     const _Py_CODEUNIT *first_instr;
     PyObject *names;
     PyObject *consts;
+    CodeProfile *profile = NULL;        /* Type feedback, if profiling */
+    int pending_branch = -1;            /* Offset of the last branch */
 
 /* Computed GOTOs, or
        the-optimization-commonly-but-improperly-known-as-"threaded code"
@@ -345,6 +366,22 @@ cinder_eval_frame(PyFrameObject *f, int throwflag)
     if (throwflag) /* support for generator.throw() */
         goto error;
 
+    cinder_safepoint();
+    if (f->f_lasti == -1 && !resumed && cinder_tierup_enabled()) {
+        jit_function_entry_t entry = cinder_tierup(f);
+        if (entry != NULL) {
+            /* The compiled code borrows its arguments from the frame */
+            retval = entry(fastlocals);
+            if (retval == NULL)
+                goto error;
+            why = WHY_RETURN;
+            goto fast_block_end;
+        }
+    }
+    if (cinder_profiling_enabled() && cinder_tierup_should_profile(f)) {
+        profile = cinder_get_profile(co);
+    }
+
     for (;;) {
         assert(stack_pointer >= f->f_valuestack); /* else underflow */
         assert(STACK_LEVEL() <= co->co_stacksize);  /* else overflow */
@@ -357,6 +394,15 @@ cinder_eval_frame(PyFrameObject *f, int throwflag)
 
         NEXTOPARG();
     dispatch_opcode:
+        if (profile != NULL) {
+            cinder_profile_instruction(
+                profile,
+                INSTR_OFFSET() - sizeof(_Py_CODEUNIT),
+                opcode,
+                oparg,
+                stack_pointer,
+                &pending_branch);
+        }
         switch (opcode) {
 
         /* BEWARE!
@@ -2112,6 +2158,23 @@ cinder_eval_frame(PyFrameObject *f, int throwflag)
         }
 
         TARGET(JUMP_ABSOLUTE) {
+            if (oparg < (int) INSTR_OFFSET()) {
+                cinder_safepoint();
+                osr_entry_t entry = NULL;
+                if (cinder_osr_enabled())
+                    entry = cinder_osr_backedge(f, oparg);
+                if (entry != NULL) {
+                    /* The compiled code takes ownership of the operand stack
+                       and has no block stack */
+                    retval = entry(fastlocals, f->f_valuestack);
+                    stack_pointer = f->f_valuestack;
+                    f->f_iblock = 0;
+                    if (retval == NULL)
+                        goto error;
+                    why = WHY_RETURN;
+                    goto fast_block_end;
+                }
+            }
             JUMPTO(oparg);
             DISPATCH();
         }
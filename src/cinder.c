@@ -1,19 +1,30 @@
 #include <Python.h>
 #include <frameobject.h>
+#include <longintrepr.h>
+#include <stddef.h>
 
+#include "asm.h"
 #include "cinder.h"
+#include "osr.h"
+#include "profile.h"
+#include "tierup.h"
 
 static int
 JitFunction_init(JitFunction* self, PyObject* args, PyObject* kwargs) {
   (void) kwargs;
 
   unsigned long address;
+  unsigned long register_address = 0;
+  Py_ssize_t num_args = 0;
   PyObject* code_handle;
-  if (!PyArg_ParseTuple(args, "Ok", &code_handle, &address)) {
+  if (!PyArg_ParseTuple(args, "Ok|kn", &code_handle, &address,
+                        &register_address, &num_args)) {
     return -1;
   }
 
   self->entry = (jit_function_entry_t) address;
+  self->register_entry = (void*) register_address;
+  self->num_args = num_args;
   Py_INCREF(code_handle);
   self->code_handle = code_handle;
 
@@ -23,6 +34,9 @@ JitFunction_init(JitFunction* self, PyObject* args, PyObject* kwargs) {
 static void
 JitFunction_dealloc(JitFunction* self)
 {
+    if (self->weakreflist != NULL) {
+      PyObject_ClearWeakRefs((PyObject*) self);
+    }
     Py_DECREF(self->code_handle);
     Py_TYPE(self)->tp_free((PyObject *) self);
 }
@@ -30,15 +44,60 @@ JitFunction_dealloc(JitFunction* self)
 static PyObject*
 JitFunction_call(JitFunction* self, PyObject* args, PyObject* kwargs) {
   // TODO(mpage): Make this real - keywords and defaulting
-  Py_ssize_t num_items = PyTuple_Size(args);
+  if (kwargs != NULL && PyDict_Size(kwargs) != 0) {
+    PyErr_SetString(PyExc_TypeError, "jit functions do not take keyword arguments");
+    return NULL;
+  }
+  if (self->num_args < 0) {
+    // OSR entries take a frame's locals and operand stack (see osr.h)
+    PyErr_SetString(PyExc_TypeError, "OSR entries cannot be called from Python");
+    return NULL;
+  }
+  // The entry reads exactly num_args arguments from the array
+  Py_ssize_t num_items = PyTuple_GET_SIZE(args);
+  if (num_items != self->num_args) {
+    PyErr_Format(PyExc_TypeError, "jit function takes %zd arguments (%zd given)",
+                 self->num_args, num_items);
+    return NULL;
+  }
   PyObject** items = (PyObject**) alloca(num_items * sizeof(PyObject*));
   assert(items != NULL);
-  for (int i = 0; i < num_items; i++) {
-    items[i] = PyTuple_GetItem(args, i);
+  for (Py_ssize_t i = 0; i < num_items; i++) {
+    items[i] = PyTuple_GET_ITEM(args, i);
   }
   return self->entry(items);
 }
 
+static PyObject*
+JitFunction_replace(JitFunction* self, PyObject* other) {
+  if (Py_TYPE(other) != Py_TYPE(self)) {
+    PyErr_SetString(PyExc_TypeError, "expected a JitFunction");
+    return NULL;
+  }
+  JitFunction* replacement = (JitFunction*) other;
+  if (replacement->num_args != self->num_args) {
+    PyErr_SetString(PyExc_ValueError, "replacement takes a different number of arguments");
+    return NULL;
+  }
+  // The old code may still be executing (e.g. if it is being replaced after
+  // deoptimizing), and compiled callers may embed its address, so it must be
+  // kept alive.
+  PyObject* code_handle = PyTuple_Pack(2, replacement->code_handle, self->code_handle);
+  if (code_handle == NULL) {
+    return NULL;
+  }
+  Py_SETREF(self->code_handle, code_handle);
+  self->entry = replacement->entry;
+  self->register_entry = replacement->register_entry;
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef JitFunction_methods[] = {
+  {"replace", (PyCFunction) JitFunction_replace, METH_O,
+   "Replace the code of this function with the code of another."},
+  {NULL, NULL, 0, NULL}
+};
+
 PyTypeObject JitFunctionType = {
   PyVarObject_HEAD_INIT(NULL, 0)
   .tp_name = "cinder.JitFunction",
@@ -50,14 +109,31 @@ PyTypeObject JitFunctionType = {
   .tp_init = (initproc) JitFunction_init,
   .tp_dealloc = (destructor) JitFunction_dealloc,
   .tp_call = (ternaryfunc) JitFunction_call,
+  .tp_methods = JitFunction_methods,
+  .tp_weaklistoffset = offsetof(JitFunction, weakreflist),
 };
 
 static _PyFrameEvalFunction old_eval_frame = NULL;
 
+static int policy_installed = 0;
+
 extern PyObject* cinder_eval_frame(PyFrameObject* f, int throwflag);
 
 static PyObject *
 cinder_install_interpreter(PyObject *self, PyObject* args) {
+  PyObject* policy = Py_None;
+  if (!PyArg_ParseTuple(args, "|O", &policy)) {
+    return NULL;
+  }
+  if (cinder_set_tierup_policy(policy) < 0) {
+    return NULL;
+  }
+  // Compiled code is specialized using the type feedback recorded by the
+  // interpreter
+  if (policy != Py_None) {
+    cinder_set_profiling_enabled(1);
+  }
+  policy_installed = policy != Py_None;
   PyThreadState *tstate = PyThreadState_GET();
   old_eval_frame = tstate->interp->eval_frame;
   tstate->interp->eval_frame = cinder_eval_frame;
@@ -70,14 +146,162 @@ cinder_uninstall_interpreter(PyObject *self, PyObject* args) {
   // TODO(mpage): Check that old_eval_frame is not null. Raise an
   // exception if so.
   tstate->interp->eval_frame = old_eval_frame;
+  if (policy_installed) {
+    cinder_set_tierup_policy(Py_None);
+    cinder_set_profiling_enabled(0);
+    policy_installed = 0;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_publish(PyObject *self, PyObject* args) {
+  PyObject* code;
+  PyObject* result;
+  PyObject* offset = Py_None;
+  if (!PyArg_ParseTuple(args, "O!O|O", &PyCode_Type, &code, &result, &offset)) {
+    return NULL;
+  }
+  int err;
+  if (offset == Py_None) {
+    err = cinder_publish_compiled((PyCodeObject*) code, result);
+  } else {
+    long target = PyLong_AsLong(offset);
+    if (target == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    err = cinder_osr_publish((PyCodeObject*) code, (int) target, result);
+  }
+  if (err < 0) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_enter_compiler_func(PyObject *self, PyObject* args) {
+  cinder_enter_compiler();
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_leave_compiler_func(PyObject *self, PyObject* args) {
+  cinder_leave_compiler();
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_get_compiled_function(PyObject *self, PyObject* code) {
+  if (!PyCode_Check(code)) {
+    PyErr_SetString(PyExc_TypeError, "expected a code object");
+    return NULL;
+  }
+  PyObject* result = cinder_get_compiled((PyCodeObject*) code);
+  if (result == NULL) {
+    Py_RETURN_NONE;
+  }
+  return result;
+}
+
+static PyObject *
+cinder_enable_profiling(PyObject *self, PyObject* args) {
+  cinder_set_profiling_enabled(1);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_disable_profiling(PyObject *self, PyObject* args) {
+  cinder_set_profiling_enabled(0);
   Py_RETURN_NONE;
 }
 
+static PyObject *
+cinder_get_profile_dict(PyObject *self, PyObject* code) {
+  if (!PyCode_Check(code)) {
+    PyErr_SetString(PyExc_TypeError, "expected a code object");
+    return NULL;
+  }
+  return cinder_profile_as_dict((PyCodeObject*) code);
+}
+
+static PyObject *
+cinder_clear_profile_dict(PyObject *self, PyObject* code) {
+  if (!PyCode_Check(code)) {
+    PyErr_SetString(PyExc_TypeError, "expected a code object");
+    return NULL;
+  }
+  cinder_clear_profile((PyCodeObject*) code);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_set_osr_handler_func(PyObject *self, PyObject* args) {
+  PyObject* handler;
+  Py_ssize_t threshold;
+  if (!PyArg_ParseTuple(args, "On", &handler, &threshold)) {
+    return NULL;
+  }
+  if (handler != Py_None && !PyCallable_Check(handler)) {
+    PyErr_SetString(PyExc_TypeError, "OSR handler must be callable or None");
+    return NULL;
+  }
+  cinder_set_osr_handler(handler, threshold);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cinder_type_version_tag(PyObject *self, PyObject* type) {
+  if (!PyType_Check(type)) {
+    PyErr_SetString(PyExc_TypeError, "expected a type");
+    return NULL;
+  }
+  if (!PyType_HasFeature((PyTypeObject*) type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+    Py_RETURN_NONE;
+  }
+  return PyLong_FromUnsignedLong(((PyTypeObject*) type)->tp_version_tag);
+}
+
+static PyObject *
+cinder_dict_version(PyObject *self, PyObject* dict) {
+  if (!PyDict_Check(dict)) {
+    PyErr_SetString(PyExc_TypeError, "expected a dict");
+    return NULL;
+  }
+  return PyLong_FromUnsignedLongLong(((PyDictObject*) dict)->ma_version_tag);
+}
+
 static PyMethodDef cinder_methods[] = {
-  {"install_interpreter",  cinder_install_interpreter, METH_NOARGS,
-   "Install the cinder interpreter loop."},
+  {"install_interpreter",  cinder_install_interpreter, METH_VARARGS,
+   "Install the cinder interpreter loop, optionally compiling hot code "
+   "according to a policy (see cinder.policy)."},
   {"uninstall_interpreter", cinder_uninstall_interpreter, METH_NOARGS,
    "Uninstall the cinder interpreter loop."},
+  {"enable_profiling", cinder_enable_profiling, METH_NOARGS,
+   "Record type feedback for code executed by the cinder interpreter loop."},
+  {"disable_profiling", cinder_disable_profiling, METH_NOARGS,
+   "Stop recording type feedback."},
+  {"get_profile", cinder_get_profile_dict, METH_O,
+   "Return the type feedback recorded for a code object."},
+  {"clear_profile", cinder_clear_profile_dict, METH_O,
+   "Discard the type feedback recorded for a code object."},
+  {"set_osr_handler", cinder_set_osr_handler_func, METH_VARARGS,
+   "Compile hot loops with handler(code, globals, offset) once their headers "
+   "have been the target of threshold back edges. None disables OSR."},
+  {"get_compiled", cinder_get_compiled_function, METH_O,
+   "Return the JitFunction that the interpreter compiled for a code object, "
+   "or None."},
+  {"publish", cinder_publish, METH_VARARGS,
+   "publish(code, result, offset=None): Publish the result of a queued "
+   "compilation of code, or of the loop header at offset in code."},
+  {"enter_compiler", cinder_enter_compiler_func, METH_NOARGS,
+   "Stop counting and compiling code run by the current thread."},
+  {"leave_compiler", cinder_leave_compiler_func, METH_NOARGS,
+   "Undo a call to enter_compiler."},
+  {"type_version_tag", cinder_type_version_tag, METH_O,
+   "Return the version tag of a type, or None if it is not valid."},
+  {"dict_version", cinder_dict_version, METH_O,
+   "Return the version of a dict (see PEP 509), which changes whenever it is "
+   "modified."},
   {NULL, NULL, 0, NULL}
 };
 
@@ -89,12 +313,102 @@ static PyModuleDef cinder_extension_module = {
   .m_size = -1,
 };
 
+// Offsets of the fields that the code generator reads directly
+static int
+add_struct_offset(PyObject* offsets, const char* field, size_t offset) {
+  PyObject* value = PyLong_FromSize_t(offset);
+  if (value == NULL) {
+    return -1;
+  }
+  int err = PyDict_SetItemString(offsets, field, value);
+  Py_DECREF(value);
+  return err;
+}
+
+#define ADD_STRUCT_OFFSET(offsets, type, field) \
+  add_struct_offset(offsets, #type "." #field, offsetof(type, field))
+
+// The iterators for range and list objects are private to rangeobject.c and
+// listobject.c. These must be kept in sync with the definitions there.
+typedef struct {
+  PyObject_HEAD
+  long index;
+  long start;
+  long step;
+  long len;
+} rangeiterobject;
+
+typedef struct {
+  PyObject_HEAD
+  Py_ssize_t it_index;
+  PyListObject* it_seq;
+} listiterobject;
+
+static PyObject*
+make_struct_offsets(void) {
+  PyObject* offsets = PyDict_New();
+  if (offsets == NULL) {
+    return NULL;
+  }
+  if (ADD_STRUCT_OFFSET(offsets, PyObject, ob_refcnt) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyObject, ob_type) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyVarObject, ob_size) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyLongObject, ob_digit) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyListObject, ob_item) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyDictObject, ma_used) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyDictObject, ma_version_tag) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyASCIIObject, length) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyASCIIObject, state) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_dealloc) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_as_number) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_as_sequence) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_as_mapping) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_iternext) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_flags) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyTypeObject, tp_version_tag) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyNumberMethods, nb_bool) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PySequenceMethods, sq_length) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyMappingMethods, mp_length) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, JitFunction, register_entry) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, JitFunction, num_args) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, PyFunctionObject, func_code) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, rangeiterobject, index) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, rangeiterobject, start) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, rangeiterobject, step) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, rangeiterobject, len) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, listiterobject, it_index) < 0 ||
+      ADD_STRUCT_OFFSET(offsets, listiterobject, it_seq) < 0) {
+    Py_DECREF(offsets);
+    return NULL;
+  }
+  return offsets;
+}
+
+// The bit in PyASCIIObject.state that is set once a string is ready. The layout
+// of bitfields is up to the compiler, so let it tell us.
+static unsigned int
+unicode_ready_mask(void) {
+  PyASCIIObject str;
+  unsigned int mask;
+  Py_BUILD_ASSERT(sizeof(str.state) == sizeof(mask));
+  memset(&str.state, 0, sizeof(str.state));
+  str.state.ready = 1;
+  memcpy(&mask, &str.state, sizeof(mask));
+  return mask;
+}
+
 PyMODINIT_FUNC
 PyInit__cinder(void)
 {
   if (PyType_Ready(&JitFunctionType) < 0) {
     return NULL;
   }
+  if (cinder_profile_init() < 0) {
+    return NULL;
+  }
+  if (cinder_osr_init() < 0 || cinder_tierup_init() < 0) {
+    return NULL;
+  }
 
   PyObject* m = PyModule_Create(&cinder_extension_module);
   if (m == NULL) {
@@ -104,5 +418,20 @@ PyInit__cinder(void)
   Py_INCREF(&JitFunctionType);
   PyModule_AddObject(m, "JitFunction", (PyObject *) &JitFunctionType);
 
+  PyObject* offsets = make_struct_offsets();
+  if (offsets == NULL) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  PyModule_AddObject(m, "struct_offsets", offsets);
+  PyModule_AddIntConstant(m, "UNICODE_READY_MASK", unicode_ready_mask());
+  PyModule_AddIntConstant(m, "VALID_VERSION_TAG", Py_TPFLAGS_VALID_VERSION_TAG);
+  Py_INCREF(cinder_compile_pending());
+  PyModule_AddObject(m, "PENDING", cinder_compile_pending());
+  if (cinder_asm_init(m) < 0) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
   return m;
 }
@@ -8,5 +8,16 @@ typedef PyObject* (*jit_function_entry_t)(PyObject**);
 typedef struct {
   PyObject_HEAD
   jit_function_entry_t entry;
+  // Entry point that receives the arguments in registers, following the SysV
+  // calling convention. Only called from generated code. NULL if the function
+  // takes too many arguments to pass them all in registers.
+  void* register_entry;
+  // The number of arguments that the function takes, or -1 for OSR entries,
+  // whose entry is an osr_entry_t (see osr.h) and which cannot be called from
+  // Python
+  Py_ssize_t num_args;
   PyObject* code_handle;
+  PyObject* weakreflist;
 } JitFunction;
+
+extern PyTypeObject JitFunctionType;
@@ -0,0 +1,83 @@
+#include <Python.h>
+#include <frameobject.h>
+#include <opcode.h>
+
+#include "deopt.h"
+
+extern PyObject* cinder_eval_resumed_frame(PyFrameObject* f);
+
+void*
+get_deopt_address(void) {
+  return &cinder_deopt;
+}
+
+PyObject*
+cinder_deopt(PyObject* metadata, PyObject** frame_base, PyObject** stack_top) {
+  PyCodeObject* code;
+  PyObject* globals;
+  int offset;
+  PyObject* borrowed_locals;
+  PyObject* stack;
+  PyObject* blocks;
+  PyObject* on_deopt;
+  if (!PyArg_ParseTuple(metadata, "O!O!iO!O!O!O", &PyCode_Type, &code,
+                        &PyDict_Type, &globals, &offset,
+                        &PyTuple_Type, &borrowed_locals, &PyTuple_Type, &stack,
+                        &PyTuple_Type, &blocks, &on_deopt)) {
+    return NULL;
+  }
+
+  if (on_deopt != Py_None) {
+    PyObject* res = PyObject_CallFunction(on_deopt, "i", offset);
+    if (res == NULL) {
+      PyErr_WriteUnraisable(on_deopt);
+    }
+    Py_XDECREF(res);
+  }
+
+  PyFrameObject* f = PyFrame_New(PyThreadState_GET(), code, globals, NULL);
+  if (f == NULL) {
+    return NULL;
+  }
+  Py_ssize_t num_locals = PyTuple_GET_SIZE(borrowed_locals);
+  for (Py_ssize_t i = 0; i < num_locals; i++) {
+    PyObject* value = frame_base[-(i + 1)];
+    int borrowed = PyObject_IsTrue(PyTuple_GET_ITEM(borrowed_locals, i));
+    if (i < code->co_nlocals) {
+      // The frame takes over the function's locals
+      if (borrowed) {
+        Py_XINCREF(value);
+      }
+      f->f_localsplus[i] = value;
+    } else if (!borrowed) {
+      // e.g. the locals of inlined functions
+      Py_XDECREF(value);
+    }
+  }
+  Py_ssize_t depth = PyTuple_GET_SIZE(stack);
+  for (Py_ssize_t i = 0; i < depth; i++) {
+    PyObject* value = stack_top[depth - i - 1];
+    if (PyObject_IsTrue(PyTuple_GET_ITEM(stack, i))) {
+      Py_INCREF(value);
+    }
+    f->f_valuestack[i] = value;
+  }
+  f->f_stacktop = f->f_valuestack + depth;
+  for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(blocks); i++) {
+    int handler, level;
+    if (!PyArg_ParseTuple(PyTuple_GET_ITEM(blocks, i), "ii", &handler, &level)) {
+      Py_DECREF(f);
+      return NULL;
+    }
+    PyFrame_BlockSetup(f, SETUP_LOOP, handler, level);
+  }
+  // The interpreter resumes at the instruction following f_lasti
+  f->f_lasti = offset - (int) sizeof(_Py_CODEUNIT);
+  if (f->f_lasti < 0) {
+    f->f_lasti = -1;
+  }
+
+  PyObject* result = cinder_eval_resumed_frame(f);
+  Py_DECREF(f);
+  return result;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Python.h>
+
+// Resumes execution of a jit compiled function in the interpreter after one of
+// its guards has failed.
+//
+// metadata describes the state of the function at the guard. It is a tuple of
+//
+//   (code, globals, offset, locals, stack, blocks, on_deopt)
+//
+// where
+//
+//   - offset is the offset of the instruction to resume at.
+//   - locals has an entry for each local variable slot of the compiled
+//     function, which may have more slots than code (e.g. for the locals of
+//     inlined functions), that is true if the slot holds a borrowed reference.
+//   - stack has an entry for each value on the operand stack, from the bottom
+//     up, that is true if the value is a borrowed reference.
+//   - blocks has a (handler, level) pair for each loop that encloses the
+//     instruction, from the outermost in.
+//   - on_deopt is None or a callable that is passed offset before execution
+//     resumes.
+//
+// frame_base points just past the function's local variables, which are
+// stored in reverse order below it, and stack_top points to the top of the
+// operand stack, which grows down. Ownership of the owned locals of code and
+// of the owned values on the operand stack is transferred to the new frame,
+// and the remaining owned locals are released.
+//
+// The new frame always runs in the interpreter, even when it resumes at the
+// first instruction, where a fresh frame would enter the compiled code again.
+//
+// Returns the result of the function.
+PyObject* cinder_deopt(
+    PyObject* metadata,
+    PyObject** frame_base,
+    PyObject** stack_top);
+
+void* get_deopt_address(void);
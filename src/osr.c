@@ -0,0 +1,198 @@
+#include <Python.h>
+#include <code.h>
+#include <frameobject.h>
+#include <opcode.h>
+
+#include "cinder.h"
+#include "osr.h"
+#include "tierup.h"
+
+static Py_ssize_t osr_extra_index = -1;
+
+static PyObject* osr_handler = NULL;
+
+static Py_ssize_t osr_threshold = 0;
+
+typedef struct {
+  // The offset of the loop header
+  int target;
+  // The number of back edges taken to the loop header
+  Py_ssize_t count;
+  // The compiled entry, Py_None if compilation failed, the pending sentinel if
+  // it is queued, or NULL if it has not been attempted
+  PyObject* entry;
+  // The globals that entry was compiled against. A reference is held so that
+  // a different dictionary cannot be allocated at the same address while the
+  // entry exists (the entry's deoptimization metadata refers to it anyway).
+  PyObject* globals;
+} OsrSite;
+
+// The sites of a code object, one for each target of a backward JUMP_ABSOLUTE,
+// which are the only instructions that record back edges
+typedef struct {
+  Py_ssize_t num_sites;
+  OsrSite sites[1];
+} OsrState;
+
+static void
+free_osr_state(void* ptr) {
+  OsrState* state = (OsrState*) ptr;
+  if (state == NULL) {
+    return;
+  }
+  for (Py_ssize_t i = 0; i < state->num_sites; i++) {
+    Py_XDECREF(state->sites[i].entry);
+    Py_XDECREF(state->sites[i].globals);
+  }
+  PyMem_Free(state);
+}
+
+int
+cinder_osr_init(void) {
+  if (osr_extra_index < 0) {
+    osr_extra_index = _PyEval_RequestCodeExtraIndex(free_osr_state);
+  }
+  return osr_extra_index < 0 ? -1 : 0;
+}
+
+int
+cinder_osr_enabled(void) {
+  return osr_handler != NULL && !cinder_in_compiler();
+}
+
+void
+cinder_set_osr_handler(PyObject* handler, Py_ssize_t threshold) {
+  if (handler == Py_None) {
+    handler = NULL;
+  }
+  Py_XINCREF(handler);
+  Py_XSETREF(osr_handler, handler);
+  osr_threshold = threshold;
+}
+
+static OsrSite*
+find_site(OsrState* state, int target) {
+  for (Py_ssize_t i = 0; i < state->num_sites; i++) {
+    if (state->sites[i].target == target) {
+      return &state->sites[i];
+    }
+  }
+  return NULL;
+}
+
+static OsrState*
+get_osr_state(PyCodeObject* co) {
+  void* extra = NULL;
+  if (osr_extra_index < 0 ||
+      _PyCode_GetExtra((PyObject*) co, osr_extra_index, &extra) < 0) {
+    PyErr_Clear();
+    return NULL;
+  }
+  if (extra != NULL) {
+    return (OsrState*) extra;
+  }
+  _Py_CODEUNIT* code = (_Py_CODEUNIT*) PyBytes_AS_STRING(co->co_code);
+  Py_ssize_t num_instrs = PyBytes_GET_SIZE(co->co_code) / sizeof(_Py_CODEUNIT);
+  Py_ssize_t num_jumps = 0;
+  for (Py_ssize_t i = 0; i < num_instrs; i++) {
+    if (_Py_OPCODE(code[i]) == JUMP_ABSOLUTE) {
+      num_jumps++;
+    }
+  }
+  OsrState* state = PyMem_Calloc(
+      1, sizeof(OsrState) + num_jumps * sizeof(OsrSite));
+  if (state == NULL) {
+    return NULL;
+  }
+  int oparg = 0;
+  for (Py_ssize_t i = 0; i < num_instrs; i++) {
+    int opcode = _Py_OPCODE(code[i]);
+    oparg = (oparg << 8) | _Py_OPARG(code[i]);
+    if (opcode == EXTENDED_ARG) {
+      continue;
+    }
+    int next = (int) ((i + 1) * sizeof(_Py_CODEUNIT));
+    if (opcode == JUMP_ABSOLUTE && oparg < next && find_site(state, oparg) == NULL) {
+      state->sites[state->num_sites++].target = oparg;
+    }
+    oparg = 0;
+  }
+  if (_PyCode_SetExtra((PyObject*) co, osr_extra_index, state) < 0) {
+    PyErr_Clear();
+    PyMem_Free(state);
+    return NULL;
+  }
+  return state;
+}
+
+// Only frames whose block stack consists entirely of loops can be replaced;
+// compiled code has no equivalent of the other blocks.
+static int
+can_replace(PyFrameObject* f) {
+  if (f->f_code->co_flags & (CO_GENERATOR | CO_COROUTINE | CO_ASYNC_GENERATOR)) {
+    return 0;
+  }
+  for (int i = 0; i < f->f_iblock; i++) {
+    if (f->f_blockstack[i].b_type != SETUP_LOOP) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Returns a new reference to the entry for the loop header at target, to the
+// pending sentinel, or to None if it cannot be compiled
+static PyObject*
+compile_entry(PyFrameObject* f, int target) {
+  PyObject* args = Py_BuildValue("OOi", f->f_code, f->f_globals, target);
+  if (args == NULL) {
+    PyErr_Clear();
+    Py_RETURN_NONE;
+  }
+  PyObject* entry = cinder_call_compiler(osr_handler, args);
+  Py_DECREF(args);
+  return entry;
+}
+
+osr_entry_t
+cinder_osr_backedge(PyFrameObject* f, int target) {
+  OsrState* state = get_osr_state(f->f_code);
+  if (state == NULL) {
+    return NULL;
+  }
+  OsrSite* site = find_site(state, target);
+  if (site == NULL) {
+    return NULL;
+  }
+  if (site->entry == NULL) {
+    if (++site->count < osr_threshold || !can_replace(f)) {
+      return NULL;
+    }
+    site->entry = compile_entry(f, target);
+    Py_INCREF(f->f_globals);
+    Py_XSETREF(site->globals, f->f_globals);
+  }
+  if (site->entry == Py_None || site->entry == cinder_compile_pending() ||
+      site->globals != f->f_globals || !can_replace(f)) {
+    return NULL;
+  }
+  // The JitFunctions of OSR entries hold an osr_entry_t in place of the usual
+  // entry (see cinder.codegen.x64._link)
+  return (osr_entry_t) (void*) ((JitFunction*) site->entry)->entry;
+}
+
+int
+cinder_osr_publish(PyCodeObject* co, int target, PyObject* entry) {
+  OsrState* state = get_osr_state(co);
+  OsrSite* site = state == NULL ? NULL : find_site(state, target);
+  if (site == NULL) {
+    PyErr_SetString(PyExc_ValueError, "no compilation is pending");
+    return -1;
+  }
+  if (cinder_check_published(site->entry, entry) < 0) {
+    return -1;
+  }
+  Py_INCREF(entry);
+  Py_SETREF(site->entry, entry);
+  return 0;
+}
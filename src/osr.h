@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Python.h>
+#include <frameobject.h>
+
+// On-stack replacement (OSR) of loops running in cinder_eval_frame.
+//
+// A function that is entered once and then loops for a long time never
+// benefits from being compiled on entry. Instead, the interpreter counts the
+// back edges taken to each loop header. Once a header has been the target of
+// enough back edges, the OSR handler is asked to compile an entry point that
+// continues the loop in machine code. The frame's locals and operand stack are
+// handed to the entry, which runs the rest of the function and returns its
+// result.
+//
+// Each loop header is compiled at most once. Headers that fail to compile are
+// remembered and left to the interpreter.
+
+// Continues execution of a function at a loop header. locals are the frame's
+// local variables, which remain owned by the frame, and stack is the bottom of
+// its operand stack. Ownership of the values on the operand stack is
+// transferred to the entry.
+typedef PyObject* (*osr_entry_t)(PyObject** locals, PyObject** stack);
+
+// Sets up the co_extra slot used to store back edge counts. Returns -1 on
+// error.
+int cinder_osr_init(void);
+
+int cinder_osr_enabled(void);
+
+// Sets the callable that compiles OSR entries. It is called with the code
+// object, the globals of the frame and the offset of the loop header, and
+// returns a JitFunction whose entry is an osr_entry_t, or None if the loop
+// cannot be compiled (see tierup.h for queued compilation). Compilation is triggered once a loop header has been the
+// target of threshold back edges. Passing None disables OSR.
+void cinder_set_osr_handler(PyObject* handler, Py_ssize_t threshold);
+
+// Publishes the result of a queued compilation of the loop header at target (a
+// JitFunction, or None if it failed). Returns -1 with an exception set if no
+// compilation of it is pending.
+int cinder_osr_publish(PyCodeObject* co, int target, PyObject* entry);
+
+// Records a back edge to the instruction at target in f. Returns the entry to
+// continue at, or NULL if execution should remain in the interpreter. Never
+// sets an exception.
+osr_entry_t cinder_osr_backedge(PyFrameObject* f, int target);
@@ -0,0 +1,348 @@
+#include <Python.h>
+#include <code.h>
+#include <opcode.h>
+
+#include "profile.h"
+
+static Py_ssize_t profile_extra_index = -1;
+
+static int profiling_enabled = 0;
+
+static int
+site_kind(int opcode, int* num_operands) {
+  switch (opcode) {
+    case LOAD_ATTR:
+    case STORE_ATTR:
+      *num_operands = 1;
+      return PROFILE_SITE_TYPES;
+    case BINARY_POWER:
+    case BINARY_MULTIPLY:
+    case BINARY_MATRIX_MULTIPLY:
+    case BINARY_MODULO:
+    case BINARY_ADD:
+    case BINARY_SUBTRACT:
+    case BINARY_SUBSCR:
+    case BINARY_FLOOR_DIVIDE:
+    case BINARY_TRUE_DIVIDE:
+    case BINARY_LSHIFT:
+    case BINARY_RSHIFT:
+    case BINARY_AND:
+    case BINARY_XOR:
+    case BINARY_OR:
+    case INPLACE_POWER:
+    case INPLACE_MULTIPLY:
+    case INPLACE_MATRIX_MULTIPLY:
+    case INPLACE_MODULO:
+    case INPLACE_ADD:
+    case INPLACE_SUBTRACT:
+    case INPLACE_FLOOR_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+    case INPLACE_LSHIFT:
+    case INPLACE_RSHIFT:
+    case INPLACE_AND:
+    case INPLACE_XOR:
+    case INPLACE_OR:
+    case COMPARE_OP:
+      *num_operands = 2;
+      return PROFILE_SITE_TYPES;
+    case CALL_FUNCTION:
+      *num_operands = 1;
+      return PROFILE_SITE_CALLEE;
+    case POP_JUMP_IF_FALSE:
+    case POP_JUMP_IF_TRUE:
+    case JUMP_IF_FALSE_OR_POP:
+    case JUMP_IF_TRUE_OR_POP:
+      *num_operands = 0;
+      return PROFILE_SITE_BRANCH;
+    default:
+      return -1;
+  }
+}
+
+static void
+free_profile(void* ptr) {
+  CodeProfile* profile = (CodeProfile*) ptr;
+  if (profile == NULL) {
+    return;
+  }
+  for (Py_ssize_t i = 0; i < profile->num_sites; i++) {
+    ProfileSite* site = &profile->sites[i];
+    if (site->kind == PROFILE_SITE_BRANCH) {
+      continue;
+    }
+    for (int j = 0; j < site->num_operands; j++) {
+      for (int k = 0; k < PROFILE_MAX_TYPES; k++) {
+        Py_XDECREF(site->u.values[j][k]);
+      }
+    }
+  }
+  PyMem_Free(profile->site_indices);
+  PyMem_Free(profile);
+}
+
+int
+cinder_profile_init(void) {
+  if (profile_extra_index < 0) {
+    profile_extra_index = _PyEval_RequestCodeExtraIndex(free_profile);
+  }
+  return profile_extra_index < 0 ? -1 : 0;
+}
+
+int
+cinder_profiling_enabled(void) {
+  return profiling_enabled;
+}
+
+void
+cinder_set_profiling_enabled(int enabled) {
+  profiling_enabled = enabled;
+}
+
+CodeProfile*
+cinder_find_profile(PyCodeObject* co) {
+  void* extra = NULL;
+  if (profile_extra_index < 0 ||
+      _PyCode_GetExtra((PyObject*) co, profile_extra_index, &extra) < 0) {
+    PyErr_Clear();
+    return NULL;
+  }
+  return (CodeProfile*) extra;
+}
+
+static CodeProfile*
+new_profile(PyCodeObject* co) {
+  const _Py_CODEUNIT* code = (_Py_CODEUNIT*) PyBytes_AS_STRING(co->co_code);
+  Py_ssize_t num_instrs = PyBytes_GET_SIZE(co->co_code) / sizeof(_Py_CODEUNIT);
+  Py_ssize_t num_sites = 0;
+  int num_operands;
+  for (Py_ssize_t i = 0; i < num_instrs; i++) {
+    if (site_kind(_Py_OPCODE(code[i]), &num_operands) >= 0) {
+      num_sites++;
+    }
+  }
+
+  CodeProfile* profile = PyMem_Calloc(
+      1, sizeof(CodeProfile) + num_sites * sizeof(ProfileSite));
+  if (profile == NULL) {
+    return NULL;
+  }
+  profile->site_indices = PyMem_Malloc(num_instrs * sizeof(int32_t));
+  if (profile->site_indices == NULL) {
+    PyMem_Free(profile);
+    return NULL;
+  }
+  profile->num_sites = num_sites;
+  Py_ssize_t site = 0;
+  for (Py_ssize_t i = 0; i < num_instrs; i++) {
+    int kind = site_kind(_Py_OPCODE(code[i]), &num_operands);
+    if (kind < 0) {
+      profile->site_indices[i] = -1;
+      continue;
+    }
+    profile->sites[site].kind = kind;
+    profile->sites[site].num_operands = num_operands;
+    profile->site_indices[i] = site++;
+  }
+  return profile;
+}
+
+CodeProfile*
+cinder_get_profile(PyCodeObject* co) {
+  CodeProfile* profile = cinder_find_profile(co);
+  if (profile == NULL) {
+    if (profile_extra_index < 0) {
+      return NULL;
+    }
+    profile = new_profile(co);
+    if (profile == NULL) {
+      return NULL;
+    }
+    if (_PyCode_SetExtra((PyObject*) co, profile_extra_index, profile) < 0) {
+      PyErr_Clear();
+      free_profile(profile);
+      return NULL;
+    }
+  }
+  if (profile->executions >= PROFILE_MAX_EXECUTIONS) {
+    return NULL;
+  }
+  profile->executions++;
+  return profile;
+}
+
+void
+cinder_clear_profile(PyCodeObject* co) {
+  if (cinder_find_profile(co) == NULL) {
+    return;
+  }
+  // This releases the existing profile using free_profile
+  if (_PyCode_SetExtra((PyObject*) co, profile_extra_index, NULL) < 0) {
+    PyErr_Clear();
+  }
+}
+
+static ProfileSite*
+get_site(CodeProfile* profile, int offset) {
+  int32_t index = profile->site_indices[offset / sizeof(_Py_CODEUNIT)];
+  if (index < 0) {
+    return NULL;
+  }
+  return &profile->sites[index];
+}
+
+static void
+record_value(ProfileSite* site, int operand, PyObject* value) {
+  if (site->megamorphic & (1 << operand)) {
+    return;
+  }
+  PyObject** values = site->u.values[operand];
+  for (int i = 0; i < PROFILE_MAX_TYPES; i++) {
+    if (values[i] == value) {
+      return;
+    }
+    if (values[i] == NULL) {
+      Py_INCREF(value);
+      values[i] = value;
+      return;
+    }
+  }
+  site->megamorphic |= 1 << operand;
+}
+
+void
+cinder_profile_instruction(
+    CodeProfile* profile,
+    int offset,
+    int opcode,
+    int oparg,
+    PyObject** stack_pointer,
+    int* pending_branch) {
+  ProfileSite* site;
+  if (*pending_branch >= 0) {
+    site = get_site(profile, *pending_branch);
+    if (offset == *pending_branch + (int) sizeof(_Py_CODEUNIT)) {
+      site->u.branch.not_taken++;
+    } else {
+      site->u.branch.taken++;
+    }
+    *pending_branch = -1;
+  }
+
+  site = get_site(profile, offset);
+  if (site == NULL) {
+    return;
+  }
+  switch (site->kind) {
+    case PROFILE_SITE_TYPES:
+      if (site->num_operands == 1) {
+        record_value(site, 0, (PyObject*) Py_TYPE(stack_pointer[-1]));
+      } else {
+        record_value(site, 0, (PyObject*) Py_TYPE(stack_pointer[-2]));
+        record_value(site, 1, (PyObject*) Py_TYPE(stack_pointer[-1]));
+      }
+      break;
+    case PROFILE_SITE_CALLEE:
+      record_value(site, 0, stack_pointer[-oparg - 1]);
+      break;
+    case PROFILE_SITE_BRANCH:
+      *pending_branch = offset;
+      break;
+  }
+}
+
+static PyObject*
+operand_values(ProfileSite* site, int operand) {
+  if (site->megamorphic & (1 << operand)) {
+    Py_RETURN_NONE;
+  }
+  PyObject** values = site->u.values[operand];
+  int num_values = 0;
+  while (num_values < PROFILE_MAX_TYPES && values[num_values] != NULL) {
+    num_values++;
+  }
+  PyObject* result = PyTuple_New(num_values);
+  if (result == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < num_values; i++) {
+    Py_INCREF(values[i]);
+    PyTuple_SET_ITEM(result, i, values[i]);
+  }
+  return result;
+}
+
+static PyObject*
+site_as_object(ProfileSite* site) {
+  switch (site->kind) {
+    case PROFILE_SITE_TYPES: {
+      if (site->u.values[0][0] == NULL) {
+        Py_RETURN_NONE;
+      }
+      PyObject* result = PyTuple_New(site->num_operands);
+      if (result == NULL) {
+        return NULL;
+      }
+      for (int i = 0; i < site->num_operands; i++) {
+        PyObject* values = operand_values(site, i);
+        if (values == NULL) {
+          Py_DECREF(result);
+          return NULL;
+        }
+        PyTuple_SET_ITEM(result, i, values);
+      }
+      return result;
+    }
+    case PROFILE_SITE_CALLEE:
+      if (site->u.values[0][0] == NULL) {
+        Py_RETURN_NONE;
+      }
+      return operand_values(site, 0);
+    case PROFILE_SITE_BRANCH:
+      if (site->u.branch.taken == 0 && site->u.branch.not_taken == 0) {
+        Py_RETURN_NONE;
+      }
+      return Py_BuildValue(
+          "(KK)",
+          (unsigned long long) site->u.branch.taken,
+          (unsigned long long) site->u.branch.not_taken);
+  }
+  Py_RETURN_NONE;
+}
+
+PyObject*
+cinder_profile_as_dict(PyCodeObject* co) {
+  PyObject* result = PyDict_New();
+  if (result == NULL) {
+    return NULL;
+  }
+  CodeProfile* profile = cinder_find_profile(co);
+  if (profile == NULL) {
+    return result;
+  }
+  Py_ssize_t num_instrs = PyBytes_GET_SIZE(co->co_code) / sizeof(_Py_CODEUNIT);
+  for (Py_ssize_t i = 0; i < num_instrs; i++) {
+    if (profile->site_indices[i] < 0) {
+      continue;
+    }
+    ProfileSite* site = &profile->sites[profile->site_indices[i]];
+    PyObject* value = site_as_object(site);
+    if (value == NULL) {
+      Py_DECREF(result);
+      return NULL;
+    }
+    if (value == Py_None) {
+      // The site has not executed yet
+      Py_DECREF(value);
+      continue;
+    }
+    PyObject* offset = PyLong_FromSsize_t(i * sizeof(_Py_CODEUNIT));
+    int err = offset == NULL ? -1 : PyDict_SetItem(result, offset, value);
+    Py_XDECREF(offset);
+    Py_DECREF(value);
+    if (err < 0) {
+      Py_DECREF(result);
+      return NULL;
+    }
+  }
+  return result;
+}
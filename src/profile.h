@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Python.h>
+
+#include <stdint.h>
+
+// Type feedback collected by cinder_eval_frame.
+//
+// Each code object that is executed while profiling is enabled gets a
+// CodeProfile, stored in its co_extra. The profile has one ProfileSite for each
+// instruction whose operands are interesting to the JIT, and a table mapping
+// instruction indices to sites.
+
+// The number of distinct values recorded for each operand of a site. Operands
+// that take on more values than this are megamorphic.
+#define PROFILE_MAX_TYPES 4
+
+// The number of operands recorded for each site (e.g. both sides of a binary
+// operation)
+#define PROFILE_MAX_OPERANDS 2
+
+// The number of frames running a code object that record type feedback. Later
+// frames run unprofiled, since by then the feedback has either been used to
+// compile the code or is unlikely to change.
+#define PROFILE_MAX_EXECUTIONS 10000
+
+typedef enum {
+  // Records the types of operands (LOAD_ATTR, STORE_ATTR, BINARY_*, INPLACE_*
+  // and COMPARE_OP)
+  PROFILE_SITE_TYPES,
+  // Records the identity of the callee (CALL_FUNCTION)
+  PROFILE_SITE_CALLEE,
+  // Records the direction of a conditional branch
+  PROFILE_SITE_BRANCH,
+} ProfileSiteKind;
+
+typedef struct {
+  unsigned char kind;
+  unsigned char num_operands;
+  // Bit i is set if operand i is megamorphic
+  unsigned char megamorphic;
+  union {
+    // The values are owned references so that they cannot be reused for a
+    // different object while the profile is alive
+    PyObject* values[PROFILE_MAX_OPERANDS][PROFILE_MAX_TYPES];
+    struct {
+      uint64_t taken;
+      uint64_t not_taken;
+    } branch;
+  } u;
+} ProfileSite;
+
+typedef struct {
+  // The number of frames that have recorded feedback in the profile
+  Py_ssize_t executions;
+  Py_ssize_t num_sites;
+  // Maps the index of each instruction to its site, or -1 if the instruction
+  // is not profiled
+  int32_t* site_indices;
+  ProfileSite sites[1];
+} CodeProfile;
+
+// Sets up the co_extra slot used to store profiles. Returns -1 on error.
+int cinder_profile_init(void);
+
+int cinder_profiling_enabled(void);
+
+void cinder_set_profiling_enabled(int enabled);
+
+// Returns the profile that a new frame running co should record feedback in,
+// creating it if necessary. Returns NULL without an exception set if co cannot
+// be profiled or has already been profiled PROFILE_MAX_EXECUTIONS times.
+CodeProfile* cinder_get_profile(PyCodeObject* co);
+
+// Returns the profile for co if one exists
+CodeProfile* cinder_find_profile(PyCodeObject* co);
+
+// Drops the profile for co, if any
+void cinder_clear_profile(PyCodeObject* co);
+
+// Records the operands of the instruction at offset, which has not yet
+// executed. pending_branch holds the offset of the last conditional branch that
+// was executed in the frame, or -1, and is updated as branches are resolved.
+void cinder_profile_instruction(
+    CodeProfile* profile,
+    int offset,
+    int opcode,
+    int oparg,
+    PyObject** stack_pointer,
+    int* pending_branch);
+
+// Converts the profile for co into a dictionary mapping the offsets of sites
+// to the values recorded for them:
+//
+//   - Type sites map to a tuple with an entry for each operand. Each entry is
+//     a tuple of the observed types, or None if the operand is megamorphic.
+//   - Callee sites map to a tuple of the observed callees, or None.
+//   - Branch sites map to a tuple of (taken, not taken) counts.
+//
+// Sites that have not executed are omitted.
+PyObject* cinder_profile_as_dict(PyCodeObject* co);
@@ -0,0 +1,361 @@
+#include <Python.h>
+#include <code.h>
+#include <frameobject.h>
+
+#include "osr.h"
+#include "tierup.h"
+
+static Py_ssize_t tierup_extra_index = -1;
+
+static PyObject* tierup_compile = NULL;
+
+// The installed policy, or NULL
+static PyObject* tierup_policy = NULL;
+
+static Py_ssize_t call_threshold = 0;
+
+// Non-zero while the compiler is running on the current thread, so that the
+// compiler itself is never compiled
+static __thread int compiling = 0;
+
+// Returned by compilers that have queued the work instead of doing it
+static PyObject* pending = NULL;
+
+// The number of queued compilations whose results have not been published
+static Py_ssize_t num_pending = 0;
+
+// The number of safepoints reached since the GIL was last yielded
+static int safepoint_ticks = 0;
+
+typedef struct {
+  // The number of times the code has been entered
+  Py_ssize_t calls;
+  // The compiled function, Py_None if compilation failed, pending if it is
+  // queued, or NULL if it has not been attempted
+  PyObject* jit_function;
+  // Whether the policy has been asked if the code may be compiled
+  int checked;
+  // The globals that jit_function was compiled against. A reference is held
+  // so that a different dictionary cannot be allocated at the same address
+  // while the compiled code exists.
+  PyObject* globals;
+} TierUpState;
+
+static void
+free_tierup_state(void* ptr) {
+  TierUpState* state = (TierUpState*) ptr;
+  if (state == NULL) {
+    return;
+  }
+  Py_XDECREF(state->jit_function);
+  Py_XDECREF(state->globals);
+  PyMem_Free(state);
+}
+
+int
+cinder_tierup_init(void) {
+  if (tierup_extra_index < 0) {
+    tierup_extra_index = _PyEval_RequestCodeExtraIndex(free_tierup_state);
+  }
+  if (pending == NULL) {
+    pending = PyObject_CallObject((PyObject*) &PyBaseObject_Type, NULL);
+  }
+  return tierup_extra_index < 0 || pending == NULL ? -1 : 0;
+}
+
+PyObject*
+cinder_compile_pending(void) {
+  return pending;
+}
+
+void
+cinder_safepoint(void) {
+  if (num_pending == 0 || ++safepoint_ticks < SAFEPOINT_INTERVAL) {
+    return;
+  }
+  safepoint_ticks = 0;
+  // Lets the compiler thread run. If it has been waiting for the GIL it will
+  // have asked for it to be dropped, in which case it is handed over before
+  // this thread can take it back.
+  Py_BEGIN_ALLOW_THREADS
+  Py_END_ALLOW_THREADS
+}
+
+PyObject*
+cinder_call_compiler(PyObject* compiler, PyObject* args) {
+  Py_INCREF(compiler);
+  cinder_enter_compiler();
+  PyObject* result = PyObject_Call(compiler, args, NULL);
+  cinder_leave_compiler();
+  if (result != NULL && result != Py_None && result != pending &&
+      Py_TYPE(result) != &JitFunctionType) {
+    PyErr_Format(PyExc_TypeError, "%R returned %.200s, expected a JitFunction",
+                 compiler, Py_TYPE(result)->tp_name);
+    Py_CLEAR(result);
+  }
+  if (result == NULL) {
+    PyErr_WriteUnraisable(compiler);
+    Py_INCREF(Py_None);
+    result = Py_None;
+  } else if (result == pending) {
+    num_pending++;
+  }
+  Py_DECREF(compiler);
+  return result;
+}
+
+int
+cinder_check_published(PyObject* current, PyObject* result) {
+  if (current != pending) {
+    PyErr_SetString(PyExc_ValueError, "no compilation is pending");
+    return -1;
+  }
+  if (result != Py_None && Py_TYPE(result) != &JitFunctionType) {
+    PyErr_SetString(PyExc_TypeError, "expected a JitFunction or None");
+    return -1;
+  }
+  num_pending--;
+  return 0;
+}
+
+int
+cinder_tierup_enabled(void) {
+  return tierup_compile != NULL && !compiling;
+}
+
+int
+cinder_in_compiler(void) {
+  return compiling;
+}
+
+void
+cinder_enter_compiler(void) {
+  compiling++;
+}
+
+void
+cinder_leave_compiler(void) {
+  compiling--;
+}
+
+// Reads an optional threshold from policy. None and missing attributes are
+// treated as 0, which disables the threshold.
+static int
+get_threshold(PyObject* policy, const char* name, Py_ssize_t* threshold) {
+  PyObject* value = PyObject_GetAttrString(policy, name);
+  if (value == NULL) {
+    if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+      return -1;
+    }
+    PyErr_Clear();
+    *threshold = 0;
+    return 0;
+  }
+  if (value == Py_None) {
+    *threshold = 0;
+  } else {
+    *threshold = PyLong_AsSsize_t(value);
+  }
+  Py_DECREF(value);
+  return *threshold == -1 && PyErr_Occurred() ? -1 : 0;
+}
+
+int
+cinder_set_tierup_policy(PyObject* policy) {
+  if (policy == Py_None) {
+    Py_CLEAR(tierup_compile);
+    Py_CLEAR(tierup_policy);
+    call_threshold = 0;
+    cinder_set_osr_handler(Py_None, 0);
+    return 0;
+  }
+  Py_ssize_t calls, loops;
+  if (get_threshold(policy, "call_threshold", &calls) < 0 ||
+      get_threshold(policy, "loop_threshold", &loops) < 0) {
+    return -1;
+  }
+  PyObject* compile = NULL;
+  if (calls > 0) {
+    compile = PyObject_GetAttrString(policy, "compile");
+    if (compile == NULL) {
+      return -1;
+    }
+  }
+  if (loops > 0) {
+    PyObject* compile_osr = PyObject_GetAttrString(policy, "compile_osr");
+    if (compile_osr == NULL) {
+      Py_XDECREF(compile);
+      return -1;
+    }
+    cinder_set_osr_handler(compile_osr, loops);
+    Py_DECREF(compile_osr);
+  } else {
+    cinder_set_osr_handler(Py_None, 0);
+  }
+  Py_XSETREF(tierup_compile, compile);
+  Py_INCREF(policy);
+  Py_XSETREF(tierup_policy, policy);
+  call_threshold = calls;
+  return 0;
+}
+
+static TierUpState*
+get_tierup_state(PyCodeObject* co) {
+  void* extra = NULL;
+  if (tierup_extra_index < 0 ||
+      _PyCode_GetExtra((PyObject*) co, tierup_extra_index, &extra) < 0) {
+    PyErr_Clear();
+    return NULL;
+  }
+  if (extra != NULL) {
+    return (TierUpState*) extra;
+  }
+  TierUpState* state = PyMem_Calloc(1, sizeof(TierUpState));
+  if (state == NULL) {
+    return NULL;
+  }
+  if (_PyCode_SetExtra((PyObject*) co, tierup_extra_index, state) < 0) {
+    PyErr_Clear();
+    PyMem_Free(state);
+    return NULL;
+  }
+  return state;
+}
+
+// Compiled functions receive exactly their positional arguments, so code that
+// takes any other kind of argument, or that uses cells, is run in the
+// interpreter.
+static int
+can_compile(PyCodeObject* co) {
+  return !(co->co_flags & (CO_VARARGS | CO_VARKEYWORDS | CO_GENERATOR |
+                           CO_COROUTINE | CO_ASYNC_GENERATOR)) &&
+         co->co_kwonlyargcount == 0 &&
+         PyTuple_GET_SIZE(co->co_cellvars) == 0 &&
+         PyTuple_GET_SIZE(co->co_freevars) == 0;
+}
+
+// Returns a new reference to the compiled function, to pending, or to None if
+// co cannot be compiled
+static PyObject*
+compile_function(PyCodeObject* co, PyObject* globals) {
+  if (!can_compile(co)) {
+    Py_RETURN_NONE;
+  }
+  PyObject* args = PyTuple_Pack(2, co, globals);
+  if (args == NULL) {
+    PyErr_Clear();
+    Py_RETURN_NONE;
+  }
+  PyObject* result = cinder_call_compiler(tierup_compile, args);
+  Py_DECREF(args);
+  return result;
+}
+
+// Returns whether the policy allows code running against globals to be
+// compiled. Policies without an allows method accept everything.
+static int
+policy_allows(PyObject* globals) {
+  cinder_enter_compiler();
+  PyObject* result = PyObject_CallMethod(tierup_policy, "allows", "O", globals);
+  cinder_leave_compiler();
+  if (result == NULL) {
+    if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+      PyErr_Clear();
+      return 1;
+    }
+    PyErr_WriteUnraisable(tierup_policy);
+    return 0;
+  }
+  int allowed = PyObject_IsTrue(result);
+  Py_DECREF(result);
+  if (allowed < 0) {
+    PyErr_WriteUnraisable(tierup_policy);
+    return 0;
+  }
+  return allowed;
+}
+
+// Asks the policy whether the code running in f may be compiled, the first
+// time that the code is run. Rejected code is treated like code that failed to
+// compile, so that it is neither counted nor profiled.
+static void
+check_allowed(TierUpState* state, PyFrameObject* f) {
+  if (state->checked) {
+    return;
+  }
+  state->checked = 1;
+  if (state->jit_function == NULL && !policy_allows(f->f_globals)) {
+    Py_INCREF(Py_None);
+    state->jit_function = Py_None;
+  }
+}
+
+int
+cinder_tierup_should_profile(PyFrameObject* f) {
+  if (compiling) {
+    return 0;
+  }
+  if (tierup_policy == NULL) {
+    return 1;
+  }
+  TierUpState* state = get_tierup_state(f->f_code);
+  if (state == NULL) {
+    return 1;
+  }
+  check_allowed(state, f);
+  return state->jit_function == NULL;
+}
+
+jit_function_entry_t
+cinder_tierup(PyFrameObject* f) {
+  TierUpState* state = get_tierup_state(f->f_code);
+  if (state == NULL) {
+    return NULL;
+  }
+  check_allowed(state, f);
+  if (state->jit_function == NULL) {
+    if (++state->calls < call_threshold) {
+      return NULL;
+    }
+    state->jit_function = compile_function(f->f_code, f->f_globals);
+    Py_INCREF(f->f_globals);
+    Py_XSETREF(state->globals, f->f_globals);
+  }
+  if (state->jit_function == Py_None || state->jit_function == pending ||
+      state->globals != f->f_globals) {
+    return NULL;
+  }
+  return ((JitFunction*) state->jit_function)->entry;
+}
+
+PyObject*
+cinder_get_compiled(PyCodeObject* co) {
+  void* extra = NULL;
+  if (tierup_extra_index < 0 ||
+      _PyCode_GetExtra((PyObject*) co, tierup_extra_index, &extra) < 0) {
+    PyErr_Clear();
+    return NULL;
+  }
+  TierUpState* state = (TierUpState*) extra;
+  if (state == NULL || state->jit_function == NULL ||
+      state->jit_function == pending) {
+    return NULL;
+  }
+  Py_INCREF(state->jit_function);
+  return state->jit_function;
+}
+
+int
+cinder_publish_compiled(PyCodeObject* co, PyObject* result) {
+  TierUpState* state = get_tierup_state(co);
+  if (state == NULL) {
+    PyErr_SetString(PyExc_ValueError, "no compilation is pending");
+    return -1;
+  }
+  if (cinder_check_published(state->jit_function, result) < 0) {
+    return -1;
+  }
+  Py_INCREF(result);
+  Py_SETREF(state->jit_function, result);
+  return 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Python.h>
+#include <frameobject.h>
+
+#include "cinder.h"
+
+// Automatic compilation of hot functions by cinder_eval_frame.
+//
+// When a policy is installed, the interpreter counts the number of times that
+// each code object is entered. Once the count reaches the policy's call
+// threshold, policy.compile(code, globals) is asked for a JitFunction. The
+// result is stored against the code object and later calls go straight to its
+// entry point. Code that fails to compile (policy.compile returns None or
+// raises) is marked so that it is not retried.
+//
+// Compilers (policy.compile and the OSR handler) may instead queue the work
+// and return the pending sentinel (cinder.PENDING). The code keeps running in
+// the interpreter until the result is published with cinder.publish. Results
+// are published by the compiler thread while it holds the GIL, which it can
+// only take from an interpreter thread at a safepoint (function entry or a
+// loop back edge), so the switch to compiled code is atomic.
+
+// The number of safepoints between which the interpreter yields the GIL while
+// compilations are pending
+#define SAFEPOINT_INTERVAL 1000
+
+// Sets up the co_extra slot used to store compiled functions. Returns -1 on
+// error.
+int cinder_tierup_init(void);
+
+// Installs policy, replacing any existing one. Passing None disables tier-up.
+// Returns -1 with an exception set if the policy is malformed.
+int cinder_set_tierup_policy(PyObject* policy);
+
+int cinder_tierup_enabled(void);
+
+// Returns whether the current thread is running the compiler (i.e.
+// policy.compile or the OSR handler). Neither counts nor compiles code while
+// it is.
+int cinder_in_compiler(void);
+
+void cinder_enter_compiler(void);
+
+void cinder_leave_compiler(void);
+
+// Returns the pending sentinel (borrowed)
+PyObject* cinder_compile_pending(void);
+
+// Calls compiler with args on behalf of the interpreter. Returns a new
+// reference to a JitFunction, to the pending sentinel, or to None if
+// compilation failed. Never sets an exception.
+PyObject* cinder_call_compiler(PyObject* compiler, PyObject* args);
+
+// Checks that result may be published in place of current, which must be the
+// pending sentinel, and records that it has been. Returns -1 with an exception
+// set otherwise.
+int cinder_check_published(PyObject* current, PyObject* result);
+
+// Called at every safepoint. Yields the GIL periodically while compilations
+// are pending so that the compiler thread can make progress.
+void cinder_safepoint(void);
+
+// Returns whether f should record type feedback. Code that has been compiled
+// (or queued), that failed to compile, or that the policy's allows(globals)
+// rejects is not profiled, nor is the compiler itself. Without a policy every
+// frame is. Never sets an exception.
+int cinder_tierup_should_profile(PyFrameObject* f);
+
+// Records a call to the function running in f, which has not started
+// executing. Returns the entry point to run instead of interpreting f, or NULL.
+// Never sets an exception.
+jit_function_entry_t cinder_tierup(PyFrameObject* f);
+
+// Returns a new reference to the JitFunction compiled for co, None if
+// compilation failed, or NULL (without an exception) if it has not been
+// attempted or is pending.
+PyObject* cinder_get_compiled(PyCodeObject* co);
+
+// Publishes the result of a queued compilation of co (a JitFunction, or None
+// if it failed). Returns -1 with an exception set if no compilation of co is
+// pending.
+int cinder_publish_compiled(PyCodeObject* co, PyObject* result);
@@ -0,0 +1,66 @@
+"""Fixtures shared by the tests of the compiler's passes"""
+import sys
+
+from cinder import bytecode, ir, ssa
+from cinder.codegen import x64
+from cinder.passes.manager import Context, PassManager
+from cinder.profile import Profile
+
+
+SHARED_TYPES = (type(None), bool, int, float, str)
+
+
+def ops_of(func, op_class):
+    """Returns the stack IR instructions of class op_class in the code of func"""
+    cfg = bytecode.disassemble(func.__code__.co_code)
+    return [instr for block in cfg for instr in block.instructions
+            if isinstance(instr, op_class)]
+
+
+def receiver_profile(func, *types):
+    """Returns type feedback in which every attribute load in func has seen
+    receivers of types
+    """
+    profile = Profile()
+    for load in ops_of(func, ir.LoadAttr):
+        profile.sites[load.offset] = (types,)
+    return profile
+
+
+def build(func, entry=None):
+    """Returns the SSA form of the code of func, with its constant and name pools"""
+    code = func.__code__
+    return ssa.build(bytecode.disassemble(code.co_code), code.co_nlocals, entry,
+                     code.co_consts, code.co_names)
+
+
+def optimize(func, profile=None, without=()):
+    """Returns the SSA form of func after the passes of the default pipeline,
+    except those named in without
+    """
+    function = build(func)
+    globals, builtins = x64.globals_and_builtins(func)
+    pipeline = PassManager(p for p in x64.PIPELINES[x64.DEFAULT_TIER].passes
+                           if p.name not in without)
+    pipeline.run(function, Context(func, globals, builtins, profile or Profile()))
+    return function
+
+
+def find(function, op_class):
+    """Returns the instructions in function whose ops are of class op_class"""
+    return [instr for instr in function.instructions() if isinstance(instr.op, op_class)]
+
+
+def check_compiled(func, profile, args, expected, deopt_args, deopt_expected):
+    """Compile func, specialized for profile, and check that it returns expected
+    for args and deopt_expected for deopt_args, which must fail its guards.
+    Neither call may leak references to the objects among its arguments.
+    Numbers and strs, which are shared and may legitimately be stored by func,
+    are not checked.
+    """
+    compiled = x64.compile(func, profile)
+    for call_args, result in ((args, expected), (deopt_args, deopt_expected)):
+        objects = [arg for arg in call_args if not isinstance(arg, SHARED_TYPES)]
+        refs = [sys.getrefcount(obj) for obj in objects]
+        assert compiled(*call_args) == result
+        assert [sys.getrefcount(obj) for obj in objects] == refs
@@ -0,0 +1,132 @@
+import ctypes
+
+import pytest
+
+from cinder.codegen.asm import *
+
+
+def assemble(emit):
+    with Function('test') as func:
+        emit()
+    return func.finalize()
+
+
+# Callee saved registers are pushed on entry
+@pytest.mark.parametrize("emit,expected", [
+    (lambda: MOV(rax, rcx), '4889c8'),
+    (lambda: MOV(r11, rsp), '4989e3'),
+    (lambda: MOV(rax, 5), 'b805000000'),
+    (lambda: MOV(rax, -5), '48c7c0fbffffff'),
+    (lambda: MOV(rax, 0x123456789a), '48b89a78563412000000'),
+    (lambda: MOV(rax, [rbp - 8]), '55' '488b45f8'),
+    (lambda: MOV(rax, [r13]), '4155' '498b4500'),
+    (lambda: MOV(rax, [r12 + 16]), '4154' '498b442410'),
+    (lambda: MOV(rax, [rdx + rcx * 8]), '488b04ca'),
+    (lambda: MOV([r11 - 0x400], r15), '4157' '4d89bb00fcffff'),
+    (lambda: MOV(qword[rbp - 16], 0), '55' '48c745f000000000'),
+    (lambda: MOV(dword[rax + 4], -1), 'c74004ffffffff'),
+    (lambda: MOVSXD(rdi, ecx), '4863f9'),
+    (lambda: LEA(r8, [r12 + r13 * 4 - 3]), '4154' '4155' '4f8d44acfd'),
+    (lambda: SUB(rsp, 0x1000), '4881ec00100000'),
+    (lambda: AND(rsp, -16), '4883e4f0'),
+    (lambda: ADD(ecx, edx), '01d1'),
+    (lambda: IMUL(ecx, edx), '0fafca'),
+    (lambda: CMP(rax, [rsp + 8]), '483b442408'),
+    (lambda: CMP(dword[rax + 0x100], 0x12345), '81b80001000045230100'),
+    (lambda: TEST(qword[rax + 168], 0x80000), '48f780a800000000000800'),
+    (lambda: INC(qword[rax]), '48ff00'),
+    (lambda: PUSH(qword[rax + 8]), 'ff7008'),
+    (lambda: POP(rax), '58'),
+    (lambda: CALL(rax), 'ffd0'),
+])
+def test_encoding(emit, expected):
+    assert assemble(emit).code == bytes.fromhex(expected)
+
+
+def test_jumps():
+    def emit():
+        back = Label()
+        forward = Label()
+        LABEL(back)
+        JE(back)
+        JMP(back)
+        JL(forward)
+        JMP(forward)
+        LABEL(forward)
+
+    assert assemble(emit).code == bytes.fromhex('74fe' 'ebfc' '0f8c05000000' 'e900000000')
+
+
+def test_long_backward_jump():
+    def emit():
+        back = Label()
+        LABEL(back)
+        for _ in range(20):
+            MOV(rax, 0x123456789a)
+        JG(back)
+
+    assert assemble(emit).code[-6:] == bytes.fromhex('0f8f' '32ffffff')
+
+
+def test_callee_saved_registers():
+    def emit():
+        MOV(rbx, rdi)
+        MOV(r14, rsi)
+        RETURN(rbx)
+
+    code = assemble(emit).code
+    assert code == bytes.fromhex('53' '4156' '4889fb' '4989f6' '4889d8' '415e' '5b' 'c3') + b'\xcc' * 7
+
+
+def test_align():
+    def emit():
+        MOV(rax, rcx)
+        ALIGN(16)
+        LABEL(Label())
+
+    code = assemble(emit)
+    assert (code.address + len(code.code)) % 16 == 0
+
+
+def test_execute():
+    def emit():
+        loop = Label()
+        done = Label()
+        MOV(rax, 0)
+        LABEL(loop)
+        CMP(rdi, 0)
+        JE(done)
+        ADD(rax, [rsi])
+        ADD(rsi, 8)
+        SUB(rdi, 1)
+        JMP(loop)
+        LABEL(done)
+        RETURN(rax)
+
+    code = assemble(emit)
+    func = ctypes.CFUNCTYPE(ctypes.c_long, ctypes.c_long, ctypes.c_void_p)(code.address)
+    values = (ctypes.c_long * 4)(1, 2, 3, -10)
+    assert func(4, values) == -4
+
+
+def test_invalid_operands():
+    for emit in (lambda: MOV(qword[rax], 0x123456789a),
+                 lambda: MOV([rax], 0),
+                 lambda: ADD(rax, ecx),
+                 lambda: LEA(rax, rcx)):
+        with pytest.raises(ValueError):
+            assemble(emit)
+
+
+def test_unbound_label():
+    with pytest.raises(ValueError):
+        assemble(lambda: JMP(Label()))
+
+
+def test_finalized_functions_are_read_only():
+    with Function('test') as func:
+        MOV(rax, 1)
+        RETURN(rax)
+        func.finalize()
+        with pytest.raises(ValueError):
+            MOV(rax, 2)
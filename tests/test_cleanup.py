@@ -0,0 +1,84 @@
+import types
+
+from cinder import ir, ssa
+from cinder.codegen.bytecode import assemble
+from cinder.passes import cleanup, constants
+from tests.helpers import build, find
+
+
+def clean(func):
+    function = build(func)
+    constants.fold_constants(function)
+    cleanup.clean_up(function)
+    return function
+
+
+def reassemble(func, function):
+    """Returns a copy of func whose code is assembled from function"""
+    code = func.__code__
+    lowered = ssa.lower(function)
+    assert lowered.num_locals == code.co_nlocals
+    new_code = types.CodeType(
+        code.co_argcount, code.co_kwonlyargcount, code.co_nlocals, code.co_stacksize,
+        code.co_flags, assemble(lowered.cfg), lowered.consts, code.co_names,
+        code.co_varnames, code.co_filename, code.co_name, code.co_firstlineno,
+        code.co_lnotab)
+    return types.FunctionType(new_code, func.__globals__)
+
+
+def choose(x):
+    if x:
+        y = 1
+    else:
+        y = 2
+    return y
+
+
+def test_threads_jumps_through_empty_blocks():
+    function = clean(choose)
+    entry, join = function.blocks
+    assert [edge.target for edge in entry.terminator.edges] == [join, join]
+    test = reassemble(choose, function)
+    assert (test(True), test(False)) == (1, 2)
+
+
+def increment_if_enabled(x):
+    enabled = True
+    if enabled:
+        x = x + 1
+    return x
+
+
+def test_merges_straight_line_code():
+    function = clean(increment_if_enabled)
+    assert len(function.blocks) == 1
+    assert reassemble(increment_if_enabled, function)(1) == 2
+
+
+def discard(x):
+    x is None
+    return x
+
+
+def test_removes_unused_pure_instructions():
+    function = clean(discard)
+    assert not find(function, ir.Compare)
+
+
+def nested_loops(n):
+    total = 0
+    i = 0
+    while i < n:
+        j = 0
+        while True:
+            if j == i:
+                break
+            total = total + j
+            j = j + 1
+        i = i + 1
+    return total
+
+
+def test_keeps_loop_structure():
+    function = clean(nested_loops)
+    assert reassemble(nested_loops, function)(5) == nested_loops(5)
@@ -0,0 +1,129 @@
+import contextlib
+import os
+import subprocess
+import sys
+import tempfile
+
+import pytest
+
+from cinder.code_cache import CodeCache
+from cinder.codegen import x64
+from cinder.profile import Profile
+
+
+class Point:
+    def __init__(self, x):
+        self.x = x
+
+
+def describe(values):
+    total = 0
+    for value in values:
+        total = total + value
+    if total > 10:
+        return 'big'
+    return len(values)
+
+
+def get_x(point):
+    return point.x
+
+
+@contextlib.contextmanager
+def cache_in(directory):
+    cache = CodeCache(directory)
+    x64.set_code_cache(cache)
+    try:
+        yield cache
+    finally:
+        x64.set_code_cache(None)
+
+
+def test_store_and_load():
+    with tempfile.TemporaryDirectory() as directory:
+        with cache_in(directory) as cache:
+            compiled = x64.compile(describe, Profile())
+            assert compiled([1, 2]) == 2
+            assert (cache.misses, cache.stores) == (1, 1)
+        with cache_in(directory) as cache:
+            loaded = x64.compile(describe, Profile())
+            assert cache.hits == 1 and cache.stores == 0
+            assert loaded([1, 2]) == 2
+            assert loaded([5, 6]) == 'big'
+
+
+def test_code_specialized_by_feedback_is_not_stored():
+    profile = Profile()
+    load = [instr for block in x64.bytecode.disassemble(get_x.__code__.co_code)
+            for instr in block.instructions if isinstance(instr, x64.ir.LoadAttr)][0]
+    profile.sites[load.offset] = ((Point,),)
+    with tempfile.TemporaryDirectory() as directory:
+        with cache_in(directory) as cache:
+            assert x64.compile(get_x, profile)(Point(1)) == 1
+            assert cache.stores == 0
+            assert x64.compile(get_x, Profile())(Point(2)) == 2
+            assert cache.stores == 1
+
+
+def test_changed_code_misses():
+    def first(x):
+        return x + 1
+
+    def second(x):
+        return x + 2
+
+    with tempfile.TemporaryDirectory() as directory:
+        with cache_in(directory) as cache:
+            x64.compile(first, Profile())
+            assert x64.compile(second, Profile())(1) == 3
+            assert cache.hits == 0 and cache.stores == 2
+
+
+def test_unusable_entries_are_recompiled():
+    with tempfile.TemporaryDirectory() as directory:
+        with cache_in(directory) as cache:
+            x64.compile(describe, Profile())
+            for name in os.listdir(directory):
+                with open(os.path.join(directory, name), 'wb') as f:
+                    f.write(b'garbage')
+            assert x64.compile(describe, Profile())([1]) == 1
+            assert cache.misses == 2 and cache.stores == 2
+
+
+def test_entries_are_specific_to_tiers():
+    with tempfile.TemporaryDirectory() as directory:
+        with cache_in(directory) as cache:
+            x64.compile(describe, Profile(), tier='baseline')
+            assert x64.compile(describe, Profile(), tier='optimized')([1, 2]) == 2
+            assert cache.hits == 0 and cache.stores == 2
+            x64.compile(describe, Profile(), tier='optimized')
+            assert cache.hits == 1
+
+
+def test_shared_directories_are_refused():
+    with tempfile.TemporaryDirectory() as directory:
+        os.chmod(directory, 0o777)
+        with pytest.raises(PermissionError):
+            CodeCache(directory)
+        # New directories are private
+        private = os.path.join(directory, 'cache')
+        CodeCache(private)
+        assert os.stat(private).st_mode & 0o777 == 0o700
+
+
+def test_load_in_another_process():
+    script = (
+        'import sys\n'
+        'from cinder.codegen import x64\n'
+        'from cinder.profile import Profile\n'
+        'from tests.test_code_cache import describe\n'
+        'func = x64.compile(describe, Profile())\n'
+        'print(func([1, 2]), func([7, 8]), x64.get_code_cache().hits)\n'
+    )
+    with tempfile.TemporaryDirectory() as directory:
+        env = dict(os.environ, CINDER_CODE_CACHE=directory)
+        outputs = [
+            subprocess.check_output([sys.executable, '-c', script], env=env).split()
+            for _ in range(2)
+        ]
+    assert outputs == [[b'2', b'big', b'0'], [b'2', b'big', b'1']]
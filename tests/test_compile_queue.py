@@ -0,0 +1,78 @@
+import pytest
+
+import cinder
+
+from cinder.compile_queue import CompileQueue
+from cinder.policy import Policy
+
+
+def square(x):
+    return x * x
+
+
+def count_down(n):
+    while n > 0:
+        n = n - 1
+    return n
+
+
+def run_with_policy(policy, func, args, num_calls):
+    cinder.install_interpreter(policy)
+    try:
+        return [func(*args) for _ in range(num_calls)]
+    finally:
+        cinder.uninstall_interpreter()
+
+
+def test_compile_in_background():
+    policy = Policy(call_threshold=2, loop_threshold=None, background=True)
+    assert run_with_policy(policy, square, (3,), 5) == [9] * 5
+    policy.queue.join()
+    assert isinstance(cinder.get_compiled(square.__code__), cinder.JitFunction)
+    assert run_with_policy(policy, square, (3,), 5) == [9] * 5
+
+
+def test_osr_in_background():
+    policy = Policy(call_threshold=None, loop_threshold=10, background=True)
+    assert run_with_policy(policy, count_down, (100,), 1) == [0]
+    policy.queue.join()
+    assert run_with_policy(policy, count_down, (100,), 1) == [0]
+
+
+def test_publish_requires_pending_compilation():
+    def never_called(x):
+        return x
+
+    with pytest.raises(ValueError):
+        cinder.publish(never_called.__code__, None)
+
+
+class FakeClock:
+    def __init__(self):
+        self.now = 0.0
+        self.sleeps = []
+
+    def __call__(self):
+        return self.now
+
+    def sleep(self, duration):
+        self.sleeps.append(duration)
+        self.now += duration
+
+
+def test_compile_budget():
+    clock = FakeClock()
+    queue = CompileQueue(0.25, clock, clock.sleep)
+    queue.wait_for_budget()
+    clock.now += 0.125
+    queue._spent += 0.125
+    queue.wait_for_budget()
+    assert clock.sleeps == []
+    clock.now += 0.25
+    queue._spent += 0.25
+    # The budget for the current second is exhausted
+    queue.wait_for_budget()
+    assert clock.sleeps == [0.625]
+    # and is replenished once it is over
+    queue.wait_for_budget()
+    assert clock.sleeps == [0.625]
@@ -0,0 +1,105 @@
+from cinder import ir, ssa
+from cinder.codegen import x64
+from cinder.passes import constants
+from tests.helpers import build, find
+
+
+def fold(func, unstable_offsets=(), fold_globals=True):
+    function = build(func)
+    globals, builtins = x64.globals_and_builtins(func)
+    constants.fold_constants(function, globals if fold_globals else None, builtins,
+                             unstable_offsets)
+    return function
+
+
+def returned(function):
+    """Returns the value of the constant that function returns"""
+    terminator, = find(function, ir.ReturnValue)
+    value, = terminator.operands
+    assert isinstance(value, ssa.Constant)
+    return function.value_of(value)
+
+
+def through_locals():
+    width = 6
+    height = width + 1
+    return width * height
+
+
+def test_propagates_through_locals():
+    function = fold(through_locals)
+    assert returned(function) == 42
+    assert find(function, ir.BinaryOperation) == []
+
+
+def compare_none():
+    value = None
+    if value is not None:
+        return 'some'
+    return 'none'
+
+
+def test_folds_identity_and_prunes_branches():
+    function = fold(compare_none)
+    assert returned(function) == 'none'
+    assert find(function, ir.ConditionalBranch) == []
+
+
+def divide_by_zero():
+    zero = 0
+    return 1 // zero
+
+
+def repeat():
+    count = 10000
+    return 'x' * count
+
+
+def test_leaves_failures_and_large_values_to_runtime():
+    assert len(find(fold(divide_by_zero), ir.BinaryOperation)) == 1
+    assert len(find(fold(repeat), ir.BinaryOperation)) == 1
+
+
+DEBUG = False
+
+
+def log(message):
+    raise AssertionError(message)
+
+
+def debug_log(x):
+    if DEBUG:
+        log(x)
+    return x + 1
+
+
+def test_folds_globals():
+    function = fold(debug_log)
+    guard, = find(function, ir.GuardGlobal)
+    assert guard.op.name == 'DEBUG'
+    assert find(function, ir.LoadGlobal) == []
+    assert find(function, ir.Call) == []
+    assert find(function, ir.ConditionalBranch) == []
+
+
+def test_leaves_unstable_globals_alone():
+    load = find(fold(debug_log, fold_globals=False), ir.LoadGlobal)[0]
+    assert find(fold(debug_log, [load.offset]), ir.GuardGlobal) == []
+
+
+def debug_value(x):
+    if DEBUG:
+        return 'debug'
+    return len(x)
+
+
+def test_deoptimizes_when_globals_change():
+    global DEBUG
+    test = x64.compile(debug_value)
+    assert test('abc') == 3
+    DEBUG = True
+    try:
+        assert test('abc') == 'debug'
+    finally:
+        DEBUG = False
+    assert test('abc') == 3
@@ -0,0 +1,65 @@
+from cinder import ir
+from cinder.passes import escape
+from cinder.profile import Profile
+from tests.helpers import build, check_compiled, find, receiver_profile
+
+
+class Accumulator:
+    def __init__(self):
+        self.total = 0
+
+    def add(self, value):
+        # Too large to inline
+        self.total = self.total + value
+        self.total = self.total + 0
+        self.total = self.total + 0
+        self.total = self.total + 0
+        return self.total
+
+
+class Reset(Accumulator):
+    def add(self, value):
+        self.total = value
+        return value
+
+
+def add_twice(acc, value):
+    acc.add(value)
+    return acc.add(value)
+
+
+def get_add(acc):
+    method = acc.add
+    return method(1)
+
+
+def sink(func, profile):
+    function = build(func)
+    escape.sink_allocations(function, profile)
+    return function
+
+
+def test_sinks_bound_methods():
+    function = sink(add_twice, receiver_profile(add_twice, Accumulator))
+    assert find(function, ir.LoadAttr) == []
+    assert len(find(function, ir.GuardMethod)) == 2
+    calls = find(function, ir.Call)
+    assert [call.op.callee for call in calls] == [Accumulator.add] * 2
+    assert all(call.op.num_args == 2 for call in calls)
+
+
+def test_leaves_escaping_methods_alone():
+    function = sink(get_add, receiver_profile(get_add, Accumulator))
+    assert len(find(function, ir.LoadAttr)) == 1
+    assert find(function, ir.GuardMethod) == []
+
+
+def test_leaves_methods_without_feedback_alone():
+    function = sink(add_twice, Profile())
+    assert len(find(function, ir.LoadAttr)) == 2
+
+
+def test_compiled_direct_calls():
+    # Other receivers deoptimize
+    check_compiled(add_twice, receiver_profile(add_twice, Accumulator),
+                   (Accumulator(), 2), 4, (Reset(), 3), 3)
@@ -0,0 +1,220 @@
+import sys
+
+import cinder
+
+from cinder import bytecode, ir
+from cinder.codegen import x64
+from cinder.passes import inline
+from cinder.profile import Profile
+from tests.helpers import ops_of, receiver_profile
+
+
+class Counter:
+    def __init__(self, value):
+        self.value = value
+
+    def is_big(self):
+        return self.value > 10
+
+    def is_bigger_than(self, other):
+        return self.value > other
+
+
+class SmallCounter(Counter):
+    pass
+
+
+class NegatedCounter(Counter):
+    def is_big(self):
+        return self.value < -10
+
+
+def get_value(counter):
+    return counter.value
+
+
+def identity(x):
+    return x
+
+
+def apply(f, x):
+    return f(x)
+
+
+def is_big(counter):
+    return counter.is_big()
+
+
+def is_bigger_than(counter, other):
+    return counter.is_bigger_than(other)
+
+
+def call_get_value(counter):
+    return get_value(counter)
+
+
+def sum_values(counters):
+    total = 0
+    for counter in counters:
+        total = total + get_value(counter)
+    return total
+
+
+def spread(*args):
+    return args
+
+
+def callee_profile(func, callee):
+    profile = Profile()
+    for call in ops_of(func, ir.Call):
+        profile.sites[call.offset] = (callee,)
+    return profile
+
+
+def inlined_instructions(func, profile):
+    cfg = bytecode.disassemble(func.__code__.co_code)
+    result = inline.inline_calls(func, cfg, profile)
+    return [instr for block in result.cfg for instr in block.instructions]
+
+
+def test_inline_known_callee():
+    profile = callee_profile(apply, get_value)
+    instrs = inlined_instructions(apply, profile)
+    assert not any(isinstance(instr, ir.Call) for instr in instrs)
+    guards = [instr for instr in instrs if isinstance(instr, ir.GuardCallee)]
+    assert len(guards) == 1 and guards[0].callee is get_value
+    test = x64.compile(apply, profile)
+    counter = Counter(0)
+    counter_refs = sys.getrefcount(counter)
+    assert test(get_value, counter) == 0
+    assert sys.getrefcount(counter) == counter_refs
+
+
+def test_inline_known_callee_deopts():
+    test = x64.compile(apply, callee_profile(apply, get_value))
+    assert test(get_value, Counter(1)) == 1
+    # Calls to anything else are performed by the interpreter
+    assert test(identity, 2) == 2
+    assert test(lambda x: x + 1, 2) == 3
+
+
+def test_inline_global_function():
+    test = x64.compile(call_get_value, callee_profile(call_get_value, get_value))
+    assert test(Counter(1)) == 1
+    # Rebinding the global invalidates the guard
+    original = get_value
+    globals()['get_value'] = identity
+    try:
+        assert test(2) == 2
+    finally:
+        globals()['get_value'] = original
+    assert test(Counter(3)) == 3
+
+
+def test_inline_in_loop():
+    test = x64.compile(sum_values, callee_profile(sum_values, get_value))
+    counters = [Counter(i) for i in range(5)]
+    assert test(counters) == 10
+
+
+def test_inline_method():
+    profile = receiver_profile(is_big, Counter)
+    instrs = inlined_instructions(is_big, profile)
+    assert not any(isinstance(instr, ir.Call) for instr in instrs)
+    guards = [instr for instr in instrs if isinstance(instr, ir.GuardMethod)]
+    assert len(guards) == 1 and guards[0].method is Counter.is_big
+    test = x64.compile(is_big, profile)
+    assert test(Counter(11)) is True
+    assert test(Counter(1)) is False
+    counter = Counter(11)
+    counter_refs = sys.getrefcount(counter)
+    assert test(counter) is True
+    assert sys.getrefcount(counter) == counter_refs
+
+
+def test_inline_method_with_arguments():
+    test = x64.compile(is_bigger_than, receiver_profile(is_bigger_than, Counter))
+    assert test(Counter(5), 4) is True
+    assert test(Counter(5), 6) is False
+
+
+def test_inline_method_deopts():
+    test = x64.compile(is_big, receiver_profile(is_big, Counter))
+    # Other types, overridden methods, and methods shadowed by the instance
+    assert test(NegatedCounter(-11)) is True
+    counter = Counter(0)
+    counter.is_big = lambda: 'shadowed'
+    assert test(counter) == 'shadowed'
+    # Changes to the class invalidate the guard
+    original = Counter.is_big
+    Counter.is_big = lambda self: 'patched'
+    try:
+        assert test(Counter(0)) == 'patched'
+    finally:
+        Counter.is_big = original
+    assert test(Counter(11)) is True
+
+
+def test_inline_method_with_replaced_code():
+    class Local(Counter):
+        def is_big(self):
+            return self.value > 10
+
+    test = x64.compile(is_big, receiver_profile(is_big, Local))
+    assert test(Local(11)) is True
+    code = Local.is_big.__code__
+    Local.is_big.__code__ = NegatedCounter.is_big.__code__
+    try:
+        assert test(Local(-11)) is True
+    finally:
+        Local.is_big.__code__ = code
+
+
+def test_inline_polymorphic_method():
+    profile = receiver_profile(is_big, Counter, SmallCounter)
+    assert any(isinstance(instr, ir.GuardMethod)
+               for instr in inlined_instructions(is_big, profile))
+    test = x64.compile(is_big, profile)
+    assert test(Counter(11)) is True
+    assert test(SmallCounter(1)) is False
+    # The method differs between the receivers
+    profile = receiver_profile(is_big, Counter, NegatedCounter)
+    assert not any(isinstance(instr, ir.GuardMethod)
+                   for instr in inlined_instructions(is_big, profile))
+
+
+def test_uninlinable_callees():
+    assert inline.inlinable_body(get_value, globals()) is not None
+    # Calls, varargs, and large functions
+    assert inline.inlinable_body(apply, globals()) is None
+    assert inline.inlinable_body(spread, globals()) is None
+    assert inline.inlinable_body(sum_values, globals()) is None
+    # Objects that are not Python functions
+    assert inline.inlinable_body(len, globals()) is None
+    assert inline.inlinable_body(x64.compile(get_value), globals()) is None
+
+
+def test_inlined_code_uses_callee_feedback():
+    cinder.clear_profile(get_value.__code__)
+    cinder.install_interpreter()
+    cinder.enable_profiling()
+    try:
+        get_value(Counter(1))
+    finally:
+        cinder.disable_profiling()
+        cinder.uninstall_interpreter()
+    profile = callee_profile(call_get_value, get_value)
+    inlined = inline.inline_calls(call_get_value, bytecode.disassemble(
+        call_get_value.__code__.co_code), profile)
+    load = [instr for block in inlined.cfg for instr in block.instructions
+            if isinstance(instr, ir.LoadAttr)][0]
+    assert load.offset is None
+    assert inlined.profile.monomorphic_type(load) is Counter
+    test = x64.compile(call_get_value, profile)
+    assert test(Counter(1)) == 1
+
+    # Specializations in inlined code fall back to the generic path
+    class Other:
+        value = 'class attribute'
+
+    assert test(Other()) == 'class attribute'
@@ -87,6 +87,46 @@ def binary_and(x, y):
     return x & y
 
 
+def arithmetic(x, y):
+    return x + y * 2 - x // y
+
+
+def inplace_add(x, y):
+    x += y
+    return x
+
+
+def cmp_lt(x, y):
+    return x < y
+
+
+def cmp_in(x, y):
+    return x in y
+
+
+def break_loop(x):
+    while x:
+        if x:
+            break
+        x = 1
+    else:
+        x = 3
+    return x
+
+
+def for_loop(x):
+    for y in x:
+        x = y
+    return x
+
+
+def infinite_loop_with_break(x):
+    while True:
+        if x:
+            break
+    return x
+
+
 @pytest.mark.parametrize("function,expected_ir", [
     (single_block, """entry:
 bb0:
@@ -239,6 +279,87 @@ bb0:
   LOAD 0 LOCALS
   LOAD 1 LOCALS
   BIN_OP AND
+  RETURN_VALUE"""),
+
+    (arithmetic, """entry:
+bb0:
+  LOAD 0 LOCALS
+  LOAD 1 LOCALS
+  LOAD 1 CONSTANTS
+  BIN_OP MULTIPLY
+  BIN_OP ADD
+  LOAD 0 LOCALS
+  LOAD 1 LOCALS
+  BIN_OP FLOOR_DIVIDE
+  BIN_OP SUBTRACT
+  RETURN_VALUE"""),
+
+    (inplace_add, """entry:
+bb0:
+  LOAD 0 LOCALS
+  LOAD 1 LOCALS
+  INPLACE_OP ADD
+  STORE 0
+  LOAD 0 LOCALS
+  RETURN_VALUE"""),
+
+    (cmp_lt, """entry:
+bb0:
+  LOAD 0 LOCALS
+  LOAD 1 LOCALS
+  COMPARE LT
+  RETURN_VALUE"""),
+
+    (cmp_in, """entry:
+bb0:
+  LOAD 0 LOCALS
+  LOAD 1 LOCALS
+  COMPARE IN
+  RETURN_VALUE"""),
+
+    (break_loop, """entry:
+bb1:
+  LOAD 0 LOCALS
+  COND_BRANCH true=bb2 false=bb5
+bb2:
+  LOAD 0 LOCALS
+  COND_BRANCH true=bb3 false=bb4
+bb3:
+  BREAK_LOOP bb6
+bb4:
+  LOAD 1 CONSTANTS
+  STORE 0
+  BRANCH bb1
+bb5:
+  LOAD 2 CONSTANTS
+  STORE 0
+bb6:
+  LOAD 0 LOCALS
+  RETURN_VALUE"""),
+
+    (for_loop, """entry:
+bb1:
+  LOAD 0 LOCALS
+  GET_ITER
+bb2:
+  FOR_ITER body=bb3 exit=bb4
+bb3:
+  STORE 1
+  LOAD 1 LOCALS
+  STORE 0
+  BRANCH bb2
+bb4:
+  LOAD 0 LOCALS
+  RETURN_VALUE"""),
+
+    (infinite_loop_with_break, """entry:
+bb1:
+  LOAD 0 LOCALS
+  COND_BRANCH true=bb2 false=bb1
+bb2:
+  BREAK_LOOP bb4
+bb4:
+  LOAD 0 LOCALS
   RETURN_VALUE"""),
 ])
 def test_disassemble(function, expected_ir):
@@ -263,6 +384,11 @@ def test_disassemble(function, expected_ir):
     cmp_is_not,
     loop_with_setup,
     binary_and,
+    arithmetic,
+    inplace_add,
+    cmp_lt,
+    cmp_in,
+    for_loop,
 ])
 def test_reassemble(function):
     expected = function.__code__.co_code
@@ -0,0 +1,113 @@
+from cinder import ir
+from cinder.analysis import loops
+from cinder.codegen import x64
+from cinder.passes import constants, licm
+from cinder.profile import Profile
+from tests.helpers import build, check_compiled, find, optimize, receiver_profile
+
+
+SCALE = 3
+
+
+class Config:
+    def __init__(self, limit):
+        self.limit = limit
+
+
+class Other:
+    def __init__(self, limit):
+        self.limit = limit
+
+
+def scaled_sum(n):
+    total = 0
+    for i in range(n):
+        total = total + i * SCALE
+    return total
+
+
+def scaled_abs_sum(n):
+    total = 0
+    for i in range(n):
+        total = total + abs(i) * SCALE
+    return total
+
+
+def count_limited(config, n):
+    count = 0
+    for i in range(n):
+        if config.limit is not None:
+            count = count + 1
+    return count
+
+
+def hoist(func, profile=None, unstable_offsets=()):
+    function = build(func)
+    globals, builtins = x64.globals_and_builtins(func)
+    constants.fold_constants(function, globals, builtins)
+    licm.hoist_invariants(function, profile or Profile(), unstable_offsets)
+    return function
+
+
+def in_loop(function, op_class):
+    loop, = loops.analyze(function).loops
+    return [instr for block in function.blocks if block in loop
+            for instr in block.instructions if isinstance(instr.op, op_class)]
+
+
+def test_hoists_global_guards():
+    function = hoist(scaled_sum)
+    assert in_loop(function, ir.GuardGlobal) == []
+    guard, = [guard for guard in find(function, ir.GuardGlobal) if guard.op.name == 'SCALE']
+    loop, = loops.analyze(function).loops
+    # Deoptimizing resumes at the top of the loop
+    assert guard.offset == loop.header.offset
+    assert guard.block.terminator.edges[0].target is loop.header
+
+
+def test_leaves_loops_with_calls_alone():
+    function = hoist(scaled_abs_sum)
+    assert len(in_loop(function, ir.GuardGlobal)) == 2
+
+
+def test_leaves_unstable_loops_alone():
+    offset = loops.analyze(hoist(scaled_sum)).loops[0].header.offset
+    function = hoist(scaled_sum, unstable_offsets=[offset])
+    assert len(in_loop(function, ir.GuardGlobal)) == 1
+
+
+def test_hoists_attribute_loads():
+    function = hoist(count_limited, receiver_profile(count_limited, Config))
+    assert in_loop(function, ir.LoadAttr) == []
+    load, = find(function, ir.SpeculativeLoadAttr)
+    assert load.op.receiver is Config
+    # Loads without feedback may run arbitrary code
+    function = hoist(count_limited)
+    assert len(in_loop(function, ir.LoadAttr)) == 1
+
+
+def test_default_pipeline_hoists():
+    # No other pass in the pipeline takes the guards and loads out of the loops
+    assert len(in_loop(optimize(scaled_sum, without=['licm']), ir.GuardGlobal)) == 1
+    assert in_loop(optimize(scaled_sum), ir.GuardGlobal) == []
+    profile = receiver_profile(count_limited, Config)
+    assert len(in_loop(optimize(count_limited, profile, without=['licm']), ir.LoadAttr)) == 1
+    assert in_loop(optimize(count_limited, profile), ir.LoadAttr) == []
+
+
+def test_compiled_hoisted_guards():
+    global SCALE
+    test = x64.compile(scaled_sum)
+    assert test(10) == 135
+    try:
+        SCALE = 2
+        assert test(10) == 90
+    finally:
+        SCALE = 3
+
+
+def test_compiled_speculative_loads():
+    profile = receiver_profile(count_limited, Config)
+    # Other receivers deoptimize before the loop
+    check_compiled(count_limited, profile, (Config(5), 10), 10, (Other(5), 10), 10)
+    assert x64.compile(count_limited, profile)(Config(None), 10) == 0
@@ -0,0 +1,112 @@
+import sys
+
+from cinder import ir
+from cinder.analysis import liveness
+from cinder.bytecode import disassemble
+from cinder.codegen import x64
+
+
+def analyze(function, extra_uses=None):
+    cfg = disassemble(function.__code__.co_code)
+    return cfg, liveness.analyze(cfg, extra_uses)
+
+
+def instructions(cfg, instr_class):
+    return [instr for block in cfg for instr in block.instructions
+            if isinstance(instr, instr_class)]
+
+
+def overwrite(x):
+    y = x
+    y = 2
+    return y
+
+
+def test_dead_store():
+    cfg, live = analyze(overwrite)
+    first, second = instructions(cfg, ir.Store)
+    assert live.is_dead_store(first)
+    assert not live.is_dead_store(second)
+
+
+def use_twice(x):
+    y = x + 1
+    while y:
+        y = y - x
+    return y
+
+
+def test_last_use():
+    cfg, live = analyze(use_twice)
+    loads_x = [load for load in instructions(cfg, ir.Load)
+               if load.pool == ir.VarPool.LOCALS and load.index == 0]
+    # x is read again on every iteration of the loop
+    assert not any(live.is_last_use(load) for load in loads_x)
+    *_, load_y = [load for load in instructions(cfg, ir.Load)
+                  if load.pool == ir.VarPool.LOCALS and load.index == 1]
+    assert live.is_last_use(load_y)
+
+
+def reassign_arg(a, b):
+    a = a + b
+    return a
+
+
+def test_assigned():
+    cfg, live = analyze(reassign_arg)
+    assert live.assigned == {0}
+
+
+def test_extra_uses():
+    def reads_y(instr):
+        # e.g. an instruction that may deoptimize before y is reassigned
+        if isinstance(instr, ir.Load) and instr.pool == ir.VarPool.CONSTANTS:
+            return (1,)
+        return ()
+
+    cfg, live = analyze(overwrite, reads_y)
+    assert not any(live.is_dead_store(store) for store in instructions(cfg, ir.Store))
+    load_2 = instructions(cfg, ir.Load)[1]
+    assert 1 in live.live_at(load_2.offset)
+
+
+def store_twice(x):
+    y = x
+    y = x
+    return y
+
+
+def test_stores_release_previous_values():
+    test = x64.compile(store_twice)
+    item = object()
+    refs = sys.getrefcount(item)
+    assert test(item) is item
+    assert sys.getrefcount(item) == refs
+
+
+def locals_at_return(x):
+    y = x
+    z = x
+    return 1
+
+
+def test_locals_are_released_on_return():
+    test = x64.compile(locals_at_return)
+    item = object()
+    refs = sys.getrefcount(item)
+    assert test(item) == 1
+    assert sys.getrefcount(item) == refs
+
+
+def drop_arg(a, b):
+    a = b
+    return a
+
+
+def test_reassigned_args_are_owned():
+    test = x64.compile(drop_arg)
+    a, b = object(), object()
+    a_refs, b_refs = sys.getrefcount(a), sys.getrefcount(b)
+    assert test(a, b) is b
+    assert sys.getrefcount(a) == a_refs
+    assert sys.getrefcount(b) == b_refs
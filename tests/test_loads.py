@@ -0,0 +1,102 @@
+from cinder import ir
+from cinder.passes import loads
+from cinder.profile import Profile
+from tests.helpers import build, check_compiled, find, optimize, receiver_profile
+
+
+class Point:
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+
+
+class Ticker:
+    def __init__(self):
+        self.ticks = 0
+
+    @property
+    def x(self):
+        self.ticks += 1
+        return self.ticks
+
+    y = x
+
+
+def norm(point):
+    return point.x * point.x + point.y * point.y
+
+
+def aliased(point):
+    other = point
+    return point.x is other.x
+
+
+def move(point):
+    x = point.x
+    point.x = 0
+    return x is point.x
+
+
+def branches(point):
+    x = point.x
+    if x is None:
+        return point.x
+    return point.x
+
+
+def forward(func, profile):
+    function = build(func)
+    removed = loads.forward_loads(function, profile)
+    return function, removed
+
+
+def test_forwards_loads_until_writes():
+    function, removed = forward(norm, receiver_profile(norm, Point))
+    # The first multiplication may run arbitrary code
+    assert removed == 2
+    assert len(find(function, ir.LoadAttr)) == 2
+    for multiply in find(function, ir.BinaryOperation)[:2]:
+        left, right = multiply.operands
+        assert left is right
+
+
+def test_forwards_loads_through_aliases():
+    function, removed = forward(aliased, receiver_profile(aliased, Point))
+    assert removed == 1
+    compare, = find(function, ir.Compare)
+    left, right = compare.operands
+    assert left is right
+
+
+def test_stores_kill_loads():
+    _, removed = forward(move, receiver_profile(move, Point))
+    assert removed == 0
+
+
+def test_forwards_loads_into_extended_blocks():
+    function, removed = forward(branches, receiver_profile(branches, Point))
+    assert removed == 2
+    load, = find(function, ir.LoadAttr)
+    assert all(ret.operands == [load] for ret in find(function, ir.ReturnValue))
+
+
+def test_leaves_generic_loads_alone():
+    # Without feedback loads are generic and may run arbitrary code
+    _, removed = forward(norm, Profile())
+    assert removed == 0
+    # Properties may return a new value each time
+    _, removed = forward(norm, receiver_profile(norm, Ticker))
+    assert removed == 0
+
+
+def test_default_pipeline_forwards_loads():
+    # No other pass in the pipeline removes the repeated loads
+    profile = receiver_profile(norm, Point)
+    assert len(find(optimize(norm, profile, without=['loads']), ir.LoadAttr)) == 4
+    assert len(find(optimize(norm, profile), ir.LoadAttr)) == 2
+
+
+def test_compiled_forwarded_loads():
+    # Other receivers deoptimize at the first load
+    check_compiled(norm, receiver_profile(norm, Point), (Point(3, 4),), 25,
+                   (Ticker(),), 1 * 2 + 3 * 4)
@@ -0,0 +1,80 @@
+from cinder import ssa
+from cinder.analysis import dominators, loops
+from cinder.bytecode import disassemble
+
+
+def analyze(function):
+    cfg = disassemble(function.__code__.co_code)
+    return cfg, loops.analyze(cfg)
+
+
+def diamond(x):
+    if x:
+        y = 1
+    else:
+        y = 2
+    return y
+
+
+def test_dominators():
+    cfg = disassemble(diamond.__code__.co_code)
+    tree = dominators.analyze(cfg)
+    entry, then, orelse, join = [cfg.blocks[label] for label in cfg.blocks]
+    assert tree.entry is entry
+    assert tree.immediate_dominator(entry) is None
+    assert [tree.immediate_dominator(block) for block in (then, orelse, join)] == [entry] * 3
+    assert tree.dominates(entry, join) and tree.dominates(join, join)
+    assert not tree.dominates(then, join) and not tree.dominates(join, then)
+    assert loops.analyze(cfg, tree).loops == []
+
+
+def nested(rows):
+    total = 0
+    for row in rows:
+        i = 0
+        while i < row:
+            total = total + i
+            i = i + 1
+    return total
+
+
+def test_nested_loops():
+    cfg, forest = analyze(nested)
+    outer, inner = forest.loops
+    assert forest.roots == [outer]
+    assert inner.parent is outer and outer.children == [inner]
+    assert (outer.depth, inner.depth) == (1, 2)
+    assert inner.blocks < outer.blocks
+    assert forest.loop_with_header(inner.header) is inner
+    assert forest.depth(inner.header) == 2
+    assert forest.depth(outer.header) == 1
+    # The return is outside both loops
+    exit, = [block for block in cfg.blocks.values() if forest.depth(block) == 0
+             and block.terminator.__class__.__name__ == 'ReturnValue']
+    assert forest.loop_of(exit) is None
+    assert len(forest.back_edges) == 2
+
+
+def loop_with_break(x):
+    while True:
+        if x:
+            break
+        x = x - 1
+    return x
+
+
+def test_loop_with_break():
+    cfg, forest = analyze(loop_with_break)
+    loop, = forest.loops
+    assert loop.latches and all(latch in loop for latch in loop.latches)
+    exits = [block for block in cfg.blocks.values()
+             if block not in loop and forest.dominators.is_reachable(block)]
+    assert all(forest.depth(block) == 0 for block in exits)
+
+
+def test_ssa_functions():
+    code = nested.__code__
+    function = ssa.build(disassemble(code.co_code), code.co_nlocals)
+    forest = loops.analyze(function)
+    assert [loop.depth for loop in forest.loops] == [1, 2]
+    assert all(len(loop.header.params) > 0 for loop in forest.loops)
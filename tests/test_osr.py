@@ -0,0 +1,111 @@
+import sys
+
+import pytest
+
+import cinder
+
+from cinder.codegen import x64
+
+
+def count_up(n):
+    total = 0
+    i = 0
+    while i < n:
+        total = total + i
+        i = i + 1
+    return total
+
+
+def count_down(n):
+    while n > 0:
+        n = n - 1
+    return n
+
+
+def sum_items(items):
+    total = 0
+    for item in items:
+        total = total + item
+    return total
+
+
+def build_lists(n):
+    total = 0
+    i = 0
+    while i < n:
+        total = total + len([i])
+        i = i + 1
+    return total
+
+
+def count_to(limit):
+    def count():
+        i = 0
+        while i < limit:
+            i = i + 1
+        return i
+    return count
+
+
+class RecordingHandler:
+    def __init__(self):
+        self.offsets = []
+        self.entries = []
+
+    def __call__(self, code, globals, offset):
+        self.offsets.append(offset)
+        entry = x64.osr_handler(code, globals, offset)
+        self.entries.append(entry)
+        return entry
+
+
+def run_with_osr(handler, func, *args):
+    cinder.install_interpreter()
+    cinder.set_osr_handler(handler, 10)
+    try:
+        return func(*args)
+    finally:
+        cinder.set_osr_handler(None, 0)
+        cinder.uninstall_interpreter()
+
+
+def test_while_loop():
+    handler = RecordingHandler()
+    assert run_with_osr(handler, count_up, 100) == sum(range(100))
+    assert len(handler.offsets) == 1
+    assert handler.entries[0] is not None
+    # The entry is reused
+    assert run_with_osr(handler, count_up, 100) == sum(range(100))
+    assert len(handler.offsets) == 1
+
+
+def test_entries_cannot_be_called():
+    handler = RecordingHandler()
+    assert run_with_osr(handler, count_down, 100) == 0
+    entry, = handler.entries
+    with pytest.raises(TypeError):
+        entry()
+
+
+def test_for_loop():
+    handler = RecordingHandler()
+    items = list(range(100))
+    items_refs = sys.getrefcount(items)
+    assert run_with_osr(handler, sum_items, items) == sum(items)
+    assert len(handler.offsets) == 1
+    assert handler.entries[0] is not None
+    # The iterator was handed to the compiled code, which released it
+    assert sys.getrefcount(items) == items_refs
+
+
+def test_failed_compilation_is_not_retried():
+    handler = RecordingHandler()
+    assert run_with_osr(handler, build_lists, 100) == 100
+    assert run_with_osr(handler, build_lists, 100) == 100
+    assert handler.entries == [None]
+
+
+def test_closures_are_not_compiled():
+    handler = RecordingHandler()
+    assert run_with_osr(handler, count_to(100)) == 100
+    assert handler.entries == [None]
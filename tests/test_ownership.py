@@ -0,0 +1,103 @@
+from cinder import ir
+from cinder.analysis import ownership
+from cinder.bytecode import disassemble
+
+
+def analyze(function):
+    cfg = disassemble(function.__code__.co_code)
+    return cfg, ownership.analyze(cfg)
+
+
+def instructions(cfg):
+    return [instr for block in cfg for instr in block.instructions]
+
+
+def is_none(x):
+    if x is None:
+        return 1
+    return 2
+
+
+def test_compare_with_constant_is_borrowed():
+    cfg, owned = analyze(is_none)
+    load_x, load_none, compare, branch = instructions(cfg)[:4]
+    assert owned.is_borrowed(load_x)
+    assert owned.is_borrowed(load_none)
+    assert owned.operands_borrowed(compare) == {0, 1}
+    # The result of `is` is always True or False
+    assert owned.is_borrowed(compare)
+    assert owned.operands_borrowed(branch) == {0}
+
+
+def identity(x):
+    return x
+
+
+def test_returned_values_are_owned():
+    cfg, owned = analyze(identity)
+    load, ret = instructions(cfg)
+    assert not owned.is_borrowed(load)
+    assert owned.operands_borrowed(ret) == set()
+
+
+def get_bar(x):
+    return x.bar
+
+
+def test_load_attr_borrows_owner():
+    cfg, owned = analyze(get_bar)
+    load, load_attr, ret = instructions(cfg)
+    assert owned.is_borrowed(load)
+    assert owned.operands_borrowed(load_attr) == {0}
+    assert not owned.is_borrowed(load_attr)
+
+
+def set_bar(x, v):
+    x.bar = v
+
+
+def test_store_attr_borrows_owner_and_value():
+    cfg, owned = analyze(set_bar)
+    load_v, load_x, store_attr = instructions(cfg)[:3]
+    assert owned.is_borrowed(load_v)
+    assert owned.is_borrowed(load_x)
+    assert owned.operands_borrowed(store_attr) == {0, 1}
+
+
+def call(f, x):
+    return f(x)
+
+
+def test_call_arguments_are_owned():
+    cfg, owned = analyze(call)
+    for instr in instructions(cfg):
+        assert not owned.is_borrowed(instr)
+        assert owned.operands_borrowed(instr) == set()
+
+
+def test_store_to_local_invalidates_borrow():
+    # LOAD x; LOAD y; STORE x; COMPARE IS
+    blocks = [ir.BasicBlock('bb0', [
+        ir.Load(0, ir.VarPool.LOCALS),
+        ir.Load(1, ir.VarPool.LOCALS),
+        ir.Load(1, ir.VarPool.LOCALS),
+        ir.Store(0),
+        ir.Compare(ir.ComparePredicate.IS),
+        ir.ReturnValue(),
+    ])]
+    cfg = ir.build_initial_cfg(blocks)
+    owned = ownership.analyze(cfg)
+    load_x, load_y, _, _, compare, _ = blocks[0].instructions
+    assert not owned.is_borrowed(load_x)
+    assert owned.is_borrowed(load_y)
+    assert owned.operands_borrowed(compare) == {0}
+
+
+def or_else(x, y):
+    return x or y
+
+
+def test_values_live_across_blocks_are_owned():
+    cfg, owned = analyze(or_else)
+    for instr in instructions(cfg):
+        assert not owned.is_borrowed(instr)
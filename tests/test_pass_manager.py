@@ -0,0 +1,59 @@
+import io
+
+from cinder.codegen import x64
+from cinder.passes import manager
+from cinder.passes.manager import Context, Pass, PassManager
+from cinder.profile import Profile
+from tests.helpers import build
+
+
+def choose(x):
+    flag = True
+    if flag:
+        return x
+    return None
+
+
+def context(func):
+    return Context(func, None, None, Profile())
+
+
+def test_records_statistics():
+    pipeline = PassManager([
+        Pass('constants', x64.fold_constants),
+        Pass('cleanup', x64.clean_up),
+    ])
+    for _ in range(2):
+        pipeline.run(build(choose), context(choose))
+    constants, cleanup = pipeline.statistics.values()
+    assert constants.runs == cleanup.runs == 2
+    assert constants.instructions_after < constants.instructions_before
+    assert cleanup.instructions_before == constants.instructions_after
+    assert constants.seconds > 0
+    assert pipeline.report().splitlines()[1].startswith('constants')
+
+
+def test_dumps_after_passes():
+    out = io.StringIO()
+    pipeline = PassManager([Pass('cleanup', x64.clean_up)], dump=['cleanup'], out=out)
+    pipeline.run(build(choose), context(choose))
+    header, *body = out.getvalue().splitlines()
+    assert header == '-- choose after cleanup --'
+    assert any('RETURN_VALUE' in line for line in body)
+
+
+def test_dump_ir_applies_to_every_pass_manager():
+    out = io.StringIO()
+    pipeline = PassManager([Pass('cleanup', x64.clean_up)], out=out)
+    manager.set_dump_ir(['input'])
+    try:
+        pipeline.run(build(choose), context(choose))
+    finally:
+        manager.set_dump_ir(())
+    assert out.getvalue().startswith('-- choose after input --')
+
+
+def test_compiles_at_each_tier():
+    for tier in x64.PIPELINES:
+        test = x64.compile(choose, tier=tier)
+        assert test(1) == 1
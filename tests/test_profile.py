@@ -0,0 +1,94 @@
+import cinder
+
+from cinder import ir
+from cinder.bytecode import disassemble
+from cinder.profile import Profile
+
+
+class Foo:
+    def __init__(self, bar):
+        self.bar = bar
+
+
+def get_bar(x):
+    return x.bar
+
+
+def add(x, y):
+    return x + y
+
+
+def call(f):
+    return f()
+
+
+def branch(x):
+    if x:
+        return 1
+    return 2
+
+
+def profile(function, *calls):
+    code = function.__code__
+    cinder.clear_profile(code)
+    cinder.install_interpreter()
+    cinder.enable_profiling()
+    try:
+        for args in calls:
+            function(*args)
+    finally:
+        cinder.disable_profiling()
+        cinder.uninstall_interpreter()
+    return Profile.from_code(code)
+
+
+def find(function, instr_type):
+    cfg = disassemble(function.__code__.co_code)
+    for block in cfg:
+        for instr in block.instructions:
+            if isinstance(instr, instr_type):
+                return instr
+    raise AssertionError(f'No {instr_type.__name__} in {function.__name__}')
+
+
+def test_receiver_types():
+    p = profile(get_bar, (Foo(1),), (Foo(2),))
+    load = find(get_bar, ir.LoadAttr)
+    assert p.operand_types(load) == (Foo,)
+    assert p.monomorphic_type(load) is Foo
+
+
+def test_operand_types():
+    p = profile(add, (1, 2), (1.0, 2))
+    op = find(add, ir.BinaryOperation)
+    assert p.operand_types(op, 0) == (int, float)
+    assert p.operand_types(op, 1) == (int,)
+    assert p.monomorphic_type(op, 1) is int
+    assert not p.may_be(op, 1, str)
+
+
+def test_megamorphic():
+    p = profile(add, (1, 2), (1.0, 2.0), ('a', 'b'), ([], []), ((), ()))
+    op = find(add, ir.BinaryOperation)
+    assert p.operand_types(op, 0) is None
+    assert p.may_be(op, 0, str)
+
+
+def test_callees():
+    p = profile(call, (list,), (list,))
+    assert p.callee(find(call, ir.Call)) is list
+    p = profile(call, (list,), (dict,))
+    assert p.callee(find(call, ir.Call)) is None
+
+
+def test_branch_counts():
+    p = profile(branch, (True,), (True,), (False,))
+    assert p.branch_counts(find(branch, ir.ConditionalBranch)) == (2, 1)
+
+
+def test_disabled():
+    cinder.clear_profile(add.__code__)
+    cinder.install_interpreter()
+    add(1, 2)
+    cinder.uninstall_interpreter()
+    assert cinder.get_profile(add.__code__) == {}
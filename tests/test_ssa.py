@@ -0,0 +1,142 @@
+import dis
+import types
+
+import pytest
+
+from cinder import ir, ssa
+from cinder.bytecode import disassemble
+from cinder.codegen.bytecode import assemble
+from tests import test_ir
+from tests.helpers import build, find
+
+
+def arithmetic(x, y):
+    return x + y * 2 - x // y
+
+
+def test_operands_are_explicit():
+    function = build(arithmetic)
+    x, y = function.entry.params
+    multiply, add, floor_divide, subtract = find(function, ir.BinaryOperation)
+    assert multiply.operands == [y, function.constant(1)]
+    assert add.operands == [x, multiply]
+    assert floor_divide.operands == [x, y]
+    assert subtract.operands == [add, floor_divide]
+    assert function.entry.terminator.operands == [subtract]
+
+
+def test_users():
+    function = build(arithmetic)
+    x, y = function.entry.params
+    multiply, add, floor_divide, subtract = find(function, ir.BinaryOperation)
+    terminator = function.entry.terminator
+    assert set(subtract.users) == {terminator, terminator.state}
+    # Values are also used by the frame states of the instructions that follow
+    assert add in x.users and floor_divide in x.users
+    assert multiply.state in x.users
+    x.replace_all_uses_with(y)
+    assert x.users == []
+    assert add.operands == [y, multiply]
+    assert floor_divide.operands == [y, y]
+    assert add.state.locals == [y, y]
+
+
+def choose(x):
+    if x:
+        y = 1
+    else:
+        y = 2
+    return y
+
+
+def test_merges_take_parameters():
+    function = build(choose)
+    join = function.blocks[-1]
+    param, = join.params
+    assert sorted(edge.operands[0].index for edge in join.predecessors) == [1, 2]
+    assert join.terminator.operands == [param]
+
+
+def count_up(n):
+    total = 0
+    i = 0
+    while i < n:
+        total = total + i
+        i = i + 1
+    return total
+
+
+def test_loops_only_take_the_values_that_they_change():
+    function = build(count_up)
+    header, = [block for block in function.blocks if len(block.predecessors) > 1]
+    total, i = header.params
+    compare, = find(function, ir.Compare)
+    assert compare.operands == [i, function.entry.params[0]]
+    assert function.blocks[-1].terminator.operands == [total]
+
+
+def test_osr_entry():
+    code = count_up.__code__
+    cfg = disassemble(code.co_code)
+    header = [block for block in cfg.blocks.values() if block.is_loop_header][0]
+    function = ssa.build(cfg, code.co_nlocals, header.label)
+    assert function.entry.label == ssa.OSR_ENTRY
+    assert len(function.entry.params) == code.co_nlocals
+    # The code before the loop is omitted
+    assert len(function.blocks) == 4
+    cfg = ssa.lower(function).cfg
+    assert list(cfg.blocks) == [ssa.OSR_ENTRY, header.label] + list(cfg.blocks)[2:]
+
+
+# Lowering prefers the lowest numbered local when more than one holds a value,
+# so functions that load a copy of another local are reassembled differently
+@pytest.mark.parametrize("function", [
+    test_ir.single_block,
+    test_ir.cond_jump,
+    test_ir.nested_cond_jump,
+    test_ir.load_attr,
+    test_ir.unary_not,
+    test_ir.two_way_cond,
+    test_ir.while_loop,
+    test_ir.store_attr,
+    test_ir.load_global,
+    test_ir.do_call,
+    test_ir.jump_forward,
+    test_ir.cmp_is,
+    test_ir.cmp_is_not,
+    test_ir.loop_with_setup,
+    test_ir.binary_and,
+    test_ir.arithmetic,
+    test_ir.inplace_add,
+    test_ir.cmp_lt,
+    test_ir.cmp_in,
+])
+def test_lowering_reproduces_the_stack_ir(function):
+    assert assemble(build(function)) == function.__code__.co_code
+
+
+class Point:
+    def __init__(self, x):
+        self.x = x
+
+
+def load_twice(point):
+    return point.x + point.x
+
+
+def test_lowering_keeps_values_in_temporaries():
+    function = build(load_twice)
+    first, second = find(function, ir.LoadAttr)
+    second.replace_all_uses_with(first)
+    second.remove()
+    lowered = ssa.lower(function)
+    code = load_twice.__code__
+    assert lowered.num_locals == code.co_nlocals + 1
+    co_code = assemble(lowered.cfg)
+    varnames = code.co_varnames + ('temp',)
+    reassembled = types.CodeType(
+        code.co_argcount, code.co_kwonlyargcount, lowered.num_locals, code.co_stacksize,
+        code.co_flags, co_code, code.co_consts, code.co_names, varnames,
+        code.co_filename, code.co_name, code.co_firstlineno, code.co_lnotab)
+    assert types.FunctionType(reassembled, globals())(Point(3)) == 6
+    assert co_code.count(bytes([dis.opmap['LOAD_ATTR'], 0])) == 1
@@ -0,0 +1,52 @@
+import pytest
+
+from cinder import ir
+from cinder.analysis import stack
+from cinder.bytecode import disassemble
+
+
+def analyze(function):
+    cfg = disassemble(function.__code__.co_code)
+    return cfg, stack.analyze(cfg)
+
+
+def jump_if_true(x, y):
+    return x or y
+
+
+def test_non_popping_branch_leaves_value_when_taken():
+    cfg, depths = analyze(jump_if_true)
+    entry, fall_through, join = list(cfg)
+    assert depths.at_entry(entry) == 0
+    assert depths.at_exit(entry) == 1
+    assert depths.at_entry(fall_through) == 0
+    assert depths.at_entry(join) == 1
+
+
+def break_loop(x):
+    while x:
+        if x:
+            break
+    return x
+
+
+def test_break_unwinds_to_loop_header():
+    cfg, depths = analyze(break_loop)
+    breaks = [block for block in cfg if isinstance(block.terminator, ir.BreakLoop)]
+    assert len(breaks) == 1
+    assert depths.to_unwind(breaks[0].terminator, breaks[0]) == 0
+    assert all(depths.at_entry(block) == 0 for block in cfg)
+
+
+def test_inconsistent_depths_are_rejected():
+    blocks = [
+        ir.BasicBlock('bb0', [
+            ir.Load(0, ir.VarPool.LOCALS),
+            ir.Load(0, ir.VarPool.LOCALS),
+            ir.ConditionalBranch('bb1', 'bb2', False, True),
+        ]),
+        ir.BasicBlock('bb1', [ir.Load(0, ir.VarPool.LOCALS)]),
+        ir.BasicBlock('bb2', [ir.ReturnValue()]),
+    ]
+    with pytest.raises(ValueError):
+        stack.analyze(ir.build_initial_cfg(blocks))
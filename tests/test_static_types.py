@@ -0,0 +1,93 @@
+from cinder import ir
+from cinder.analysis import static_types
+from cinder.analysis.static_types import ANY, BOOL, Type
+from cinder.codegen import x64
+from cinder.passes import constants
+from tests.helpers import build, find
+
+
+def analyze(func):
+    function = build(func)
+    globals, builtins = x64.globals_and_builtins(func)
+    constants.fold_constants(function, globals, builtins)
+    return function, static_types.analyze(function)
+
+
+def returned_type(function, types):
+    terminator, = find(function, ir.ReturnValue)
+    return types.operand_type(terminator.op)
+
+
+def arithmetic(x):
+    a = 1
+    b = a * 3 + len(x)
+    return b // 2
+
+
+def test_infers_operators_and_builtins():
+    function, types = analyze(arithmetic)
+    assert returned_type(function, types) == Type.of(int)
+
+
+def count(items):
+    total = 0
+    for i in range(len(items)):
+        total += i
+    return total
+
+
+def test_infers_through_loops():
+    function, types = analyze(count)
+    assert returned_type(function, types) == Type.of(int)
+    add, = find(function, ir.BinaryOperation)
+    assert types.operand_type(add.op, 0) == Type.of(int)
+    assert types.operand_type(add.op, 1) == Type.of(int)
+
+
+def default(x):
+    if x is None:
+        x = 0
+    return x
+
+
+def test_narrows_none_tests():
+    function, types = analyze(default)
+    assert returned_type(function, types) == Type(None, not_none=True)
+
+
+def is_empty(x):
+    empty = x is not None and len(x) == 0
+    if empty:
+        return 'yes'
+    return 'no'
+
+
+def test_comparisons_are_bools():
+    function, types = analyze(is_empty)
+    branch, = find(function, ir.ConditionalBranch)[-1:]
+    assert types.operand_type(branch.op) == BOOL
+
+
+def unknown(x, y):
+    return x + y
+
+
+def test_unknown_values_have_any_type():
+    function, types = analyze(unknown)
+    assert returned_type(function, types) == ANY
+
+
+def truthiness(flag, n):
+    result = 0
+    while n > 0 and not flag:
+        n = n - 1
+        result = result + 1
+    return result
+
+
+def test_compiled_code_uses_static_types():
+    test = x64.compile(truthiness)
+    assert test(False, 10) == 10
+    assert test(True, 10) == 0
+    assert test(None, 3) == 3
+    assert test([], 2) == 2
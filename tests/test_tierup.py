@@ -0,0 +1,165 @@
+import cinder
+
+from cinder import bytecode, ir
+from cinder.codegen import x64
+from cinder.policy import Policy
+from cinder.profile import Profile
+
+
+FACTOR = 2
+
+
+def add(x, y):
+    return x + y
+
+
+def scale(x):
+    return FACTOR * x
+
+
+def count_up(n):
+    total = 0
+    i = 0
+    while i < n:
+        total = total + i
+        i = i + 1
+    return total
+
+
+def subtract(x, y):
+    return x - y
+
+
+def concat(x, y):
+    return x + y
+
+
+def double(x):
+    return x + x
+
+
+def triple(x):
+    return x + x + x
+
+
+def call_double(x):
+    return double(x)
+
+
+def make_list(x):
+    return [x]
+
+
+def make_adder(x):
+    def adder(y):
+        return x + y
+    return adder
+
+
+class RecordingPolicy(Policy):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.compiled = []
+
+    def compile(self, code, globals):
+        self.compiled.append(code)
+        return super().compile(code, globals)
+
+
+def run_with_policy(policy, func, args, num_calls):
+    cinder.install_interpreter(policy)
+    try:
+        return [func(*args) for _ in range(num_calls)]
+    finally:
+        cinder.uninstall_interpreter()
+
+
+def test_compile_after_threshold():
+    policy = RecordingPolicy(call_threshold=5, loop_threshold=None)
+    assert run_with_policy(policy, add, (1, 2), 4) == [3] * 4
+    assert cinder.get_compiled(add.__code__) is None
+    assert run_with_policy(policy, add, (1, 2), 10) == [3] * 10
+    assert policy.compiled == [add.__code__]
+    assert isinstance(cinder.get_compiled(add.__code__), cinder.JitFunction)
+
+
+def test_failed_compilation_is_not_retried():
+    policy = RecordingPolicy(call_threshold=2, loop_threshold=None)
+    assert run_with_policy(policy, make_list, (1,), 10) == [[1]] * 10
+    assert policy.compiled == [make_list.__code__]
+    assert cinder.get_compiled(make_list.__code__) is None
+
+
+def test_module_allowlist():
+    policy = RecordingPolicy(call_threshold=1, loop_threshold=None, modules=['elsewhere'])
+    assert run_with_policy(policy, concat, ('a', 'b'), 3) == ['ab'] * 3
+    # Rejected code is neither compiled nor profiled
+    assert policy.compiled == []
+    assert cinder.get_compiled(concat.__code__) is None
+    assert cinder.get_profile(concat.__code__) == {}
+
+
+def test_compiled_code_is_not_profiled():
+    policy = Policy(call_threshold=2, loop_threshold=None)
+    assert run_with_policy(policy, subtract, (3, 1), 2) == [2, 2]
+    profile = cinder.get_profile(subtract.__code__)
+    assert list(profile.values()) == [((int,), (int,))]
+    # Arguments that fail the guards run in the interpreter
+    assert run_with_policy(policy, subtract, (3.0, 1.0), 2) == [2.0, 2.0]
+    assert cinder.get_profile(subtract.__code__) == profile
+
+
+def test_loop_threshold():
+    policy = RecordingPolicy(call_threshold=None, loop_threshold=10)
+    assert run_with_policy(policy, count_up, (100,), 2) == [sum(range(100))] * 2
+    assert policy.compiled == []
+
+
+def test_call_compiled_function():
+    policy = Policy(call_threshold=1, loop_threshold=None)
+    assert run_with_policy(policy, double, (1,), 2) == [2, 2]
+    assert x64.register_entry(double, 1) is not None
+    cfg = bytecode.disassemble(call_double.__code__.co_code)
+    call = [instr for block in cfg for instr in block.instructions
+            if isinstance(instr, ir.Call)][0]
+    test = x64.compile(call_double, Profile({call.offset: (double,)}))
+    assert test(2) == 4
+    # The call is guarded on the code of the callee
+    code = double.__code__
+    double.__code__ = triple.__code__
+    try:
+        assert test(2) == 6
+    finally:
+        double.__code__ = code
+
+
+def test_resumed_frames_stay_in_the_interpreter():
+    global FACTOR
+    compiled = []
+    compile_ = x64._compile
+
+    def counting_compile(func, profile, deopt_state):
+        if func.__code__ is scale.__code__:
+            compiled.append(dict(deopt_state.failures))
+        return compile_(func, profile, deopt_state)
+
+    policy = Policy(call_threshold=1, loop_threshold=None)
+    threshold = x64.DEOPT_RECOMPILE_THRESHOLD
+    x64.DEOPT_RECOMPILE_THRESHOLD = 3
+    x64._compile = counting_compile
+    try:
+        assert run_with_policy(policy, scale, (3,), 1) == [6]
+        # The guard on the first instruction fails once per call, instead of the
+        # resumed frame entering the compiled code again
+        FACTOR = 3
+        assert run_with_policy(policy, scale, (3,), 2) == [9, 9]
+        assert compiled == [{}]
+    finally:
+        FACTOR = 2
+        x64.DEOPT_RECOMPILE_THRESHOLD = threshold
+        x64._compile = compile_
+
+
+def test_closures_are_not_compiled():
+    adder = make_adder(1)
+    assert Policy().compile_function(adder.__code__, adder.__globals__) is None
@@ -1,4 +1,11 @@
+import sys
+
+import pytest
+
+from cinder import bytecode, ir
+from cinder.analysis import loops
 from cinder.codegen import x64
+from cinder.profile import Profile
 
 
 def identity(x):
@@ -158,6 +165,193 @@ def test_call():
     assert test_call3(get_third, 1, 2, 3) == 3
 
 
+def get_last(a, b, c, d, e, f, g):
+    return g
+
+
+def test_many_arguments():
+    test = x64.compile(get_last)
+    assert test(1, 2, 3, 4, 5, 6, 7) == 7
+
+
+def test_argument_count_is_checked():
+    test = x64.compile(get_third)
+    with pytest.raises(TypeError):
+        test(1, 2)
+    with pytest.raises(TypeError):
+        test(1, 2, 3, 4)
+    with pytest.raises(TypeError):
+        test(1, 2, c=3)
+    # Too many arguments for registers go through the array entry
+    test = x64.compile(get_last)
+    with pytest.raises(TypeError):
+        test(1, 2, 3)
+
+
+def test_leaf_function():
+    cfg = bytecode.disassemble(get_third.__code__.co_code)
+    assert x64.is_leaf(cfg)
+    cfg = bytecode.disassemble(call0.__code__.co_code)
+    assert not x64.is_leaf(cfg)
+    test = x64.compile(store_local)
+    assert test(10) == 10
+
+
+def test_call_jit_function():
+    jit_get_third = x64.compile(get_third)
+    jit_get_last = x64.compile(get_last)
+    jit_call3 = x64.compile(call3)
+    assert jit_call3(jit_get_third, 1, 2, 3) == 3
+    # Functions that take their arguments in an array go through the generic path
+    assert jit_call3(lambda *args: jit_get_last(*args, 4, 5, 6, 7), 1, 2, 3) == 7
+    items = [1]
+    refs = sys.getrefcount(items)
+    assert jit_call3(jit_get_third, 1, 2, items) is items
+    assert sys.getrefcount(items) == refs
+
+
+class Temporary:
+    finalized = 0
+
+    def __del__(self):
+        Temporary.finalized += 1
+
+
+def drop_temporary(make, count):
+    make()
+    return count()
+
+
+def return_from_loop(make):
+    for item in make():
+        return item.__class__.__name__
+
+
+def test_temporaries_are_deallocated():
+    # A weakref would not do: they report referents with a count of zero as dead,
+    # whether or not they were deallocated
+    test = x64.compile(drop_temporary)
+    # The result of make() is released, and so deallocated, before count() runs
+    assert test(Temporary, lambda: Temporary.finalized) == 1
+    assert Temporary.finalized == 1
+    # The iterator and the local are released after the return value is popped
+    # into a register
+    test = x64.compile(return_from_loop)
+    assert test(lambda: [Temporary()]) == 'Temporary'
+    assert Temporary.finalized == 2
+
+
+def test_specialize_instance_attribute():
+    profile = Profile()
+    cfg = bytecode.disassemble(get_bar.__code__.co_code)
+    load = [instr for block in cfg for instr in block.instructions
+            if isinstance(instr, ir.LoadAttr)][0]
+    profile.sites[load.offset] = ((Foo,),)
+    test = x64.compile(get_bar, profile)
+    foo = Foo('testing 123')
+    assert test(foo) == 'testing 123'
+    foo_refs = sys.getrefcount(foo)
+    assert test(foo) == 'testing 123'
+    assert sys.getrefcount(foo) == foo_refs
+
+    class Bar:
+        bar = 'class attribute'
+
+    # The guard fails for other types
+    assert test(Bar()) == 'class attribute'
+    # and once the type is modified
+    Foo.bar = property(lambda self: 'property')
+    try:
+        assert test(foo) == 'property'
+    finally:
+        del Foo.bar
+    assert test(foo) == 'testing 123'
+
+
+def test_specialize_call():
+    jit_get_third = x64.compile(get_third)
+    profile = Profile()
+    cfg = bytecode.disassemble(call3.__code__.co_code)
+    call = [instr for block in cfg for instr in block.instructions
+            if isinstance(instr, ir.Call)][0]
+    profile.sites[call.offset] = (jit_get_third,)
+    test = x64.compile(call3, profile)
+    assert test(jit_get_third, 1, 2, 3) == 3
+    assert test(get_third, 1, 2, 3) == 3
+    assert test(x64.compile(get_third), 1, 2, 3) == 3
+
+
+def test_specialize_arithmetic():
+    profile = Profile()
+    cfg = bytecode.disassemble(add.__code__.co_code)
+    op = [instr for block in cfg for instr in block.instructions
+          if isinstance(instr, ir.BinaryOperation)][0]
+    profile.sites[op.offset] = ((str,), (str,))
+    test = x64.compile(add, profile)
+    assert test('a', 'b') == 'ab'
+    assert test(1, 2) == 3
+
+
+def sum_bars(xs):
+    total = 0
+    for x in xs:
+        total = total + x.bar
+    return total
+
+
+def specialize_attribute(func, typ):
+    profile = Profile()
+    cfg = bytecode.disassemble(func.__code__.co_code)
+    for block in cfg:
+        for instr in block.instructions:
+            if isinstance(instr, ir.LoadAttr):
+                profile.sites[instr.offset] = ((typ,),)
+    return profile
+
+
+def test_deoptimize_in_loop():
+    test = x64.compile(sum_bars, specialize_attribute(sum_bars, Foo))
+    assert test([Foo(1), Foo(2)]) == 3
+
+    class Bar:
+        def __init__(self, bar):
+            self.bar = bar
+
+    # The interpreter resumes in the middle of the loop with the iterator and the
+    # running total on the stack
+    items = [Foo(1), Bar(2), Foo(3), Bar(4)]
+    items_refs = sys.getrefcount(items)
+    assert test(items) == 10
+    assert sys.getrefcount(items) == items_refs
+
+
+def test_repeated_deopts_recompile():
+    recompiled = []
+    compile_ = x64._compile
+
+    def counting_compile(func, profile, deopt_state):
+        recompiled.append(profile)
+        return compile_(func, profile, deopt_state)
+
+    class Bar:
+        bar = 'class attribute'
+
+    threshold = x64.DEOPT_RECOMPILE_THRESHOLD
+    x64.DEOPT_RECOMPILE_THRESHOLD = 3
+    x64._compile = counting_compile
+    try:
+        test = x64.compile(get_bar, specialize_attribute(get_bar, Foo))
+        for _ in range(5):
+            assert test(Bar()) == 'class attribute'
+    finally:
+        x64.DEOPT_RECOMPILE_THRESHOLD = threshold
+        x64._compile = compile_
+    # The initial compilation and the recompilation without the attribute's feedback
+    assert len(recompiled) == 2
+    assert not recompiled[1].sites
+    assert test(Foo('testing 123')) == 'testing 123'
+
+
 def test_store():
     test = x64.compile(store_local)
     assert test(10) == 10
@@ -168,11 +362,91 @@ def test_while_loop():
     assert test(True, 0) == 0
 
 
+def break_loop(x, y):
+    while x:
+        if y:
+            break
+        x = y
+    else:
+        return 2
+    return 1
+
+
+def test_break_loop():
+    test = x64.compile(break_loop)
+    assert test(True, True) == 1
+    assert test(True, False) == 2
+    assert test(False, True) == 2
+
+
+def sum_items(items):
+    total = 0
+    for item in items:
+        total += item
+    return total
+
+
+def find(items, x):
+    for item in items:
+        if item is x:
+            return item
+    return None
+
+
+def count_until(items, x):
+    count = 0
+    for item in items:
+        if item is x:
+            break
+        count += 1
+    return count
+
+
+def test_for_loop():
+    test = x64.compile(sum_items)
+    assert test(range(10)) == 45
+    assert test(range(10, 0, -3)) == 22
+    assert test(range(0)) == 0
+    assert test(range(2 ** 64, 2 ** 64 + 2)) == 2 ** 65 + 1
+    assert test([1, 2, 3]) == 6
+    assert test([]) == 0
+    assert test((1, 2, 3)) == 6
+    assert test({4: 'a', 5: 'b'}) == 9
+    assert test(x for x in (1, 2)) == 3
+
+
+def test_exhausted_list_iterator_releases_list():
+    items = [1, 2, 3]
+    refs = sys.getrefcount(items)
+    test = x64.compile(find)
+    assert test(items, 4) is None
+    assert sys.getrefcount(items) == refs
+
+
+def test_exit_loop_early():
+    items = [1, 2, 3]
+    assert x64.compile(find)(items, 2) == 2
+    assert x64.compile(count_until)(items, 3) == 2
+    assert x64.compile(count_until)(range(5), 7) == 5
+
+
+def test_for_loop_over_mutated_list():
+    def f(items):
+        count = 0
+        for item in items:
+            items.append(item) if count < 2 else None
+            count += 1
+        return count
+
+    test = x64.compile(f)
+    assert test([1, 2]) == 4
+
+
 def test_jump_forward():
     test = x64.compile(jump_forward)
-    assert test(True, True) == 1
-    assert test(True, False) == None
-    assert test(False, False) == 2
+    assert test(True, True, None) == 1
+    assert test(True, False, None) == None
+    assert test(False, False, None) == 2
 
 
 def test_is():
@@ -188,3 +462,190 @@ def test_is_not():
     test = x64.compile(f)
     assert test(1, 1) == False
     assert test(1, 2) == True
+
+
+def test_borrowed_references_are_balanced():
+    def f(x, y):
+        if x is None:
+            return y.bar
+        return x
+
+    test = x64.compile(f)
+    foo = Foo('testing 123')
+    foo_refs = sys.getrefcount(foo)
+    none_refs = sys.getrefcount(None)
+    assert test(None, foo) == 'testing 123'
+    assert sys.getrefcount(foo) == foo_refs
+    assert sys.getrefcount(None) == none_refs
+
+
+def add(x, y):
+    return x + y
+
+
+def sub(x, y):
+    return x - y
+
+
+def mul(x, y):
+    return x * y
+
+
+def increment(x):
+    x += 1
+    return x
+
+
+def test_small_int_arithmetic():
+    test_add = x64.compile(add)
+    assert test_add(1, 2) == 3
+    assert test_add(-5, 3) == -2
+    test_sub = x64.compile(sub)
+    assert test_sub(1, 2) == -1
+    test_mul = x64.compile(mul)
+    assert test_mul(-7, 6) == -42
+    test_increment = x64.compile(increment)
+    assert test_increment(41) == 42
+    # Zeros other than the cached one have no digits
+    zero = int.from_bytes(bytes(8), 'little')
+    assert zero is not 0
+    assert test_add(zero, 5) == 5
+    assert test_mul(-7, zero) == 0
+
+
+def test_int_arithmetic_overflow():
+    test_add = x64.compile(add)
+    assert test_add(2**30 - 1, 2**30 - 1) == 2**31 - 2
+    test_mul = x64.compile(mul)
+    assert test_mul(2**29, 2**29) == 2**58
+    assert test_mul(-(2**29), 2**29) == -(2**58)
+    assert test_add(2**100, 1) == 2**100 + 1
+
+
+def test_generic_arithmetic():
+    test_add = x64.compile(add)
+    assert test_add('foo', 'bar') == 'foobar'
+    assert test_add(1.5, 2) == 3.5
+    test_mul = x64.compile(mul)
+    assert test_mul([1], 2) == [1, 1]
+
+    def other_ops(x, y):
+        return (x // y) + (x % y) + (x ** y) + (x << y) + (x >> y) + (x & y) + (x | y) + (x ^ y)
+
+    test = x64.compile(other_ops)
+    assert test(7, 2) == other_ops(7, 2)
+
+
+def test_rich_compare():
+    def lt(x, y):
+        return x < y
+
+    def eq(x, y):
+        return x == y
+
+    def ge(x, y):
+        return x >= y
+
+    test_lt = x64.compile(lt)
+    assert test_lt(1, 2) is True
+    assert test_lt(2, 1) is False
+    assert test_lt(-3, -2) is True
+    assert test_lt(2**40, 2**41) is True
+    assert test_lt('a', 'b') is True
+    test_eq = x64.compile(eq)
+    assert test_eq(0, 0) is True
+    assert test_eq(0, 1) is False
+    assert test_eq('a', 'a') is True
+    test_ge = x64.compile(ge)
+    assert test_ge(1, 1) is True
+    assert test_ge(1.0, 2) is False
+
+
+def test_contains():
+    def contains(x, y):
+        return x in y
+
+    def not_contains(x, y):
+        return x not in y
+
+    test_in = x64.compile(contains)
+    assert test_in(1, [1, 2]) is True
+    assert test_in(3, [1, 2]) is False
+    test_not_in = x64.compile(not_contains)
+    assert test_not_in(1, [1, 2]) is False
+    assert test_not_in(3, (1, 2)) is True
+
+
+def assign_in_branches(x, y, z):
+    if x:
+        if y:
+            z = 1
+    else:
+        z = 2
+    return z
+
+
+def test_fall_through_out_of_layout_order():
+    test = x64.compile(assign_in_branches)
+    assert test(True, True, 0) == 1
+    assert test(True, False, 0) == 0
+    assert test(False, False, 0) == 2
+
+
+def test_layout_blocks():
+    cfg = bytecode.disassemble(assign_in_branches.__code__.co_code)
+    order = [block.label for block in x64.layout_blocks(cfg)]
+    # Each conditional branch falls through to its "true" arm and the inner
+    # arm falls through to the join point.
+    assert order == ['bb0', 'bb1', 'bb2', 'bb4', 'bb3']
+    assert loops.analyze(cfg).headers == set()
+
+    cfg = bytecode.disassemble(while_loop.__code__.co_code)
+    assert [block.label for block in loops.analyze(cfg).headers] == ['bb1']
+
+
+class NoBool:
+    pass
+
+
+class WithBool:
+    def __init__(self, value):
+        self.value = value
+
+    def __bool__(self):
+        return self.value
+
+
+class WithLen:
+    def __init__(self, length):
+        self.length = length
+
+    def __len__(self):
+        return self.length
+
+
+def test_truthiness():
+    test = x64.compile(pop_jump)
+    x64_invert = x64.compile(invert)
+    cases = [
+        None, True, False, 0, 1, -1, 2**100, [], [0], (), (0,), {}, {0: 0},
+        '', 'a', 'ሴ', 0.0, 1.5, NoBool(), WithBool(True), WithBool(False),
+        WithLen(0), WithLen(3), set(), {1},
+    ]
+    for value in cases:
+        assert test(value, 'yes', 'no') == ('yes' if value else 'no'), value
+        assert x64_invert(value) == (not value), value
+
+
+def test_truthiness_tracks_type_changes():
+    class Changing:
+        pass
+
+    test = x64.compile(pop_jump)
+    obj = Changing()
+    assert test(obj, 'yes', 'no') == 'yes'
+    Changing.__bool__ = lambda self: False
+    assert test(obj, 'yes', 'no') == 'no'
+    del Changing.__bool__
+    Changing.__len__ = lambda self: 0
+    assert test(obj, 'yes', 'no') == 'no'